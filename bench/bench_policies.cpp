@@ -0,0 +1,164 @@
+// Decode throughput of the C++ policies of qjson.hpp compared with the
+// generic C entry points.
+//
+// Converts the same synthetic corpus, or the *.qjson files given as
+// arguments, in a loop for each entry point and reports the throughput.
+//
+// Usage:
+//
+//     make bench_policies && ./bench_policies [--seconds 1] [file.qjson ...]
+#include "qjson.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// syntheticCorpus returns generated qjson documents covering the syntax
+// features, like bench_scaling.py.
+std::vector<std::string> syntheticCorpus(int count = 64, int members = 200) {
+	std::vector<std::string> docs;
+	char line[128];
+	for (int i = 0; i < count; i++) {
+		std::string doc;
+		for (int j = 0; j < members; j++) {
+			switch ((i*members + j) % 7) {
+			case 0: snprintf(line, sizeof(line), "key %d: quoteless value %d\n", j, i); break;
+			case 1: snprintf(line, sizeof(line), "'key %d': 'single quoted %d'\n", j, i); break;
+			case 2: snprintf(line, sizeof(line), "\"key %d\": \"double quoted %d\"\n", j, i); break;
+			case 3: snprintf(line, sizeof(line), "key %d: (%d + 3) * 0x10 // comment\n", j, j); break;
+			case 4: snprintf(line, sizeof(line), "key %d: 1h30m%ds\n", j, j % 60); break;
+			case 5: snprintf(line, sizeof(line), "key %d: 2021-03-0%dT10:20:30Z\n", j, j % 9 + 1); break;
+			default: snprintf(line, sizeof(line), "key %d: [ 1, 2, { a: b, c: true } ]\n", j); break;
+			}
+			doc += line;
+		}
+		docs.push_back(doc);
+	}
+	return docs;
+}
+
+// jsonCorpus returns the json members of the decoded docs, the input of
+// the json policy.
+std::vector<std::string> jsonCorpus(const std::vector<std::string> &docs) {
+	std::vector<std::string> out;
+	for (const auto &d : docs) {
+		auto j = qjson::decode(d);
+		if (j)
+			out.emplace_back(j->view().substr(1, j->size()-2));
+	}
+	return out;
+}
+
+// run calls f on the docs in a loop for the given seconds and prints the
+// throughput.
+template <typename F>
+void run(const char *name, const std::vector<std::string> &docs, double seconds, F f) {
+	using clock = std::chrono::steady_clock;
+	size_t bytes = 0, calls = 0, failed = 0;
+	auto start = clock::now();
+	auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+	while (clock::now() < deadline) {
+		for (const auto &d : docs) {
+			if (!f(d))
+				failed++;
+			bytes += d.size();
+			calls++;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	printf("%-32s %10.1f %12.2f %10zu\n", name, bytes/elapsed/1e6, elapsed/calls*1e6, failed);
+}
+
+struct throwing : qjson::default_policy {
+	static constexpr bool exceptions = true;
+};
+
+struct canonical : qjson::default_policy {
+	using sink = qjson::sink::canonical;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	double seconds = 1;
+	std::vector<std::string> docs;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc) {
+			seconds = atof(argv[++i]);
+			continue;
+		}
+		std::ifstream f(argv[i], std::ios::binary);
+		std::stringstream ss;
+		ss << f.rdbuf();
+		docs.push_back(ss.str());
+	}
+	if (docs.empty())
+		docs = syntheticCorpus();
+	std::vector<std::string> json = jsonCorpus(docs);
+	size_t total = 0;
+	for (const auto &d : docs)
+		total += d.size();
+	printf("%s, %zu documents, %zu bytes\n", qjson_version(), docs.size(), total);
+	printf("%-32s %10s %12s %10s\n", "entry point", "MB/s", "us/call", "failed");
+
+	run("qjson_decode", docs, seconds, [](const std::string &d) {
+		char *s = qjson_decode(d.c_str());
+		bool ok = s[0] == '{';
+		free(s);
+		return ok;
+	});
+	run("qjson_decode_ex", docs, seconds, [](const std::string &d) {
+		qjson_result_t res;
+		bool ok = qjson_decode_ex(d.data(), d.size(), nullptr, &res);
+		qjson_result_free(&res);
+		return ok;
+	});
+	run("decode<default_policy>", docs, seconds, [](const std::string &d) {
+		return bool(qjson::decode(d));
+	});
+	run("decode<throwing>", docs, seconds, [](const std::string &d) {
+		return qjson::decode<throwing>(d).size() > 0;
+	});
+	run("validate<default_policy>", docs, seconds, [](const std::string &d) {
+		return bool(qjson::validate(d));
+	});
+	run("decode<canonical>", docs, seconds, [](const std::string &d) {
+		return bool(qjson::decode<canonical>(d));
+	});
+	// the arena is reused by every call, so that they don’t allocate
+	std::vector<std::byte> buf(4 << 20);
+	std::pmr::monotonic_buffer_resource arena(buf.data(), buf.size());
+	run("pmr::decode<default_policy>", docs, seconds, [&](const std::string &d) {
+		arena.release();
+		return bool(qjson::pmr::decode(d, &arena));
+	});
+	run("pmr::parse<default_policy>", docs, seconds, [&](const std::string &d) {
+		arena.release();
+		auto doc = qjson::pmr::parse(d, &arena);
+		return doc && doc->root().size() > 0;
+	});
+	run("json: qjson_decode_ex", json, seconds, [](const std::string &d) {
+		qjson_result_t res;
+		bool ok = qjson_decode_ex(d.data(), d.size(), nullptr, &res);
+		qjson_result_free(&res);
+		return ok;
+	});
+	run("json: decode<json_policy>", json, seconds, [](const std::string &d) {
+		return bool(qjson::decode<qjson::json_policy>(d));
+	});
+	run("json: pmr::decode<json_policy>", json, seconds, [&](const std::string &d) {
+		arena.release();
+		return bool(qjson::pmr::decode<qjson::json_policy>(d, &arena));
+	});
+	run("json: validate<json_policy>", json, seconds, [](const std::string &d) {
+		return bool(qjson::validate<qjson::json_policy>(d));
+	});
+	return 0;
+}
@@ -0,0 +1,179 @@
+"""
+Decode throughput scaling benchmark for qjson2json.
+
+Runs qjson2json.decode over the same corpus with 1 to N threads, 1 to N
+processes, or a mix of both (each process running a number of threads),
+and reports for each configuration the aggregate throughput, the per call
+p50/p99 latency and the GIL wait time.
+
+The GIL wait time is estimated per call as the wall clock time minus the
+CPU time consumed by the calling thread. With a decoder holding the GIL,
+this difference grows with the number of threads of a process. With a
+decoder releasing the GIL, it stays close to zero as long as there are
+enough cores.
+
+Usage:
+
+    python3 bench/bench_scaling.py [--corpus DIR] [--threads 1,2,4,8]
+                                   [--procs 1,2,4] [--duration 2]
+"""
+
+import argparse
+import glob
+import multiprocessing
+import os
+import statistics
+import sys
+import threading
+import time
+
+import qjson2json
+
+
+def synthetic_corpus(count=64, members=200):
+    """
+    Return a list of generated qjson documents covering the syntax features.
+    """
+    docs = []
+    for i in range(count):
+        lines = []
+        for j in range(members):
+            k = (i * members + j) % 7
+            if k == 0:
+                lines.append("key %d: quoteless value %d" % (j, i))
+            elif k == 1:
+                lines.append("'key %d': 'single quoted %d'" % (j, i))
+            elif k == 2:
+                lines.append('"key %d": "double quoted %d"' % (j, i))
+            elif k == 3:
+                lines.append("key %d: (%d + 3) * 0x10 // comment" % (j, j))
+            elif k == 4:
+                lines.append("key %d: 1h30m%ds" % (j, j % 60))
+            elif k == 5:
+                lines.append("key %d: 2021-03-0%dT10:20:30Z" % (j, j % 9 + 1))
+            else:
+                lines.append("key %d: [ 1, 2, { a: b, c: true } ]" % j)
+        docs.append("\n".join(lines))
+    return docs
+
+
+def load_corpus(path):
+    """
+    Return the content of the *.qjson files found in directory path.
+    """
+    docs = []
+    for name in sorted(glob.glob(os.path.join(path, "*.qjson"))):
+        with open(name, encoding="utf-8") as f:
+            docs.append(f.read())
+    if not docs:
+        sys.exit("no *.qjson file found in %s" % path)
+    return docs
+
+
+def worker(docs, sizes, deadline, latencies, waits, counts):
+    """
+    Decode the documents, whose utf8 byte lengths are sizes, in a loop until
+    deadline and record per call latency and estimated GIL wait time.
+    """
+    n = nbytes = 0
+    i = 0
+    while time.perf_counter() < deadline:
+        doc = docs[i % len(docs)]
+        size = sizes[i % len(docs)]
+        i += 1
+        w0 = time.perf_counter()
+        c0 = time.thread_time()
+        qjson2json.decode(doc)
+        c1 = time.thread_time()
+        w1 = time.perf_counter()
+        latencies.append(w1 - w0)
+        waits.append(max(0.0, (w1 - w0) - (c1 - c0)))
+        n += 1
+        nbytes += size
+    counts.append((n, nbytes))
+
+
+def run_threads(docs, sizes, nthreads, duration):
+    """
+    Run nthreads decoding threads for duration seconds and return
+    (calls, bytes, latencies, waits).
+    """
+    latencies, waits, counts = [], [], []
+    deadline = time.perf_counter() + duration
+    threads = [threading.Thread(target=worker, args=(docs, sizes, deadline, latencies, waits, counts))
+               for _ in range(nthreads)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return (sum(c[0] for c in counts), sum(c[1] for c in counts), latencies, waits)
+
+
+def process_main(docs, sizes, nthreads, duration, queue):
+    """
+    Entry point of a benchmark process.
+    """
+    queue.put(run_threads(docs, sizes, nthreads, duration))
+
+
+def run(docs, sizes, nprocs, nthreads, duration):
+    """
+    Run nprocs processes with nthreads threads each and return the
+    aggregated (calls, bytes, latencies, waits).
+    """
+    if nprocs == 1:
+        return run_threads(docs, sizes, nthreads, duration)
+    queue = multiprocessing.Queue()
+    procs = [multiprocessing.Process(target=process_main, args=(docs, sizes, nthreads, duration, queue))
+             for _ in range(nprocs)]
+    for p in procs:
+        p.start()
+    results = [queue.get() for _ in procs]
+    for p in procs:
+        p.join()
+    calls = sum(r[0] for r in results)
+    nbytes = sum(r[1] for r in results)
+    latencies = [x for r in results for x in r[2]]
+    waits = [x for r in results for x in r[3]]
+    return calls, nbytes, latencies, waits
+
+
+def percentile(values, p):
+    """
+    Return the p percentile of values.
+    """
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1])
+    parser.add_argument("--corpus", help="directory containing *.qjson files")
+    parser.add_argument("--threads", default="1,2,4,8", help="comma separated thread counts")
+    parser.add_argument("--procs", default="1,2,4", help="comma separated process counts")
+    parser.add_argument("--duration", type=float, default=2.0, help="seconds per configuration")
+    args = parser.parse_args()
+
+    docs = load_corpus(args.corpus) if args.corpus else synthetic_corpus()
+    sizes = [len(d.encode()) for d in docs]
+    threads = [int(x) for x in args.threads.split(",")]
+    procs = [int(x) for x in args.procs.split(",")]
+    print("%s, %d documents, %d bytes, %d cpus" % (qjson2json.version(), len(docs),
+          sum(sizes), os.cpu_count()))
+    print("%6s %8s %10s %10s %10s %10s %12s" % ("procs", "threads", "MB/s", "p50 us", "p99 us",
+          "GIL us", "calls"))
+    for nprocs in procs:
+        for nthreads in threads:
+            start = time.perf_counter()
+            calls, nbytes, latencies, waits = run(docs, sizes, nprocs, nthreads, args.duration)
+            elapsed = time.perf_counter() - start
+            print("%6d %8d %10.1f %10.1f %10.1f %10.1f %12d" % (
+                nprocs, nthreads, nbytes / elapsed / 1e6,
+                percentile(latencies, 50) * 1e6, percentile(latencies, 99) * 1e6,
+                statistics.fmean(waits) * 1e6 if waits else 0.0, calls))
+
+
+if __name__ == "__main__":
+    main()
@@ -6,9 +6,20 @@
 #include <stdlib.h>
 #include <stdbool.h> 
 #include <stdint.h>
+#include <limits.h>
+#include <float.h>
 #include <errno.h>
+#include <sys/stat.h>
 #define _XOPEN_SOURCE       /* See feature_test_macros(7) */
 #include <time.h>
+#ifdef _WIN32
+#define realpath(path, resolved) _fullpath(resolved, path, 0)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 // qjson_version returns the version of the code and the supported
 // syntax (e.g. "qjson-c: v0.1.1 syntax: v0.0.0").
@@ -59,7 +70,10 @@ enum tokenTag_t {
 	tagDoubleQuotedString,
 	tagSingleQuotedString,
 	tagMultilineString,
-	tagComma
+	tagComma,
+	tagWhitespace, // white spaces, only in syntax trees
+	tagNewline,    // \n or \r\n, only in syntax trees
+	tagComment     // #... //... or /*...*/ comment, only in syntax trees
 };
 
 // slice_t is a slice of characters. 
@@ -78,11 +92,18 @@ typedef struct {
 // outBuf_t is an output buffer that will grow its storage space as needed.
 // Data is written with outBufByte() or outBufString().
 typedef struct {
-	char  *buf; // data storage allocated with malloc
+	char  *buf; // data storage allocated with malloc or alloc
 	int    len; // number of data bytes in storage
 	int    cap; // maximum capacity of storage.
+	const qjson_allocator_t *alloc; // allocator of buf, NULL for malloc
 } outBuf_t;
 
+// error_t is an error message with associated pos.
+typedef struct {
+	pos_t       pos; // the position of the error
+	const char *err; // the error message (one of the ErrXXX string)
+} error_t;
+
 // engine_t is the conversion engine.
 typedef struct {
 	const char *in;     // input string
@@ -91,14 +112,30 @@ typedef struct {
 	outBuf_t    out;    // output buffer
 	token_t     tk;     // current token
 	int         depth;  // depth of [] and {}
+	bool        discard; // output is discarded when the buffer is full
+	qjson_source_map_t *map; // source map being recorded or NULL
+	qjson_error_t *errs;   // errors collected in recovery mode
+	int         nErrs;     // number of errors in errs
+	int         maxErrs;   // recovery mode when greater than 1
+	int         checkIn;   // number of tokens before the next budget check
+	int         maxDepth;  // maximum depth of [] and {}
+	struct budget *budget; // execution limits or NULL
+	struct dups *dups;     // keys of the open objects when duplicate keys are checked, NULL otherwise
+	struct canon *canon;   // canonical json writer when the output is canonical, NULL otherwise
+	struct flat *flat;     // flattened output writer when the output is flattened, NULL otherwise
+	struct pretty *pretty; // pretty output writer when the output has an indent or separators, NULL otherwise
+	bool        ascii;     // non ascii chars of strings are output as \uxxxx escapes
+	unsigned    disabled;  // disabled syntax features (QJSON_NO_XXX flags)
+	bool        rejectDisabled; // disabled constructs are errors instead of quoteless strings
+	const qjson_options_t *opts; // options of the call, used to decode included files
+	qjson_includes_t *includes;  // cache of included files, NULL when includes are disabled
+	char       *errFile;   // included file of the first error in an included file, or NULL
+	qjson_error_t fileErr; // that error, positioned in errFile
+	int         fileErrIdx; // index of that error in errs
+	const qjson_allocator_t *alloc; // allocator of the output and work buffers, NULL for malloc
+	error_t     err;       // last error returned by the tokenizer
 } engine_t;
 
-// error_t is an error message with associated pos.
-typedef struct {
-	pos_t       pos; // the position of the error
-	const char *err; // the error message (one of the ErrXXX string)
-} error_t;
-
 
 // -----------------------------------------------------
 // errors
@@ -137,6 +174,9 @@ const char* const ErrExpectStringIdentifier = "expect string identifier";
 // ErrExpectColon is return when an a colon is not found after the identifier.
 const char* const ErrExpectColon = "expect a colon";
 
+// ErrDuplicateKey is returned when a key is met twice in an object and duplicates are errors.
+const char* const ErrDuplicateKey = "duplicate key";
+
 // ErrInvalidValueType is return when an invalid value type is found.
 const char* const ErrInvalidValueType = "invalid value type";
 
@@ -224,12 +264,194 @@ const char* const ErrUnexpectedCloseSquare = "unexpected ]";
 // ErrInvalidISODateTime is returned when the parsed ISO date time is invalid.
 const char* const ErrInvalidISODateTime = "invalid ISO date time";
 
+// ErrInputTooLarge is returned when the input is larger than 2GB.
+const char* const ErrInputTooLarge = "input too large";
 
-error_t *newError(pos_t pos, const char* err) {
-	error_t *tmp = malloc(sizeof(error_t));
-	tmp->pos = pos;
-	tmp->err = err;
-	return tmp;
+// ErrInputLimit is returned when the input is larger than the input limit.
+const char* const ErrInputLimit = "input size limit exceeded";
+
+// ErrOutputLimit is returned when the output is larger than the output limit.
+const char* const ErrOutputLimit = "output size limit exceeded";
+
+// ErrTokenLimit is returned when the input has more tokens than the token limit.
+const char* const ErrTokenLimit = "token limit exceeded";
+
+// ErrDepthLimit is returned when the nesting depth exceeds the depth limit.
+const char* const ErrDepthLimit = "nesting depth limit exceeded";
+
+// ErrTimeLimit is returned when the conversion takes longer than the time limit.
+const char* const ErrTimeLimit = "time limit exceeded";
+
+// ErrCancelled is returned when the conversion is cancelled.
+const char* const ErrCancelled = "conversion cancelled";
+
+// ErrExpressionsDisabled is returned when a numeric expression is met and expressions are disabled.
+const char* const ErrExpressionsDisabled = "numeric expressions are disabled";
+
+// ErrDurationsDisabled is returned when a duration is met and durations are disabled.
+const char* const ErrDurationsDisabled = "durations are disabled";
+
+// ErrMultilineDisabled is returned when a multiline string is met and multiline strings are disabled.
+const char* const ErrMultilineDisabled = "multiline strings are disabled";
+
+// ErrPathNotFound is returned when a syntax tree path doesn’t match a value.
+const char* const ErrPathNotFound = "path not found";
+
+// ErrInvalidEditRange is returned when a document edit range is invalid.
+const char* const ErrInvalidEditRange = "invalid edit range";
+
+// ErrIncludeRead is returned when an included file can’t be read.
+const char* const ErrIncludeRead = "cannot read included file";
+
+// ErrIncludeCycle is returned when a file includes itself directly or indirectly.
+const char* const ErrIncludeCycle = "include cycle";
+
+// ErrIncludeDepth is returned when included files are nested deeper than the include depth limit.
+const char* const ErrIncludeDepth = "include depth limit exceeded";
+
+
+// newError returns the error err at pos. It is stored in e, so that the
+// tokenizer doesn’t allocate memory.
+error_t *newError(engine_t *e, pos_t pos, const char* err) {
+	e->err = (error_t){pos, err};
+	return &e->err;
+}
+
+// memRealloc resizes the block p to n bytes with the allocator a, or with
+// realloc when a is NULL. p may be NULL.
+void* memRealloc(const qjson_allocator_t *a, void *p, size_t n) {
+	return (a == NULL) ? realloc(p, n) : a->realloc(a->arg, p, n);
+}
+
+// memFree releases the block p allocated with a. p may be NULL.
+void memFree(const qjson_allocator_t *a, void *p) {
+	if (p == NULL)
+		return;
+	if (a == NULL)
+		free(p);
+	else
+		a->realloc(a->arg, p, 0);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Budget
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The budget limits the tokens, output bytes and time of a conversion, 
+// and lets it be cancelled. It is checked by nextToken every checkInterval
+// tokens, so that the cost in the tokenizer is a decrement and a test.
+
+// checkInterval is the number of tokens between two budget checks.
+const int checkInterval = 1024;
+
+// checkCallbackInterval is the minimum number of nanoseconds between two
+// calls to the check callback.
+const long long checkCallbackInterval = 10000000;
+
+// budget_t holds the execution limits of a conversion.
+typedef struct budget {
+	long long   tokens;     // number of tokens read before the current check interval
+	int         interval;   // number of tokens read between two checks
+	long long   maxTokens;  // 0 for no limit
+	long long   maxOutput;  // 0 for no limit
+	long long   deadline;   // monotonic time limit in nanoseconds, 0 for none
+	long long   nextCall;   // monotonic time of the next check callback call
+	const volatile bool *cancel;
+	bool      (*check)(void *arg);
+	void       *checkArg;
+} budget_t;
+
+// nowNs returns the time of a monotonic clock in nanoseconds, so that the
+// deadline is not moved by changes of the wall clock.
+long long nowNs(void) {
+#ifdef _WIN32
+	LARGE_INTEGER t, f;
+	QueryPerformanceCounter(&t);
+	QueryPerformanceFrequency(&f);
+	return (long long)(t.QuadPart / f.QuadPart)*1000000000 + (long long)(t.QuadPart % f.QuadPart)*1000000000/f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
+void setError(engine_t *e, const char *err);
+
+// budgetInterval sets the number of tokens to read before the next check.
+void budgetInterval(budget_t *b) {
+	b->interval = checkInterval;
+	if (b->maxTokens > 0 && b->maxTokens-b->tokens < checkInterval)
+		b->interval = (int)(b->maxTokens-b->tokens);
+}
+
+// isLimitError returns true if err is the error of an exceeded limit or
+// a cancellation.
+bool isLimitError(const char *err) {
+	return err == ErrInputLimit || err == ErrOutputLimit || err == ErrTokenLimit ||
+		err == ErrDepthLimit || err == ErrTimeLimit || err == ErrCancelled;
+}
+
+// budgetCheck checks the budget of e every checkInterval tokens. It returns
+// false with the error set when a limit is exceeded.
+bool budgetCheck(engine_t *e) {
+	budget_t *b = e->budget;
+	if (b == NULL) {
+		e->checkIn = INT_MAX;
+		return true;
+	}
+	b->tokens += b->interval;
+	if (b->maxTokens > 0 && b->tokens >= b->maxTokens) {
+		setError(e, ErrTokenLimit);
+		return false;
+	}
+	budgetInterval(b);
+	e->checkIn = b->interval;
+	if (b->maxOutput > 0 && e->out.len > b->maxOutput) {
+		setError(e, ErrOutputLimit);
+		return false;
+	}
+	if (b->cancel != NULL && *b->cancel) {
+		setError(e, ErrCancelled);
+		return false;
+	}
+	if (b->deadline == 0 && b->check == NULL)
+		return true;
+	long long now = nowNs();
+	if (b->deadline != 0 && now > b->deadline) {
+		setError(e, ErrTimeLimit);
+		return false;
+	}
+	if (b->check != NULL && now >= b->nextCall) {
+		b->nextCall = now + checkCallbackInterval;
+		if (!b->check(b->checkArg)) {
+			setError(e, ErrCancelled);
+			return false;
+		}
+	}
+	return true;
+}
+
+// budgetInit sets b from opts and returns it, or returns NULL if opts has
+// no limits on the tokens, output size, time and cancellation.
+budget_t* budgetInit(budget_t *b, const qjson_options_t *opts) {
+	if (opts->maxTokens == 0 && opts->maxOutputBytes == 0 && opts->timeout <= 0 &&
+		opts->cancel == NULL && opts->check == NULL)
+		return NULL;
+	memset(b, 0, sizeof(*b));
+	b->maxTokens = (opts->maxTokens > LLONG_MAX) ? LLONG_MAX : (long long)opts->maxTokens;
+	b->maxOutput = (opts->maxOutputBytes > LLONG_MAX) ? LLONG_MAX : (long long)opts->maxOutputBytes;
+	b->cancel = opts->cancel;
+	b->check = opts->check;
+	b->checkArg = opts->checkArg;
+	if (opts->timeout > 0 || opts->check != NULL) {
+		long long now = nowNs();
+		if (opts->timeout > 0)
+			b->deadline = now + (long long)(opts->timeout*1e9) + 1;
+		b->nextCall = now + checkCallbackInterval;
+	}
+	budgetInterval(b);
+	return b;
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------------------
@@ -340,24 +562,24 @@ const byte utf8Range[16] = {
 // charX requires that x == s0 || x >= s2.
 error_t* qcharX(engine_t *e, byte x, int* nOut) {
  	if (x == s0)
-		return newError(e->pos, ErrInvalidChar);
+		return newError(e, e->pos, ErrInvalidChar);
 	
 	int n = (int)(x & 0xF);
 	if (n > e->p.l) {
-		return newError(e->pos, ErrTruncatedChar);
+		return newError(e, e->pos, ErrTruncatedChar);
 	}
 	byte b2 = (byte)e->p.p[1];
 	byte r = (x >> 4) << 1;
 	if (b2 < utf8Range[r] || b2 > utf8Range[r+1]) {
-		return newError(e->pos, ErrInvalidChar);
+		return newError(e, e->pos, ErrInvalidChar);
 	}
 	if (n >= 3) {
 		if (((byte)e->p.p[2]) < utf8lo || e->p.p[2] > utf8hi) {
-			return newError(e->pos, ErrInvalidChar);
+			return newError(e, e->pos, ErrInvalidChar);
 		}
 		if (n == 4) {
 			if (((byte)e->p.p[3]) < utf8lo || e->p.p[3] > utf8hi) {
-				return newError(e->pos, ErrInvalidChar);
+				return newError(e, e->pos, ErrInvalidChar);
 			}
 		}
 	}
@@ -442,7 +664,7 @@ error_t* skipMultilineComment(engine_t *e, bool *out) {
 	popBytes(e, 2);
 	for (;;) {
 		if (e->p.l == 0) {
-			return newError(startPos, ErrUnclosedSlashStarComment);
+			return newError(e, startPos, ErrUnclosedSlashStarComment);
 		}
 		if (e->p.p[0] == '*' && e->p.l >= 2 && e->p.p[1] == '/') {
 			popBytes(e, 2);
@@ -485,9 +707,9 @@ error_t* doubleQuotedString(engine_t *e, slice_t *out) {
 	popBytes(e, 1);
 	for (;;) {
 		if (e->p.l == 0) {
-			return newError(startPos, ErrUnclosedDoubleQuoteString);
+			return newError(e, startPos, ErrUnclosedDoubleQuoteString);
 		}
-		if (e->p.p[0] == '\\' && e->p.l > 1 && e->p.p[1] == '"') {
+		if (e->p.p[0] == '\\' && e->p.l > 1 && (e->p.p[1] == '"' || e->p.p[1] == '\\')) {
 			popBytes(e, 2);
 			continue;
 		}
@@ -498,7 +720,7 @@ error_t* doubleQuotedString(engine_t *e, slice_t *out) {
 			return NULL;
 		}
 		if (newline(e->p) != 0) {
-			return newError(startPos, ErrNewlineInDoubleQuoteString);
+			return newError(e, startPos, ErrNewlineInDoubleQuoteString);
 		}
 		int n;
 		error_t *err = qchar(e, &n);
@@ -522,9 +744,9 @@ error_t* singleQuotedString(engine_t *e, slice_t *out) {
 	popBytes(e, 1);
 	for (;;) {
 		if (e->p.l == 0)  {
-			return newError(startPos, ErrUnclosedSingleQuoteString);
+			return newError(e, startPos, ErrUnclosedSingleQuoteString);
 		}
-		if (e->p.p[0] == '\\' && e->p.l >= 2 && e->p.p[1] == '\'') {
+		if (e->p.p[0] == '\\' && e->p.l >= 2 && (e->p.p[1] == '\'' || e->p.p[1] == '\\')) {
 			popBytes(e, 2);
 			continue;
 		}
@@ -535,7 +757,7 @@ error_t* singleQuotedString(engine_t *e, slice_t *out) {
 			return NULL;
 		}
 		if (newline(e->p) != 0) {
-			return newError(startPos, ErrNewlineInSingleQuoteString);
+			return newError(e, startPos, ErrNewlineInSingleQuoteString);
 		}
 		int n;
 		error_t *err = qchar(e, &n);
@@ -592,7 +814,7 @@ error_t* quotelessString(engine_t* e, slice_t *out) {
 			if ((e->p.p[0] == '/' && e->p.l > 1 && (e->p.p[1] == '/' || e->p.p[1] == '*')) ||
 				newline(e->p) != 0 || (e->p.p[0] != '\r' && e->p.p[0] != '/')) {
 				// we met any of , : { } [ ] # \n \r\n // /*
-				int n = lenISODateTime(e);
+				int n = (e->disabled & QJSON_NO_DATES) ? 0 : lenISODateTime(e);
 				if (n == 0)
 					break;
 				popBytes(e, n);
@@ -708,17 +930,17 @@ error_t* multilineString(engine_t *e, slice_t *out) {
 	}
 	int b = getMargin((slice_t){e->in+e->pos.s,e->pos.b-e->pos.s}) + e->pos.s;
 	if (b != e->pos.b) {
-		return newError((pos_t){b, e->pos.s, e->pos.l}, ErrMarginMustBeWhitespaceOnly);
+		return newError(e, (pos_t){b, e->pos.s, e->pos.l}, ErrMarginMustBeWhitespaceOnly);
 	}
 	slice_t margin = {e->in+e->pos.s, e->pos.b-e->pos.s};
 	pos_t startPos = e->pos; // for error reporting
 	popBytes(e, 1);     // pops starting `
 	skipWhitespaces(e);
 	if (e->p.l == 0)
-		return newError(startPos, ErrMissingNewlineSpecifier);
+		return newError(e, startPos, ErrMissingNewlineSpecifier);
 	int n = newlineSpecifier(e->p);
 	if (n == 0) 
-		return newError(startPos, ErrInvalidNewlineSpecifier);
+		return newError(e, startPos, ErrInvalidNewlineSpecifier);
 	popBytes(e, n);
 	skipWhitespaces(e);
 	if (!popNewline(e)) {
@@ -727,20 +949,20 @@ error_t* multilineString(engine_t *e, slice_t *out) {
 		if (err != NULL)
 			return err;
 		if (!ok) {
-			return newError(startPos, ErrInvalidMultilineStart);
+			return newError(e, startPos, ErrInvalidMultilineStart);
 		}
 	}
 	if (e->p.l == 0)
-		return newError(startPos, ErrUnclosedMultiline);
+		return newError(e, startPos, ErrUnclosedMultiline);
 	n = matchingMarginLength(margin, e->p);
 	if (n != margin.l)
-		return newError((pos_t){e->pos.b + n, e->pos.s, e->pos.l}, ErrInvalidMarginChar);
+		return newError(e, (pos_t){e->pos.b + n, e->pos.s, e->pos.l}, ErrInvalidMarginChar);
 	popBytes(e, n);
 	while (e->p.l > 0) {
 		if (popNewline(e)) {
 			int n = matchingMarginLength(margin, e->p);
 			if (n != margin.l)
-				return newError((pos_t){e->pos.b+n, e->pos.s, e->pos.l}, ErrInvalidMarginChar);
+				return newError(e, (pos_t){e->pos.b+n, e->pos.s, e->pos.l}, ErrInvalidMarginChar);
 			if (n > 0)
 				popBytes(e, n);
 			continue;
@@ -765,7 +987,7 @@ error_t* multilineString(engine_t *e, slice_t *out) {
 		}
 		popBytes(e, n);
 	}
-	return newError(startPos, ErrUnclosedMultiline);
+	return newError(e, startPos, ErrUnclosedMultiline);
 }
 
 
@@ -778,7 +1000,6 @@ void nextToken(engine_t *e) {
 	error_t *err = skipSpaces(e);
 	if (err != NULL) {
 		e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
-		free(err);
 		return;
 	}
 	pos_t tokenPos = e->pos;
@@ -786,6 +1007,8 @@ void nextToken(engine_t *e) {
 		e->tk = (token_t){tagError, e->pos, (slice_t){ErrEndOfInput, strlen(ErrEndOfInput)}};
 		return;
 	}
+	if (--e->checkIn == 0 && !budgetCheck(e))
+		return;
 	enum tokenTag_t tag = delimiter(e); 
 	if (tag != tagUnknown) {
 		e->tk = (token_t){tag, tokenPos, (slice_t){NULL, 0}};
@@ -795,7 +1018,6 @@ void nextToken(engine_t *e) {
 	err = doubleQuotedString(e, &s);
 	if (err != NULL) {
 		e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
-		free(err);
 		return;
 	}
 	if (s.p != NULL) {
@@ -805,27 +1027,29 @@ void nextToken(engine_t *e) {
 	err = singleQuotedString(e, &s);
 	if (err != NULL) {
 		e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
-		free(err);
 		return;
 	}
 	if (s.p != NULL) {
 		e->tk = (token_t){tagSingleQuotedString, tokenPos, s};
 		return;
 	}
-	err = multilineString(e, &s);
-	if (err != NULL) {
-		e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
-		free(err);
-		return;
-	}
-	if (s.p != NULL) {
-		e->tk = (token_t){tagMultilineString, tokenPos, s};
+	if (!(e->disabled & QJSON_NO_MULTILINE)) {
+		err = multilineString(e, &s);
+		if (err != NULL) {
+			e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
+				return;
+		}
+		if (s.p != NULL) {
+			e->tk = (token_t){tagMultilineString, tokenPos, s};
+			return;
+		}
+	} else if (e->rejectDisabled && e->p.p[0] == '`') {
+		e->tk = (token_t){tagError, tokenPos, (slice_t){ErrMultilineDisabled, strlen(ErrMultilineDisabled)}};
 		return;
 	}
 	err = quotelessString(e, &s);
 	if (err != NULL) {
 		e->tk = (token_t){tagError, err->pos, (slice_t){err->err, strlen(err->err)}};
-		free(err);
 		return;
 	}
 	if (s.p != NULL) {
@@ -846,6 +1070,11 @@ bool done(engine_t *e) {
 	return e->tk.tag == tagError;
 }
 
+// failed returns true if an error occurred, the output being dropped.
+bool failed(engine_t *e) {
+	return e->nErrs > 0 || (done(e) && e->tk.val.p != ErrEndOfInput);
+}
+
 void setErrorAndPos(engine_t *e, const char *err, pos_t pos) {
 	e->tk = (token_t){tagError, pos, (slice_t){err, strlen(err)}};
 }
@@ -863,19 +1092,20 @@ void outputInit(engine_t *e) {
 	e->out.len = e->out.cap = 0;
 }
 
-// outputGrow grows the output buffer without modifying len.
+// outputGrow grows the output buffer without modifying len. In validate
+// only mode, the output is discarded instead so that the buffer never grows.
 void outputGrow(engine_t *e) {
+	if (e->discard && e->out.len > 0) {
+		e->out.len = 0;
+		return;
+	}
 	if (e->out.buf == NULL) {
 		e->out.cap = 1024;
-		e->out.buf = malloc(e->out.cap);
+		e->out.buf = memRealloc(e->out.alloc, NULL, e->out.cap);
 		e->out.len = 0;
 	}
-	int newCap = e->out.cap*2;
-	char *tmp = malloc(newCap);
-	memcpy(tmp, e->out.buf, e->out.cap);
-	free(e->out.buf);
-	e->out.buf = tmp;
-	e->out.cap = newCap;
+	e->out.cap *= 2;
+	e->out.buf = memRealloc(e->out.alloc, e->out.buf, e->out.cap);
 }
 
 // outBufByte appends a byte to the output buffer.
@@ -896,10 +1126,21 @@ void outputString(engine_t *e, const char *s) {
 	e->out.len += l;
 }
 
+// outputBytes appends the n bytes of p to the output buffer.
+void outputBytes(engine_t *e, const char *p, int n) {
+	if (n == 0)
+		return;
+	while (e->out.len + n > e->out.cap)
+		outputGrow(e);
+	memcpy(e->out.buf+e->out.len, p, n);
+	e->out.len += n;
+}
+
 // outBufGet returns the output buffer content. 
 // On return, the output buffer is empty.
 char* outputGet(engine_t *e) {
-	char *tmp = realloc(e->out.buf, e->out.len);
+	// the buffer is shrunk only for malloc, allocators are often arenas
+	char *tmp = (e->out.alloc == NULL) ? realloc(e->out.buf, e->out.len) : e->out.buf;
 	e->out.buf = NULL;
 	e->out.len = 0;
 	e->out.cap = 0;
@@ -913,12 +1154,17 @@ void outputReset(engine_t *e) {
 
 
 bool isHexDigit(byte v);
+int outputRune(engine_t *e, const char *p, int i, int n);
 
 void outputDoubleQuotedString(engine_t *e) {
 	char c;
 	slice_t str = e->tk.val;
 	outputByte(e, '"');
 	for (int i = 1; i < str.l-1; i++) {
+		if ((byte)str.p[i] >= 0x80 && e->ascii) {
+			i += outputRune(e, str.p, i, str.l-1) - 1;
+			continue;
+		}
 		switch (str.p[i]) {
 		case '/':
 			if (str.p[i-1] == '<')
@@ -931,10 +1177,17 @@ void outputDoubleQuotedString(engine_t *e) {
 		case '\\':
 			c = str.p[i+1];
 			if (c != 't' && c != 'n' && c != 'r' && c != 'f' && c != 'b' && c != '/' && c != '\\' && c != '"' &&
-				!(c == 'u' && str.l >= i+6 && isHexDigit(str.p[i+2]) && isHexDigit(str.p[i+3]) && isHexDigit(str.p[i+5]) && isHexDigit(str.p[i+5]))) {
+				!(c == 'u' && str.l >= i+6 && isHexDigit(str.p[i+2]) && isHexDigit(str.p[i+3]) && isHexDigit(str.p[i+4]) && isHexDigit(str.p[i+5]))) {
 				setErrorAndPos(e, ErrInvalidEscapeSequence, (pos_t){e->tk.pos.b+i, e->tk.pos.s, e->tk.pos.l});
 				return;
 			}
+			if (c == '\\' || c == '"') {
+				// the escaped char is output with the backslash
+				outputByte(e, '\\');
+				outputByte(e, c);
+				i++;
+				continue;
+			}
 			break;
 		}
 		outputByte(e, str.p[i]);
@@ -947,6 +1200,10 @@ void outputSingleQuotedString(engine_t *e) {
 	slice_t str = e->tk.val;
 	outputByte(e, '"');
 	for (int i = 1; i < str.l-1; i++) {
+		if ((byte)str.p[i] >= 0x80 && e->ascii) {
+			i += outputRune(e, str.p, i, str.l-1) - 1;
+			continue;
+		}
 		switch (str.p[i]) {
 		case '/':
 			if (str.p[i-1] == '<') {
@@ -960,12 +1217,19 @@ void outputSingleQuotedString(engine_t *e) {
 		case '\\':
 			c = str.p[i+1];
 			if (c != 't' && c != 'n' && c != 'r' && c != 'f' && c != 'b' && c != '/' && c != '\\' && c != '\'' &&
-				!(c == 'u' && str.l >= i+6 && isHexDigit(str.p[i+2]) && isHexDigit(str.p[i+3]) && isHexDigit(str.p[i+5]) && isHexDigit(str.p[i+5]))) {
+				!(c == 'u' && str.l >= i+6 && isHexDigit(str.p[i+2]) && isHexDigit(str.p[i+3]) && isHexDigit(str.p[i+4]) && isHexDigit(str.p[i+5]))) {
 				setErrorAndPos(e, ErrInvalidEscapeSequence, (pos_t){e->tk.pos.b+i, e->tk.pos.s, e->tk.pos.l});
 				return;
 			}
 			if (c == '\'')
 				continue;
+			if (c == '\\') {
+				// the escaped backslash is output with the backslash
+				outputByte(e, '\\');
+				outputByte(e, c);
+				i++;
+				continue;
+			}
 			break;
 		case '"':
 			outputByte(e, '\\');
@@ -980,6 +1244,10 @@ void outputQuotelessString(engine_t *e) {
 	slice_t str = e->tk.val;
 	outputByte(e, '"');
 	for (int i = 0; i < str.l; i++) {
+		if ((byte)str.p[i] >= 0x80 && e->ascii) {
+			i += outputRune(e, str.p, i, str.l) - 1;
+			continue;
+		}
 		switch (str.p[i]) {
 		case '"':
 			outputByte(e, '\\');
@@ -1043,7 +1311,7 @@ void outputMultilineString(engine_t *e) {
 			str.l -= n+margin.l;
 			continue;
 		}
-		if (str.p[0] < 0x20) {
+		if ((byte)str.p[0] < 0x20) {
 			char tmp[256];
 			switch (str.p[0]) {
 			case '\b':
@@ -1059,7 +1327,7 @@ void outputMultilineString(engine_t *e) {
 				outputString(e, "\\f");
 				break;
 			default:
-				sprintf(tmp, "\\u00%0X", str.p[0]);
+				sprintf(tmp, "\\u00%02X", str.p[0]);
 				outputString(e, tmp);
 				break;
 			}
@@ -1095,6 +1363,12 @@ void outputMultilineString(engine_t *e) {
 			str.l--;
 			continue;
 		}
+		if ((byte)str.p[0] >= 0x80 && e->ascii) {
+			n = outputRune(e, str.p, 0, str.l);
+			str.p += n;
+			str.l -= n;
+			continue;
+		}
 		outputByte(e, str.p[0]);
 		str.p++;
 		str.l--;
@@ -1136,6 +1410,7 @@ typedef struct {
 	slice_t    p;   // expression left to parse
 	int        pos; // position in b of the first byte of p
 	numToken_t tk;  // the last token
+	unsigned   disabled; // disabled syntax features (QJSON_NO_XXX flags)
 } numEngine_t;
 
 
@@ -1409,7 +1684,7 @@ int64_t decodeIntLiteral(slice_t v) {
 	for (int p = 0; p < v.l; p++) {
 		if (v.p[p] == '_')
 			continue;
-		if (val > 0x1999999999999999)
+		if (val > 0x0CCCCCCCCCCCCCCC) // val*10+9 would wrap around
 			return -1;
 		val = val*10 + (uint64_t)(v.p[p]-'0');
 	}
@@ -1599,9 +1874,13 @@ double decodeDecLiteral(slice_t v) {
 	if (v.l > 255)
 		return -1;
 	char buf[256];
-	memcpy(buf, v.p, v.l);
-	buf[v.l] = '\0';
+	int n = 0;
+	for (int i = 0; i < v.l; i++)
+		if (v.p[i] != '_') // strtod doesn’t accept digit separators
+			buf[n++] = v.p[i];
+	buf[n] = '\0';
 	char *eptr;
+	errno = 0;
 	double x = strtod(buf, &eptr);
 	if (x == 0 && errno == ERANGE) 
 		return -1;
@@ -1621,6 +1900,10 @@ bool nextDecValue(numEngine_t *e) {
 		e->tk = (numToken_t){tagError, e->pos, {.e=ErrInvalidDecimalNumber}};
 		return true;
 	}
+	if (val > DBL_MAX) {
+		e->tk = (numToken_t){tagError, e->pos, {.e=ErrNumberOverflow}};
+		return true;
+	}
 	e->tk = (numToken_t){tagDecimalVal, e->pos, {.f=val}};
 	numPopBytes(e, n);
 	return true;
@@ -1786,6 +2069,29 @@ bool nextISODateTimeValue(numEngine_t *e) {
 	return true;
 }
 
+// checkOperator sets an error if the operator token is disabled. A leading
+// sign is allowed without expressions.
+void checkOperator(numEngine_t *e, bool first) {
+	switch (e->tk.tag) {
+	case tagWeeks:
+	case tagDays:
+	case tagHours:
+	case tagMinutes:
+	case tagSeconds:
+		if (e->disabled & QJSON_NO_DURATIONS)
+			e->tk = (numToken_t){tagError, e->tk.pos, {.e=ErrDurationsDisabled}};
+		return;
+	case tagPlus:
+	case tagMinus:
+		if (first)
+			return;
+		// fall through
+	default:
+		if (e->disabled & QJSON_NO_EXPRESSIONS)
+			e->tk = (numToken_t){tagError, e->tk.pos, {.e=ErrExpressionsDisabled}};
+	}
+}
+
 void numNextToken(numEngine_t *e) {
 	if (e->tk.tag == tagError)
 		return;
@@ -1799,18 +2105,25 @@ void numNextToken(numEngine_t *e) {
 		e->tk = (numToken_t){tagError, e->pos, {.e=ErrEndOfInput} };
 		return;
 	}
-	if (!nextOperator(e) && !nextISODateTimeValue(e) && !nextBinValue(e) && !nextHexValue(e) &&
+	bool first = e->tk.tag == tagUnknown;
+	if (nextOperator(e)) {
+		if (e->disabled != 0)
+			checkOperator(e, first);
+		return;
+	}
+	if (!((e->disabled & QJSON_NO_DATES) == 0 && nextISODateTimeValue(e)) && !nextBinValue(e) && !nextHexValue(e) &&
 		!nextDecValue(e) && !nextOctValue(e) && !nextIntValue(e)) {
 			e->tk = (numToken_t){tagError, e->pos, {.e=ErrInvalidNumericExpression}};
 	}
 }
 
-void numEngineInit(numEngine_t *e, slice_t in) {
+void numEngineInit(numEngine_t *e, slice_t in, unsigned disabled) {
 	assert(in.p != NULL);
 	assert(in.l != 0);
 	e->in = in;
 	e->p = in;
 	e->pos = 0;
+	e->disabled = disabled;
 	e->tk.tag = tagUnknown;
 	e->tk.pos = 0;
 	e->tk.val.i = 0;
@@ -1956,16 +2269,46 @@ numToken_t expression(numEngine_t *e, byte rbp) {
 // evalNumberExpression evaluates the expression in input and
 // return the resulting value as a numToken. The returned value
 // may be a decimal value or an error.
-numToken_t evalNumberExpression(slice_t input) {
+numToken_t evalNumberExpression(slice_t input, unsigned disabled) {
 	numEngine_t e;
-	numEngineInit(&e, input);
+	numEngineInit(&e, input, disabled);
 	numToken_t t = expression(&e, 0);
+	if (t.tag != tagError && e.tk.tag == tagError && 
+		(e.tk.val.e == ErrExpressionsDisabled || e.tk.val.e == ErrDurationsDisabled))
+		return e.tk; // the expression stopped at a disabled operator
 	if (t.tag == tagError || t.tag == tagDecimalVal) 
 		return t;
 	assert(t.tag == tagIntegerVal);
 	return (numToken_t){tagDecimalVal, t.pos, {.f=(double)t.val.i}};
 }
 
+// isJSONNumber returns true if p is a json number.
+bool isJSONNumber(slice_t p) {
+	int i = 0;
+	if (i < p.l && p.p[i] == '-')
+		i++;
+	if (i == p.l || !isIntDigit(p.p[i]))
+		return false;
+	if (p.p[i++] != '0')
+		while (i < p.l && isIntDigit(p.p[i]))
+			i++;
+	if (i < p.l && p.p[i] == '.') {
+		if (++i == p.l || !isIntDigit(p.p[i]))
+			return false;
+		while (i < p.l && isIntDigit(p.p[i]))
+			i++;
+	}
+	if (i < p.l && (p.p[i] == 'e' || p.p[i] == 'E')) {
+		if (++i < p.l && (p.p[i] == '+' || p.p[i] == '-'))
+			i++;
+		if (i == p.l || !isIntDigit(p.p[i]))
+			return false;
+		while (i < p.l && isIntDigit(p.p[i]))
+			i++;
+	}
+	return i == p.l;
+}
+
 // isNumberExpr return true if p is a number expression. It looks for the
 // first digit that must be in the range '0' to '9'.
 bool isNumberExpr(slice_t p) {
@@ -2055,8 +2398,15 @@ numToken_t nudInverse(numEngine_t *e, numToken_t t) {
 	return right;
 }
 
+// numOverflow returns the result r of the operator t, or an error if r
+// is a decimal overflowing to an infinite value.
+numToken_t numOverflow(numToken_t t, numToken_t r) {
+	if (r.tag == tagDecimalVal && (r.val.f > DBL_MAX || r.val.f < -DBL_MAX))
+		return (numToken_t){tagError, t.pos, {.e=ErrNumberOverflow}};
+	return r;
+}
+
 numToken_t ledPlus(numEngine_t *e, numToken_t t, numToken_t left) {
-	(void)t;
 	assert(left.tag == tagIntegerVal || left.tag == tagDecimalVal);
 	numToken_t right = expression(e, precedenceTable[tagPlus]);
 	if (right.tag == tagError) {
@@ -2073,11 +2423,10 @@ numToken_t ledPlus(numEngine_t *e, numToken_t t, numToken_t left) {
 		assert(right.tag == tagDecimalVal);
 		left.val.f += right.val.f;
 	}
-	return left;
+	return numOverflow(t, left);
 }
 
 numToken_t ledMinus(numEngine_t *e, numToken_t t, numToken_t left) {
-	(void)t;
 	assert(left.tag == tagIntegerVal || left.tag == tagDecimalVal);
 	numToken_t right = expression(e, precedenceTable[tagMinus]);
 	if (right.tag == tagError) {
@@ -2091,11 +2440,10 @@ numToken_t ledMinus(numEngine_t *e, numToken_t t, numToken_t left) {
 		left.val.i -= right.val.i;
 	else
 		left.val.f -= right.val.f;	
-	return left;
+	return numOverflow(t, left);
 }
 
 numToken_t ledMultiplication(numEngine_t *e, numToken_t t, numToken_t left) {
-	(void)t;
 	assert(left.tag == tagIntegerVal || left.tag == tagDecimalVal);
 	numToken_t right = expression(e, precedenceTable[tagMultiplication]);
 	if (right.tag == tagError) {
@@ -2109,11 +2457,10 @@ numToken_t ledMultiplication(numEngine_t *e, numToken_t t, numToken_t left) {
 		left.val.i *= right.val.i;
 	else
 		left.val.f *= right.val.f;	
-	return left;
+	return numOverflow(t, left);
 }
 
 numToken_t ledDivision(numEngine_t *e, numToken_t t, numToken_t left) {
-	(void)t;
 	assert(left.tag == tagIntegerVal || left.tag == tagDecimalVal);
 	numToken_t right = expression(e, precedenceTable[tagDivision]);
 	if (right.tag == tagError) {
@@ -2132,7 +2479,7 @@ numToken_t ledDivision(numEngine_t *e, numToken_t t, numToken_t left) {
 			return (numToken_t){tagError, t.pos, {.e=ErrDivisionByZero}};
 		left.val.f /= right.val.f;
 	}
-	return left;
+	return numOverflow(t, left);
 }
 
 numToken_t ledModulo(numEngine_t *e, numToken_t t, numToken_t left) {
@@ -2210,24 +2557,23 @@ numToken_t toDouble(numToken_t t) {
 
 
 numToken_t ledDuration(numEngine_t *e, numToken_t t, numToken_t left, double duration, byte rbp) {
-	(void)t;
 	assert(left.tag == tagIntegerVal || left.tag == tagDecimalVal);
 	left = toDouble(left);
 	if (e->tk.tag == tagCloseParen) {
 		left.val.f *= duration;
-		return left;
+		return numOverflow(t, left);
 	}
 	numToken_t right = expression(e, rbp);
 	if (right.tag == tagError) { 
 		if (right.val.e == ErrEndOfInput) { // right hand operand is optional
 			left.val.f *= duration;
-			return left;
+			return numOverflow(t, left);
 		}
 		return right; // return error
 	}
 	right = toDouble(right);
 	left.val.f = left.val.f*duration + right.val.f;
-	return left;
+	return numOverflow(t, left);
 }
 
 numToken_t ledWeeks(numEngine_t *e, numToken_t t, numToken_t left) {
@@ -2296,8 +2642,144 @@ const char* isLiteralValue(slice_t p) {
 	return NULL;
 }
 
+// The recovery mode collects up to maxErrs errors in one pass. When an
+// error is met in a member or value, the enclosing members or values loop
+// records it and resynchronizes on the next comma, closing bracket, or
+// token starting a new line, at the same depth, before resuming the loop.
+// The output is meaningless after an error.
+
+// errorCode returns the code of the error message err.
+qjson_error_code_t errorCode(const char *err) {
+	if (err == ErrInputLimit || err == ErrInputTooLarge)
+		return QJSON_ERROR_INPUT_LIMIT;
+	if (err == ErrOutputLimit)
+		return QJSON_ERROR_OUTPUT_LIMIT;
+	if (err == ErrTokenLimit)
+		return QJSON_ERROR_TOKEN_LIMIT;
+	if (err == ErrDepthLimit || err == ErrMaxObjectArrayDepth)
+		return QJSON_ERROR_DEPTH_LIMIT;
+	if (err == ErrTimeLimit)
+		return QJSON_ERROR_TIME_LIMIT;
+	if (err == ErrCancelled)
+		return QJSON_ERROR_CANCELLED;
+	return QJSON_ERROR_SYNTAX;
+}
+
+// recordError appends the current error to the collected errors.
+void recordError(engine_t *e) {
+	if (e->nErrs%16 == 0)
+		e->errs = memRealloc(e->alloc, e->errs, (e->nErrs+16)*sizeof(qjson_error_t));
+	pos_t pos = e->tk.pos;
+	e->errs[e->nErrs++] = (qjson_error_t){e->tk.val.p, (size_t)pos.b, pos.l+1,
+		column((slice_t){e->in+pos.s, pos.b-pos.s})+1, errorCode(e->tk.val.p)};
+}
+
+// seek restarts the tokenizer at pos.
+void seek(engine_t *e, pos_t pos) {
+	int len = (int)(e->p.p-e->in) + e->p.l;
+	e->p = (slice_t){e->in+pos.b, len-pos.b};
+	e->pos = pos;
+	e->tk.tag = tagUnknown;
+}
+
+// recover records the current error and resynchronizes the tokenizer so
+// that the members or values loop at depth, closed by close, can resume.
+// It returns false if the error can’t be recovered from.
+bool recover(engine_t *e, int depth, enum tokenTag_t close) {
+	const char *err = e->tk.val.p;
+	if (e->nErrs+1 >= e->maxErrs || err == ErrEndOfInput || err == ErrMaxObjectArrayDepth || isLimitError(err))
+		return false;
+	recordError(e);
+	pos_t pos = e->tk.pos;
+	if (pos.b < e->pos.b)
+		pos = e->pos; // don’t go back before what was parsed
+	if ((err == ErrUnexpectedCloseBrace || err == ErrUnexpectedCloseSquare ||
+		err == ErrExpectIdentifierAfterComma || err == ErrExpectValueAfterComma) &&
+		pos.b > 0 && (e->in[pos.b-1] == '}' || e->in[pos.b-1] == ']'))
+		pos.b--; // resume at the closing bracket
+	int errLine = pos.l, nesting = 0;
+	seek(e, pos);
+	for (;;) {
+		nextToken(e);
+		switch (e->tk.tag) {
+		case tagError:
+			if (e->tk.val.p == ErrEndOfInput || isLimitError(e->tk.val.p))
+				goto resume;
+			// skip the invalid token or char and retry
+			if (e->tk.pos.b > pos.b)
+				pos = e->tk.pos;
+			if (e->pos.b > pos.b) {
+				seek(e, e->pos);
+				pos = e->pos;
+				continue;
+			}
+			int end = (int)(e->p.p-e->in)+e->p.l;
+			if (pos.b >= end)
+				goto resume;
+			if (e->in[pos.b] == '\n')
+				pos = (pos_t){pos.b+1, pos.b+1, pos.l+1};
+			else {
+				// a char truncated by the end of input is skipped up to the end
+				int n = (int)(utf8Table[(byte)e->in[pos.b]]&0xF);
+				pos.b += (n == 0) ? 1 : (n < end-pos.b) ? n : end-pos.b;
+			}
+			seek(e, pos);
+			continue;
+		case tagOpenBrace:
+		case tagOpenSquare:
+			nesting++;
+			continue;
+		case tagCloseBrace:
+		case tagCloseSquare:
+			if (nesting > 0) {
+				nesting--;
+				continue;
+			}
+			if (e->tk.tag != close && depth > 0) {
+				// end the loop and leave the bracket to the enclosing one
+				seek(e, e->tk.pos);
+				e->tk.tag = close;
+			}
+			if (e->tk.tag == close)
+				goto resume;
+			continue; // skip unbalanced closing bracket at the top level
+		case tagComma:
+			if (nesting == 0)
+				goto resume;
+			continue;
+		default:
+			if (nesting == 0 && e->tk.pos.l > errLine)
+				goto resume;
+		}
+	}
+resume:
+	e->depth = depth;
+	return true;
+}
+
 bool values(engine_t *e);
 bool members(engine_t *e);
+void mapRecord(engine_t *e);
+void dupOpen(engine_t *e);
+void dupClose(engine_t *e);
+int dupKey(engine_t *e, int key, bool *dup);
+void dupValue(engine_t *e, int slot, bool dup, int start, int val);
+void dupReset(engine_t *e);
+int canonOpen(engine_t *e);
+void canonMember(engine_t *e, int key, int val);
+void canonClose(engine_t *e, int base, int start);
+void canonScalar(engine_t *e, int start);
+void canonRewrite(engine_t *e, int start);
+void canonReset(engine_t *e);
+bool isIncludeDirective(slice_t v);
+bool includeValue(engine_t *e);
+void outputOpen(engine_t *e, char c);
+void outputItem(engine_t *e, int i);
+void outputColon(engine_t *e, int key);
+void outputClose(engine_t *e, char c, int n);
+void outputScalar(engine_t *e);
+void outputScalarEnd(engine_t *e);
+void formatReset(engine_t *e);
 
 // value process a value. If an error occurred it returns with the error set,
 // otherwise calls nextToken() and return the returned value of done().
@@ -2306,6 +2788,13 @@ bool value(engine_t *e) {
 	const char* str;
 	pos_t startPos;
 	char buf[256];
+	if (e->map != NULL)
+		mapRecord(e);
+	bool include = e->tk.tag == tagQuotelessString && e->includes != NULL && isIncludeDirective(e->tk.val);
+	bool scalar = e->tk.tag != tagOpenBrace && e->tk.tag != tagOpenSquare && !include;
+	if (scalar)
+		outputScalar(e);
+	int start = e->out.len;
 	switch (e->tk.tag) {
 	case tagCloseSquare:
 		setError(e, ErrUnexpectedCloseSquare);
@@ -2324,14 +2813,30 @@ bool value(engine_t *e) {
 		break;
 	case tagQuotelessString:
 		val = e->tk.val;
+		if (include) {
+			if (includeValue(e))
+				return true;
+			if (e->canon != NULL)
+				canonRewrite(e, start);
+			break;
+		}
 		str = isLiteralValue(val);
 		if (str != NULL) {
 			outputString(e, str);
 			break;
 		}
 		if (isNumberExpr(val)) {
-			numToken_t t = evalNumberExpression(val);
+			if ((e->disabled & QJSON_NO_EXPRESSIONS) && isJSONNumber(val)) {
+				// without expressions, json numbers are copied as is
+				outputBytes(e, val.p, val.l);
+				break;
+			}
+			numToken_t t = evalNumberExpression(val, e->disabled);
 			if (t.tag == tagError) {
+				if (!e->rejectDisabled && (t.val.e == ErrExpressionsDisabled || t.val.e == ErrDurationsDisabled)) {
+					outputQuotelessString(e);
+					break;
+				}
 				setErrorAndPos(e, t.val.e, (pos_t){e->tk.pos.b+t.pos, e->tk.pos.s, e->tk.pos.l});
 				return true;
 			}
@@ -2350,8 +2855,8 @@ bool value(engine_t *e) {
 				setErrorAndPos(e, ErrUnclosedObject, startPos);
 			return true;
 		}
-		if (e->depth == maxDepth) {
-			setError(e, ErrMaxObjectArrayDepth);
+		if (e->depth == e->maxDepth) {
+			setError(e, (e->maxDepth == maxDepth) ? ErrMaxObjectArrayDepth : ErrDepthLimit);
 			return true;
 		}
 		e->depth++;
@@ -2370,8 +2875,8 @@ bool value(engine_t *e) {
 			return true;
 		}
 		startPos = e->tk.pos;
-		if (e->depth == maxDepth) {
-			setError(e, ErrMaxObjectArrayDepth);
+		if (e->depth == e->maxDepth) {
+			setError(e, (e->maxDepth == maxDepth) ? ErrMaxObjectArrayDepth : ErrDepthLimit);
 			return true;
 		}
 		e->depth++;
@@ -2387,42 +2892,53 @@ bool value(engine_t *e) {
 		//		e.setError(fmt.Errorf("expected value, got %v", e.tk))
 		return false;
 	}
+	if (e->canon != NULL)
+		canonScalar(e, start);
+	if (scalar)
+		outputScalarEnd(e);
 	nextToken(e);
 	return done(e);
 }
 
 // values process 0 or more values and pops the ending ]. Return done().
 bool values(engine_t *e) {
-	bool notFirst = false;
-	outputByte(e, '[');
+	int depth = e->depth, n = 0;
+	outputOpen(e, '[');
 	while (!done(e) && e->tk.tag != tagCloseSquare) {
-		if (notFirst) {
-			outputByte(e, ',');
-			if (e->tk.tag == tagComma) {
-				nextToken(e);
-				if (done(e)) {
-					if (e->tk.val.p == ErrEndOfInput) {
-						setError(e, ErrExpectValueAfterComma);
-					}
-					break;
-				}
-				if (e->tk.tag == tagCloseBrace || e->tk.tag == tagCloseSquare) {
+		if (n > 0 && e->tk.tag == tagComma) {
+			nextToken(e);
+			if (done(e)) {
+				if (e->tk.val.p == ErrEndOfInput) {
 					setError(e, ErrExpectValueAfterComma);
-					break;
 				}
+				if (e->maxErrs > 1 && recover(e, depth, tagCloseSquare))
+					continue;
+				break;
+			}
+			if (e->tk.tag == tagCloseBrace || e->tk.tag == tagCloseSquare) {
+				setError(e, ErrExpectValueAfterComma);
+				if (e->maxErrs > 1 && recover(e, depth, tagCloseSquare))
+					continue;
+				break;
 			}
-		} else {
-			notFirst = true;
 		}
-		if (value(e)) {
+		outputItem(e, n++);
+		if ((value(e) || done(e)) && !(e->maxErrs > 1 && recover(e, depth, tagCloseSquare))) {
 			break;
 		}
 	}
-	outputByte(e, ']');
+	outputClose(e, ']', n);
 	return done(e);
 }
 
-bool member(engine_t *e) {
+// member process a member output from offset start, following the
+// separator of the previous member.
+bool member(engine_t *e, int start) {
+	if (e->map != NULL)
+		mapRecord(e);
+	int key = e->out.len, slot = 0;
+	bool keyed = true, dup = false;
+	pos_t keyPos = e->tk.pos;
 	switch (e->tk.tag) {
 	case tagCloseSquare:
 		setError(e, ErrUnexpectedCloseSquare);
@@ -2438,8 +2954,18 @@ bool member(engine_t *e) {
 		break;
 	default:
 		setError(e,ErrExpectStringIdentifier);
+		keyed = false;
 		break;
 	}
+	if (e->canon != NULL && keyed && !done(e))
+		canonScalar(e, key);
+	if (e->dups != NULL && keyed && !done(e)) {
+		slot = dupKey(e, key, &dup);
+		if (slot < 0) {
+			setErrorAndPos(e, ErrDuplicateKey, keyPos);
+			return true;
+		}
+	}
 	nextToken(e);
 	if (done(e)) {
 		if (e->tk.val.p == ErrEndOfInput)
@@ -2450,90 +2976,4477 @@ bool member(engine_t *e) {
 		setError(e, ErrExpectColon);
 		return true;
 	}
-	outputByte(e, ':');
+	if (keyed)
+		outputColon(e, key);
 	nextToken(e);
 	if (done(e)) {
 		if (e->tk.val.p == ErrEndOfInput)
 			setError(e,ErrUnexpectedEndOfInput);
 		return true;
 	}
-	return value(e);
+	int val = e->out.len;
+	bool end = value(e);
+	if (keyed && (!done(e) || e->tk.val.p == ErrEndOfInput)) {
+		if (e->dups != NULL)
+			dupValue(e, slot, dup, start, val);
+		// unless it was removed as a duplicate
+		if (e->canon != NULL && e->out.len > val)
+			canonMember(e, key, val);
+	}
+	return end;
 }
 
 // values process 0 or more members (identifiers : value) and pops the ending }. Return done().
 bool members(engine_t *e) {
-	bool notFirst = false;
-	outputByte(e, '{');
+	int depth = e->depth, start = e->out.len, n = 0;
+	int base = (e->canon != NULL) ? canonOpen(e) : 0;
+	outputOpen(e, '{');
+	if (e->dups != NULL)
+		dupOpen(e);
 	while (!done(e) && e->tk.tag != tagCloseBrace) {
-		if (notFirst) {
-			outputByte(e, ',');
-			if (e->tk.tag == tagComma) {
-				nextToken(e);
-				if (done(e)) {
-					if (e->tk.val.p == ErrEndOfInput)
-						setError(e, ErrExpectIdentifierAfterComma);
-					break;
-				}
-				if (e->tk.tag == tagCloseBrace || e->tk.tag == tagCloseSquare) {
+		if (n > 0 && e->tk.tag == tagComma) {
+			nextToken(e);
+			if (done(e)) {
+				if (e->tk.val.p == ErrEndOfInput)
 					setError(e, ErrExpectIdentifierAfterComma);
-					break;
-				}
+				if (e->maxErrs > 1 && recover(e, depth, tagCloseBrace))
+					continue;
+				break;
+			}
+			if (e->tk.tag == tagCloseBrace || e->tk.tag == tagCloseSquare) {
+				setError(e, ErrExpectIdentifierAfterComma);
+				if (e->maxErrs > 1 && recover(e, depth, tagCloseBrace))
+					continue;
+				break;
 			}
-		} else {
-			notFirst = true;
 		}
-		if (member(e))
+		int at = e->out.len;
+		outputItem(e, n++);
+		if ((member(e, at) || done(e)) && !(e->maxErrs > 1 && recover(e, depth, tagCloseBrace)))
 			break;
 	}
-	outputByte(e, '}');
+	if (e->dups != NULL)
+		dupClose(e);
+	outputClose(e, '}', n);
+	if (e->canon != NULL)
+		canonClose(e, base, start);
 	return done(e);
 }
 
 // ----------------------------------------------------------------------------------------------------------------------------------------
-// Main
+// Writer
 // ----------------------------------------------------------------------------------------------------------------------------------------
 
-int myStrLen(const char* str) {
-	int i = 0;
-	while (str[i] != 0)
-		i++;
-	return i;
+// The writer produces idiomatic qjson text. Members and values are
+// written one per line without commas unless requested. Strings are
+// written quoteless when it is safe, as multiline strings when they are
+// long texts, and quoted otherwise. The top level object has no braces.
+
+// Minimal byte length of a string with a newline to be written as multiline.
+const int multilineMinLen = 40;
+
+// Flags of a writer container stack entry.
+#define wArray   ((byte)0x01) // container is an array
+#define wOneLine ((byte)0x02) // array is written on one line
+#define wFirst   ((byte)0x04) // no member or value written yet
+
+struct qjson_writer {
+	outBuf_t  out;    // output buffer
+	int       indent; // number of spaces per nesting level
+	bool      commas; // separate members and values with commas
+	byte     *stack;  // flags of open containers, stack[0] is the top level object
+	int       n;      // number of open containers
+	int       cap;    // capacity of stack
+};
+
+// bufGrow grows the capacity of b so that it can hold n more bytes.
+void bufGrow(outBuf_t *b, int n) {
+	int newCap = (b->cap == 0) ? 1024 : b->cap;
+	while (b->len + n > newCap)
+		newCap *= 2;
+	b->buf = memRealloc(b->alloc, b->buf, newCap);
+	b->cap = newCap;
 }
 
-// qjson_decode accept a qjson text string as input and returns a 
-// heap allocated string. If the string start with the character '{',
-// the string is the json encoding of the input text, otherwise it
-// is an error message. qjson_decode will never return NULL or an
-// empty string.
-char* qjson_decode(const char *qjsonText) {
-	int len = (qjsonText == NULL) ? 0 : myStrLen(qjsonText); // strlen(qjsonText);
-	if (len == 0 ) {
-		return strcpy(malloc(3), "{}");
+// bufByte appends c to b.
+void bufByte(outBuf_t *b, char c) {
+	if (b->len == b->cap)
+		bufGrow(b, 1);
+	b->buf[b->len++] = c;
+}
+
+// bufBytes appends the n bytes of p to b.
+void bufBytes(outBuf_t *b, const char *p, int n) {
+	if (n == 0)
+		return;
+	if (b->len + n > b->cap)
+		bufGrow(b, n);
+	memcpy(b->buf+b->len, p, n);
+	b->len += n;
+}
+
+// bufSpaces appends n spaces to b.
+void bufSpaces(outBuf_t *b, int n) {
+	if (b->len + n > b->cap)
+		bufGrow(b, n);
+	memset(b->buf+b->len, ' ', n);
+	b->len += n;
+}
+
+// bufRune appends the utf8 encoding of the code point v to b.
+void bufRune(outBuf_t *b, unsigned v) {
+	char u[4];
+	int n;
+	if (v < 0x80) {
+		u[0] = (char)v; n = 1;
+	} else if (v < 0x800) {
+		u[0] = (char)(0xC0 | v>>6); u[1] = (char)(0x80 | (v&0x3F)); n = 2;
+	} else if (v < 0x10000) {
+		u[0] = (char)(0xE0 | v>>12); u[1] = (char)(0x80 | (v>>6&0x3F)); u[2] = (char)(0x80 | (v&0x3F)); n = 3;
+	} else {
+		u[0] = (char)(0xF0 | v>>18); u[1] = (char)(0x80 | (v>>12&0x3F)); 
+		u[2] = (char)(0x80 | (v>>6&0x3F)); u[3] = (char)(0x80 | (v&0x3F)); n = 4;
 	}
-	engine_t e;
-	e.in = qjsonText;
-	e.p = (slice_t){e.in, len};
-	outputInit(&e);
-	e.depth = 0;
-	e.pos = (pos_t){0,0,0};
-	e.tk.tag = tagUnknown;
-	e.tk.pos = e.pos;
-	e.tk.val.p = NULL;
-	e.tk.val.l = 0;
-	nextToken(&e);
-	members(&e);
-	if (e.tk.tag == tagCloseBrace)
-		e.tk = (token_t){tagError, e.tk.pos, {ErrSyntaxError, strlen(ErrSyntaxError)}};
-	assert(e.tk.tag == tagError);
-	if (e.tk.val.p == ErrEndOfInput) {
-		outputByte(&e, '\0');
-		return outputGet(&e);
+	bufBytes(b, u, n);
+}
+
+qjson_writer_t* qjson_writer_new(int indent, bool commas) {
+	qjson_writer_t *w = calloc(1, sizeof(qjson_writer_t));
+	w->indent = (indent < 0) ? 0 : indent;
+	w->commas = commas;
+	return w;
+}
+
+void qjson_writer_free(qjson_writer_t *w) {
+	if (w == NULL)
+		return;
+	free(w->out.buf);
+	free(w->stack);
+	free(w);
+}
+
+// writerPush opens a container with the given flags.
+void writerPush(qjson_writer_t *w, byte flags) {
+	if (w->n == w->cap) {
+		w->cap = (w->cap == 0) ? 16 : w->cap*2;
+		w->stack = realloc(w->stack, w->cap);
 	}
-	outputReset(&e);
-	outputString(&e, e.tk.val.p);
-	char buf[256];
-	sprintf(buf, " at line %d col %d", e.tk.pos.l+1, column((slice_t){e.in+e.tk.pos.s, e.tk.pos.b-e.tk.pos.s})+1);
-	outputString(&e, buf);
-	outputByte(&e, '\0');
-	return outputGet(&e);
-}
\ No newline at end of file
+	w->stack[w->n++] = flags | wFirst;
+}
+
+// writerNewline starts a new line indented for the current container.
+void writerNewline(qjson_writer_t *w, int level) {
+	bufByte(&w->out, '\n');
+	bufSpaces(&w->out, level*w->indent);
+}
+
+// writerItem writes the separator in front of a member or an array value.
+void writerItem(qjson_writer_t *w) {
+	byte *top = &w->stack[w->n-1];
+	bool first = (*top & wFirst) != 0;
+	*top &= ~wFirst;
+	if (*top & wOneLine) {
+		if (!first)
+			bufBytes(&w->out, ", ", 2);
+		return;
+	}
+	if (!first && w->commas)
+		bufByte(&w->out, ',');
+	if (!first || w->n > 1)
+		writerNewline(w, w->n-1);
+}
+
+// writerValue writes the separator in front of a value and returns the 
+// number of levels of the margin of a multiline string written next, 
+// or -1 when the value must be written on the current line.
+int writerValue(qjson_writer_t *w) {
+	if (w->n == 0)
+		return -1;
+	if (w->stack[w->n-1] & wArray) {
+		writerItem(w);
+		return (w->stack[w->n-1] & wOneLine) ? -1 : w->n-1;
+	}
+	return w->n;
+}
+
+// writerClose closes the current container with the character c.
+void writerClose(qjson_writer_t *w, char c) {
+	byte flags = w->stack[--w->n];
+	if (w->n == 0) {
+		if ((flags & wFirst) == 0)
+			bufByte(&w->out, '\n');
+		return;
+	}
+	if ((flags & (wFirst|wOneLine)) == 0)
+		writerNewline(w, w->n-1);
+	bufByte(&w->out, c);
+}
+
+void qjson_write_begin_object(qjson_writer_t *w) {
+	if (w->n == 0) {
+		writerPush(w, 0); // top level object has no braces
+		return;
+	}
+	if (writerValue(w) >= w->n)
+		bufByte(&w->out, ' ');
+	bufByte(&w->out, '{');
+	writerPush(w, 0);
+}
+
+void qjson_write_end_object(qjson_writer_t *w) {
+	writerClose(w, '}');
+}
+
+void qjson_write_begin_array(qjson_writer_t *w, bool oneLine) {
+	if (writerValue(w) >= w->n)
+		bufByte(&w->out, ' ');
+	bufByte(&w->out, '[');
+	writerPush(w, wArray | (oneLine ? wOneLine : 0));
+}
+
+void qjson_write_end_array(qjson_writer_t *w) {
+	writerClose(w, ']');
+}
+
+// unsafeQuotelessByte is 1 for the bytes that can’t be in a quoteless 
+// string, and 2 for / that can’t be followed by / or *.
+const byte unsafeQuotelessByte[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, // 00  \t is valid
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 10
+	0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 2, // 20  # , /
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, // 30  :
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 40
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, // 50 [ ]
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 60
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, // 70 { }
+};
+
+// isQuotelessSafe returns true if s can be written as a quoteless
+// identifier. It may not be empty, start or end with white spaces, start
+// with a quote or contain delimiters, comment starts, newlines or control
+// characters. 
+bool isQuotelessSafe(slice_t s) {
+	if (s.l == 0 || whitespace(s) != 0 || s.p[0] == '"' || s.p[0] == '\'' || s.p[0] == '`')
+		return false;
+	byte last = (byte)s.p[s.l-1];
+	if (last == ' ' || last == '\t' || (last == 0xA0 && s.l > 1 && (byte)s.p[s.l-2] == 0xC2))
+		return false;
+	for (int i = 0; i < s.l; i++) {
+		byte c = unsafeQuotelessByte[(byte)s.p[i]];
+		if (c == 0)
+			continue;
+		if (c == 1 || (i+1 < s.l && (s.p[i+1] == '/' || s.p[i+1] == '*')))
+			return false;
+	}
+	return true;
+}
+
+// isQuotelessValueSafe returns true if s can be written as a quoteless 
+// value. It must be a safe quoteless identifier that is not decoded as
+// a literal or a numeric expression.
+bool isQuotelessValueSafe(slice_t s) {
+	return isQuotelessSafe(s) && isLiteralValue(s) == NULL && !isNumberExpr(s);
+}
+
+// isMultilineSafe returns true if s is a long text with newlines and 
+// without control characters except \t. 
+bool isMultilineSafe(slice_t s) {
+	bool hasNewline = false;
+	for (int i = 0; i < s.l; i++) {
+		if ((byte)s.p[i] >= 0x20)
+			continue;
+		if (s.p[i] == '\n')
+			hasNewline = true;
+		else if (s.p[i] != '\t')
+			return false;
+	}
+	return hasNewline && s.l >= multilineMinLen;
+}
+
+// writerMultiline writes s as a multiline string with a margin of level 
+// indentation levels. Requires isMultilineSafe(s).
+void writerMultiline(qjson_writer_t *w, slice_t s, int level) {
+	int margin = level*w->indent;
+	if (level == w->n)
+		writerNewline(w, level); // margin is already written for array values
+	bufBytes(&w->out, "`\\n\n", 4);
+	bufSpaces(&w->out, margin);
+	int start = 0;
+	for (int i = 0; i < s.l; i++) {
+		if (s.p[i] == '\n') {
+			bufBytes(&w->out, s.p+start, i+1-start);
+			bufSpaces(&w->out, margin);
+			start = i+1;
+		} else if (s.p[i] == '`') {
+			bufBytes(&w->out, s.p+start, i+1-start);
+			bufByte(&w->out, '\\');
+			start = i+1;
+		}
+	}
+	bufBytes(&w->out, s.p+start, s.l-start);
+	bufByte(&w->out, '`');
+}
+
+// writerQuoted writes s as a quoted string. Single quotes are used when
+// s contains double quotes and no single quotes.
+void writerQuoted(qjson_writer_t *w, slice_t s) {
+	char q = '"';
+	if (memchr(s.p, '"', s.l) != NULL && memchr(s.p, '\'', s.l) == NULL)
+		q = '\'';
+	bufByte(&w->out, q);
+	int start = 0;
+	for (int i = 0; i < s.l; i++) {
+		byte c = (byte)s.p[i];
+		if (c >= 0x20 && c != (byte)q && c != '\\')
+			continue;
+		bufBytes(&w->out, s.p+start, i-start);
+		start = i+1;
+		char tmp[8];
+		switch (c) {
+		case '\n': bufBytes(&w->out, "\\n", 2); break;
+		case '\t': bufBytes(&w->out, "\\t", 2); break;
+		case '\r': bufBytes(&w->out, "\\r", 2); break;
+		case '\b': bufBytes(&w->out, "\\b", 2); break;
+		case '\f': bufBytes(&w->out, "\\f", 2); break;
+		case '\\': bufBytes(&w->out, "\\\\", 2); break;
+		default:
+			if (c == (byte)q) {
+				bufByte(&w->out, '\\');
+				bufByte(&w->out, q);
+				break;
+			}
+			sprintf(tmp, "\\u%04X", c);
+			bufBytes(&w->out, tmp, 6);
+		}
+	}
+	bufBytes(&w->out, s.p+start, s.l-start);
+	bufByte(&w->out, q);
+}
+
+void qjson_write_key(qjson_writer_t *w, const char *s, size_t len) {
+	slice_t k = {s, (int)len};
+	writerItem(w);
+	if (isQuotelessSafe(k))
+		bufBytes(&w->out, k.p, k.l);
+	else
+		writerQuoted(w, k);
+	bufByte(&w->out, ':');
+}
+
+void qjson_write_string(qjson_writer_t *w, const char *s, size_t len) {
+	slice_t v = {s, (int)len};
+	int level = writerValue(w);
+	if (level >= 0 && isMultilineSafe(v)) {
+		writerMultiline(w, v, level);
+		return;
+	}
+	if (level >= w->n)
+		bufByte(&w->out, ' ');
+	if (isQuotelessValueSafe(v))
+		bufBytes(&w->out, v.p, v.l);
+	else
+		writerQuoted(w, v);
+}
+
+void qjson_write_raw(qjson_writer_t *w, const char *s, size_t len) {
+	if (writerValue(w) >= w->n)
+		bufByte(&w->out, ' ');
+	bufBytes(&w->out, s, (int)len);
+}
+
+char* qjson_writer_finish(qjson_writer_t *w, size_t *len) {
+	bufByte(&w->out, '\0');
+	char *tmp = w->out.buf;
+	if (len != NULL)
+		*len = (size_t)w->out.len-1;
+	w->out = (outBuf_t){NULL, 0, 0};
+	w->n = 0;
+	return tmp;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// JSON to qjson
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The json text is validated and converted in a single pass. Numbers,
+// literals and strings that can’t be written quoteless or multiline are
+// copied unmodified from the input, so that decoding the qjson output 
+// yields the same json text as decoding the input members.
+
+// Maximal byte length of an array of scalars to be written on one line.
+const int oneLineArrayMaxLen = 60;
+
+// jsonConv_t is the json to qjson converter.
+typedef struct {
+	const char     *in;  // input json text
+	int             len; // byte length of in
+	int             b;   // index of the next byte to parse
+	const char     *err; // error message or NULL
+	int             errB;// index of the error
+	qjson_writer_t *w;   // qjson output
+	outBuf_t        tmp; // unescaped string buffer
+} jsonConv_t;
+
+bool jsonSetError(jsonConv_t *c, const char *err, int b) {
+	if (c->err == NULL) {
+		c->err = err;
+		c->errB = b;
+	}
+	return false;
+}
+
+void jsonSkipWhitespaces(jsonConv_t *c) {
+	while (c->b < c->len && (c->in[c->b] == ' ' || c->in[c->b] == '\t' || 
+		c->in[c->b] == '\n' || c->in[c->b] == '\r'))
+		c->b++;
+}
+
+// utf8CharLen returns the byte length of the valid utf8 char in front 
+// of p, or 0 if it is invalid or truncated.
+int utf8CharLen(slice_t p) {
+	byte x = utf8Table[(byte)p.p[0]];
+	if (x == s1)
+		return 1;
+	int n = (int)(x & 0xF);
+	if (x == s0 || n > p.l)
+		return 0;
+	byte r = (x >> 4) << 1;
+	if ((byte)p.p[1] < utf8Range[r] || (byte)p.p[1] > utf8Range[r+1])
+		return 0;
+	for (int i = 2; i < n; i++) 
+		if ((byte)p.p[i] < utf8lo || (byte)p.p[i] > utf8hi)
+			return 0;
+	return n;
+}
+
+// plainStringByte is 1 for the ascii bytes that are valid in a json 
+// string and need no special processing.
+const byte plainStringByte[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 00
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 10
+	1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 20 "
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 30
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 40
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, // 50 backslash
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 60
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 70
+};
+
+// jsonString validates the string at c->b and returns its span including
+// the quotes in s. escapes is set to true if the string contains escape
+// sequences, and simple to true if they are all \n \t \" or \\.
+bool jsonString(jsonConv_t *c, slice_t *s, bool *escapes, bool *simple) {
+	int start = c->b++;
+	*escapes = false;
+	*simple = true;
+	for (;;) {
+		while (c->b < c->len && plainStringByte[(byte)c->in[c->b]])
+			c->b++;
+		if (c->b >= c->len)
+			return jsonSetError(c, ErrUnclosedDoubleQuoteString, start);
+		byte x = (byte)c->in[c->b];
+		if (x == '"')
+			break;
+		if (x == '\\') {
+			*escapes = true;
+			if (c->b+1 >= c->len)
+				return jsonSetError(c, ErrUnclosedDoubleQuoteString, start);
+			char e = c->in[c->b+1];
+			if (e == 'u') {
+				if (c->b+5 >= c->len || !isHexDigit(c->in[c->b+2]) || !isHexDigit(c->in[c->b+3]) ||
+					!isHexDigit(c->in[c->b+4]) || !isHexDigit(c->in[c->b+5]))
+					return jsonSetError(c, ErrInvalidEscapeSequence, c->b);
+				*simple = false;
+				c->b += 6;
+				continue;
+			}
+			if (e != 'n' && e != 't' && e != '"' && e != '\\') {
+				if (e != '/' && e != 'b' && e != 'f' && e != 'r')
+					return jsonSetError(c, ErrInvalidEscapeSequence, c->b);
+				*simple = false;
+			}
+			c->b += 2;
+			continue;
+		}
+		if (x < 0x80) {
+			if (x < 0x20)
+				return jsonSetError(c, ErrInvalidChar, c->b);
+			c->b++;
+			continue;
+		}
+		int n = utf8CharLen((slice_t){c->in+c->b, c->len-c->b});
+		if (n == 0)
+			return jsonSetError(c, ErrInvalidChar, c->b);
+		c->b += n;
+	}
+	c->b++;
+	*s = (slice_t){c->in+start, c->b-start};
+	return true;
+}
+
+// jsonUnescape returns the content of the string s with simple escape
+// sequences, using c->tmp as storage.
+slice_t jsonUnescape(jsonConv_t *c, slice_t s) {
+	c->tmp.len = 0;
+	for (int i = 1; i < s.l-1; i++) {
+		char x = s.p[i];
+		if (x == '\\') {
+			x = s.p[++i];
+			if (x == 'n')
+				x = '\n';
+			else if (x == 't')
+				x = '\t';
+		}
+		bufByte(&c->tmp, x);
+	}
+	return (slice_t){c->tmp.buf, c->tmp.len};
+}
+
+// jsonStringValue writes the string s as a value or a key.
+void jsonStringValue(jsonConv_t *c, slice_t s, bool escapes, bool simple, bool isKey) {
+	qjson_writer_t *w = c->w;
+	slice_t v = {s.p+1, s.l-2};
+	if (isKey) {
+		writerItem(w);
+		if (!escapes && isQuotelessSafe(v))
+			bufBytes(&w->out, v.p, v.l);
+		else
+			bufBytes(&w->out, s.p, s.l);
+		bufByte(&w->out, ':');
+		return;
+	}
+	int level = writerValue(w);
+	if (level >= 0 && simple && escapes) {
+		slice_t u = jsonUnescape(c, s);
+		if (isMultilineSafe(u)) {
+			writerMultiline(w, u, level);
+			return;
+		}
+	}
+	if (level >= w->n)
+		bufByte(&w->out, ' ');
+	if (!escapes && isQuotelessValueSafe(v))
+		bufBytes(&w->out, v.p, v.l);
+	else
+		bufBytes(&w->out, s.p, s.l);
+}
+
+// jsonNumber validates the number at c->b and returns its span in s.
+bool jsonNumber(jsonConv_t *c, slice_t *s) {
+	int start = c->b, b = c->b;
+	const char *p = c->in;
+	if (b < c->len && p[b] == '-')
+		b++;
+	if (b < c->len && p[b] == '0')
+		b++;
+	else if (b < c->len && inRange(p[b], '1', '9'))
+		while (b < c->len && isIntDigit(p[b]))
+			b++;
+	else
+		return jsonSetError(c, ErrInvalidIntegerNumber, start);
+	if (b < c->len && p[b] == '.') {
+		b++;
+		if (b == c->len || !isIntDigit(p[b]))
+			return jsonSetError(c, ErrInvalidDecimalNumber, start);
+		while (b < c->len && isIntDigit(p[b]))
+			b++;
+	}
+	if (b < c->len && (p[b] == 'e' || p[b] == 'E')) {
+		b++;
+		if (b < c->len && (p[b] == '+' || p[b] == '-'))
+			b++;
+		if (b == c->len || !isIntDigit(p[b]))
+			return jsonSetError(c, ErrInvalidDecimalNumber, start);
+		while (b < c->len && isIntDigit(p[b]))
+			b++;
+	}
+	c->b = b;
+	*s = (slice_t){p+start, b-start};
+	return true;
+}
+
+// isOneLineArray returns true if the array starting at c->b contains only
+// scalar values without newlines and is short enough to be written on one line.
+bool isOneLineArray(jsonConv_t *c) {
+	int end = c->b + oneLineArrayMaxLen;
+	if (end > c->len)
+		end = c->len;
+	bool inString = false;
+	for (int b = c->b+1; b < end; b++) {
+		char x = c->in[b];
+		if (inString) {
+			if (x == '\\') {
+				if (b+1 < end && c->in[b+1] == 'n')
+					return false;
+				b++;
+			} else if (x == '"') {
+				inString = false;
+			}
+			continue;
+		}
+		if (x == '"')
+			inString = true;
+		else if (x == '{' || x == '[')
+			return false;
+		else if (x == ']')
+			return b > c->b+1;
+	}
+	return false;
+}
+
+bool jsonValue(jsonConv_t *c, int depth);
+
+// jsonMembers converts the members of the object at c->b.
+bool jsonMembers(jsonConv_t *c, int depth) {
+	int start = c->b++;
+	jsonSkipWhitespaces(c);
+	if (c->b < c->len && c->in[c->b] == '}') {
+		c->b++;
+		return true;
+	}
+	for (;;) {
+		jsonSkipWhitespaces(c);
+		if (c->b >= c->len)
+			return jsonSetError(c, ErrUnclosedObject, start);
+		if (c->in[c->b] != '"')
+			return jsonSetError(c, ErrExpectStringIdentifier, c->b);
+		slice_t s;
+		bool escapes, simple;
+		if (!jsonString(c, &s, &escapes, &simple))
+			return false;
+		jsonStringValue(c, s, escapes, simple, true);
+		jsonSkipWhitespaces(c);
+		if (c->b >= c->len || c->in[c->b] != ':')
+			return jsonSetError(c, ErrExpectColon, c->b);
+		c->b++;
+		if (!jsonValue(c, depth))
+			return false;
+		jsonSkipWhitespaces(c);
+		if (c->b >= c->len)
+			return jsonSetError(c, ErrUnclosedObject, start);
+		if (c->in[c->b] == '}') {
+			c->b++;
+			return true;
+		}
+		if (c->in[c->b] != ',')
+			return jsonSetError(c, ErrSyntaxError, c->b);
+		c->b++;
+	}
+}
+
+// jsonValues converts the values of the array at c->b.
+bool jsonValues(jsonConv_t *c, int depth) {
+	int start = c->b++;
+	jsonSkipWhitespaces(c);
+	if (c->b < c->len && c->in[c->b] == ']') {
+		c->b++;
+		return true;
+	}
+	for (;;) {
+		if (!jsonValue(c, depth))
+			return false;
+		jsonSkipWhitespaces(c);
+		if (c->b >= c->len)
+			return jsonSetError(c, ErrUnclosedArray, start);
+		if (c->in[c->b] == ']') {
+			c->b++;
+			return true;
+		}
+		if (c->in[c->b] != ',')
+			return jsonSetError(c, ErrSyntaxError, c->b);
+		c->b++;
+	}
+}
+
+// jsonValue converts the value at c->b.
+bool jsonValue(jsonConv_t *c, int depth) {
+	jsonSkipWhitespaces(c);
+	if (c->b >= c->len)
+		return jsonSetError(c, ErrUnexpectedEndOfInput, c->b);
+	slice_t s;
+	bool escapes, simple;
+	const char *p = c->in + c->b;
+	int l = c->len - c->b;
+	switch (*p) {
+	case '{':
+		if (depth == maxDepth)
+			return jsonSetError(c, ErrMaxObjectArrayDepth, c->b);
+		qjson_write_begin_object(c->w);
+		if (!jsonMembers(c, depth+1))
+			return false;
+		qjson_write_end_object(c->w);
+		return true;
+	case '[':
+		if (depth == maxDepth)
+			return jsonSetError(c, ErrMaxObjectArrayDepth, c->b);
+		qjson_write_begin_array(c->w, isOneLineArray(c));
+		if (!jsonValues(c, depth+1))
+			return false;
+		qjson_write_end_array(c->w);
+		return true;
+	case '"':
+		if (!jsonString(c, &s, &escapes, &simple))
+			return false;
+		jsonStringValue(c, s, escapes, simple, false);
+		return true;
+	case 't':
+	case 'n':
+		if (l >= 4 && (memcmp(p, "true", 4) == 0 || memcmp(p, "null", 4) == 0)) {
+			qjson_write_raw(c->w, p, 4);
+			c->b += 4;
+			return true;
+		}
+		return jsonSetError(c, ErrInvalidValueType, c->b);
+	case 'f':
+		if (l >= 5 && memcmp(p, "false", 5) == 0) {
+			qjson_write_raw(c->w, p, 5);
+			c->b += 5;
+			return true;
+		}
+		return jsonSetError(c, ErrInvalidValueType, c->b);
+	default:
+		if (*p != '-' && !isIntDigit(*p))
+			return jsonSetError(c, ErrInvalidValueType, c->b);
+		if (!jsonNumber(c, &s))
+			return false;
+		qjson_write_raw(c->w, s.p, s.l);
+		return true;
+	}
+}
+
+// errorPos returns the position of the byte at index b of in.
+pos_t errorPos(const char *in, int b) {
+	pos_t pos = {b, 0, 0};
+	for (int i = 0; i < b; i++) {
+		if (in[i] == '\n') {
+			pos.l++;
+			pos.s = i+1;
+		}
+	}
+	return pos;
+}
+
+char* qjson_from_json(const char *jsonText, size_t len, size_t *outLen, qjson_error_t *err) {
+	if (len > 0x7FFFFFFF) {
+		*err = (qjson_error_t){ErrInputTooLarge, 0, 1, 1};
+		return NULL;
+	}
+	jsonConv_t c;
+	memset(&c, 0, sizeof(c));
+	c.in = jsonText;
+	c.len = (int)len;
+	c.w = qjson_writer_new(2, false);
+	bufGrow(&c.w->out, c.len + c.len/4); // qjson text is usually smaller than json
+	jsonSkipWhitespaces(&c);
+	if (c.b >= c.len || c.in[c.b] != '{')
+		jsonSetError(&c, ErrExpectStringIdentifier, c.b);
+	else if (jsonValue(&c, 0)) {
+		jsonSkipWhitespaces(&c);
+		if (c.b < c.len)
+			jsonSetError(&c, ErrSyntaxError, c.b);
+	}
+	free(c.tmp.buf);
+	if (c.err != NULL) {
+		qjson_writer_free(c.w);
+		pos_t pos = errorPos(c.in, c.errB);
+		*err = (qjson_error_t){c.err, (size_t)pos.b, pos.l+1, 
+			column((slice_t){c.in+pos.s, pos.b-pos.s})+1};
+		return NULL;
+	}
+	char *out = qjson_writer_finish(c.w, outLen);
+	qjson_writer_free(c.w);
+	return out;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Source map
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The source map records for each key and value the offset of its first
+// byte in the output and the position of its first token in the input.
+// The mappings are recorded in output order, which is also input order,
+// so they are stored as varint encoded deltas from the previous mapping,
+// a few bytes per mapping. Every mapInterval mappings, the absolute
+// mapping is stored in a checkpoint array on which lookups do a binary
+// search before decoding at most mapInterval-1 deltas.
+
+// mapInterval is the number of mappings between two checkpoints.
+const int mapInterval = 16;
+
+// mapping_t is a decoded mapping.
+typedef struct {
+	int out;  // output byte offset
+	int b;    // input byte offset
+	int l;    // input line number starting at 0
+	int col;  // input byte offset from the start of the line
+	int next; // offset in deltas of the following mapping
+} mapping_t;
+
+struct qjson_source_map {
+	outBuf_t   deltas; // varint encoded mappings relative to the previous one
+	mapping_t *cps;    // checkpoints, one every mapInterval mappings
+	int        nCps;   // number of checkpoints
+	int        capCps; // capacity of cps
+	int        n;      // number of mappings
+	mapping_t  last;   // last recorded mapping
+	const qjson_allocator_t *alloc; // allocator of the map
+};
+
+// mapVarint appends the varint encoding of v to b.
+void mapVarint(outBuf_t *b, unsigned v) {
+	while (v >= 0x80) {
+		bufByte(b, (char)(v|0x80));
+		v >>= 7;
+	}
+	bufByte(b, (char)v);
+}
+
+// mapReadVarint decodes the varint at p[*i] and advances *i past it.
+int mapReadVarint(const char *p, int *i) {
+	unsigned v = 0;
+	for (int shift = 0;; shift += 7) {
+		byte c = (byte)p[(*i)++];
+		v |= (unsigned)(c&0x7F) << shift;
+		if (c < 0x80)
+			return (int)v;
+	}
+}
+
+// mapRecord records that the output at its current length starts the
+// current token.
+void mapRecord(engine_t *e) {
+	qjson_source_map_t *m = e->map;
+	mapping_t c = {e->out.len, e->tk.pos.b, e->tk.pos.l, e->tk.pos.b-e->tk.pos.s, 0};
+	mapVarint(&m->deltas, (unsigned)(c.out-m->last.out));
+	mapVarint(&m->deltas, (unsigned)(c.b-m->last.b));
+	mapVarint(&m->deltas, (unsigned)(c.l-m->last.l));
+	mapVarint(&m->deltas, (unsigned)c.col);
+	c.next = m->deltas.len;
+	if (m->n%mapInterval == 0) {
+		if (m->nCps == m->capCps) {
+			m->capCps = (m->capCps == 0) ? 16 : m->capCps*2;
+			m->cps = memRealloc(m->alloc, m->cps, m->capCps*sizeof(mapping_t));
+		}
+		m->cps[m->nCps++] = c;
+	}
+	m->last = c;
+	m->n++;
+}
+
+// mapFree releases m. m may be NULL.
+void mapFree(qjson_source_map_t *m) {
+	if (m == NULL)
+		return;
+	memFree(m->alloc, m->deltas.buf);
+	memFree(m->alloc, m->cps);
+	memFree(m->alloc, m);
+}
+
+bool qjson_source_map_lookup(const qjson_source_map_t *m, size_t outOffset, const char *qjsonText, qjson_mapping_t *res) {
+	if (m == NULL || m->n == 0 || outOffset < (size_t)m->cps[0].out)
+		return false;
+	int out = (outOffset > INT_MAX) ? INT_MAX : (int)outOffset;
+	int lo = 0, hi = m->nCps;
+	while (hi-lo > 1) {
+		int mid = (lo+hi)/2;
+		if (m->cps[mid].out <= out)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	mapping_t c = m->cps[lo];
+	int end = (lo+1)*mapInterval;
+	if (end > m->n)
+		end = m->n;
+	for (int i = lo*mapInterval+1; i < end; i++) {
+		mapping_t d;
+		int j = c.next;
+		d.out = c.out + mapReadVarint(m->deltas.buf, &j);
+		if (d.out > out)
+			break;
+		d.b = c.b + mapReadVarint(m->deltas.buf, &j);
+		d.l = c.l + mapReadVarint(m->deltas.buf, &j);
+		d.col = mapReadVarint(m->deltas.buf, &j);
+		d.next = j;
+		c = d;
+	}
+	res->outOffset = (size_t)c.out;
+	res->offset = (size_t)c.b;
+	res->line = c.l+1;
+	res->col = (qjsonText == NULL) ? c.col+1 : column((slice_t){qjsonText+c.b-c.col, c.col})+1;
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// JSON fast path
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// Inputs made of strict json members, a json object without its braces,
+// are converted by a streamlined scanner that drops the white spaces and
+// copies the keys, strings, literals and integers to the output. The 
+// other numbers are evaluated like in value() and strings containing a 
+// tab or </ are output by outputDoubleQuotedString, so that the output is
+// identical to the one of the engine. On the first byte that isn’t strict
+// json, the output is reset and the input is decoded by the engine.
+
+// fastScanner_t is the state of the json fast path.
+typedef struct {
+	engine_t   *e;
+	const char *in;    // input
+	int         i;     // index of the next byte in the input
+	int         n;     // input length
+	int         depth; // depth of [] and {}
+	bool        stop;  // a limit is exceeded, the error is set in e
+} fastScanner_t;
+
+// posAt returns the position of the byte at index b of the input of e.
+pos_t posAt(engine_t *e, int b) {
+	pos_t pos = {b, 0, 0};
+	const char *p = e->in, *end = e->in+b;
+	while ((p = memchr(p, '\n', end-p)) != NULL) {
+		pos.l++;
+		pos.s = (int)(++p - e->in);
+	}
+	return pos;
+}
+
+// fastSpaces skips the json white spaces.
+void fastSpaces(fastScanner_t *js) {
+	while (js->i < js->n) {
+		char c = js->in[js->i];
+		if (c == ' ' || c == '\t' || c == '\n' || (c == '\r' && js->i+1 < js->n && js->in[js->i+1] == '\n'))
+			js->i++;
+		else
+			break;
+	}
+}
+
+// fastToken counts a token for the budget of the engine. It returns false
+// when a limit is exceeded.
+bool fastToken(fastScanner_t *js) {
+	engine_t *e = js->e;
+	if (--e->checkIn != 0 || budgetCheck(e))
+		return true;
+	e->tk.pos = posAt(e, js->i);
+	js->stop = true;
+	return false;
+}
+
+// fastString outputs the json string starting at js->i.
+bool fastString(fastScanner_t *js) {
+	const char *in = js->in;
+	int start = js->i, i = start+1;
+	bool rewrite = false, ascii = true;
+	for (;;) {
+		if (i == js->n)
+			return false;
+		byte c = (byte)in[i];
+		if (c < 0x80 && plainStringByte[c]) {
+			rewrite |= c == '/' && in[i-1] == '<';
+			i++;
+			continue;
+		}
+		if (c == '"')
+			break;
+		if (c == '\\') {
+			if (i+1 == js->n)
+				return false;
+			c = (byte)in[i+1];
+			if (c == 'u') {
+				if (i+5 >= js->n || !isHexDigit(in[i+2]) || !isHexDigit(in[i+3]) || !isHexDigit(in[i+4]) || !isHexDigit(in[i+5]))
+					return false;
+				i += 6;
+			} else if (c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' || c == 'n' || c == 'r' || c == 't')
+				i += 2;
+			else
+				return false;
+		} else if (c == '\t') {
+			rewrite = true;
+			i++;
+		} else {
+			int n = (c < 0x80) ? 0 : utf8CharLen((slice_t){in+i, js->n-i});
+			if (n == 0)
+				return false;
+			ascii = false;
+			i += n;
+		}
+	}
+	i++;
+	js->i = i;
+	int at = js->e->out.len;
+	if (rewrite || (!ascii && js->e->ascii)) {
+		js->e->tk.val = (slice_t){in+start, i-start};
+		outputDoubleQuotedString(js->e);
+	} else
+		outputBytes(js->e, in+start, i-start);
+	if (js->e->canon != NULL)
+		canonScalar(js->e, at);
+	return true;
+}
+
+// fastNumber outputs the json number starting at js->i. Integers of at
+// most 15 digits are copied, other numbers are evaluated.
+bool fastNumber(fastScanner_t *js) {
+	const char *in = js->in;
+	int start = js->i, i = start;
+	if (in[i] == '-')
+		i++;
+	if (i == js->n || !isIntDigit(in[i]))
+		return false;
+	if (in[i++] != '0')
+		while (i < js->n && isIntDigit(in[i]))
+			i++;
+	bool integer = true;
+	if (i < js->n && in[i] == '.') {
+		integer = false;
+		if (++i == js->n || !isIntDigit(in[i]))
+			return false;
+		while (i < js->n && isIntDigit(in[i]))
+			i++;
+	}
+	if (i < js->n && (in[i] == 'e' || in[i] == 'E')) {
+		integer = false;
+		if (++i < js->n && (in[i] == '+' || in[i] == '-'))
+			i++;
+		if (i == js->n || !isIntDigit(in[i]))
+			return false;
+		while (i < js->n && isIntDigit(in[i]))
+			i++;
+	}
+	slice_t val = {in+start, i-start};
+	js->i = i;
+	int digits = val.l - (in[start] == '-'), at = js->e->out.len;
+	if ((integer && digits <= 15 && !(val.l == 2 && in[start+1] == '0')) || (js->e->disabled & QJSON_NO_EXPRESSIONS))
+		outputBytes(js->e, val.p, val.l);
+	else {
+		numToken_t t = evalNumberExpression(val, js->e->disabled);
+		if (t.tag == tagError)
+			return false;
+		char buf[32];
+		sprintf(buf, "%.16g", t.val.f);
+		outputString(js->e, buf);
+	}
+	if (js->e->canon != NULL)
+		canonScalar(js->e, at);
+	return true;
+}
+
+bool fastMembers(fastScanner_t *js, bool top);
+bool fastElements(fastScanner_t *js);
+
+// fastValue outputs the json value starting at js->i.
+bool fastValue(fastScanner_t *js) {
+	if (js->i == js->n || !fastToken(js))
+		return false;
+	const char *p = js->in+js->i;
+	int left = js->n-js->i;
+	if (*p == '{' || *p == '[') {
+		if (++js->depth >= js->e->maxDepth)
+			return false;
+		js->i++;
+		bool ok = (*p == '{') ? fastMembers(js, false) : fastElements(js);
+		js->depth--;
+		return ok;
+	}
+	outputScalar(js->e);
+	switch (*p) {
+	case '"':
+		if (!fastString(js))
+			return false;
+		outputScalarEnd(js->e);
+		return true;
+	case 't':
+		if (left < 4 || memcmp(p, "true", 4) != 0)
+			return false;
+		js->i += 4;
+		outputBytes(js->e, p, 4);
+		break;
+	case 'f':
+		if (left < 5 || memcmp(p, "false", 5) != 0)
+			return false;
+		js->i += 5;
+		outputBytes(js->e, p, 5);
+		break;
+	case 'n':
+		if (left < 4 || memcmp(p, "null", 4) != 0)
+			return false;
+		js->i += 4;
+		outputBytes(js->e, p, 4);
+		break;
+	default:
+		if (!fastNumber(js))
+			return false;
+	}
+	outputScalarEnd(js->e);
+	// a literal or number must be followed by a delimiter
+	if (js->i == js->n)
+		return true;
+	char c = js->in[js->i];
+	return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// fastPunct skips the punctuation c if it is the next byte.
+bool fastPunct(fastScanner_t *js, char c) {
+	if (js->i == js->n || js->in[js->i] != c || !fastToken(js))
+		return false;
+	js->i++;
+	fastSpaces(js);
+	return true;
+}
+
+// fastMembers outputs the json members starting at js->i until the closing
+// brace, or the end of input when top is true.
+bool fastMembers(fastScanner_t *js, bool top) {
+	engine_t *e = js->e;
+	int start = e->out.len, base = (e->canon != NULL) ? canonOpen(e) : 0, n = 0;
+	outputOpen(e, '{');
+	if (e->dups != NULL)
+		dupOpen(e);
+	fastSpaces(js);
+	if (js->i < js->n && js->in[js->i] != '}') {
+		for (;;) {
+			int at = e->out.len;
+			outputItem(e, n++);
+			int key = e->out.len, slot = 0;
+			bool dup = false;
+			if (js->in[js->i] != '"' || !fastToken(js) || !fastString(js))
+				return false;
+			if (e->dups != NULL) {
+				slot = dupKey(e, key, &dup);
+				if (slot < 0)
+					return false;
+			}
+			fastSpaces(js);
+			if (!fastPunct(js, ':'))
+				return false;
+			outputColon(e, key);
+			int val = e->out.len;
+			if (!fastValue(js))
+				return false;
+			if (e->dups != NULL)
+				dupValue(e, slot, dup, at, val);
+			if (e->canon != NULL && e->out.len > val)
+				canonMember(e, key, val);
+			fastSpaces(js);
+			if (js->i == js->n || js->in[js->i] != ',')
+				break;
+			if (!fastPunct(js, ',') || js->i == js->n)
+				return false;
+		}
+	}
+	if (e->dups != NULL)
+		dupClose(e);
+	if ((top) ? js->i != js->n : !fastPunct(js, '}'))
+		return false;
+	outputClose(e, '}', n);
+	if (e->canon != NULL)
+		canonClose(e, base, start);
+	return true;
+}
+
+// fastElements outputs the json array elements starting at js->i until
+// the closing bracket.
+bool fastElements(fastScanner_t *js) {
+	int n = 0;
+	outputOpen(js->e, '[');
+	fastSpaces(js);
+	if (js->i < js->n && js->in[js->i] != ']') {
+		for (;;) {
+			outputItem(js->e, n++);
+			if (!fastValue(js))
+				return false;
+			fastSpaces(js);
+			if (js->i == js->n || js->in[js->i] != ',')
+				break;
+			if (!fastPunct(js, ','))
+				return false;
+		}
+	}
+	if (!fastPunct(js, ']'))
+		return false;
+	outputClose(js->e, ']', n);
+	return true;
+}
+
+// jsonFastPath converts the input of e if it is made of strict json members.
+// It returns false if it isn’t, with e unmodified.
+bool jsonFastPath(engine_t *e) {
+	fastScanner_t js = {e, e->in, 0, e->p.l, 0, false};
+	int checkIn = e->checkIn;
+	budget_t budget;
+	if (e->budget != NULL)
+		budget = *e->budget;
+	if (fastMembers(&js, true)) {
+		setErrorAndPos(e, ErrEndOfInput, posAt(e, js.n));
+		return true;
+	}
+	if (js.stop)
+		return true;
+	outputReset(e);
+	if (e->dups != NULL)
+		dupReset(e);
+	if (e->canon != NULL)
+		canonReset(e);
+	formatReset(e);
+	e->checkIn = checkIn;
+	if (e->budget != NULL)
+		*e->budget = budget;
+	return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Canonical json
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The json output of the engine is written in canonical form. Members
+// are sorted by the utf8 bytes of their unescaped key, members with the
+// same key keeping their order. Numbers are converted to double and
+// written as integers below 2^53, or in the shortest %g form that round
+// trips. Strings are unescaped and only ", \, control chars and lone 
+// surrogates are escaped, with \b \f \n \r \t or \u00xx in lower case.
+//
+// Strings and numbers are normalized as they are output, and the members
+// of an object are sorted from their recorded offsets when it is closed,
+// only if they are out of order. The members of the top level object are
+// then written in order to a 128 bit MurmurHash3 digest of the canonical
+// json and, unless only the digest is requested, to the output. The json
+// of included files is rewritten in canonical form by canonValue.
+
+// digest_t is the state of an incremental MurmurHash3 x64 128 bit hash.
+typedef struct {
+	uint64_t h1, h2;
+	uint64_t len;      // number of bytes hashed
+	byte     tail[16]; // bytes of the last incomplete block
+	int      nTail;
+} digest_t;
+
+const uint64_t murmurC1 = 0x87c37b91114253d5ULL;
+const uint64_t murmurC2 = 0x4cf5ad432745937fULL;
+
+uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+// load64 returns the little endian 64 bit integer of the n <= 8 bytes of p.
+uint64_t load64(const byte *p, int n) {
+	uint64_t v = 0;
+	for (int i = n-1; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+void digestBlock(digest_t *d, const byte *p) {
+	uint64_t k1 = load64(p, 8), k2 = load64(p+8, 8);
+	k1 *= murmurC1; k1 = rotl64(k1, 31); k1 *= murmurC2; d->h1 ^= k1;
+	d->h1 = rotl64(d->h1, 27); d->h1 += d->h2; d->h1 = d->h1*5 + 0x52dce729;
+	k2 *= murmurC2; k2 = rotl64(k2, 33); k2 *= murmurC1; d->h2 ^= k2;
+	d->h2 = rotl64(d->h2, 31); d->h2 += d->h1; d->h2 = d->h2*5 + 0x38495ab5;
+}
+
+// digestUpdate adds the n bytes of p to the digest.
+void digestUpdate(digest_t *d, const char *p, int n) {
+	const byte *b = (const byte*)p;
+	d->len += (uint64_t)n;
+	if (d->nTail > 0) {
+		int k = (16-d->nTail < n) ? 16-d->nTail : n;
+		memcpy(d->tail+d->nTail, b, k);
+		d->nTail += k;
+		b += k;
+		n -= k;
+		if (d->nTail < 16)
+			return;
+		digestBlock(d, d->tail);
+		d->nTail = 0;
+	}
+	for (; n >= 16; b += 16, n -= 16)
+		digestBlock(d, b);
+	memcpy(d->tail, b, n);
+	d->nTail = n;
+}
+
+// digestFinal stores the digest in out as the little endian bytes of h1 
+// followed by those of h2.
+void digestFinal(digest_t *d, unsigned char out[16]) {
+	int n = d->nTail;
+	if (n > 8) {
+		uint64_t k2 = load64(d->tail+8, n-8);
+		k2 *= murmurC2; k2 = rotl64(k2, 33); k2 *= murmurC1; d->h2 ^= k2;
+	}
+	if (n > 0) {
+		uint64_t k1 = load64(d->tail, (n > 8) ? 8 : n);
+		k1 *= murmurC1; k1 = rotl64(k1, 31); k1 *= murmurC2; d->h1 ^= k1;
+	}
+	d->h1 ^= d->len; d->h2 ^= d->len;
+	d->h1 += d->h2; d->h2 += d->h1;
+	d->h1 = fmix64(d->h1); d->h2 = fmix64(d->h2);
+	d->h1 += d->h2; d->h2 += d->h1;
+	for (int i = 0; i < 8; i++) {
+		out[i] = (unsigned char)(d->h1 >> (8*i));
+		out[8+i] = (unsigned char)(d->h2 >> (8*i));
+	}
+}
+
+// canonMember_t is a member of an object being written by canonValue.
+typedef struct {
+	int         key; // offset of the unescaped key in canon_t.keys
+	int         len; // byte length of the unescaped key
+	const char *k;   // unescaped key while sorting
+	const char *val; // value in the engine output
+} canonMember_t;
+
+// canonSpan_t is a member of an open object of the engine output.
+typedef struct {
+	int         key;  // output offset of the key
+	int         kLen; // byte length of the key with its quotes
+	int         val;  // output offset of the value
+	int         end;  // output offset following the value
+	int         uk;   // offset of the unescaped key in canon_t.keys, -1 without escape sequence
+	const char *k;    // unescaped key while sorting
+	int         len;  // byte length of the unescaped key
+} canonSpan_t;
+
+// canon_t is the canonical json writer.
+typedef struct canon {
+	outBuf_t       out;        // rewritten value or sorted object
+	outBuf_t       keys;       // unescaped keys of the objects being sorted or written
+	outBuf_t       str;        // unescaped string value
+	canonMember_t *mbrs;       // members of the objects written by canonValue
+	int            nMbrs, capMbrs;
+	canonSpan_t   *spans;      // members of the open objects of the engine output
+	int            nSpans, capSpans;
+	bool           digestOnly; // the top level object is only written to the digest
+	bool           keepLast;   // members with the same key are reduced to the last one
+	digest_t       d;
+	int            len;        // byte length of the engine output of the top level object
+} canon_t;
+
+// hex4 returns the value of the 4 hexadecimal digits of p.
+unsigned hex4(const char *p) {
+	unsigned v = 0;
+	for (int i = 0; i < 4; i++)
+		v = (v << 4) | (unsigned)(isIntDigit(p[i]) ? p[i]-'0' : (p[i]|0x20)-'a'+10);
+	return v;
+}
+
+// canonUnescape appends to b the unescaped content of the json string 
+// starting at p. It returns the pointer following the string. Lone 
+// surrogates are encoded in 3 bytes like other code points.
+const char* canonUnescape(outBuf_t *b, const char *p) {
+	p++;
+	for (;;) {
+		const char *s = p;
+		while (*p != '"' && *p != '\\')
+			p++;
+		bufBytes(b, s, (int)(p-s));
+		if (*p == '"')
+			return p+1;
+		char x = p[1];
+		p += 2;
+		switch (x) {
+		case 'n': bufByte(b, '\n'); break;
+		case 't': bufByte(b, '\t'); break;
+		case 'r': bufByte(b, '\r'); break;
+		case 'b': bufByte(b, '\b'); break;
+		case 'f': bufByte(b, '\f'); break;
+		case 'u': {
+			unsigned v = hex4(p);
+			p += 4;
+			if (v >= 0xD800 && v < 0xDC00 && p[0] == '\\' && p[1] == 'u') {
+				unsigned lo = hex4(p+2);
+				if (lo >= 0xDC00 && lo < 0xE000) {
+					v = 0x10000 + ((v - 0xD800) << 10) + (lo - 0xDC00);
+					p += 6;
+				}
+			}
+			bufRune(b, v);
+			break;
+		}
+		default:
+			bufByte(b, x);
+		}
+	}
+}
+
+// jsonEscape appends the n unescaped bytes of s to b escaped as the 
+// content of a json string.
+void jsonEscape(outBuf_t *b, const char *s, int n) {
+	int i = 0;
+	while (i < n) {
+		int start = i;
+		while (i < n && (byte)s[i] >= 0x20 && s[i] != '"' && s[i] != '\\' && 
+			!((byte)s[i] == 0xED && (byte)s[i+1] >= 0xA0))
+			i++;
+		bufBytes(b, s+start, i-start);
+		if (i == n)
+			break;
+		byte x = (byte)s[i];
+		char esc[8];
+		switch (x) {
+		case '"': bufBytes(b, "\\\"", 2); break;
+		case '\\': bufBytes(b, "\\\\", 2); break;
+		case '\b': bufBytes(b, "\\b", 2); break;
+		case '\f': bufBytes(b, "\\f", 2); break;
+		case '\n': bufBytes(b, "\\n", 2); break;
+		case '\r': bufBytes(b, "\\r", 2); break;
+		case '\t': bufBytes(b, "\\t", 2); break;
+		case 0xED:
+			// lone surrogate
+			sprintf(esc, "\\u%04x", 0xD000 | ((byte)s[i+1]&0x3F) << 6 | ((byte)s[i+2]&0x3F));
+			bufBytes(b, esc, 6);
+			i += 2;
+			break;
+		default:
+			sprintf(esc, "\\u%04x", x);
+			bufBytes(b, esc, 6);
+		}
+		i++;
+	}
+}
+
+// canonString writes the n unescaped bytes of s as a json string.
+void canonString(canon_t *c, const char *s, int n) {
+	bufByte(&c->out, '"');
+	jsonEscape(&c->out, s, n);
+	bufByte(&c->out, '"');
+}
+
+// canonNumber writes the number starting at p and returns the pointer 
+// following it.
+const char* canonNumber(canon_t *c, const char *p) {
+	char *end, buf[32];
+	double f = strtod(p, &end);
+	int n;
+	if (end == p || f - f != 0) {
+		// not a finite number, copied as is
+		for (end = (char*)p; *end != ',' && *end != '}' && *end != ']' && *end != '\0'; end++)
+			;
+		bufBytes(&c->out, p, (int)(end-p));
+		return end;
+	}
+	if (f > -9007199254740992.0 && f < 9007199254740992.0 && f == (double)(long long)f)
+		n = sprintf(buf, "%lld", (long long)f);
+	else {
+		for (int prec = 15; ; prec++) {
+			n = sprintf(buf, "%.*g", prec, f);
+			if (prec == 17 || strtod(buf, NULL) == f)
+				break;
+		}
+	}
+	bufBytes(&c->out, buf, n);
+	return end;
+}
+
+// canonSkip returns the pointer following the value starting at p.
+const char* canonSkip(const char *p) {
+	int depth = 0;
+	do {
+		switch (*p) {
+		case '"':
+			for (p++; *p != '"'; p++)
+				if (*p == '\\')
+					p++;
+			p++;
+			break;
+		case '{':
+		case '[':
+			depth++;
+			p++;
+			break;
+		case '}':
+		case ']':
+			depth--;
+			p++;
+			break;
+		case ',':
+		case ':':
+			p++;
+			break;
+		default:
+			while (*p != ',' && *p != '}' && *p != ']' && *p != '\0')
+				p++;
+		}
+	} while (depth > 0);
+	return p;
+}
+
+int canonCompare(const void *a, const void *b) {
+	const canonMember_t *x = a, *y = b;
+	int r = memcmp(x->k, y->k, (x->len < y->len) ? x->len : y->len);
+	if (r != 0)
+		return r;
+	if (x->len != y->len)
+		return (x->len < y->len) ? -1 : 1;
+	return (x->val < y->val) ? -1 : (x->val > y->val);
+}
+
+const char* canonValue(canon_t *c, const char *p);
+
+// canonObject writes the object starting at p with its members sorted.
+const char* canonObject(canon_t *c, const char *p) {
+	int base = c->nMbrs, keys = c->keys.len;
+	for (p++; *p != '}'; ) {
+		if (c->nMbrs == c->capMbrs) {
+			c->capMbrs = (c->capMbrs == 0) ? 64 : c->capMbrs*2;
+			c->mbrs = memRealloc(c->out.alloc, c->mbrs, c->capMbrs*sizeof(canonMember_t));
+		}
+		canonMember_t *m = &c->mbrs[c->nMbrs++];
+		m->key = c->keys.len;
+		p = canonUnescape(&c->keys, p);
+		m->len = c->keys.len - m->key;
+		m->val = p+1;
+		p = canonSkip(p+1);
+		if (*p == ',')
+			p++;
+	}
+	int n = c->nMbrs - base;
+	for (int i = base; i < c->nMbrs; i++)
+		c->mbrs[i].k = c->keys.buf + c->mbrs[i].key;
+	if (n > 1)
+		qsort(c->mbrs+base, n, sizeof(canonMember_t), canonCompare);
+	bufByte(&c->out, '{');
+	for (int i = base; i < base+n; i++) {
+		if (i > base)
+			bufByte(&c->out, ',');
+		canonString(c, c->keys.buf + c->mbrs[i].key, c->mbrs[i].len);
+		bufByte(&c->out, ':');
+		canonValue(c, c->mbrs[i].val);
+	}
+	bufByte(&c->out, '}');
+	c->keys.len = keys;
+	c->nMbrs = base;
+	return p+1;
+}
+
+// canonValue writes the value starting at p and returns the pointer 
+// following it.
+const char* canonValue(canon_t *c, const char *p) {
+	switch (*p) {
+	case '{':
+		return canonObject(c, p);
+	case '[':
+		bufByte(&c->out, '[');
+		for (p++; *p != ']'; ) {
+			p = canonValue(c, p);
+			if (*p == ',') {
+				bufByte(&c->out, ',');
+				p++;
+			}
+		}
+		bufByte(&c->out, ']');
+		return p+1;
+	case '"':
+		c->str.len = 0;
+		p = canonUnescape(&c->str, p);
+		canonString(c, c->str.buf, c->str.len);
+		return p;
+	case 't':
+	case 'n':
+		bufBytes(&c->out, p, 4);
+		return p+4;
+	case 'f':
+		bufBytes(&c->out, p, 5);
+		return p+5;
+	default:
+		return canonNumber(c, p);
+	}
+}
+
+// canonRewrite rewrites the json value output from offset start to the 
+// end of the output of e in canonical form.
+void canonRewrite(engine_t *e, int start) {
+	canon_t *c = e->canon;
+	outputByte(e, '\0');
+	c->out.len = 0;
+	canonValue(c, e->out.buf+start);
+	e->out.len = start;
+	outputBytes(e, c->out.buf, c->out.len);
+}
+
+// canonScalar normalizes the string or number output from offset start to
+// the end of the output of e. Strings without escape sequences and
+// integers of at most 15 digits but -0 are already canonical.
+void canonScalar(engine_t *e, int start) {
+	const char *p = e->out.buf+start;
+	int n = e->out.len-start;
+	if (*p == '"') {
+		if (memchr(p, '\\', n) == NULL)
+			return;
+	} else if (*p == '-' || isIntDigit(*p)) {
+		int i = (*p == '-');
+		while (i < n && isIntDigit(p[i]))
+			i++;
+		if (i == n && n-(*p == '-') <= 15 && !(n == 2 && p[1] == '0'))
+			return;
+	} else
+		return;
+	canonRewrite(e, start);
+}
+
+// canonOpen returns the index of the first member of an object being 
+// opened.
+int canonOpen(engine_t *e) {
+	return e->canon->nSpans;
+}
+
+// canonMember records the member of the open object whose key is at output
+// offset key and value at offset val.
+void canonMember(engine_t *e, int key, int val) {
+	canon_t *c = e->canon;
+	if (c->nSpans == c->capSpans) {
+		c->capSpans = (c->capSpans == 0) ? 64 : c->capSpans*2;
+		c->spans = memRealloc(c->out.alloc, c->spans, c->capSpans*sizeof(canonSpan_t));
+	}
+	c->spans[c->nSpans++] = (canonSpan_t){key, val-key-1, val, e->out.len, -1, NULL, 0};
+}
+
+// canonKeyCompare compares the unescaped keys of x and y.
+int canonKeyCompare(const canonSpan_t *x, const canonSpan_t *y) {
+	int r = memcmp(x->k, y->k, (x->len < y->len) ? x->len : y->len);
+	if (r != 0 || x->len == y->len)
+		return r;
+	return (x->len < y->len) ? -1 : 1;
+}
+
+int canonSpanCompare(const void *a, const void *b) {
+	const canonSpan_t *x = a, *y = b;
+	int r = canonKeyCompare(x, y);
+	if (r != 0)
+		return r;
+	return (x->key < y->key) ? -1 : (x->key > y->key);
+}
+
+// canonEmit writes the n bytes of p to the sorted object, and to the 
+// digest for the top level object.
+void canonEmit(canon_t *c, bool top, const char *p, int n) {
+	if (top)
+		digestUpdate(&c->d, p, n);
+	if (!top || !c->digestOnly)
+		bufBytes(&c->out, p, n);
+}
+
+// canonClose sorts the members of the object output from offset start, 
+// its closing brace included, whose first member is at index base. The 
+// top level object is written to the digest, and replaces the output 
+// unless only the digest is requested.
+void canonClose(engine_t *e, int base, int start) {
+	canon_t *c = e->canon;
+	canonSpan_t *m = c->spans+base;
+	int n = c->nSpans - base;
+	c->nSpans = base;
+	if (failed(e))
+		return;
+	c->keys.len = 0;
+	for (int i = 0; i < n; i++) {
+		const char *k = e->out.buf+m[i].key;
+		m[i].k = k+1;
+		m[i].len = m[i].kLen-2;
+		if (memchr(k, '\\', m[i].kLen) != NULL) {
+			m[i].uk = c->keys.len;
+			canonUnescape(&c->keys, k);
+			m[i].len = c->keys.len - m[i].uk;
+		}
+	}
+	for (int i = 0; i < n; i++)
+		if (m[i].uk >= 0)
+			m[i].k = c->keys.buf+m[i].uk;
+	// the members are kept in place when they are in order and contiguous
+	bool sorted = n == 0 || m[n-1].end == e->out.len-1;
+	for (int i = 0; i < n && sorted; i++) {
+		int r = (i == 0) ? -1 : canonKeyCompare(&m[i-1], &m[i]);
+		sorted = (r < 0 || (r == 0 && !c->keepLast)) && m[i].key == ((i == 0) ? start+1 : m[i-1].end+1);
+	}
+	bool top = start == 0;
+	if (top)
+		c->len = e->out.len;
+	if (sorted) {
+		if (top)
+			digestUpdate(&c->d, e->out.buf, e->out.len);
+		return;
+	}
+	if (n > 1)
+		qsort(m, n, sizeof(canonSpan_t), canonSpanCompare);
+	c->out.len = 0;
+	canonEmit(c, top, "{", 1);
+	bool first = true;
+	for (int i = 0; i < n; i++) {
+		// of the members with the same key, the last one sorts last
+		if (c->keepLast && i+1 < n && canonKeyCompare(&m[i], &m[i+1]) == 0)
+			continue;
+		if (!first)
+			canonEmit(c, top, ",", 1);
+		first = false;
+		canonEmit(c, top, e->out.buf+m[i].key, m[i].kLen+1);
+		canonEmit(c, top, e->out.buf+m[i].val, m[i].end-m[i].val);
+	}
+	canonEmit(c, top, "}", 1);
+	if (top) {
+		outBuf_t tmp = e->out;
+		e->out = c->out;
+		c->out = tmp;
+		return;
+	}
+	e->out.len = start;
+	outputBytes(e, c->out.buf, c->out.len);
+}
+
+// canonReset drops the members of the open objects.
+void canonReset(engine_t *e) {
+	e->canon->nSpans = 0;
+}
+
+// canonFree releases c.
+void canonFree(canon_t *c) {
+	if (c == NULL)
+		return;
+	const qjson_allocator_t *a = c->out.alloc;
+	memFree(a, c->out.buf);
+	memFree(a, c->keys.buf);
+	memFree(a, c->str.buf);
+	memFree(a, c->mbrs);
+	memFree(a, c->spans);
+	memFree(a, c);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Ascii output
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// Non ascii chars only appear in strings of the json output, so that the 
+// output is made ascii by replacing each of them by a \uxxxx escape, or a
+// surrogate pair of escapes above U+FFFF, in lower case like json.dumps.
+// The string writers of the engine escape them as they meet them, and the
+// json fast path copies its strings without non ascii chars as is. The 
+// json of included files and canonical json are escaped by asciiBytes: 
+// the runs of ascii bytes between non ascii chars are found 16 bytes at a
+// time with SSE2, or 8 bytes at a time in a 64 bit integer otherwise, and
+// copied in bulk.
+
+// asciiScan returns the index of the first non ascii byte of the n bytes
+// of p starting at i, or n if there is none.
+int asciiScan(const char *p, int i, int n) {
+#if defined(__SSE2__) || defined(_M_X64)
+	for (; i+16 <= n; i += 16)
+		if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p+i))) != 0)
+			break;
+#else
+	for (; i+8 <= n; i += 8) {
+		uint64_t v;
+		memcpy(&v, p+i, 8);
+		if ((v & 0x8080808080808080ULL) != 0)
+			break;
+	}
+#endif
+	while (i < n && (byte)p[i] < 0x80)
+		i++;
+	return i;
+}
+
+// asciiRune decodes the utf8 char of the n bytes of p starting at i and
+// returns its byte length. An invalid byte is decoded as U+FFFD.
+int asciiRune(const char *p, int i, int n, unsigned *v) {
+	const byte *b = (const byte*)p+i;
+	int l = (b[0] >= 0xF0) ? 4 : (b[0] >= 0xE0) ? 3 : (b[0] >= 0xC0) ? 2 : 1;
+	*v = (l == 4) ? b[0]&0x07 : (l == 3) ? b[0]&0x0F : b[0]&0x1F;
+	for (int k = 1; k < l; k++) {
+		if (i+k >= n || (b[k]&0xC0) != 0x80)
+			l = 1;
+		else
+			*v = (*v << 6) | (b[k]&0x3F);
+	}
+	if (l == 1 || *v > 0x10FFFF) {
+		*v = 0xFFFD;
+		l = 1;
+	}
+	return l;
+}
+
+// asciiEscape appends the \uxxxx escape of the utf16 unit v to b.
+void asciiEscape(outBuf_t *b, unsigned v) {
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = {'\\', 'u', hex[v>>12], hex[(v>>8)&0xF], hex[(v>>4)&0xF], hex[v&0xF]};
+	bufBytes(b, esc, 6);
+}
+
+// asciiRunes appends the escapes of the utf8 char of the n bytes of p 
+// starting at i to b and returns its byte length.
+int asciiRunes(outBuf_t *b, const char *p, int i, int n) {
+	unsigned v;
+	int l = asciiRune(p, i, n, &v);
+	if (v >= 0x10000) {
+		asciiEscape(b, 0xD800 + ((v-0x10000) >> 10));
+		asciiEscape(b, 0xDC00 + ((v-0x10000) & 0x3FF));
+	} else
+		asciiEscape(b, v);
+	return l;
+}
+
+// asciiBytes appends the n bytes of p to b with their non ascii chars
+// escaped.
+void asciiBytes(outBuf_t *b, const char *p, int n) {
+	int i = asciiScan(p, 0, n), start = 0;
+	while (i < n) {
+		bufBytes(b, p+start, i-start);
+		i += asciiRunes(b, p, i, n);
+		start = i;
+		i = asciiScan(p, i, n);
+	}
+	bufBytes(b, p+start, n-start);
+}
+
+// outputRune outputs the escapes of the utf8 char of the n bytes of p 
+// starting at i and returns its byte length.
+int outputRune(engine_t *e, const char *p, int i, int n) {
+	return asciiRunes(&e->out, p, i, n);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Formatted output
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The engine and the json fast path output the punctuation of objects and
+// arrays and the scalar values through the functions below, so that the
+// output is formatted as it is written. The json of included files, and
+// canonical json once its members are sorted, is formatted by outputJson.
+//
+// Flattened output is one "path\tvalue\n" line per scalar value and empty
+// object or array, in document order. The path is the RFC 6901 json 
+// pointer of the value, like /servers/0/host, escaped like the content of
+// a json string so that it holds no tab or newline. The value is its json
+// text. The root object has no line. The pointer of the current value is
+// kept in one buffer, extended by the key or index of each member or value
+// and truncated to the pointer of its container before the next one.
+//
+// Pretty output has the separators of the options and, when an indent is
+// given, each member and value on its own line, indented by the indent 
+// repeated once per nesting level. Empty objects and arrays stay on one 
+// line. The newline and indentation of a line are written in one copy 
+// from a block holding a newline followed by the indent repeated for the
+// deepest level met so far.
+
+// flatLevel_t is an open object or array of the flattened output.
+typedef struct {
+	int  len;   // length of the pointer of the container
+	bool array;
+} flatLevel_t;
+
+// flat_t is the flattened output writer.
+typedef struct flat {
+	outBuf_t     path;   // json pointer of the current value
+	outBuf_t     key;    // unescaped key of the current member
+	flatLevel_t *levels; // open objects and arrays
+	int          nLevels, capLevels;
+	const qjson_allocator_t *alloc;
+} flat_t;
+
+// flatNew returns an empty flattened output writer.
+flat_t* flatNew(const qjson_allocator_t *a) {
+	flat_t *f = memset(memRealloc(a, NULL, sizeof(flat_t)), 0, sizeof(flat_t));
+	f->alloc = f->path.alloc = f->key.alloc = a;
+	return f;
+}
+
+// flatKey moves the key output from offset key to the path, unescaped and
+// with ~ and / written as ~0 and ~1.
+void flatKey(engine_t *e, int key) {
+	flat_t *f = e->flat;
+	f->key.len = 0;
+	canonUnescape(&f->key, e->out.buf+key);
+	e->out.len = key;
+	const char *s = f->key.buf;
+	int n = f->key.len, start = 0, mark = f->path.len;
+	bufByte(&f->path, '/');
+	for (int i = 0; i < n; i++) {
+		if (s[i] != '~' && s[i] != '/')
+			continue;
+		jsonEscape(&f->path, s+start, i-start);
+		bufBytes(&f->path, (s[i] == '~') ? "~0" : "~1", 2);
+		start = i+1;
+	}
+	jsonEscape(&f->path, s+start, n-start);
+	if (e->ascii && asciiScan(f->path.buf, mark, f->path.len) < f->path.len) {
+		f->key.len = 0;
+		bufBytes(&f->key, f->path.buf+mark, f->path.len-mark);
+		f->path.len = mark;
+		asciiBytes(&f->path, f->key.buf, f->key.len);
+	}
+}
+
+// flatFree releases f.
+void flatFree(flat_t *f) {
+	if (f == NULL)
+		return;
+	memFree(f->alloc, f->path.buf);
+	memFree(f->alloc, f->key.buf);
+	memFree(f->alloc, f->levels);
+	memFree(f->alloc, f);
+}
+
+// pretty_t is the pretty output writer.
+typedef struct pretty {
+	outBuf_t    block;    // newline followed by the indent repeated levels times
+	int         levels;   // number of indents in block
+	int         level;    // nesting level of the output
+	const char *indent;   // indent of one level, NULL for a single line
+	int         indentLen;
+	const char *itemSep;  // separator of members and values
+	const char *keySep;   // separator of keys and values
+	int         itemLen, keyLen;
+} pretty_t;
+
+// prettyNew returns a pretty output writer with the indent and separators
+// of opts.
+pretty_t* prettyNew(const qjson_options_t *opts) {
+	pretty_t *pp = memset(memRealloc(opts->allocator, NULL, sizeof(pretty_t)), 0, sizeof(pretty_t));
+	pp->block.alloc = opts->allocator;
+	pp->indent = opts->indent;
+	pp->indentLen = (pp->indent != NULL) ? strlen(pp->indent) : 0;
+	pp->itemSep = (opts->itemSeparator != NULL) ? opts->itemSeparator : ",";
+	pp->keySep = (opts->keySeparator != NULL) ? opts->keySeparator : (pp->indent != NULL) ? ": " : ":";
+	pp->itemLen = strlen(pp->itemSep);
+	pp->keyLen = strlen(pp->keySep);
+	bufByte(&pp->block, '\n');
+	return pp;
+}
+
+// prettyNewline starts a new line at level when an indent is given.
+void prettyNewline(engine_t *e, int level) {
+	pretty_t *pp = e->pretty;
+	if (pp->indent == NULL)
+		return;
+	for (; pp->levels < level; pp->levels++)
+		bufBytes(&pp->block, pp->indent, pp->indentLen);
+	outputBytes(e, pp->block.buf, 1 + level*pp->indentLen);
+}
+
+// formatInit sets the writer of the output format of opts, if any.
+void formatInit(engine_t *e, const qjson_options_t *opts) {
+	e->ascii = opts->ensureAscii;
+	if (opts->flatten)
+		e->flat = flatNew(opts->allocator);
+	else if (opts->indent != NULL || opts->itemSeparator != NULL || opts->keySeparator != NULL)
+		e->pretty = prettyNew(opts);
+}
+
+// formatReset drops the open objects and arrays of the output format.
+void formatReset(engine_t *e) {
+	if (e->flat != NULL)
+		e->flat->nLevels = e->flat->path.len = 0;
+	if (e->pretty != NULL)
+		e->pretty->level = 0;
+}
+
+// formatFree releases the writer of the output format.
+void formatFree(engine_t *e) {
+	e->ascii = false;
+	flatFree(e->flat);
+	e->flat = NULL;
+	if (e->pretty != NULL) {
+		memFree(e->alloc, e->pretty->block.buf);
+		memFree(e->alloc, e->pretty);
+		e->pretty = NULL;
+	}
+}
+
+// outputOpen outputs the opening brace or bracket c of an object or array.
+void outputOpen(engine_t *e, char c) {
+	flat_t *f = e->flat;
+	if (f != NULL) {
+		if (f->nLevels == f->capLevels) {
+			f->capLevels = (f->capLevels == 0) ? 16 : f->capLevels*2;
+			f->levels = memRealloc(f->alloc, f->levels, f->capLevels*sizeof(flatLevel_t));
+		}
+		f->levels[f->nLevels++] = (flatLevel_t){f->path.len, c == '['};
+		return;
+	}
+	outputByte(e, c);
+	if (e->pretty != NULL)
+		e->pretty->level++;
+}
+
+// outputItem outputs the separator preceding the member or value at index
+// i of an object or array.
+void outputItem(engine_t *e, int i) {
+	flat_t *f = e->flat;
+	pretty_t *pp = e->pretty;
+	if (f != NULL) {
+		flatLevel_t *l = &f->levels[f->nLevels-1];
+		f->path.len = l->len;
+		if (l->array) {
+			char buf[16];
+			bufBytes(&f->path, buf, sprintf(buf, "/%d", i));
+		}
+	} else if (pp != NULL) {
+		if (i > 0)
+			outputBytes(e, pp->itemSep, pp->itemLen);
+		prettyNewline(e, pp->level);
+	} else if (i > 0)
+		outputByte(e, ',');
+}
+
+// outputColon outputs the separator of the key output from offset key and
+// its value.
+void outputColon(engine_t *e, int key) {
+	if (e->flat != NULL)
+		flatKey(e, key);
+	else if (e->pretty != NULL)
+		outputBytes(e, e->pretty->keySep, e->pretty->keyLen);
+	else
+		outputByte(e, ':');
+}
+
+// outputScalar starts the output of a string, number or literal value.
+void outputScalar(engine_t *e) {
+	if (e->flat != NULL) {
+		outputBytes(e, e->flat->path.buf, e->flat->path.len);
+		outputByte(e, '\t');
+	}
+}
+
+// outputScalarEnd ends the output of a string, number or literal value.
+void outputScalarEnd(engine_t *e) {
+	if (e->flat != NULL)
+		outputByte(e, '\n');
+}
+
+// outputClose outputs the closing brace or bracket c of an object or array
+// of n members or values.
+void outputClose(engine_t *e, char c, int n) {
+	flat_t *f = e->flat;
+	pretty_t *pp = e->pretty;
+	if (f != NULL) {
+		f->path.len = f->levels[--f->nLevels].len;
+		// empty objects and arrays have a line, but the root object
+		if (n == 0 && f->path.len > 0) {
+			outputScalar(e);
+			outputBytes(e, (c == '}') ? "{}" : "[]", 2);
+			outputScalarEnd(e);
+		}
+		return;
+	}
+	if (pp != NULL) {
+		pp->level--;
+		if (n > 0)
+			prettyNewline(e, pp->level);
+	}
+	outputByte(e, c);
+}
+
+// outputText outputs the n bytes of the json text p, with its non ascii
+// chars escaped when the output is ascii.
+void outputText(engine_t *e, const char *p, int n) {
+	if (e->ascii && asciiScan(p, 0, n) < n)
+		asciiBytes(&e->out, p, n);
+	else
+		outputBytes(e, p, n);
+}
+
+// outputJson outputs the compact json value starting at p and returns the
+// pointer following it.
+const char* outputJson(engine_t *e, const char *p) {
+	if (*p != '{' && *p != '[') {
+		const char *end = canonSkip(p);
+		outputScalar(e);
+		outputText(e, p, (int)(end-p));
+		outputScalarEnd(e);
+		return end;
+	}
+	char c = (*p == '{') ? '}' : ']';
+	int n = 0;
+	outputOpen(e, *p++);
+	for (; *p != c; n++) {
+		if (*p == ',')
+			p++;
+		outputItem(e, n);
+		if (c == '}') {
+			int key = e->out.len;
+			const char *end = canonSkip(p);
+			outputText(e, p, (int)(end-p));
+			outputColon(e, key);
+			p = end+1;
+		}
+		p = outputJson(e, p);
+	}
+	outputClose(e, c, n);
+	return p+1;
+}
+
+// outputRewrite formats the compact json output of e with the output 
+// format of opts.
+void outputRewrite(engine_t *e, const qjson_options_t *opts) {
+	outBuf_t json = e->out;
+	bufByte(&json, '\0');
+	e->out = (outBuf_t){NULL, 0, 0, json.alloc};
+	formatInit(e, opts);
+	outputJson(e, json.buf);
+	formatFree(e);
+	memFree(json.alloc, json.buf);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Duplicate keys
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The keys of the open objects are tracked in open addressing hash sets 
+// stacked in a single slot array, the set of the innermost object on top.
+// A set grows in place since the sets of nested objects are popped before 
+// the next key of their parent. Keys are copied unescaped to an arena as
+// they are inserted, since flattened output moves them out of the output.
+//
+// With QJSON_DUP_FIRST the duplicate member is removed from the output. 
+// With QJSON_DUP_LAST the value of the first member is replaced by the 
+// value of the duplicate, like json parsers building a map: the duplicate 
+// value is moved aside and the object is written once when it is closed.
+
+// dupSlot_t is a key of an open object.
+typedef struct {
+	uint32_t hash;
+	int      key;  // offset of the key in dups_t.k, -1 for an empty slot
+	int      len;  // byte length of the key with its quotes
+	int      val;  // output offset of the value
+	int      end;  // output offset following the value
+	int      win;  // offset in dups_t.c of the value of the last duplicate, -1 if none
+	int      winLen;
+} dupSlot_t;
+
+// dupSet_t is the hash set of the keys of an open object.
+typedef struct {
+	int slots; // index of the first slot in dups_t.slots
+	int cap;   // number of slots, a power of 2
+	int n;     // number of keys
+	int start; // output offset following the opening brace
+	int mark;  // length of dups_t.c when the object was opened
+	int keys;  // length of dups_t.k when the object was opened
+	bool won;  // a value was replaced by a duplicate
+} dupSet_t;
+
+// dups_t tracks the keys of the open objects.
+typedef struct dups {
+	qjson_dup_policy_t policy;
+	const qjson_allocator_t *alloc;
+	dupSlot_t *slots;
+	int        nSlots, capSlots;
+	dupSet_t  *sets;
+	int        nSets, capSets;
+	outBuf_t   a, b; // unescaped keys being compared, rewritten object
+	outBuf_t   c;    // values of the last duplicates of the open objects
+	outBuf_t   k;    // unescaped keys of the open objects
+} dups_t;
+
+const char* canonUnescape(outBuf_t *b, const char *p);
+
+// dupKeyBytes returns the key output from offset key with its quotes, 
+// unescaped in b if it contains an escape sequence.
+slice_t dupKeyBytes(engine_t *e, outBuf_t *b, int key, int len) {
+	const char *p = e->out.buf+key;
+	if (memchr(p, '\\', len) == NULL)
+		return (slice_t){p, len};
+	b->len = 0;
+	bufByte(b, '"');
+	canonUnescape(b, p);
+	bufByte(b, '"');
+	return (slice_t){b->buf, b->len};
+}
+
+// dupHash returns the FNV-1a hash of s.
+uint32_t dupHash(slice_t s) {
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < s.l; i++)
+		h = (h ^ (byte)s.p[i]) * 16777619u;
+	return h;
+}
+
+// dupSlots returns the slots of the set on top.
+dupSlot_t* dupSlots(dups_t *d) {
+	return d->slots + d->sets[d->nSets-1].slots;
+}
+
+// dupReserve makes room for n slots on top of the slot array.
+void dupReserve(dups_t *d, int n) {
+	if (d->nSlots + n > d->capSlots) {
+		while (d->nSlots + n > d->capSlots)
+			d->capSlots = (d->capSlots == 0) ? 256 : d->capSlots*2;
+		d->slots = memRealloc(d->alloc, d->slots, d->capSlots*sizeof(dupSlot_t));
+	}
+	for (int i = 0; i < n; i++)
+		d->slots[d->nSlots+i].key = -1;
+	d->nSlots += n;
+}
+
+// dupOpen pushes the empty key set of an object.
+void dupOpen(engine_t *e) {
+	dups_t *d = e->dups;
+	if (d->nSets == d->capSets) {
+		d->capSets = (d->capSets == 0) ? 16 : d->capSets*2;
+		d->sets = memRealloc(d->alloc, d->sets, d->capSets*sizeof(dupSet_t));
+	}
+	d->sets[d->nSets++] = (dupSet_t){d->nSlots, 8, 0, e->out.len, d->c.len, d->k.len, false};
+	dupReserve(d, 8);
+}
+
+// dupCompare orders slots by key offset, which is the member order.
+int dupCompare(const void *a, const void *b) {
+	return ((const dupSlot_t*)a)->key - ((const dupSlot_t*)b)->key;
+}
+
+// dupWrite rewrites the members of the object on top with the values of 
+// their last duplicates.
+void dupWrite(engine_t *e) {
+	dups_t *d = e->dups;
+	dupSet_t *s = &d->sets[d->nSets-1];
+	dupSlot_t *slots = dupSlots(d);
+	int n = 0;
+	for (int i = 0; i < s->cap; i++)
+		if (slots[i].key >= 0)
+			slots[n++] = slots[i];
+	qsort(slots, n, sizeof(dupSlot_t), dupCompare);
+	int at = s->start;
+	d->b.len = 0;
+	for (int i = 0; i < n; i++) {
+		dupSlot_t *m = &slots[i];
+		bufBytes(&d->b, e->out.buf+at, m->val-at);
+		if (m->win >= 0)
+			bufBytes(&d->b, d->c.buf+m->win, m->winLen);
+		else
+			bufBytes(&d->b, e->out.buf+m->val, m->end-m->val);
+		at = m->end;
+	}
+	bufBytes(&d->b, e->out.buf+at, e->out.len-at);
+	e->out.len = s->start;
+	outputBytes(e, d->b.buf, d->b.len);
+}
+
+// dupClose pops the key set of an object.
+void dupClose(engine_t *e) {
+	dups_t *d = e->dups;
+	dupSet_t *s = &d->sets[d->nSets-1];
+	// on error, the last key may have no value
+	if (s->won && !failed(e))
+		dupWrite(e);
+	d->c.len = s->mark;
+	d->k.len = s->keys;
+	d->nSlots = s->slots;
+	d->nSets--;
+}
+
+// dupReset pops all the key sets.
+void dupReset(engine_t *e) {
+	e->dups->nSets = e->dups->nSlots = e->dups->c.len = e->dups->k.len = 0;
+}
+
+// dupGrow doubles the capacity of the set on top.
+void dupGrow(dups_t *d) {
+	dupSet_t *s = &d->sets[d->nSets-1];
+	int old = s->cap;
+	dupReserve(d, old);
+	s->cap *= 2;
+	dupSlot_t *slots = dupSlots(d);
+	dupSlot_t *tmp = memRealloc(d->alloc, NULL, old*sizeof(dupSlot_t));
+	memcpy(tmp, slots, old*sizeof(dupSlot_t));
+	for (int i = 0; i < old; i++)
+		slots[i].key = -1;
+	for (int i = 0; i < old; i++) {
+		if (tmp[i].key < 0)
+			continue;
+		int j = (int)(tmp[i].hash & (s->cap-1));
+		while (slots[j].key >= 0)
+			j = (j+1) & (s->cap-1);
+		slots[j] = tmp[i];
+	}
+	memFree(d->alloc, tmp);
+}
+
+// dupKey looks up the key output from offset key to the end of the output 
+// in the set on top and inserts it if it is new. It returns the index of 
+// its slot and sets *dup to true if it was already in the set, or -1 if 
+// it was and duplicates are errors.
+int dupKey(engine_t *e, int key, bool *dup) {
+	dups_t *d = e->dups;
+	dupSet_t *s = &d->sets[d->nSets-1];
+	if (2*(s->n+1) > s->cap)
+		dupGrow(d);
+	int len = e->out.len - key;
+	slice_t k = dupKeyBytes(e, &d->a, key, len);
+	uint32_t h = dupHash(k);
+	dupSlot_t *slots = dupSlots(d);
+	int j = (int)(h & (s->cap-1));
+	for (; slots[j].key >= 0; j = (j+1) & (s->cap-1)) {
+		if (slots[j].hash != h)
+			continue;
+		if (slots[j].len == k.l && memcmp(d->k.buf+slots[j].key, k.p, k.l) == 0) {
+			*dup = true;
+			return (d->policy == QJSON_DUP_ERROR) ? -1 : s->slots + j;
+		}
+	}
+	slots[j] = (dupSlot_t){h, d->k.len, k.l, 0, 0, -1, 0};
+	bufBytes(&d->k, k.p, k.l);
+	s->n++;
+	*dup = false;
+	return s->slots + j;
+}
+
+// dupValue applies the policy once the member output from offset start,
+// with its value from offset val, has been output.
+void dupValue(engine_t *e, int slot, bool dup, int start, int val) {
+	dups_t *d = e->dups;
+	dupSlot_t *m = &d->slots[slot];
+	if (!dup) {
+		m->val = val;
+		m->end = e->out.len;
+		return;
+	}
+	// in canonical output, the last member is kept when the object is sorted
+	if (d->policy == QJSON_DUP_LAST && e->canon != NULL)
+		return;
+	// the duplicate member and its leading separator are removed, its 
+	// value is kept aside until the object is closed
+	if (d->policy == QJSON_DUP_LAST) {
+		if (m->win < 0 || m->win + m->winLen != d->c.len)
+			m->win = d->c.len;
+		else
+			d->c.len = m->win;
+		m->winLen = e->out.len - val;
+		bufBytes(&d->c, e->out.buf+val, m->winLen);
+		d->sets[d->nSets-1].won = true;
+	}
+	e->out.len = start;
+}
+
+// dupsFree releases d.
+void dupsFree(dups_t *d) {
+	if (d == NULL)
+		return;
+	const qjson_allocator_t *a = d->alloc;
+	memFree(a, d->slots);
+	memFree(a, d->sets);
+	memFree(a, d->a.buf);
+	memFree(a, d->b.buf);
+	memFree(a, d->c.buf);
+	memFree(a, d->k.buf);
+	memFree(a, d);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Includes
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// A quoteless value "@include path" is replaced by the json object of the
+// qjson file at path when the includes option is set. The json of each 
+// file is cached with its modification time and size, and with the 
+// options it depends on, so that a fragment shared by many documents is 
+// decoded once. The real paths of the files being included are stacked 
+// to detect cycles and limit the nesting. An error in an included file is
+// reported at the directive, and with its position in the innermost file
+// in the result.
+
+// fragment_t is the cached json of an included file.
+typedef struct {
+	char      *path;  // real path of the file
+	uint32_t   hash;  // hash of path
+	long long  mtime; // modification time in nanoseconds
+	long long  size;  // byte length of the file
+	unsigned   opts;  // options the json depends on
+	char      *json;
+	int        len;
+} fragment_t;
+
+// qjson_includes is the cache of included files.
+struct qjson_includes {
+	char       *baseDir;  // directory of the paths included by the decoded text
+	int         maxDepth; // maximum number of nested included files
+	fragment_t *frags;
+	int         nFrags, capFrags;
+	char      **stack;    // real paths of the files being included
+	int         nStack;
+	size_t      parses, hits;
+};
+
+qjson_includes_t* qjson_includes_new(const char *baseDir, int maxDepth) {
+	qjson_includes_t *inc = calloc(1, sizeof(qjson_includes_t));
+	inc->baseDir = strdup((baseDir == NULL || baseDir[0] == '\0') ? "." : baseDir);
+	inc->maxDepth = (maxDepth > 0) ? maxDepth : 16;
+	inc->stack = malloc(inc->maxDepth*sizeof(char*));
+	return inc;
+}
+
+void qjson_includes_free(qjson_includes_t *inc) {
+	if (inc == NULL)
+		return;
+	for (int i = 0; i < inc->nFrags; i++) {
+		free(inc->frags[i].path);
+		free(inc->frags[i].json);
+	}
+	free(inc->frags);
+	free(inc->stack);
+	free(inc->baseDir);
+	free(inc);
+}
+
+void qjson_includes_stats(const qjson_includes_t *inc, size_t *parses, size_t *hits) {
+	*parses = inc->parses;
+	*hits = inc->hits;
+}
+
+// isIncludeDirective returns true if the quoteless string v is an include
+// directive.
+bool isIncludeDirective(slice_t v) {
+	return v.l > 9 && memcmp(v.p, "@include", 8) == 0 && (v.p[8] == ' ' || v.p[8] == '\t');
+}
+
+// includePath returns the heap allocated path of the file included with 
+// the relative or absolute path rel.
+char* includePath(qjson_includes_t *inc, slice_t rel) {
+	const char *dir = inc->baseDir;
+	int dirLen = (int)strlen(dir);
+	if (inc->nStack > 0) {
+		dir = inc->stack[inc->nStack-1];
+		const char *slash = strrchr(dir, '/');
+#ifdef _WIN32
+		const char *bslash = strrchr(dir, '\\');
+		if (bslash != NULL && (slash == NULL || bslash > slash))
+			slash = bslash;
+#endif
+		dirLen = (slash == NULL) ? 0 : (int)(slash-dir);
+	}
+	bool absolute = rel.p[0] == '/';
+#ifdef _WIN32
+	absolute = absolute || rel.p[0] == '\\' || (rel.l > 1 && rel.p[1] == ':');
+#endif
+	if (absolute)
+		dirLen = 0;
+	char *path = malloc(dirLen+rel.l+2);
+	memcpy(path, dir, dirLen);
+	int n = dirLen;
+	if (!absolute)
+		path[n++] = '/';
+	memcpy(path+n, rel.p, rel.l);
+	path[n+rel.l] = '\0';
+	return path;
+}
+
+// includeRead returns the heap allocated content of the file at path and
+// its byte length in *len, or NULL.
+char* includeRead(const char *path, long long size, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+	char *buf = malloc(size+1);
+	*len = fread(buf, 1, size, f);
+	fclose(f);
+	if ((long long)*len != size) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+// includeError sets the error of the directive from the result r of the 
+// included file path, keeping the position in the innermost file of the 
+// first one. It takes ownership of path.
+void includeError(engine_t *e, qjson_result_t *r, char *path) {
+	if (e->errFile == NULL) {
+		e->errFile = (r->errorFile != NULL) ? r->errorFile : path;
+		e->fileErr = r->error;
+		e->fileErrIdx = e->nErrs;
+		r->errorFile = NULL;
+	}
+	if (e->errFile != path)
+		free(path);
+	setErrorAndPos(e, r->error.msg, e->tk.pos);
+	qjson_result_free(r);
+}
+
+// includeOutput outputs the json of the included file f.
+void includeOutput(engine_t *e, fragment_t *f) {
+	if (e->flat != NULL || e->pretty != NULL)
+		outputJson(e, f->json);
+	else
+		outputText(e, f->json, f->len);
+}
+
+// includeValue outputs the json of the file included by the directive of
+// the current token. It returns true if an error occurred.
+bool includeValue(engine_t *e) {
+	qjson_includes_t *inc = e->includes;
+	slice_t rel = {e->tk.val.p+9, e->tk.val.l-9};
+	while (rel.l > 0 && (rel.p[0] == ' ' || rel.p[0] == '\t')) {
+		rel.p++;
+		rel.l--;
+	}
+	if (inc->nStack == inc->maxDepth) {
+		setErrorAndPos(e, ErrIncludeDepth, e->tk.pos);
+		return true;
+	}
+	char *path = includePath(inc, rel);
+	char *real = realpath(path, NULL);
+	free(path);
+	struct stat st;
+	if (real == NULL || stat(real, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) {
+		free(real);
+		setErrorAndPos(e, ErrIncludeRead, e->tk.pos);
+		return true;
+	}
+	for (int i = 0; i < inc->nStack; i++) {
+		if (strcmp(inc->stack[i], real) == 0) {
+			free(real);
+			setErrorAndPos(e, ErrIncludeCycle, e->tk.pos);
+			return true;
+		}
+	}
+	long long mtime = (long long)st.st_mtime*1000000000;
+#ifdef __linux__
+	mtime += st.st_mtim.tv_nsec;
+#endif
+	const qjson_options_t *opts = e->opts;
+	unsigned fragOpts = opts->disabled | (opts->rejectDisabled << 4) | (opts->duplicateKeys << 5);
+	uint32_t hash = dupHash((slice_t){real, (int)strlen(real)});
+	fragment_t *f = NULL;
+	for (int i = 0; i < inc->nFrags && f == NULL; i++)
+		if (inc->frags[i].hash == hash && strcmp(inc->frags[i].path, real) == 0)
+			f = &inc->frags[i];
+	if (f != NULL && f->mtime == mtime && f->size == (long long)st.st_size && f->opts == fragOpts) {
+		free(real);
+		inc->hits++;
+		includeOutput(e, f);
+		return false;
+	}
+
+	// decode the file with the options of the call, without the ones
+	// changing the output
+	size_t len;
+	char *text = includeRead(real, (long long)st.st_size, &len);
+	if (text == NULL) {
+		free(real);
+		setErrorAndPos(e, ErrIncludeRead, e->tk.pos);
+		return true;
+	}
+	qjson_options_t o = *opts;
+	o.validateOnly = o.sourceMap = o.canonical = o.digestOnly = o.flatten = o.ensureAscii = false;
+	o.indent = o.itemSeparator = o.keySeparator = NULL;
+	o.maxErrors = 0;
+	o.allocator = NULL; // the json is kept in the cache
+	qjson_result_t r;
+	inc->stack[inc->nStack++] = real;
+	bool ok = qjson_decode_ex(text, len, &o, &r);
+	inc->nStack--;
+	free(text);
+	if (!ok) {
+		includeError(e, &r, real);
+		return true;
+	}
+	inc->parses++;
+	if (f == NULL) {
+		if (inc->nFrags == inc->capFrags) {
+			inc->capFrags = (inc->capFrags == 0) ? 16 : inc->capFrags*2;
+			inc->frags = realloc(inc->frags, inc->capFrags*sizeof(fragment_t));
+		}
+		f = &inc->frags[inc->nFrags++];
+	} else {
+		free(f->path);
+		free(f->json);
+	}
+	*f = (fragment_t){real, hash, mtime, (long long)st.st_size, fragOpts, r.json, (int)r.len};
+	includeOutput(e, f);
+	return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Main
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+int myStrLen(const char* str) {
+	int i = 0;
+	while (str[i] != 0)
+		i++;
+	return i;
+}
+
+// qjson_options_init sets opts to the default options.
+void qjson_options_init(qjson_options_t *opts) {
+	memset(opts, 0, sizeof(*opts));
+}
+
+// engineInit prepares e to decode the len bytes of in.
+void engineInit(engine_t *e, const char *in, int len, const qjson_options_t *opts) {
+	e->in = in;
+	e->p = (slice_t){e->in, len};
+	outputInit(e);
+	e->depth = 0;
+	e->discard = opts->validateOnly && opts->duplicateKeys == QJSON_DUP_ALLOW;
+	e->map = NULL;
+	e->errs = NULL;
+	e->nErrs = 0;
+	e->maxErrs = opts->maxErrors;
+	e->checkIn = INT_MAX;
+	e->disabled = opts->disabled;
+	e->rejectDisabled = opts->rejectDisabled;
+	e->maxDepth = (opts->maxDepth > 0 && opts->maxDepth < maxDepth) ? opts->maxDepth : maxDepth;
+	e->budget = NULL;
+	e->dups = NULL;
+	e->canon = NULL;
+	e->flat = NULL;
+	e->pretty = NULL;
+	e->ascii = false;
+	e->opts = opts;
+	e->includes = opts->includes;
+	e->errFile = NULL;
+	e->alloc = opts->allocator;
+	e->out.alloc = opts->allocator;
+	e->pos = (pos_t){0,0,0};
+	e->tk.tag = tagUnknown;
+	e->tk.pos = e->pos;
+	e->tk.val.p = NULL;
+	e->tk.val.l = 0;
+}
+
+// decode runs the conversion. On return, e->tk is the error token.
+// The conversion succeeded when its value is ErrEndOfInput.
+void decode(engine_t *e) {
+	if (e->map == NULL && e->maxErrs <= 1 && jsonFastPath(e))
+		return;
+	nextToken(e);
+	if (e->map != NULL)
+		mapRecord(e);
+	members(e);
+	while (e->tk.tag == tagCloseBrace) {
+		e->tk = (token_t){tagError, e->tk.pos, {ErrSyntaxError, strlen(ErrSyntaxError)}};
+		if (e->nErrs+1 >= e->maxErrs)
+			break;
+		// skip the closing brace and resume at the top level
+		recordError(e);
+		seek(e, (pos_t){e->tk.pos.b+1, e->tk.pos.s, e->tk.pos.l});
+		nextToken(e);
+		members(e);
+	}
+	assert(e->tk.tag == tagError);
+}
+
+// qjson_decode accept a qjson text string as input and returns a 
+// heap allocated string. If the string start with the character '{',
+// the string is the json encoding of the input text, otherwise it
+// is an error message. qjson_decode will never return NULL or an
+// empty string.
+char* qjson_decode(const char *qjsonText) {
+	int len = (qjsonText == NULL) ? 0 : myStrLen(qjsonText); // strlen(qjsonText);
+	if (len == 0 ) {
+		return strcpy(malloc(3), "{}");
+	}
+	engine_t e;
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	engineInit(&e, qjsonText, len, &opts);
+	decode(&e);
+	if (e.tk.val.p == ErrEndOfInput) {
+		outputByte(&e, '\0');
+		return outputGet(&e);
+	}
+	outputReset(&e);
+	outputString(&e, e.tk.val.p);
+	char buf[256];
+	sprintf(buf, " at line %d col %d", e.tk.pos.l+1, column((slice_t){e.in+e.tk.pos.s, e.tk.pos.b-e.tk.pos.s})+1);
+	outputString(&e, buf);
+	outputByte(&e, '\0');
+	return outputGet(&e);
+}
+
+// qjson_decode_ex converts the len bytes of qjsonText into json. It returns 
+// true and res->json on success, otherwise false with res->error set. 
+bool qjson_decode_ex(const char *qjsonText, size_t len, const qjson_options_t *opts, qjson_result_t *res) {
+	qjson_options_t defaults;
+	if (opts == NULL) {
+		qjson_options_init(&defaults);
+		opts = &defaults;
+	}
+	memset(res, 0, sizeof(*res));
+	if (len > 0x7FFFFFFF) {
+		res->error = (qjson_error_t){ErrInputTooLarge, 0, 1, 1, QJSON_ERROR_INPUT_LIMIT};
+		return false;
+	}
+	if (opts->maxInputBytes > 0 && len > opts->maxInputBytes) {
+		res->error = (qjson_error_t){ErrInputLimit, 0, 1, 1, QJSON_ERROR_INPUT_LIMIT};
+		return false;
+	}
+	if (len == 0) {
+		if (!opts->validateOnly) {
+			res->json = strcpy(memRealloc(opts->allocator, NULL, 3), opts->flatten ? "" : "{}");
+			res->len = strlen(res->json);
+			res->allocator = opts->allocator;
+		}
+		return true;
+	}
+	engine_t e;
+	engineInit(&e, qjsonText, (int)len, opts);
+	bool canonical = (opts->canonical || opts->digestOnly) && !opts->validateOnly;
+	bool dropDups = opts->duplicateKeys == QJSON_DUP_FIRST || opts->duplicateKeys == QJSON_DUP_LAST;
+	bool pretty = opts->indent != NULL || opts->itemSeparator != NULL || opts->keySeparator != NULL;
+	if (opts->duplicateKeys != QJSON_DUP_ALLOW) {
+		e.dups = memset(memRealloc(e.alloc, NULL, sizeof(dups_t)), 0, sizeof(dups_t));
+		e.dups->policy = opts->duplicateKeys;
+		e.dups->alloc = e.dups->a.alloc = e.dups->b.alloc = e.dups->c.alloc = e.dups->k.alloc = e.alloc;
+	}
+	if (canonical) {
+		e.canon = memset(memRealloc(e.alloc, NULL, sizeof(canon_t)), 0, sizeof(canon_t));
+		e.canon->out.alloc = e.canon->keys.alloc = e.canon->str.alloc = e.alloc;
+		e.canon->digestOnly = opts->digestOnly;
+		e.canon->keepLast = opts->duplicateKeys == QJSON_DUP_LAST;
+	}
+	if (!opts->validateOnly && !canonical)
+		formatInit(&e, opts);
+	if (opts->sourceMap && !opts->validateOnly && !canonical && !opts->flatten && !pretty && !opts->ensureAscii && !dropDups) {
+		e.map = memset(memRealloc(e.alloc, NULL, sizeof(qjson_source_map_t)), 0, sizeof(qjson_source_map_t));
+		e.map->alloc = e.map->deltas.alloc = e.alloc;
+	}
+	budget_t budget;
+	e.budget = budgetInit(&budget, opts);
+	if (e.budget != NULL)
+		e.checkIn = budget.interval+1;
+	decode(&e);
+	// the limit applies to the engine output before it is made canonical
+	int outLen = (e.canon != NULL) ? e.canon->len : e.out.len;
+	if (e.tk.val.p == ErrEndOfInput && !e.discard && opts->maxOutputBytes > 0 && (size_t)outLen > opts->maxOutputBytes)
+		setErrorAndPos(&e, ErrOutputLimit, e.tk.pos);
+	if (e.tk.val.p != ErrEndOfInput)
+		recordError(&e);
+	dupsFree(e.dups);
+	if (e.canon != NULL && e.nErrs == 0)
+		digestFinal(&e.canon->d, res->digest);
+	canonFree(e.canon);
+	formatFree(&e);
+	res->allocator = e.alloc;
+	if (e.nErrs > 0) {
+		memFree(e.alloc, e.out.buf);
+		mapFree(e.map);
+		if (e.errFile != NULL && e.fileErrIdx == 0) {
+			e.errs[0] = e.fileErr;
+			res->errorFile = e.errFile;
+		} else
+			free(e.errFile);
+		res->error = e.errs[0];
+		if (e.maxErrs > 1) {
+			res->errors = e.errs;
+			res->nErrors = (size_t)e.nErrs;
+		} else
+			memFree(e.alloc, e.errs);
+		return false;
+	}
+	if (opts->validateOnly) {
+		memFree(e.alloc, e.out.buf);
+		return true;
+	}
+	if (opts->digestOnly) {
+		memFree(e.alloc, e.out.buf);
+		return true;
+	}
+	// canonical json is formatted once its members are sorted
+	if (canonical && (opts->flatten || pretty || (opts->ensureAscii && asciiScan(e.out.buf, 0, e.out.len) < e.out.len)))
+		outputRewrite(&e, opts);
+	res->len = (size_t)e.out.len;
+	outputByte(&e, '\0');
+	res->json = outputGet(&e);
+	res->sourceMap = e.map;
+	return true;
+}
+
+// qjson_result_free releases the memory held by res. 
+void qjson_result_free(qjson_result_t *res) {
+	memFree(res->allocator, res->json);
+	res->json = NULL;
+	res->len = 0;
+	mapFree(res->sourceMap);
+	res->sourceMap = NULL;
+	memFree(res->allocator, res->errors);
+	res->errors = NULL;
+	res->nErrors = 0;
+	free(res->errorFile);
+	res->errorFile = NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Merge
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The layers are decoded in turn and merged into a tree of nodes whose 
+// scalars and keys point into the json outputs of the layers, kept until 
+// the merged json is written. A layer is merged while its output is 
+// scanned, so that it costs its decoding and the size of the merged tree
+// it updates. Members are looked up in a hash table keyed by the id of 
+// their object and their unescaped key. An object replaced by another 
+// value gets a new id when it becomes an object again, so that its old 
+// members are no longer found.
+
+// mergeNode_t is a value of the merged tree.
+typedef struct {
+	char        type;  // '{', '[' or 0 for a scalar
+	int         id;    // id of the object in the member table
+	const char *v;     // json text of a scalar, or of any value built by diffBuild
+	int         vl;
+	const char *k;     // key as output by the engine, NULL for array elements
+	int         kl;
+	int         ko;    // offset of the unescaped key in merge_t.keys, -1 if k has no escape
+	int         ukl;   // byte length of the unescaped key
+	uint32_t    h;     // hash of the parent id and unescaped key
+	uint64_t    sh;    // hash of the subtree, set by diffBuild
+	int         first, last, next; // children and next sibling, -1 for none
+} mergeNode_t;
+
+// mergeSlot_t is a slot of the member table.
+typedef struct {
+	uint32_t h; // hash of the member
+	int      n; // member node index, -1 for an empty slot
+} mergeSlot_t;
+
+// merge_t is the state of a merge.
+typedef struct {
+	mergeNode_t *nodes;
+	int          nNodes, capNodes;
+	int          nIds;
+	mergeSlot_t *table;  // members of the objects
+	int          capTable, nTable;
+	outBuf_t     keys;   // unescaped keys containing escape sequences
+	qjson_merge_arrays_t arrays;
+} merge_t;
+
+int mergeNew(merge_t *m) {
+	if (m->nNodes == m->capNodes) {
+		m->capNodes = (m->capNodes == 0) ? 1024 : m->capNodes*2;
+		m->nodes = realloc(m->nodes, m->capNodes*sizeof(mergeNode_t));
+	}
+	m->nodes[m->nNodes] = (mergeNode_t){0, 0, NULL, 0, NULL, 0, -1, 0, 0, 0, -1, -1, -1};
+	return m->nNodes++;
+}
+
+// mergeKey returns the unescaped key of node n without its quotes.
+slice_t mergeKey(merge_t *m, int n) {
+	mergeNode_t *x = &m->nodes[n];
+	if (x->ko < 0)
+		return (slice_t){x->k+1, x->kl-2};
+	return (slice_t){m->keys.buf+x->ko, x->ukl};
+}
+
+// mergeHash returns the hash of key k of the object with the given id.
+uint32_t mergeHash(int id, slice_t k) {
+	uint32_t h = 2166136261u ^ (uint32_t)id;
+	for (int i = 0; i < k.l; i++)
+		h = (h ^ (byte)k.p[i]) * 16777619u;
+	// the low bits select the slot, mix the high bits into them
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
+// mergeInsert adds the member node n to the table.
+void mergeInsert(merge_t *m, int n) {
+	if (2*(m->nTable+1) > m->capTable) {
+		mergeSlot_t *old = m->table;
+		int oldCap = m->capTable;
+		m->capTable = (oldCap == 0) ? 1024 : oldCap*2;
+		m->table = malloc(m->capTable*sizeof(mergeSlot_t));
+		memset(m->table, 0xFF, m->capTable*sizeof(mergeSlot_t));
+		m->nTable = 0;
+		for (int i = 0; i < oldCap; i++)
+			if (old[i].n >= 0)
+				mergeInsert(m, old[i].n);
+		free(old);
+	}
+	uint32_t h = m->nodes[n].h;
+	int j = (int)(h & (m->capTable-1));
+	while (m->table[j].n >= 0)
+		j = (j+1) & (m->capTable-1);
+	m->table[j] = (mergeSlot_t){h, n};
+	m->nTable++;
+}
+
+// mergeFind returns the member of the object with the given id whose 
+// unescaped key is k, or -1.
+int mergeFind(merge_t *m, int id, slice_t k, uint32_t h) {
+	if (m->capTable == 0)
+		return -1;
+	for (int j = (int)(h & (m->capTable-1)); m->table[j].n >= 0; j = (j+1) & (m->capTable-1)) {
+		if (m->table[j].h != h)
+			continue;
+		int n = m->table[j].n;
+		slice_t o = mergeKey(m, n);
+		if (o.l == k.l && memcmp(o.p, k.p, k.l) == 0)
+			return n;
+	}
+	return -1;
+}
+
+// mergeAppend links node c as the last child of node n.
+void mergeAppend(merge_t *m, int n, int c) {
+	if (m->nodes[n].last < 0)
+		m->nodes[n].first = c;
+	else
+		m->nodes[m->nodes[n].last].next = c;
+	m->nodes[n].last = c;
+}
+
+const char* mergeValue(merge_t *m, int n, const char *p);
+
+// mergeSet sets node n to the value starting at p and returns the pointer
+// following it.
+const char* mergeSet(merge_t *m, int n, const char *p) {
+	mergeNode_t *x = &m->nodes[n];
+	x->first = x->last = -1;
+	if (*p != '{' && *p != '[') {
+		const char *end = canonSkip(p);
+		x->type = 0;
+		x->v = p;
+		x->vl = (int)(end-p);
+		return end;
+	}
+	x->type = *p;
+	if (*p == '{') {
+		x->id = ++m->nIds;
+		return mergeValue(m, n, p);
+	}
+	for (p++; *p != ']'; ) {
+		int c = mergeNew(m);
+		mergeAppend(m, n, c);
+		p = mergeSet(m, c, p);
+		if (*p == ',')
+			p++;
+	}
+	return p+1;
+}
+
+// mergeValue merges the value starting at p into node n and returns the 
+// pointer following it.
+const char* mergeValue(merge_t *m, int n, const char *p) {
+	if (*p == '[' && m->nodes[n].type == '[' && m->arrays == QJSON_MERGE_CONCAT) {
+		for (p++; *p != ']'; ) {
+			int c = mergeNew(m);
+			mergeAppend(m, n, c);
+			p = mergeSet(m, c, p);
+			if (*p == ',')
+				p++;
+		}
+		return p+1;
+	}
+	if (*p != '{' || m->nodes[n].type != '{')
+		return mergeSet(m, n, p);
+	int id = m->nodes[n].id;
+	for (p++; *p != '}'; ) {
+		const char *k = p;
+		p = canonSkip(p);
+		int kl = (int)(p-k), ko = -1, ukl = kl-2;
+		slice_t uk = {k+1, kl-2};
+		if (memchr(k, '\\', kl) != NULL) {
+			ko = m->keys.len;
+			canonUnescape(&m->keys, k);
+			ukl = m->keys.len - ko;
+			uk = (slice_t){m->keys.buf+ko, ukl};
+		}
+		uint32_t h = mergeHash(id, uk);
+		int c = mergeFind(m, id, uk, h);
+		if (c >= 0) {
+			if (ko >= 0)
+				m->keys.len = ko;
+			p = mergeValue(m, c, p+1);
+		} else {
+			c = mergeNew(m);
+			mergeNode_t *x = &m->nodes[c];
+			x->k = k;
+			x->kl = kl;
+			x->ko = ko;
+			x->ukl = ukl;
+			x->h = h;
+			mergeAppend(m, n, c);
+			mergeInsert(m, c);
+			p = mergeSet(m, c, p+1);
+		}
+		if (*p == ',')
+			p++;
+	}
+	return p+1;
+}
+
+// mergeWrite appends the json text of node n to out.
+void mergeWrite(merge_t *m, int n, outBuf_t *out) {
+	mergeNode_t *x = &m->nodes[n];
+	if (x->type == 0) {
+		bufBytes(out, x->v, x->vl);
+		return;
+	}
+	bufByte(out, x->type);
+	for (int c = x->first; c >= 0; c = m->nodes[c].next) {
+		if (c != x->first)
+			bufByte(out, ',');
+		if (m->nodes[c].k != NULL) {
+			bufBytes(out, m->nodes[c].k, m->nodes[c].kl);
+			bufByte(out, ':');
+		}
+		mergeWrite(m, c, out);
+	}
+	bufByte(out, (x->type == '{') ? '}' : ']');
+}
+
+// mergeInit initializes m with an empty object as root, and res.
+void mergeInit(merge_t *m, qjson_merge_arrays_t arrays, qjson_result_t *res) {
+	memset(res, 0, sizeof(*res));
+	memset(m, 0, sizeof(*m));
+	m->arrays = arrays;
+	int root = mergeNew(m);
+	m->nodes[root].type = '{';
+	m->nodes[root].id = ++m->nIds;
+}
+
+// mergeEnd sets res->json to the merged json if ok, and frees m.
+void mergeEnd(merge_t *m, bool ok, qjson_result_t *res) {
+	if (ok) {
+		outBuf_t out = {NULL, 0, 0};
+		mergeWrite(m, 0, &out);
+		res->len = (size_t)out.len;
+		bufByte(&out, '\0');
+		res->json = realloc(out.buf, out.len);
+	}
+	free(m->nodes);
+	free(m->table);
+	free(m->keys.buf);
+}
+
+bool qjson_merge(const char *const *qjsonTexts, const size_t *lens, size_t n, const qjson_options_t *opts, 
+	qjson_merge_arrays_t arrays, qjson_result_t *res) {
+	qjson_options_t o;
+	if (opts == NULL)
+		qjson_options_init(&o);
+	else
+		o = *opts;
+	o.validateOnly = o.sourceMap = o.canonical = o.digestOnly = o.flatten = o.ensureAscii = false;
+	o.indent = o.itemSeparator = o.keySeparator = NULL;
+	o.maxErrors = 0;
+	o.allocator = NULL; // the layers are freed with free
+	o.duplicateKeys = QJSON_DUP_LAST; // a key repeated in a layer replaces its value
+	merge_t m;
+	mergeInit(&m, arrays, res);
+	char **outs = calloc(n+1, sizeof(char*));
+	bool ok = true;
+	for (size_t i = 0; i < n; i++) {
+		if (!qjson_decode_ex(qjsonTexts[i], lens[i], &o, res)) {
+			res->layer = i;
+			ok = false;
+			break;
+		}
+		outs[i] = res->json;
+		res->json = NULL;
+		mergeValue(&m, 0, outs[i]);
+	}
+	mergeEnd(&m, ok, res);
+	for (size_t i = 0; i < n; i++)
+		free(outs[i]);
+	free(outs);
+	return ok;
+}
+
+void qjson_merge_json(const char *const *jsons, size_t n, qjson_merge_arrays_t arrays, qjson_result_t *res) {
+	merge_t m;
+	mergeInit(&m, arrays, res);
+	for (size_t i = 0; i < n; i++)
+		mergeValue(&m, 0, jsons[i]);
+	mergeEnd(&m, true, res);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Diff
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// Both documents are decoded and built into trees of merge nodes with the
+// hash of each subtree, the hash of an object being independent of the 
+// order of its members. The trees are then walked together, skipping the
+// subtrees with equal hashes and json texts, so that the walk of mostly 
+// identical documents is short. The hash is only a fast reject: subtrees
+// with equal hashes and different texts are walked, and scalars are 
+// compared, so that a hash collision cannot hide a change. Strings with 
+// escape sequences are hashed and compared unescaped.
+
+// diff_t is the state of a diff.
+typedef struct {
+	merge_t  a, b;    // old and new trees
+	outBuf_t path;    // json pointer of the current node, without quotes
+	outBuf_t out;     // json output
+	bool     pathsOnly;
+	int      n;       // number of operations
+} diff_t;
+
+// diffHashBytes returns the FNV-1a hash of the n bytes of p from h.
+uint64_t diffHashBytes(uint64_t h, const char *p, int n) {
+	for (int i = 0; i < n; i++)
+		h = (h ^ (byte)p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+// diffBuild sets node n of m to the value starting at p, computes its hash
+// and returns the pointer following it. A key met twice in an object keeps 
+// its first position and its last value.
+const char* diffBuild(merge_t *m, int n, const char *p) {
+	const char *start = p;
+	mergeNode_t *x = &m->nodes[n];
+	uint64_t h = diffHashBytes(0xcbf29ce484222325ULL, p, 1);
+	x->first = x->last = -1;
+	if (*p == '[') {
+		x->type = '[';
+		for (p++; *p != ']'; ) {
+			int c = mergeNew(m);
+			mergeAppend(m, n, c);
+			p = diffBuild(m, c, p);
+			h = fmix64(h*31 + m->nodes[c].sh);
+			if (*p == ',')
+				p++;
+		}
+		p++;
+	} else if (*p == '{') {
+		x->type = '{';
+		int id = x->id = ++m->nIds;
+		for (p++; *p != '}'; ) {
+			const char *k = p;
+			p = canonSkip(p);
+			int kl = (int)(p-k), ko = -1, ukl = kl-2;
+			slice_t uk = {k+1, kl-2};
+			if (memchr(k, '\\', kl) != NULL) {
+				ko = m->keys.len;
+				canonUnescape(&m->keys, k);
+				ukl = m->keys.len - ko;
+				uk = (slice_t){m->keys.buf+ko, ukl};
+			}
+			uint32_t kh = mergeHash(id, uk);
+			int c = mergeFind(m, id, uk, kh);
+			if (c < 0) {
+				c = mergeNew(m);
+				mergeNode_t *y = &m->nodes[c];
+				y->k = k;
+				y->kl = kl;
+				y->ko = ko;
+				y->ukl = ukl;
+				y->h = kh;
+				mergeAppend(m, n, c);
+				mergeInsert(m, c);
+			} else if (ko >= 0)
+				m->keys.len = ko;
+			p = diffBuild(m, c, p+1);
+			if (*p == ',')
+				p++;
+		}
+		p++;
+		for (int c = m->nodes[n].first; c >= 0; c = m->nodes[c].next) {
+			slice_t k = mergeKey(m, c);
+			h += fmix64(diffHashBytes(0xcbf29ce484222325ULL, k.p, k.l) ^ m->nodes[c].sh);
+		}
+	} else {
+		x->type = 0;
+		p = canonSkip(p);
+		if (*start != '"')
+			h = diffHashBytes(h, start, (int)(p-start));
+		else if (memchr(start, '\\', p-start) == NULL)
+			h = diffHashBytes(h, start+1, (int)(p-start)-2);
+		else {
+			outBuf_t tmp = {NULL, 0, 0};
+			canonUnescape(&tmp, start);
+			h = diffHashBytes(h, tmp.buf, tmp.len);
+			free(tmp.buf);
+		}
+	}
+	x = &m->nodes[n];
+	x->v = start;
+	x->vl = (int)(p-start);
+	x->sh = fmix64(h);
+	return p;
+}
+
+// diffPush appends the json pointer segment of the unescaped key k, or of 
+// index i when k.p is NULL, to the path of d.
+void diffPush(diff_t *d, slice_t k, int i) {
+	bufByte(&d->path, '/');
+	if (k.p == NULL) {
+		char buf[16];
+		bufBytes(&d->path, buf, sprintf(buf, "%d", i));
+		return;
+	}
+	for (int j = 0; j < k.l; j++) {
+		byte c = (byte)k.p[j];
+		char esc[8];
+		if (c == '~')
+			bufBytes(&d->path, "~0", 2);
+		else if (c == '/')
+			bufBytes(&d->path, "~1", 2);
+		else if (c == '"' || c == '\\') {
+			bufByte(&d->path, '\\');
+			bufByte(&d->path, (char)c);
+		} else if (c < 0x20)
+			bufBytes(&d->path, esc, sprintf(esc, "\\u%04x", c));
+		else
+			bufByte(&d->path, (char)c);
+	}
+}
+
+// diffOp outputs the operation op on the current path, with the value of
+// node v of the new tree if v >= 0.
+void diffOp(diff_t *d, const char *op, int v) {
+	if (d->n++ > 0)
+		bufByte(&d->out, ',');
+	if (d->pathsOnly) {
+		bufByte(&d->out, '"');
+		bufBytes(&d->out, d->path.buf, d->path.len);
+		bufByte(&d->out, '"');
+		return;
+	}
+	bufBytes(&d->out, "{\"op\":\"", 7);
+	bufBytes(&d->out, op, (int)strlen(op));
+	bufBytes(&d->out, "\",\"path\":\"", 10);
+	bufBytes(&d->out, d->path.buf, d->path.len);
+	bufByte(&d->out, '"');
+	if (v >= 0) {
+		bufBytes(&d->out, ",\"value\":", 9);
+		bufBytes(&d->out, d->b.nodes[v].v, d->b.nodes[v].vl);
+	}
+	bufByte(&d->out, '}');
+}
+
+// diffSame returns true if the json texts of nodes x and y are equal, or
+// if they are strings with the same unescaped value.
+bool diffSame(const mergeNode_t *x, const mergeNode_t *y) {
+	if (x->vl == y->vl && memcmp(x->v, y->v, x->vl) == 0)
+		return true;
+	if (x->type != 0 || x->v[0] != '"' || y->v[0] != '"')
+		return false;
+	outBuf_t ux = {NULL, 0, 0}, uy = {NULL, 0, 0};
+	canonUnescape(&ux, x->v);
+	canonUnescape(&uy, y->v);
+	bool same = ux.len == uy.len && (ux.len == 0 || memcmp(ux.buf, uy.buf, ux.len) == 0);
+	free(ux.buf);
+	free(uy.buf);
+	return same;
+}
+
+// diffNode outputs the operations changing node a of the old tree into 
+// node b of the new tree.
+void diffNode(diff_t *d, int a, int b) {
+	mergeNode_t *x = &d->a.nodes[a], *y = &d->b.nodes[b];
+	if (x->sh == y->sh && x->type == y->type && diffSame(x, y))
+		return;
+	int len = d->path.len;
+	if (x->type == '{' && y->type == '{') {
+		for (int c = x->first; c >= 0; c = d->a.nodes[c].next) {
+			slice_t k = mergeKey(&d->a, c);
+			int cb = mergeFind(&d->b, y->id, k, mergeHash(y->id, k));
+			diffPush(d, k, 0);
+			if (cb < 0)
+				diffOp(d, "remove", -1);
+			else
+				diffNode(d, c, cb);
+			d->path.len = len;
+		}
+		for (int c = y->first; c >= 0; c = d->b.nodes[c].next) {
+			slice_t k = mergeKey(&d->b, c);
+			if (mergeFind(&d->a, x->id, k, mergeHash(x->id, k)) >= 0)
+				continue;
+			diffPush(d, k, 0);
+			diffOp(d, "add", c);
+			d->path.len = len;
+		}
+		return;
+	}
+	if (x->type == '[' && y->type == '[') {
+		int i = 0, ca = x->first, cb = y->first;
+		for (; ca >= 0 && cb >= 0; i++, ca = d->a.nodes[ca].next, cb = d->b.nodes[cb].next) {
+			diffPush(d, (slice_t){NULL, 0}, i);
+			diffNode(d, ca, cb);
+			d->path.len = len;
+		}
+		for (; cb >= 0; i++, cb = d->b.nodes[cb].next) {
+			diffPush(d, (slice_t){NULL, 0}, i);
+			diffOp(d, "add", cb);
+			d->path.len = len;
+		}
+		// extra elements are removed from the last one so that indexes stay valid
+		int n = i;
+		for (; ca >= 0; ca = d->a.nodes[ca].next)
+			n++;
+		for (int j = n-1; j >= i; j--) {
+			diffPush(d, (slice_t){NULL, 0}, j);
+			diffOp(d, "remove", -1);
+			d->path.len = len;
+		}
+		return;
+	}
+	diffOp(d, "replace", b);
+}
+
+bool qjson_diff(const char *oldText, size_t oldLen, const char *newText, size_t newLen, const qjson_options_t *opts,
+	bool pathsOnly, qjson_result_t *res) {
+	qjson_options_t o;
+	if (opts == NULL)
+		qjson_options_init(&o);
+	else
+		o = *opts;
+	o.validateOnly = o.sourceMap = o.canonical = o.digestOnly = o.flatten = o.ensureAscii = false;
+	o.indent = o.itemSeparator = o.keySeparator = NULL;
+	o.maxErrors = 0;
+	o.allocator = NULL;
+	char *outs[2] = {NULL, NULL};
+	const char *texts[2] = {oldText, newText};
+	size_t lens[2] = {oldLen, newLen};
+	for (int i = 0; i < 2; i++) {
+		if (!qjson_decode_ex(texts[i], lens[i], &o, res)) {
+			res->layer = (size_t)i;
+			free(outs[0]);
+			return false;
+		}
+		outs[i] = res->json;
+		res->json = NULL;
+	}
+	diff_t d;
+	memset(&d, 0, sizeof(d));
+	d.pathsOnly = pathsOnly;
+	int ra = mergeNew(&d.a), rb = mergeNew(&d.b);
+	diffBuild(&d.a, ra, outs[0]);
+	diffBuild(&d.b, rb, outs[1]);
+	bufByte(&d.out, '[');
+	diffNode(&d, ra, rb);
+	bufByte(&d.out, ']');
+	res->len = (size_t)d.out.len;
+	bufByte(&d.out, '\0');
+	res->json = realloc(d.out.buf, d.out.len);
+	merge_t *ms[2] = {&d.a, &d.b};
+	for (int i = 0; i < 2; i++) {
+		free(ms[i]->nodes);
+		free(ms[i]->table);
+		free(ms[i]->keys.buf);
+		free(outs[i]);
+	}
+	free(d.path.buf);
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Lexer
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The lexer returns the tokens of the tokenizer with the white spaces,
+// newlines and comments in between when trivia is requested. These are
+// found in the gap between the end of a token and the start of the next
+// one.
+
+// cstToken_t is a token returned by the lexer and stored in syntax trees.
+typedef struct {
+	enum tokenTag_t tag;  // token tag
+	int             b;    // byte offset of the token in the input
+	int             l;    // byte length of the token
+	int             line; // line number of the token starting at 0
+} cstToken_t;
+
+struct qjson_lexer {
+	engine_t e;       // tokenizer
+	bool     trivia;  // return white spaces, newlines and comments
+	bool     pending; // e.tk is not yet returned
+	int      b;       // start of the gap to split into trivia tokens
+	int      end;     // end of the gap
+	int      line;    // line number at b
+	int      tkEnd;   // end of the last token
+	int      tkLine;  // line number at tkEnd
+};
+
+// qjson_token_tag_t values of the internal token tags.
+const qjson_token_tag_t publicTag[] = {
+	[tagOpenBrace] = QJSON_TOKEN_OPEN_BRACE,
+	[tagCloseBrace] = QJSON_TOKEN_CLOSE_BRACE,
+	[tagOpenSquare] = QJSON_TOKEN_OPEN_SQUARE,
+	[tagCloseSquare] = QJSON_TOKEN_CLOSE_SQUARE,
+	[tagColon] = QJSON_TOKEN_COLON,
+	[tagComma] = QJSON_TOKEN_COMMA,
+	[tagQuotelessString] = QJSON_TOKEN_QUOTELESS_STRING,
+	[tagDoubleQuotedString] = QJSON_TOKEN_DOUBLE_QUOTED_STRING,
+	[tagSingleQuotedString] = QJSON_TOKEN_SINGLE_QUOTED_STRING,
+	[tagMultilineString] = QJSON_TOKEN_MULTILINE_STRING,
+	[tagWhitespace] = QJSON_TOKEN_WHITESPACE,
+	[tagNewline] = QJSON_TOKEN_NEWLINE,
+	[tagComment] = QJSON_TOKEN_COMMENT,
+};
+
+void lexerInit(qjson_lexer_t *lx, const char *in, int len, bool trivia) {
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	memset(lx, 0, sizeof(*lx));
+	engineInit(&lx->e, in, len, &opts);
+	lx->trivia = trivia;
+}
+
+// triviaLen returns the byte length and tag of the trivia token at in[b].
+// The gap up to end contains only valid white spaces, newlines and comments.
+int triviaLen(const char *in, int b, int end, enum tokenTag_t *tag) {
+	slice_t p = {in+b, end-b};
+	int n = newline(p);
+	if (n != 0) {
+		*tag = tagNewline;
+		return n;
+	}
+	*tag = tagComment;
+	if (p.p[0] == '#' || (p.l > 1 && p.p[0] == '/' && p.p[1] == '/')) {
+		while (n < p.l && newline((slice_t){p.p+n, p.l-n}) == 0)
+			n++;
+		return n;
+	}
+	if (p.l > 1 && p.p[0] == '/' && p.p[1] == '*') {
+		for (n = 2; n < p.l-1 && (p.p[n] != '*' || p.p[n+1] != '/'); n++)
+			;
+		return (n < p.l-1) ? n+2 : p.l;
+	}
+	*tag = tagWhitespace;
+	for (int w = whitespace(p); w != 0; w = whitespace((slice_t){p.p+n, p.l-n}))
+		n += w;
+	return (n == 0) ? 1 : n;
+}
+
+// lexerNext sets *tk to the next token and returns true, or returns false
+// at the end of input or on error, with lx->e.tk the error token.
+bool lexerNext(qjson_lexer_t *lx, cstToken_t *tk) {
+	for (;;) {
+		if (lx->b < lx->end) {
+			enum tokenTag_t tag;
+			int n = triviaLen(lx->e.in, lx->b, lx->end, &tag);
+			*tk = (cstToken_t){tag, lx->b, n, lx->line};
+			if (tag == tagNewline) {
+				lx->line++;
+			} else if (tag == tagComment) {
+				for (int i = lx->b; i < lx->b+n; i++)
+					lx->line += lx->e.in[i] == '\n';
+			}
+			lx->b += n;
+			return true;
+		}
+		if (lx->pending) {
+			token_t t = lx->e.tk;
+			lx->pending = false;
+			if (t.tag == tagError)
+				return false;
+			*tk = (cstToken_t){t.tag, t.pos.b, lx->tkEnd-t.pos.b, t.pos.l};
+			return true;
+		}
+		if (done(&lx->e))
+			return false;
+		nextToken(&lx->e);
+		token_t t = lx->e.tk;
+		int start = t.pos.b;
+		if (t.tag == tagError)
+			start = (t.val.p == ErrEndOfInput) ? lx->e.pos.b : lx->tkEnd;
+		if (lx->trivia) {
+			lx->b = lx->tkEnd;
+			lx->end = start;
+			lx->line = lx->tkLine;
+		}
+		if (t.tag != tagError) {
+			lx->tkEnd = (t.val.p == NULL) ? t.pos.b+1 : (int)(t.val.p - lx->e.in) + t.val.l;
+			lx->tkLine = lx->e.pos.l;
+		}
+		lx->pending = true;
+	}
+}
+
+qjson_lexer_t* qjson_lexer_new(const char *qjsonText, size_t len, bool trivia) {
+	if (len > 0x7FFFFFFF)
+		return NULL;
+	qjson_lexer_t *lx = malloc(sizeof(qjson_lexer_t));
+	lexerInit(lx, qjsonText, (int)len, trivia);
+	return lx;
+}
+
+void qjson_lexer_free(qjson_lexer_t *lx) {
+	free(lx);
+}
+
+bool qjson_lexer_next(qjson_lexer_t *lx, qjson_token_t *tk) {
+	cstToken_t t;
+	if (!lexerNext(lx, &t)) {
+		tk->tag = (lx->e.tk.val.p == ErrEndOfInput) ? QJSON_TOKEN_END : QJSON_TOKEN_ERROR;
+		tk->text = lx->e.in + lx->e.tk.pos.b;
+		tk->offset = (size_t)lx->e.tk.pos.b;
+		tk->len = 0;
+		tk->line = lx->e.tk.pos.l+1;
+		return false;
+	}
+	tk->tag = publicTag[t.tag];
+	tk->text = lx->e.in + t.b;
+	tk->offset = (size_t)t.b;
+	tk->len = (size_t)t.l;
+	tk->line = t.line+1;
+	return true;
+}
+
+bool qjson_lexer_error(const qjson_lexer_t *lx, qjson_error_t *err) {
+	token_t t = lx->e.tk;
+	if (t.tag != tagError || t.val.p == ErrEndOfInput)
+		return false;
+	*err = (qjson_error_t){t.val.p, (size_t)t.pos.b, t.pos.l+1, 
+		column((slice_t){lx->e.in+t.pos.s, t.pos.b-t.pos.s})+1};
+	return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Syntax tree
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The concrete syntax tree is lossless. Its token array covers the whole
+// input, including white spaces, newlines, comments and commas, so that 
+// the concatenation of the token texts is the input. Tokens and nodes 
+// refer to the input by byte offsets, which must remain valid while the
+// syntax tree is used. The nodes are the values, with the index of their
+// key token for object members.
+
+// Number of spaces per nesting level of the formatted output.
+const int formatIndent = 2;
+
+// noKey is the key token index of nodes without key. 
+const int noKey = INT_MIN;
+
+// cstNode_t is a value of the syntax tree. Objects and arrays span from
+// their open to their close token. Nodes are stored in preorder so that
+// the children of node n start at n+1 and each child is followed by its
+// next sibling at its end index. Node 0 is the top level object whose
+// first and last token indexes are -1 and the number of tokens.
+typedef struct {
+	int key;   // index of the member identifier token, or noKey
+	int first; // index of the first token of the value
+	int last;  // index of the last token of the value
+	int end;   // index of the node following the value and its descendants
+} cstNode_t;
+
+struct qjson_cst {
+	const char *in;     // input text
+	int         len;    // byte length of in
+	int         endLine; // line number at the end of in
+	cstToken_t *tk;     // tokens
+	int         nTk;    // number of tokens
+	int         capTk;  // capacity of tk
+	cstNode_t  *nodes;  // nodes
+	int         nNodes; // number of nodes
+	int         capNodes; // capacity of nodes
+	int         tkFrom; // tokens from tkFrom are stored after a gap of tkGap tokens and
+	int         tkGap;  // are shifted by tkB bytes and tkLine lines
+	int         tkB;
+	int         tkLine;
+	int         ndFrom; // nodes from ndFrom are stored after a gap of ndGap nodes and 
+	int         ndGap;  // are shifted by ndTk tokens and ndNode nodes
+	int         ndTk;
+	int         ndNode;
+};
+
+void cstAddToken(qjson_cst_t *c, enum tokenTag_t tag, int b, int l, int line) {
+	if (c->nTk == c->capTk) {
+		c->capTk = (c->capTk == 0) ? 256 : c->capTk*2;
+		c->tk = realloc(c->tk, c->capTk*sizeof(cstToken_t));
+	}
+	c->tk[c->nTk++] = (cstToken_t){tag, b, l, line};
+}
+
+// cstTokenize splits the input into tokens. Requires valid input.
+void cstTokenize(qjson_cst_t *c) {
+	qjson_lexer_t lx;
+	lexerInit(&lx, c->in, c->len, true);
+	cstToken_t tk;
+	while (lexerNext(&lx, &tk))
+		cstAddToken(c, tk.tag, tk.b, tk.l, tk.line);
+	c->endLine = lx.line;
+}
+
+// cstNext returns the index of the first token after i that is not a 
+// trivia or a comma, or the number of tokens.
+int cstNext(const qjson_cst_t *c, int i) {
+	for (i++; i < c->nTk; i++) {
+		enum tokenTag_t tag = c->tk[i].tag;
+		if (tag != tagWhitespace && tag != tagNewline && tag != tagComment && tag != tagComma)
+			break;
+	}
+	return i;
+}
+
+int cstNewNode(qjson_cst_t *c, int key, int first) {
+	if (c->nNodes == c->capNodes) {
+		c->capNodes = (c->capNodes == 0) ? 64 : c->capNodes*2;
+		c->nodes = realloc(c->nodes, c->capNodes*sizeof(cstNode_t));
+	}
+	c->nodes[c->nNodes] = (cstNode_t){key, first, first, c->nNodes+1};
+	return c->nNodes++;
+}
+
+void cstValue(qjson_cst_t *c, int *i, int key);
+
+// cstItems adds the nodes of the members, or values when keys is false,
+// from token *i until the token close or the end of tokens.
+void cstItems(qjson_cst_t *c, int *i, enum tokenTag_t close, bool keys) {
+	while (*i < c->nTk && c->tk[*i].tag != close) {
+		int key = noKey;
+		if (keys) {
+			key = *i;
+			*i = cstNext(c, cstNext(c, *i)); // skip key and colon
+		}
+		cstValue(c, i, key);
+	}
+}
+
+// cstValue adds the nodes of the value at token *i and pops it.
+void cstValue(qjson_cst_t *c, int *i, int key) {
+	int n = cstNewNode(c, key, *i);
+	enum tokenTag_t tag = c->tk[*i].tag;
+	*i = cstNext(c, *i);
+	if (tag == tagOpenBrace || tag == tagOpenSquare) {
+		cstItems(c, i, (tag == tagOpenBrace) ? tagCloseBrace : tagCloseSquare, tag == tagOpenBrace);
+		c->nodes[n].last = *i;
+		*i = cstNext(c, *i);
+	}
+	c->nodes[n].end = c->nNodes;
+}
+
+// cstBuild adds the tokens and nodes of the valid input c->in.
+void cstBuild(qjson_cst_t *c) {
+	cstTokenize(c);
+	int top = cstNewNode(c, noKey, -1);
+	int i = cstNext(c, -1);
+	cstItems(c, &i, tagUnknown, true);
+	c->nodes[top].last = c->nTk;
+	c->nodes[top].end = c->nNodes;
+	c->tkFrom = c->nTk;
+	c->tkGap = c->capTk - c->nTk;
+	c->ndFrom = c->nNodes;
+	c->ndGap = c->capNodes - c->nNodes;
+}
+
+qjson_cst_t* qjson_cst_parse(const char *text, size_t len, qjson_error_t *err) {
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	opts.validateOnly = true;
+	qjson_result_t res;
+	if (!qjson_decode_ex(text, len, &opts, &res)) {
+		*err = res.error;
+		return NULL;
+	}
+	qjson_cst_t *c = calloc(1, sizeof(qjson_cst_t));
+	c->in = text;
+	c->len = (int)len;
+	cstBuild(c);
+	return c;
+}
+
+void qjson_cst_free(qjson_cst_t *c) {
+	if (c == NULL)
+		return;
+	free(c->tk);
+	free(c->nodes);
+	free(c);
+}
+
+// cstFmt_t is the syntax tree formatter.
+typedef struct {
+	const qjson_cst_t *c;
+	outBuf_t           out;
+} cstFmt_t;
+
+// fmtNewline starts a new line indented for level.
+void fmtNewline(cstFmt_t *f, int level) {
+	if (f->out.len > 0)
+		bufByte(&f->out, '\n');
+	bufSpaces(&f->out, level*formatIndent);
+}
+
+// fmtComment writes the comment token t. Trailing white spaces of line 
+// comments are dropped.
+void fmtComment(cstFmt_t *f, int t) {
+	cstToken_t tk = f->c->tk[t];
+	const char *p = f->c->in + tk.b;
+	int l = tk.l;
+	if (p[0] != '/' || p[1] != '*')
+		while (l > 0 && (p[l-1] == ' ' || p[l-1] == '\t'))
+			l--;
+	bufBytes(&f->out, p, l);
+}
+
+// fmtLeading writes the comments in the tokens from to end on their own
+// lines, preserving one blank line between comment groups. It returns the 
+// number of newlines met after the last comment.
+int fmtLeading(cstFmt_t *f, int from, int end, int level, bool *any) {
+	int nl = 0;
+	for (int t = from; t < end; t++) {
+		if (f->c->tk[t].tag == tagNewline) {
+			nl++;
+		} else if (f->c->tk[t].tag == tagComment) {
+			if (nl >= 2 && *any)
+				bufByte(&f->out, '\n');
+			fmtNewline(f, level);
+			fmtComment(f, t);
+			*any = true;
+			nl = 0;
+		}
+	}
+	return nl;
+}
+
+// fmtTrailing writes the comment on the same line after token t if any, 
+// and returns the index of the token following t or the comment.
+int fmtTrailing(cstFmt_t *f, int t) {
+	for (int i = t+1; i < f->c->nTk; i++) {
+		enum tokenTag_t tag = f->c->tk[i].tag;
+		if (tag == tagComment) {
+			bufByte(&f->out, ' ');
+			fmtComment(f, i);
+			return i+1;
+		}
+		if (tag != tagWhitespace && tag != tagComma)
+			break;
+	}
+	return t+1;
+}
+
+// fmtIsOneLine returns true if the container node n is on one line and 
+// contains no comments.
+bool fmtIsOneLine(cstFmt_t *f, int n) {
+	const cstNode_t *nd = &f->c->nodes[n];
+	if (f->c->tk[nd->first].line != f->c->tk[nd->last].line)
+		return false;
+	for (int t = nd->first; t < nd->last; t++)
+		if (f->c->tk[t].tag == tagComment)
+			return false;
+	return true;
+}
+
+void fmtValue(cstFmt_t *f, int n, int level, bool oneLine);
+
+// fmtItems writes the items of the container node n.
+void fmtItems(cstFmt_t *f, int n, int level, bool oneLine) {
+	const qjson_cst_t *c = f->c;
+	int close = c->nodes[n].last;
+	if (oneLine) {
+		for (int ch = n+1; ch < c->nodes[n].end; ch = c->nodes[ch].end) {
+			if (ch != n+1)
+				bufBytes(&f->out, ", ", 2);
+			fmtValue(f, ch, level, true);
+		}
+		return;
+	}
+	bool any = false;
+	int pos = (n == 0) ? 0 : fmtTrailing(f, c->nodes[n].first);
+	for (int ch = n+1; ch < c->nodes[n].end; ch = c->nodes[ch].end) {
+		const cstNode_t *nd = &c->nodes[ch];
+		int nl = fmtLeading(f, pos, (nd->key != noKey) ? nd->key : nd->first, level, &any);
+		if (nd->key != noKey)
+			fmtLeading(f, nd->key+1, nd->first, level, &any); // comments moved before the member
+		if (nl >= 2 && any)
+			bufByte(&f->out, '\n');
+		fmtNewline(f, level);
+		fmtValue(f, ch, level, false);
+		pos = fmtTrailing(f, nd->last);
+		any = true;
+	}
+	fmtLeading(f, pos, close, level, &any);
+	if (n != 0 && any)
+		fmtNewline(f, level-1);
+}
+
+// fmtMultiline writes the multiline string token t with a margin of level.
+void fmtMultiline(cstFmt_t *f, int t, int level) {
+	cstToken_t tk = f->c->tk[t];
+	const char *in = f->c->in;
+	int s = tk.b;
+	while (s > 0 && in[s-1] != '\n')
+		s--;
+	int oldMargin = tk.b - s, start = tk.b, end = tk.b + tk.l;
+	for (int i = start; i < end; i++) {
+		if (in[i] != '\n')
+			continue;
+		bufBytes(&f->out, in+start, i+1-start);
+		bufSpaces(&f->out, level*formatIndent);
+		i += oldMargin;
+		start = i+1;
+	}
+	bufBytes(&f->out, in+start, end-start);
+}
+
+// fmtValue writes the key, if any, and the value of node n.
+void fmtValue(cstFmt_t *f, int n, int level, bool oneLine) {
+	const qjson_cst_t *c = f->c;
+	const cstNode_t *nd = &c->nodes[n];
+	if (nd->key != noKey) {
+		bufBytes(&f->out, c->in+c->tk[nd->key].b, c->tk[nd->key].l);
+		bufByte(&f->out, ':');
+	}
+	cstToken_t tk = c->tk[nd->first];
+	if (tk.tag == tagMultilineString) {
+		if (nd->key != noKey)
+			fmtNewline(f, ++level);
+		fmtMultiline(f, nd->first, level);
+		return;
+	}
+	if (nd->key != noKey)
+		bufByte(&f->out, ' ');
+	if (tk.tag != tagOpenBrace && tk.tag != tagOpenSquare) {
+		bufBytes(&f->out, c->in+tk.b, tk.l);
+		return;
+	}
+	oneLine = oneLine || fmtIsOneLine(f, n);
+	bufByte(&f->out, (tk.tag == tagOpenBrace) ? '{' : '[');
+	fmtItems(f, n, level+1, oneLine);
+	bufByte(&f->out, (tk.tag == tagOpenBrace) ? '}' : ']');
+}
+
+char* qjson_cst_format(const qjson_cst_t *c, size_t *outLen) {
+	cstFmt_t f = {c, {NULL, 0, 0}};
+	bufGrow(&f.out, c->len + c->len/8);
+	fmtItems(&f, 0, 0, false);
+	if (f.out.len > 0)
+		bufByte(&f.out, '\n');
+	bufByte(&f.out, '\0');
+	if (outLen != NULL)
+		*outLen = (size_t)f.out.len-1;
+	return f.out.buf;
+}
+
+// unescapeKey writes the identifier of the key token t in out.
+void unescapeKey(const qjson_cst_t *c, int t, outBuf_t *out) {
+	cstToken_t tk = c->tk[t];
+	const char *p = c->in + tk.b;
+	out->len = 0;
+	if (tk.tag == tagQuotelessString) {
+		bufBytes(out, p, tk.l);
+		return;
+	}
+	for (int i = 1; i < tk.l-1; i++) {
+		if (p[i] != '\\') {
+			bufByte(out, p[i]);
+			continue;
+		}
+		char x = p[++i];
+		switch (x) {
+		case 'n': bufByte(out, '\n'); break;
+		case 't': bufByte(out, '\t'); break;
+		case 'r': bufByte(out, '\r'); break;
+		case 'b': bufByte(out, '\b'); break;
+		case 'f': bufByte(out, '\f'); break;
+		case 'u': {
+			unsigned v = (unsigned)strtoul((char[5]){p[i+1], p[i+2], p[i+3], p[i+4], 0}, NULL, 16);
+			i += 4;
+			if (v >= 0xD800 && v < 0xDC00 && i+6 < tk.l && p[i+1] == '\\' && p[i+2] == 'u') {
+				unsigned lo = (unsigned)strtoul((char[5]){p[i+3], p[i+4], p[i+5], p[i+6], 0}, NULL, 16);
+				if (lo >= 0xDC00 && lo < 0xE000) {
+					v = 0x10000 + ((v - 0xD800) << 10) + (lo - 0xDC00);
+					i += 6;
+				}
+			}
+			bufRune(out, v);
+			break;
+		}
+		default:
+			bufByte(out, x);
+		}
+	}
+}
+
+int qjson_cst_find(const qjson_cst_t *c, const qjson_path_t *path, int n, size_t *start, size_t *end) {
+	int node = 0;
+	outBuf_t key = {NULL, 0, 0};
+	for (int i = 0; i < n && node >= 0; i++) {
+		int tag = (node == 0) ? tagOpenBrace : c->tk[c->nodes[node].first].tag;
+		int idx = 0, found = -1;
+		if (tag != tagOpenBrace && tag != tagOpenSquare) {
+			node = -1;
+			break;
+		}
+		if ((path[i].key == NULL) != (tag == tagOpenSquare)) {
+			node = -1;
+			break;
+		}
+		for (int ch = node+1; ch < c->nodes[node].end; ch = c->nodes[ch].end, idx++) {
+			if (path[i].key == NULL) {
+				if (idx == path[i].index) {
+					found = ch;
+					break;
+				}
+				continue;
+			}
+			// the last of duplicate keys is found, as its value is the decoded one
+			unescapeKey(c, c->nodes[ch].key, &key);
+			if ((size_t)key.len == path[i].keyLen && memcmp(key.buf, path[i].key, key.len) == 0)
+				found = ch;
+		}
+		node = found;
+	}
+	free(key.buf);
+	if (node <= 0)
+		return node;
+	*start = (size_t)c->tk[c->nodes[node].first].b;
+	*end = (size_t)(c->tk[c->nodes[node].last].b + c->tk[c->nodes[node].last].l);
+	return node;
+}
+
+char* qjson_cst_patch(const qjson_cst_t *c, const qjson_path_t *path, int n, const char *value, 
+	size_t valueLen, size_t *outLen, qjson_error_t *err) {
+	size_t start, end;
+	if (n == 0 || qjson_cst_find(c, path, n, &start, &end) <= 0) {
+		*err = (qjson_error_t){ErrPathNotFound, 0, 1, 1};
+		return NULL;
+	}
+	size_t len = (size_t)c->len - (end-start) + valueLen;
+	char *out = malloc(len+1);
+	memcpy(out, c->in, start);
+	memcpy(out+start, value, valueLen);
+	memcpy(out+start+valueLen, c->in+end, (size_t)c->len-end);
+	out[len] = '\0';
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	opts.validateOnly = true;
+	qjson_result_t res;
+	if (!qjson_decode_ex(out, len, &opts, &res)) {
+		*err = res.error;
+		free(out);
+		return NULL;
+	}
+	if (outLen != NULL)
+		*outLen = len;
+	return out;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Document
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// A document keeps its text and the syntax tree of its last valid text.
+// After edits, the text in the dirty range [os, de) replaces the text in
+// [os, oe) of the syntax tree. It is revalidated by reparsing the 
+// smallest sequence of members or values of a container that encloses 
+// the dirty range and ends on the same token as before. Otherwise the 
+// enclosing member or value is reparsed, and so on up to the whole text.
+// The tokens and nodes of the syntax tree are stored in gap buffers whose
+// gap is at the last edit location. The tokens and nodes following the 
+// gap are shifted lazily. The text is also a gap buffer, whose gap is 
+// moved past the reparsed text so that it is parsed in place, and to the
+// end when the whole text is read. The cost of an edit is thus 
+// proportional to the size of the reparsed text and to the distance to 
+// the previous edit. Char indexes are converted into byte offsets from a 
+// checkpoint kept at the last converted index, with the same cost.
+
+struct qjson_doc {
+	char         *text;  // document text, with a gap of gap bytes at gs
+	int           len;   // byte length of the document text
+	int           gs;
+	int           gap;
+	int           ckChar; // char index and byte offset of the checkpoint
+	int           ckByte;
+	qjson_cst_t  *cst;   // syntax tree of the last valid text, or NULL
+	bool          dirty; // the text in [os, de) replaces [os, oe) of cst
+	int           os;
+	int           oe;
+	int           de;
+	int          *path;  // containers and child of the last reparsed sequence
+	int           nPath; // number of nodes in path
+	qjson_error_t err;   // error of the text, msg is NULL when valid
+};
+
+// docRegion_t is a sequence of members or values of a container to reparse.
+typedef struct {
+	int *anc;    // containers from the top level object to the parent of the sequence
+	int  nAnc;   // number of containers in anc
+	int  n0, n1; // replaced nodes
+	int  t0, t1; // replaced tokens
+	int  rs, re; // byte range of the replaced tokens in the syntax tree text
+	bool open;   // the sequence starts after the open token
+	bool close;  // the sequence ends before the close token
+} docRegion_t;
+
+// cstTok returns token i.
+cstToken_t cstTok(const qjson_cst_t *c, int i) {
+	if (i < c->tkFrom)
+		return c->tk[i];
+	cstToken_t t = c->tk[i + c->tkGap];
+	t.b += c->tkB;
+	t.line += c->tkLine;
+	return t;
+}
+
+// cstNode returns node i.
+cstNode_t cstNode(const qjson_cst_t *c, int i) {
+	if (i < c->ndFrom)
+		return c->nodes[i];
+	cstNode_t n = c->nodes[i + c->ndGap];
+	if (n.key != noKey)
+		n.key += c->ndTk;
+	n.first += c->ndTk;
+	n.last += c->ndTk;
+	n.end += c->ndNode;
+	return n;
+}
+
+// cstMoveGap moves the gap of the tokens before token tk and the gap of 
+// the nodes before node nd.
+void cstMoveGap(qjson_cst_t *c, int tk, int nd) {
+	for (; c->tkFrom < tk; c->tkFrom++)
+		c->tk[c->tkFrom] = cstTok(c, c->tkFrom);
+	for (; c->tkFrom > tk; c->tkFrom--) {
+		cstToken_t t = c->tk[c->tkFrom-1];
+		t.b -= c->tkB;
+		t.line -= c->tkLine;
+		c->tk[c->tkFrom-1 + c->tkGap] = t;
+	}
+	for (; c->ndFrom < nd; c->ndFrom++)
+		c->nodes[c->ndFrom] = cstNode(c, c->ndFrom);
+	for (; c->ndFrom > nd; c->ndFrom--) {
+		cstNode_t n = c->nodes[c->ndFrom-1];
+		if (n.key != noKey)
+			n.key -= c->ndTk;
+		n.first -= c->ndTk;
+		n.last -= c->ndTk;
+		n.end -= c->ndNode;
+		c->nodes[c->ndFrom-1 + c->ndGap] = n;
+	}
+}
+
+// cstFlush moves the gaps at the end so that tokens and nodes can be 
+// accessed directly.
+void cstFlush(qjson_cst_t *c) {
+	cstMoveGap(c, c->nTk, c->nNodes);
+	c->tkB = c->tkLine = c->ndTk = c->ndNode = 0;
+}
+
+// cstGrowGap grows the gaps so that they hold at least nTk tokens and nNd nodes.
+void cstGrowGap(qjson_cst_t *c, int nTk, int nNd) {
+	if (c->tkGap < nTk) {
+		int gap = nTk + c->nTk/8 + 64, after = c->nTk - c->tkFrom;
+		c->tk = realloc(c->tk, (c->nTk + gap)*sizeof(cstToken_t));
+		memmove(c->tk + c->tkFrom + gap, c->tk + c->tkFrom + c->tkGap, after*sizeof(cstToken_t));
+		c->tkGap = gap;
+		c->capTk = c->nTk + gap;
+	}
+	if (c->ndGap < nNd) {
+		int gap = nNd + c->nNodes/8 + 64, after = c->nNodes - c->ndFrom;
+		c->nodes = realloc(c->nodes, (c->nNodes + gap)*sizeof(cstNode_t));
+		memmove(c->nodes + c->ndFrom + gap, c->nodes + c->ndFrom + c->ndGap, after*sizeof(cstNode_t));
+		c->ndGap = gap;
+		c->capNodes = c->nNodes + gap;
+	}
+}
+
+// cstSplice replaces the tokens and nodes of region g of c by those of 
+// t, whose indexes start at 0. The following tokens are shifted by dB 
+// bytes and dLine lines.
+void cstSplice(qjson_cst_t *c, const docRegion_t *g, const qjson_cst_t *t, int dB, int dLine) {
+	int dTk = t->nTk - (g->t1 - g->t0), dNd = t->nNodes - (g->n1 - g->n0);
+	cstMoveGap(c, g->t1, g->n1);
+	c->tkGap += g->t1 - g->t0;
+	c->tkFrom = g->t0;
+	c->ndGap += g->n1 - g->n0;
+	c->ndFrom = g->n0;
+	c->nTk -= g->t1 - g->t0;
+	c->nNodes -= g->n1 - g->n0;
+	cstGrowGap(c, t->nTk, t->nNodes);
+	memcpy(c->tk + g->t0, t->tk, t->nTk*sizeof(cstToken_t));
+	c->tkFrom += t->nTk;
+	c->tkGap -= t->nTk;
+	c->nTk += t->nTk;
+	for (int i = 0; i < t->nNodes; i++) {
+		cstNode_t n = t->nodes[i];
+		c->nodes[g->n0+i] = (cstNode_t){(n.key == noKey) ? noKey : n.key + g->t0, n.first + g->t0, 
+			n.last + g->t0, n.end + g->n0};
+	}
+	c->ndFrom += t->nNodes;
+	c->ndGap -= t->nNodes;
+	c->nNodes += t->nNodes;
+	c->tkB += dB;
+	c->tkLine += dLine;
+	c->ndTk += dTk;
+	c->ndNode += dNd;
+	for (int i = 0; i < g->nAnc; i++) {
+		c->nodes[g->anc[i]].last += dTk;
+		c->nodes[g->anc[i]].end += dNd;
+	}
+	c->len += dB;
+	c->endLine += dLine;
+}
+
+// isTrivia returns true for white space, newline and comment tokens.
+bool isTrivia(enum tokenTag_t tag) {
+	return tag == tagWhitespace || tag == tagNewline || tag == tagComment;
+}
+
+// regionSet sets g to the sequence of children from i to j of the last 
+// container of g. i < 0 stands for the start after the open token and 
+// j < 0 for the end before the close token.
+void regionSet(const qjson_cst_t *c, docRegion_t *g, int i, int j) {
+	int n = g->anc[g->nAnc-1];
+	cstNode_t nd = cstNode(c, n);
+	g->open = i < 0;
+	g->close = j < 0;
+	if (i >= 0) {
+		cstNode_t ni = cstNode(c, i);
+		g->n0 = i;
+		g->t0 = (ni.key != noKey) ? ni.key : ni.first;
+		g->rs = cstTok(c, g->t0).b;
+	} else {
+		g->n0 = n+1;
+		g->t0 = nd.first+1;
+		g->rs = (n == 0) ? 0 : cstTok(c, nd.first).b+1;
+	}
+	if (j >= 0) {
+		// the trivia following the child are included because an edit 
+		// may change them, e.g. by inserting a # in front of the child
+		cstNode_t nj = cstNode(c, j);
+		g->n1 = nj.end;
+		g->t1 = nj.last+1;
+		while (g->t1 < c->nTk && isTrivia(cstTok(c, g->t1).tag))
+			g->t1++;
+		g->re = (g->t1 < c->nTk) ? cstTok(c, g->t1).b : c->len;
+	} else {
+		g->n1 = nd.end;
+		g->t1 = nd.last;
+		g->re = (n == 0) ? c->len : cstTok(c, nd.last).b;
+	}
+}
+
+// regionFind sets g to the smallest sequence enclosing [os, oe). The 
+// children are scanned from the path of the previous sequence when it is
+// the same as g.
+void regionFind(const qjson_doc_t *d, docRegion_t *g, int os, int oe) {
+	const qjson_cst_t *c = d->cst;
+	int n = 0;
+	g->nAnc = 0;
+	for (;;) {
+		int k = g->nAnc;
+		g->anc[g->nAnc++] = n;
+		cstNode_t nd = cstNode(c, n);
+		int i = -1, j = -1, ch = n+1;
+		if (k+1 < d->nPath && d->path[k] == n && d->path[k+1] < nd.end) {
+			cstNode_t h = cstNode(c, d->path[k+1]);
+			if (cstTok(c, (h.key != noKey) ? h.key : h.first).b < os)
+				ch = d->path[k+1];
+		}
+		for (; ch < nd.end; ch = cstNode(c, ch).end) {
+			cstNode_t cn = cstNode(c, ch);
+			cstToken_t last = cstTok(c, cn.last);
+			if (cstTok(c, (cn.key != noKey) ? cn.key : cn.first).b < os)
+				i = ch; // text inserted at the start of a child may be a separator
+			if (last.b + last.l >= oe) {
+				j = ch;
+				break;
+			}
+		}
+		if (i >= 0 && i == j) {
+			cstNode_t cn = cstNode(c, i);
+			cstToken_t open = cstTok(c, cn.first);
+			if ((open.tag == tagOpenBrace || open.tag == tagOpenSquare) && os > open.b && 
+				oe <= cstTok(c, cn.last).b) {
+				n = i;
+				continue;
+			}
+		}
+		regionSet(c, g, i, j);
+		return;
+	}
+}
+
+// regionUp sets g to the member or value enclosing g.
+void regionUp(const qjson_cst_t *c, docRegion_t *g) {
+	if (g->nAnc == 1) {
+		regionSet(c, g, -1, -1);
+		return;
+	}
+	int n = g->anc[--g->nAnc];
+	regionSet(c, g, n, n);
+}
+
+// docWindow is the number of bytes following the reparsed text that are
+// made contiguous before parsing it, and the initial gap of the text.
+const int docWindow = 4096;
+
+// docAt returns the byte at offset b of the document text.
+byte docAt(const qjson_doc_t *d, int b) {
+	return (byte)d->text[(b < d->gs) ? b : b + d->gap];
+}
+
+// docMoveGap moves the gap of the text to offset b.
+void docMoveGap(qjson_doc_t *d, int b) {
+	if (b < d->gs)
+		memmove(d->text + b + d->gap, d->text + b, d->gs - b);
+	else
+		memmove(d->text + d->gs, d->text + d->gs + d->gap, b - d->gs);
+	d->gs = b;
+}
+
+// docChars returns the number of utf8 chars of the text from byte a to b.
+int docChars(const qjson_doc_t *d, int a, int b) {
+	int n = 0;
+	for (; a < b; a++)
+		n += (docAt(d, a) & 0xC0) != 0x80;
+	return n;
+}
+
+// docSetError sets the error of d from the error token of e.
+void docSetError(qjson_doc_t *d, const engine_t *e) {
+	pos_t pos = e->tk.pos;
+	d->err = (qjson_error_t){e->tk.val.p, (size_t)pos.b, pos.l+1, 
+		column((slice_t){d->text+pos.s, pos.b-pos.s})+1};
+}
+
+// docLineStart returns the byte offset of the start of the line containing b.
+int docLineStart(const qjson_doc_t *d, int b) {
+	while (b > 0 && d->text[b-1] != '\n')
+		b--;
+	return b;
+}
+
+// docParseWindow parses the region g in the text before the gap, like 
+// docParse. It returns -2 if the parsing ended close enough to the gap 
+// for the lexer to have looked ahead into it.
+int docParseWindow(qjson_doc_t *d, const docRegion_t *g, bool keys, int stop) {
+	const qjson_cst_t *c = d->cst;
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	opts.validateOnly = true;
+	engine_t e;
+	engineInit(&e, d->text, d->gs, &opts);
+	e.p = (slice_t){d->text+g->rs, d->gs-g->rs};
+	e.pos = (pos_t){g->rs, docLineStart(d, g->rs), cstTok(c, g->t0).line};
+	e.depth = g->nAnc-1;
+	enum tokenTag_t close = keys ? tagCloseBrace : tagCloseSquare;
+	bool notFirst = !g->open, sep = g->open;
+	nextToken(&e);
+	while (!done(&e) && e.tk.tag != close && e.tk.pos.b < stop) {
+		if (notFirst && sep && e.tk.tag == tagComma) {
+			const char *err = keys ? ErrExpectIdentifierAfterComma : ErrExpectValueAfterComma;
+			nextToken(&e);
+			if (done(&e)) {
+				if (e.tk.val.p == ErrEndOfInput)
+					setError(&e, err);
+				break;
+			}
+			if (e.tk.tag == tagCloseBrace || e.tk.tag == tagCloseSquare) {
+				setError(&e, err);
+				break;
+			}
+		}
+		notFirst = sep = true;
+		if (keys ? member(&e, e.out.len) : value(&e))
+			break;
+	}
+	free(e.out.buf);
+	// a token is lexed looking ahead of at most a few bytes
+	if (d->gs < d->len && e.pos.b + 64 > d->gs)
+		return -2;
+	if (done(&e) && e.tk.val.p != ErrEndOfInput) {
+		docSetError(d, &e);
+		return -1;
+	}
+	if (e.tk.pos.b != stop || (!notFirst && !g->close))
+		return 0;
+	return 1;
+}
+
+// docParse parses the region g in the document text. It returns 1 if the
+// parsing ends on the token following g, 0 if not, and -1 if the text is 
+// invalid with d->err set. The text before the gap is parsed, and parsed
+// again with the gap moved further if the parsing went close to the gap,
+// where the lexer could have looked ahead.
+int docParse(qjson_doc_t *d, const docRegion_t *g, bool keys) {
+	int stop = g->re + d->de - d->oe, window = docWindow;
+	if (d->gs < stop || d->gs - stop < window)
+		docMoveGap(d, (d->len - stop > window) ? stop + window : d->len);
+	for (;;) {
+		int m = docParseWindow(d, g, keys, stop);
+		if (m != -2)
+			return m;
+		window = (window < d->len/2) ? window*2 : d->len;
+		docMoveGap(d, (d->len - d->gs > window) ? d->gs + window : d->len);
+	}
+}
+
+// docUpdate replaces the tokens and nodes of the region g by those of 
+// the document text, and records the path of g.
+void docUpdate(qjson_doc_t *d, const docRegion_t *g, bool keys) {
+	qjson_cst_t *c = d->cst;
+	int delta = d->de - d->oe;
+	int re = g->re + delta, line = cstTok(c, g->t0).line;
+	int oldEndLine = (g->t1 < c->nTk) ? cstTok(c, g->t1).line : c->endLine;
+	qjson_cst_t t;
+	memset(&t, 0, sizeof(t));
+	t.in = d->text;
+	t.len = re;
+	qjson_lexer_t lx;
+	lexerInit(&lx, d->text, re, true);
+	lx.e.p = (slice_t){d->text+g->rs, re-g->rs};
+	lx.e.pos = (pos_t){g->rs, docLineStart(d, g->rs), line};
+	lx.tkEnd = g->rs;
+	lx.tkLine = line;
+	cstToken_t tk;
+	while (lexerNext(&lx, &tk))
+		cstAddToken(&t, tk.tag, tk.b, tk.l, tk.line);
+	int i = cstNext(&t, -1);
+	cstItems(&t, &i, tagUnknown, keys);
+	c->in = d->text;
+	cstSplice(c, g, &t, delta, lx.line - oldEndLine);
+	memcpy(d->path, g->anc, g->nAnc*sizeof(int));
+	d->nPath = g->nAnc;
+	if (!g->open && t.nNodes > 0)
+		d->path[d->nPath++] = g->n0;
+	free(t.tk);
+	free(t.nodes);
+}
+
+// docRebuild parses the whole document text.
+bool docRebuild(qjson_doc_t *d) {
+	docMoveGap(d, d->len);
+	qjson_cst_t *c = qjson_cst_parse(d->text, (size_t)d->len, &d->err);
+	if (c == NULL)
+		return false;
+	qjson_cst_free(d->cst);
+	d->cst = c;
+	d->dirty = false;
+	d->nPath = 0;
+	return true;
+}
+
+// docRevalidate validates the document text after an edit.
+bool docRevalidate(qjson_doc_t *d) {
+	qjson_cst_t *c = d->cst;
+	if (c == NULL)
+		return docRebuild(d);
+	c->in = d->text;
+	int anc[maxDepth+2];
+	docRegion_t g = {.anc = anc};
+	regionFind(d, &g, d->os, d->oe);
+	for (;;) {
+		if (g.nAnc == 1 && g.open && g.close)
+			return docRebuild(d);
+		int n = g.anc[g.nAnc-1];
+		bool keys = n == 0 || cstTok(c, cstNode(c, n).first).tag == tagOpenBrace;
+		int m = docParse(d, &g, keys);
+		if (m < 0)
+			return false;
+		if (m > 0) {
+			docUpdate(d, &g, keys);
+			d->dirty = false;
+			return true;
+		}
+		regionUp(c, &g);
+	}
+}
+
+qjson_doc_t* qjson_doc_new(const char *qjsonText, size_t len) {
+	if (len > 0x7FFFFFFF)
+		return NULL;
+	qjson_doc_t *d = calloc(1, sizeof(qjson_doc_t));
+	d->len = d->gs = (int)len;
+	d->gap = docWindow;
+	d->text = malloc(len + d->gap + 1);
+	memcpy(d->text, qjsonText, len);
+	d->text[len + d->gap] = '\0';
+	d->path = malloc((maxDepth+3)*sizeof(int));
+	docRebuild(d);
+	return d;
+}
+
+void qjson_doc_free(qjson_doc_t *d) {
+	if (d == NULL)
+		return;
+	qjson_cst_free(d->cst);
+	free(d->path);
+	free(d->text);
+	free(d);
+}
+// docReplace replaces the bytes from s to e of the text by the r bytes of 
+// text at the gap, and keeps the checkpoint valid.
+void docReplace(qjson_doc_t *d, int s, int e, const char *text, int r) {
+	if (d->ckByte >= e) {
+		d->ckChar -= docChars(d, s, e);
+		for (int i = 0; i < r; i++)
+			d->ckChar += (text[i] & 0xC0) != 0x80;
+		d->ckByte += r - (e-s);
+	} else if (d->ckByte > s) {
+		d->ckChar -= docChars(d, s, d->ckByte);
+		d->ckByte = s;
+	}
+	docMoveGap(d, e);
+	d->gs = s;
+	d->gap += e-s;
+	if (d->gap < r) {
+		// the gap is grown by the size of the text, so that the cost of
+		// growing it is amortized
+		int tail = d->len - e, gap = r + d->len/4 + docWindow;
+		d->text = realloc(d->text, s + gap + tail + 1);
+		memmove(d->text + s + gap, d->text + s + d->gap, tail + 1);
+		d->gap = gap;
+	}
+	memcpy(d->text + s, text, r);
+	d->gs += r;
+	d->gap -= r;
+	d->len += r - (e-s);
+}
+
+bool qjson_doc_edit(qjson_doc_t *d, size_t start, size_t end, const char *text, size_t len, qjson_error_t *err) {
+	if (start > end || end > (size_t)d->len || len > 0x7FFFFFFF || (size_t)d->len - (end-start) + len > 0x7FFFFFFF) {
+		*err = (qjson_error_t){ErrInvalidEditRange, start, 1, 1};
+		return false;
+	}
+	int s = (int)start, e = (int)end, r = (int)len;
+	docReplace(d, s, e, text, r);
+	if (!d->dirty) {
+		d->os = s;
+		d->oe = e;
+		d->de = s + r;
+		d->dirty = true;
+	} else {
+		int oe = (e > d->de) ? d->oe + e - d->de : d->oe;
+		d->de = oe - d->oe + d->de + r - (e-s);
+		d->oe = oe;
+		if (s < d->os)
+			d->os = s;
+	}
+	d->err.msg = NULL;
+	if (!docRevalidate(d)) {
+		*err = d->err;
+		return false;
+	}
+	return true;
+}
+
+const char* qjson_doc_text(qjson_doc_t *d, size_t *len) {
+	docMoveGap(d, d->len);
+	if (len != NULL)
+		*len = (size_t)d->len;
+	return d->text;
+}
+
+bool qjson_doc_byte_offset(qjson_doc_t *d, size_t pos, size_t *offset) {
+	int c = d->ckChar, b = d->ckByte;
+	if (pos < (size_t)c && pos < (size_t)c - pos) {
+		c = 0;
+		b = 0;
+	}
+	for (; (size_t)c < pos && b < d->len; c++)
+		for (b++; b < d->len && (docAt(d, b) & 0xC0) == 0x80; b++)
+			;
+	for (; (size_t)c > pos; c--)
+		for (b--; b > 0 && (docAt(d, b) & 0xC0) == 0x80; b--)
+			;
+	d->ckChar = c;
+	d->ckByte = b;
+	*offset = (size_t)b;
+	return (size_t)c == pos;
+}
+
+bool qjson_doc_error(const qjson_doc_t *d, qjson_error_t *err) {
+	if (d->err.msg == NULL)
+		return false;
+	*err = d->err;
+	return true;
+}
+
+const qjson_cst_t* qjson_doc_cst(qjson_doc_t *d) {
+	if (d->cst == NULL || d->dirty)
+		return NULL;
+	cstFlush(d->cst);
+	docMoveGap(d, d->len);
+	d->cst->in = d->text;
+	return d->cst;
+}
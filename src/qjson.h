@@ -11,17 +11,380 @@ extern "C" {
 #define timegm _mkgmtime
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
+
+// QJSON_API marks the functions exported by the libqjson shared library
+// when it is compiled with -fvisibility=hidden.
+#if defined(_WIN32) && defined(QJSON_BUILD_DLL)
+#define QJSON_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define QJSON_API __attribute__((visibility("default")))
+#else
+#define QJSON_API
+#endif
+
 // qjson_decode accept a qjson text string as input and returns a 
 // heap allocated string. If the string start with the character '{',
 // the string is the json encoding of the input text, otherwise it
 // is an error message. qjson_decode will never return NULL or an
 // empty string.
-char* qjson_decode(const char* qjsonText);
+QJSON_API char* qjson_decode(const char* qjsonText);
+
+// QJSON_NO_XXX are the syntax features that can be disabled with the
+// disabled field of qjson_options_t. Their checks are then skipped.
+#define QJSON_NO_EXPRESSIONS 0x1 // numeric expressions, json numbers are then copied as is
+#define QJSON_NO_DURATIONS   0x2 // durations like 1h30m
+#define QJSON_NO_DATES       0x4 // ISO date times, a : then always ends a quoteless string
+#define QJSON_NO_MULTILINE   0x8 // multiline strings, a ` is then a quoteless string char
+
+// qjson_dup_policy_t is the handling of keys met twice in an object.
+typedef enum {
+	QJSON_DUP_ALLOW, // duplicate members are output
+	QJSON_DUP_ERROR, // a duplicate key is an error
+	QJSON_DUP_FIRST, // the first member is kept, the others are dropped
+	QJSON_DUP_LAST   // the first member is kept with the value of the last one
+} qjson_dup_policy_t;
+
+// qjson_includes_t is a cache of the json of the files included by values
+// of the form "@include path", shared by the calls given it as option.
+typedef struct qjson_includes qjson_includes_t;
+
+// qjson_allocator_t allocates the memory of a conversion. realloc resizes 
+// the block p to size bytes and returns it, like the C realloc. p is NULL
+// to allocate a block, and size is 0 to free p. It must not return NULL
+// for a size greater than 0.
+typedef struct {
+	void* (*realloc)(void *arg, void *p, size_t size);
+	void  *arg; // argument of realloc
+} qjson_allocator_t;
+
+// qjson_options_t holds the per call options of qjson_decode_ex. 
+// Initialize it with qjson_options_init before setting fields.
+typedef struct {
+	bool validateOnly; // check the input without producing json output
+	bool sourceMap;    // record a source map of the json output in the result; ignored, the result sourceMap
+	                   // being NULL, with canonical, digestOnly, flatten, indent, separators, ensureAscii
+	                   // or the QJSON_DUP_FIRST and QJSON_DUP_LAST policies, which rewrite the output
+	int  maxErrors;    // when greater than 1, recover from errors and collect up to maxErrors of them
+	unsigned disabled;   // disabled syntax features, a combination of QJSON_NO_XXX flags
+	bool rejectDisabled; // disabled expressions, durations and multiline strings are errors instead of quoteless strings
+	qjson_dup_policy_t duplicateKeys; // handling of duplicate keys, keys are compared unescaped
+	bool canonical;      // output canonical json with sorted keys and normalized numbers and strings, and its digest
+	bool digestOnly;     // compute the digest of the canonical json without returning it
+	bool flatten;        // output a "path\tvalue\n" line per scalar value or empty container, path being its json pointer
+	const char *indent;        // indent of one nesting level, each member and value being on its own line, NULL for one line
+	const char *itemSeparator; // separator of members and values, NULL for ","
+	const char *keySeparator;  // separator of keys and values, NULL for ":", or ": " with an indent
+	bool ensureAscii;    // escape non ascii chars as \uxxxx, and chars above U+FFFF as surrogate pairs
+	qjson_includes_t *includes; // replace "@include path" values by the json of the file, NULL to disable includes
+	const qjson_allocator_t *allocator; // allocator of the result and work buffers, NULL for malloc
+
+	// Execution limits, 0 for no limit. The token count, output size, time
+	// and cancellation are checked every 1024 tokens.
+	size_t maxInputBytes;  // maximum byte length of the input
+	size_t maxOutputBytes; // maximum byte length of the json output
+	size_t maxTokens;      // maximum number of tokens
+	int    maxDepth;       // maximum nesting depth of objects and arrays, 200 at most
+	double timeout;        // maximum conversion time in seconds
+	const volatile bool *cancel; // the conversion is cancelled when *cancel becomes true
+	bool (*check)(void *arg);    // called about every 10 ms, the conversion is cancelled when it returns false
+	void  *checkArg;             // argument of check
+} qjson_options_t;
+
+// qjson_options_init sets opts to the default options.
+QJSON_API void qjson_options_init(qjson_options_t *opts);
+
+// qjson_error_code_t is the kind of a decoding error.
+typedef enum {
+	QJSON_ERROR_SYNTAX,       // invalid input
+	QJSON_ERROR_INPUT_LIMIT,  // input larger than maxInputBytes or 2GB
+	QJSON_ERROR_OUTPUT_LIMIT, // output larger than maxOutputBytes
+	QJSON_ERROR_TOKEN_LIMIT,  // more tokens than maxTokens
+	QJSON_ERROR_DEPTH_LIMIT,  // nesting deeper than maxDepth
+	QJSON_ERROR_TIME_LIMIT,   // conversion longer than timeout
+	QJSON_ERROR_CANCELLED     // conversion cancelled by cancel or check
+} qjson_error_code_t;
+
+// qjson_error_t is a decoding error with its position in the input. The
+// position of a limit error is the position reached by the conversion.
+typedef struct {
+	const char         *msg;    // static error message (e.g. "syntax error")
+	size_t              offset; // byte offset of the error in the input
+	int                 line;   // line number starting at 1
+	int                 col;    // column in utf8 chars starting at 1
+	qjson_error_code_t  code;   // kind of error
+} qjson_error_t;
+
+// qjson_source_map_t maps the offsets of keys and values in the json output
+// to their position in the qjson input.
+typedef struct qjson_source_map qjson_source_map_t;
+
+// qjson_result_t is the result of qjson_decode_ex. 
+typedef struct {
+	char               *json;      // heap allocated json text, NULL on error or in validate only mode
+	size_t              len;       // byte length of json, excluding the terminating '\0'
+	qjson_error_t       error;     // error.msg is NULL when no error occurred
+	qjson_source_map_t *sourceMap; // source map when requested by the options and compatible with them, NULL otherwise
+	qjson_error_t      *errors;    // errors in the order they are met when opts->maxErrors > 1, error is the first one
+	size_t              nErrors;   // number of errors
+	unsigned char       digest[16]; // 128 bit MurmurHash3 of the canonical json when opts->canonical or digestOnly
+	size_t              layer;      // index of the input in error for qjson_merge and qjson_diff
+	char               *errorFile;  // path of the included file in which error is, NULL if it is in the input
+	const qjson_allocator_t *allocator; // allocator of json, sourceMap and errors, NULL for malloc
+} qjson_result_t;
+
+// qjson_decode_ex converts the len bytes of qjsonText into json. The input
+// doesn’t need to be '\0' terminated. opts may be NULL to use the default
+// options. It returns true and res->json on success, otherwise it returns
+// false with res->error set. res must be released with qjson_result_free.
+QJSON_API bool qjson_decode_ex(const char *qjsonText, size_t len, const qjson_options_t *opts, qjson_result_t *res);
+
+// qjson_result_free releases the memory held by res. 
+QJSON_API void qjson_result_free(qjson_result_t *res);
+
+// qjson_includes_new returns a cache of included files. The path of an
+// "@include path" value is relative to the directory of the including 
+// file, or to baseDir for the decoded text. An included file is decoded
+// once with the options of the call, and again only when its modification
+// time or size changes. Its json object replaces the directive. Include
+// cycles and nesting deeper than maxDepth files are errors. A cache must
+// not be used by concurrent calls.
+QJSON_API qjson_includes_t* qjson_includes_new(const char *baseDir, int maxDepth);
+
+// qjson_includes_free releases inc and the cached json.
+QJSON_API void qjson_includes_free(qjson_includes_t *inc);
+
+// qjson_includes_stats sets *parses to the number of included files 
+// decoded with inc, and *hits to the number of includes served from it.
+QJSON_API void qjson_includes_stats(const qjson_includes_t *inc, size_t *parses, size_t *hits);
+
+// qjson_mapping_t is the input position of a key or value of the output.
+typedef struct {
+	size_t outOffset; // byte offset of the key or value in the json output
+	size_t offset;    // byte offset of its first token in the qjson input
+	int    line;      // line number starting at 1
+	int    col;       // column in utf8 chars starting at 1
+} qjson_mapping_t;
+
+// qjson_source_map_lookup sets res to the mapping of the last key or value
+// starting at or before outOffset in the json output. qjsonText is the
+// decoded input, used to compute the column in utf8 chars. When it is NULL,
+// the column is in bytes. It returns false if m is NULL or empty.
+QJSON_API bool qjson_source_map_lookup(const qjson_source_map_t *m, size_t outOffset, const char *qjsonText, qjson_mapping_t *res);
+
+// qjson_merge_arrays_t is the merging of an array with an array of the same
+// key in a later layer.
+typedef enum {
+	QJSON_MERGE_REPLACE, // the later array replaces the earlier one
+	QJSON_MERGE_CONCAT   // the elements of the later array are appended
+} qjson_merge_arrays_t;
+
+// qjson_merge decodes the n qjson texts with opts and merges them in order.
+// Objects are merged recursively, keys first met in a later layer are 
+// appended, and other values replace the earlier value of the same key. 
+// Within a layer, a repeated key replaces the value of the previous one 
+// without merging, as with QJSON_DUP_LAST, which overrides opts.
+// It returns true and res->json on success, otherwise it returns false with
+// res->error set and res->layer the index of the invalid text. res must be
+// released with qjson_result_free.
+QJSON_API bool qjson_merge(const char *const *qjsonTexts, const size_t *lens, size_t n, const qjson_options_t *opts, 
+	qjson_merge_arrays_t arrays, qjson_result_t *res);
+
+// qjson_merge_json merges in order, like qjson_merge, the n json objects 
+// output by qjson_decode_ex with the default options and QJSON_DUP_LAST,
+// without decoding them again. It sets res->json, which must be released
+// with qjson_result_free.
+QJSON_API void qjson_merge_json(const char *const *jsons, size_t n, qjson_merge_arrays_t arrays, qjson_result_t *res);
+
+// qjson_diff decodes the old and new qjson texts with opts and sets 
+// res->json to the json array of the RFC 6902 operations changing the old 
+// json into the new one, or of the json pointers of the changed values when
+// pathsOnly is true. Subtrees are compared by 64 bit hash. It returns false
+// with res->error set and res->layer 0 or 1 if a text is invalid. res must
+// be released with qjson_result_free.
+QJSON_API bool qjson_diff(const char *oldText, size_t oldLen, const char *newText, size_t newLen, const qjson_options_t *opts,
+	bool pathsOnly, qjson_result_t *res);
+
+
+// qjson_from_json converts the len bytes of jsonText, a json object, into
+// idiomatic qjson text. Keys and values are quoteless where it is safe, 
+// commas are dropped and long texts are written as multiline strings. 
+// Numbers, literals and other strings are copied unmodified so that 
+// decoding the qjson text yields the same json text as decoding the 
+// input members. It returns the heap allocated '\0' terminated qjson text
+// and its byte length in *outLen, or NULL with *err set if the json text 
+// is invalid. outLen may be NULL.
+QJSON_API char* qjson_from_json(const char *jsonText, size_t len, size_t *outLen, qjson_error_t *err);
+
+// qjson_writer_t writes idiomatic qjson text. The top level value must 
+// be an object. It is written without braces. Members and values are 
+// written one per line. Strings are written quoteless where it is safe,
+// as multiline strings when they are long texts, and quoted otherwise.
+typedef struct qjson_writer qjson_writer_t;
+
+// qjson_writer_new returns a writer indenting nested values with indent
+// spaces per level, and separating members and values with commas if 
+// commas is true.
+QJSON_API qjson_writer_t* qjson_writer_new(int indent, bool commas);
+
+// qjson_writer_free releases w and its output.
+QJSON_API void qjson_writer_free(qjson_writer_t *w);
+
+// qjson_write_begin_object and qjson_write_end_object delimit an object.
+// In an object, each value must be preceded by a call to qjson_write_key.
+QJSON_API void qjson_write_begin_object(qjson_writer_t *w);
+QJSON_API void qjson_write_end_object(qjson_writer_t *w);
+
+// qjson_write_begin_array and qjson_write_end_array delimit an array. The
+// values are written on one line when oneLine is true.
+QJSON_API void qjson_write_begin_array(qjson_writer_t *w, bool oneLine);
+QJSON_API void qjson_write_end_array(qjson_writer_t *w);
+
+// qjson_write_key writes the member identifier s of byte length len.
+QJSON_API void qjson_write_key(qjson_writer_t *w, const char *s, size_t len);
+
+// qjson_write_string writes the string value s of byte length len.
+QJSON_API void qjson_write_string(qjson_writer_t *w, const char *s, size_t len);
+
+// qjson_write_raw writes the len bytes of s unmodified as a value. It is
+// used for numbers, durations, ISO date times and literals.
+QJSON_API void qjson_write_raw(qjson_writer_t *w, const char *s, size_t len);
+
+// qjson_writer_finish returns the heap allocated '\0' terminated qjson 
+// text written so far, and its byte length in *len if len is not NULL. 
+// The writer is reset and can be reused.
+QJSON_API char* qjson_writer_finish(qjson_writer_t *w, size_t *len);
+
+// qjson_token_tag_t is the tag of a token returned by the lexer.
+typedef enum {
+	QJSON_TOKEN_END,                  // end of input
+	QJSON_TOKEN_ERROR,                // invalid input, see qjson_lexer_error
+	QJSON_TOKEN_OPEN_BRACE,           // {
+	QJSON_TOKEN_CLOSE_BRACE,          // }
+	QJSON_TOKEN_OPEN_SQUARE,          // [
+	QJSON_TOKEN_CLOSE_SQUARE,         // ]
+	QJSON_TOKEN_COLON,                // :
+	QJSON_TOKEN_COMMA,                // ,
+	QJSON_TOKEN_QUOTELESS_STRING,     // identifiers, numbers, literals and texts
+	QJSON_TOKEN_DOUBLE_QUOTED_STRING, // "..." with its quotes
+	QJSON_TOKEN_SINGLE_QUOTED_STRING, // '...' with its quotes
+	QJSON_TOKEN_MULTILINE_STRING,     // from ` to the closing `
+	QJSON_TOKEN_WHITESPACE,           // white spaces, when trivia is requested
+	QJSON_TOKEN_NEWLINE,              // \n or \r\n, when trivia is requested
+	QJSON_TOKEN_COMMENT               // #... //... or /*...*/, when trivia is requested
+} qjson_token_tag_t;
+
+// qjson_token_t is a token of a qjson text. text points into the input.
+typedef struct {
+	qjson_token_tag_t tag;    // token tag
+	const char       *text;   // first byte of the token in the input
+	size_t            offset; // byte offset of the token in the input
+	size_t            len;    // byte length of the token
+	int               line;   // line number of the first byte starting at 1
+} qjson_token_t;
+
+// qjson_lexer_t iterates over the tokens of a qjson text without 
+// allocating memory per token. It checks the validity of tokens, not 
+// of the grammar.
+typedef struct qjson_lexer qjson_lexer_t;
+
+// qjson_lexer_new returns a lexer of the len bytes of qjsonText, which 
+// must remain valid while the lexer is used. White spaces, newlines and 
+// comments are returned when trivia is true. It returns NULL if the text
+// is too large.
+QJSON_API qjson_lexer_t* qjson_lexer_new(const char *qjsonText, size_t len, bool trivia);
+
+// qjson_lexer_free releases lx.
+QJSON_API void qjson_lexer_free(qjson_lexer_t *lx);
+
+// qjson_lexer_next sets *tk to the next token and returns true. At the end
+// of input or on error, it returns false with tk->tag set to 
+// QJSON_TOKEN_END or QJSON_TOKEN_ERROR.
+QJSON_API bool qjson_lexer_next(qjson_lexer_t *lx, qjson_token_t *tk);
+
+// qjson_lexer_error returns true with *err set if lx stopped on an error.
+QJSON_API bool qjson_lexer_error(const qjson_lexer_t *lx, qjson_error_t *err);
+
+// qjson_cst_t is a lossless concrete syntax tree of a qjson text. It 
+// keeps comments, white spaces, commas and string styles as slices of 
+// the text, which must remain valid and unmodified while the tree is used.
+typedef struct qjson_cst qjson_cst_t;
+
+// qjson_path_t is an element of a path in a syntax tree. It is the member
+// key of byte length keyLen, or the array index when key is NULL.
+typedef struct {
+	const char *key;
+	size_t      keyLen;
+	int         index;
+} qjson_path_t;
+
+// qjson_cst_parse returns the syntax tree of the len bytes of qjsonText,
+// or NULL with *err set if the text is invalid.
+QJSON_API qjson_cst_t* qjson_cst_parse(const char *qjsonText, size_t len, qjson_error_t *err);
+
+// qjson_cst_free releases the syntax tree c.
+QJSON_API void qjson_cst_free(qjson_cst_t *c);
+
+// qjson_cst_format returns the heap allocated '\0' terminated text of c in
+// the canonical layout, and its byte length in *outLen if outLen is not 
+// NULL. Values are indented by two spaces per level, one per line, 
+// without commas, unless they were on one line without comments. Comments 
+// and single blank lines are preserved, as well as the string styles.
+QJSON_API char* qjson_cst_format(const qjson_cst_t *c, size_t *outLen);
+
+// qjson_cst_find sets *start and *end to the byte range of the value at 
+// the path of n elements. It returns a positive value if found, 0 for the
+// empty path, and -1 if not found. A key repeated in an object designates
+// its last member, whose value is the one kept by the decoder.
+QJSON_API int qjson_cst_find(const qjson_cst_t *c, const qjson_path_t *path, int n, size_t *start, size_t *end);
+
+// qjson_cst_patch returns the heap allocated '\0' terminated text of c
+// where the value at the path of n elements is replaced by the qjson 
+// value text of byte length valueLen. The rest of the text is unmodified.
+// It returns NULL with *err set if the path is not found or the result is
+// invalid. outLen may be NULL.
+QJSON_API char* qjson_cst_patch(const qjson_cst_t *c, const qjson_path_t *path, int n, const char *value, 
+	size_t valueLen, size_t *outLen, qjson_error_t *err);
+
+// qjson_doc_t is an editable qjson document. It keeps the syntax tree of
+// its text so that an edit is revalidated by reparsing only the smallest 
+// enclosing sequence of members or values whose boundaries are unchanged.
+typedef struct qjson_doc qjson_doc_t;
+
+// qjson_doc_new returns a document with a copy of the len bytes of 
+// qjsonText, which may be invalid. It returns NULL if the text is too large.
+QJSON_API qjson_doc_t* qjson_doc_new(const char *qjsonText, size_t len);
+
+// qjson_doc_free releases d.
+QJSON_API void qjson_doc_free(qjson_doc_t *d);
+
+// qjson_doc_edit replaces the bytes from start to end of the document text
+// by the len bytes of text. It returns true if the resulting text is 
+// valid, otherwise it returns false with *err set.
+QJSON_API bool qjson_doc_edit(qjson_doc_t *d, size_t start, size_t end, const char *text, size_t len, qjson_error_t *err);
+
+// qjson_doc_text returns the '\0' terminated document text and its byte 
+// length in *len if len is not NULL. It is valid until the next edit.
+QJSON_API const char* qjson_doc_text(qjson_doc_t *d, size_t *len);
+
+// qjson_doc_byte_offset sets *offset to the byte offset of the utf8 char 
+// index pos of the document text. It returns false with *offset the byte
+// length of the text if pos is beyond its end. The chars are counted from
+// the previous converted index, so that converting indexes close to each
+// other is fast.
+QJSON_API bool qjson_doc_byte_offset(qjson_doc_t *d, size_t pos, size_t *offset);
+
+// qjson_doc_error returns true with *err set if the document text is invalid.
+QJSON_API bool qjson_doc_error(const qjson_doc_t *d, qjson_error_t *err);
 
+// qjson_doc_cst returns the syntax tree of the document text, or NULL if
+// the text is invalid. It is valid until the next edit.
+QJSON_API const qjson_cst_t* qjson_doc_cst(qjson_doc_t *d);
 
 // qjson_version returns the version of the code and the supported
 // syntax (e.g. "qjson-c: v0.1.1 syntax: v0.0.0")
-const char* qjson_version();
+QJSON_API const char* qjson_version();
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,610 @@
+#ifndef QJSON_HPP
+#define QJSON_HPP
+
+// qjson.hpp is a header only C++17 layer over the C API of qjson.h.
+//
+// The options of a conversion are given by a policy type, so that they are
+// compile time constants and the result type depends on them. A policy
+// derives from qjson::default_policy and redefines some of its members:
+//
+//     struct strict : qjson::default_policy {
+//         static constexpr unsigned disabled = QJSON_NO_EXPRESSIONS | QJSON_NO_DURATIONS;
+//         static constexpr int max_depth = 32;
+//         using sink = qjson::sink::validate;
+//     };
+//     auto r = qjson::decode<strict>(text); // qjson::expected<void>
+//
+// The decoding functions return a qjson::expected holding the value or the
+// error, unless the policy sets exceptions, in which case they return the
+// value and throw a qjson::decode_error.
+//
+// The functions of qjson::pmr allocate from a std::pmr::memory_resource
+// instead of the heap, and return views into it:
+//
+//     std::byte buf[64*1024];
+//     std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+//     auto doc = qjson::pmr::parse(text, &arena); // no heap allocation
+//     std::string_view host = doc->root()["server"]["host"].as_string();
+
+#include "qjson.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace qjson {
+
+// error is a decoding error with its position in the input.
+struct error {
+	std::string_view   msg;       // static error message
+	size_t             offset = 0; // byte offset in the input
+	int                line = 0;   // line number starting at 1
+	int                col = 0;    // column in utf8 chars starting at 1
+	qjson_error_code_t code = QJSON_ERROR_SYNTAX;
+
+	error() = default;
+	explicit error(const qjson_error_t &e) : msg(e.msg), offset(e.offset), line(e.line), col(e.col), code(e.code) {}
+
+	// what returns the message with its position, like the Python module.
+	std::string what() const {
+		return std::string(msg) + " at line " + std::to_string(line) + " col " + std::to_string(col);
+	}
+};
+
+// decode_error is the exception thrown by policies setting exceptions.
+class decode_error : public std::runtime_error {
+public:
+	explicit decode_error(const qjson::error &e) : std::runtime_error(e.what()), err(e) {}
+	const qjson::error& get() const noexcept { return err; }
+private:
+	qjson::error err;
+};
+
+// json is the json text of a conversion. It owns the buffer returned by
+// the C API, so that no copy is made.
+class json {
+public:
+	json() = default;
+	json(char *p, size_t n) noexcept : buf(p), len(n) {}
+
+	std::string_view view() const noexcept { return {buf.get(), len}; }
+	const char* c_str() const noexcept { return buf.get(); }
+	size_t size() const noexcept { return len; }
+	std::string str() const { return std::string(view()); }
+	operator std::string_view() const noexcept { return view(); }
+
+private:
+	struct free_deleter {
+		void operator()(char *p) const noexcept { std::free(p); }
+	};
+	std::unique_ptr<char, free_deleter> buf;
+	size_t len = 0;
+};
+
+// digest is the 128 bit MurmurHash3 of a canonical json text.
+using digest = std::array<unsigned char, 16>;
+
+// expected holds either a value of type T or an error, like the C++23
+// std::expected. expected<void> holds only an optional error.
+template <typename T>
+class expected {
+public:
+	expected(T v) : v(std::in_place_index<0>, std::move(v)) {}
+	expected(qjson::error e) : v(std::in_place_index<1>, e) {}
+
+	bool has_value() const noexcept { return v.index() == 0; }
+	explicit operator bool() const noexcept { return has_value(); }
+	T& value() & { check(); return std::get<0>(v); }
+	const T& value() const & { check(); return std::get<0>(v); }
+	T&& value() && { check(); return std::get<0>(std::move(v)); }
+	T& operator*() & noexcept { return *std::get_if<0>(&v); }
+	const T& operator*() const & noexcept { return *std::get_if<0>(&v); }
+	T* operator->() noexcept { return std::get_if<0>(&v); }
+	const T* operator->() const noexcept { return std::get_if<0>(&v); }
+	const qjson::error& error() const noexcept { return *std::get_if<1>(&v); }
+
+private:
+	void check() const {
+		if (!has_value())
+			throw decode_error(error());
+	}
+	std::variant<T, qjson::error> v;
+};
+
+template <>
+class expected<void> {
+public:
+	expected() = default;
+	expected(qjson::error e) : err(e), failed(true) {}
+
+	bool has_value() const noexcept { return !failed; }
+	explicit operator bool() const noexcept { return has_value(); }
+	void value() const {
+		if (failed)
+			throw decode_error(err);
+	}
+	const qjson::error& error() const noexcept { return err; }
+
+private:
+	qjson::error err;
+	bool failed = false;
+};
+
+// sink contains the output policies. Each one selects what a conversion
+// produces and the type of its value.
+namespace sink {
+	struct json {      // json text
+		using value_type = qjson::json;
+	};
+	struct canonical { // canonical json text with sorted keys
+		using value_type = qjson::json;
+	};
+	struct digest {    // digest of the canonical json text, which isn’t built
+		using value_type = qjson::digest;
+	};
+	struct validate {  // no output, the input is only checked
+		using value_type = void;
+	};
+}
+
+// default_policy is the policy of the C API defaults. The members of a
+// policy deriving from it replace the defaults.
+struct default_policy {
+	static constexpr unsigned disabled = 0;          // QJSON_NO_XXX flags of the disabled syntax features
+	static constexpr bool reject_disabled = false;   // disabled constructs are errors instead of quoteless strings
+	static constexpr qjson_dup_policy_t duplicates = QJSON_DUP_ALLOW;
+	static constexpr int max_depth = 0;              // maximum nesting depth, 0 for the default of 200
+	static constexpr size_t max_input = 0;           // maximum input byte length, 0 for no limit
+	static constexpr size_t max_output = 0;          // maximum output byte length, 0 for no limit
+	static constexpr size_t max_tokens = 0;          // maximum number of tokens, 0 for no limit
+	static constexpr bool exceptions = false;        // throw decode_error instead of returning expected
+	using sink = qjson::sink::json;
+};
+
+// json_policy only accepts json numbers and literals, which are copied as
+// is, like a strict json members parser.
+struct json_policy : default_policy {
+	static constexpr unsigned disabled = QJSON_NO_EXPRESSIONS | QJSON_NO_DURATIONS | QJSON_NO_DATES | QJSON_NO_MULTILINE;
+};
+
+// options returns the C options of Policy.
+template <typename Policy>
+constexpr qjson_options_t options() {
+	using out = typename Policy::sink;
+	qjson_options_t o{};
+	o.disabled = Policy::disabled;
+	o.rejectDisabled = Policy::reject_disabled;
+	o.duplicateKeys = Policy::duplicates;
+	o.maxDepth = Policy::max_depth;
+	o.maxInputBytes = Policy::max_input;
+	o.maxOutputBytes = Policy::max_output;
+	o.maxTokens = Policy::max_tokens;
+	o.validateOnly = std::is_same_v<out, sink::validate>;
+	o.canonical = std::is_same_v<out, sink::canonical>;
+	o.digestOnly = std::is_same_v<out, sink::digest>;
+	return o;
+}
+
+// value_t is the value type of a conversion with Policy.
+template <typename Policy>
+using value_t = typename Policy::sink::value_type;
+
+// result_t is the return type of a conversion with Policy.
+template <typename Policy>
+using result_t = std::conditional_t<Policy::exceptions, value_t<Policy>, expected<value_t<Policy>>>;
+
+namespace detail {
+	// fail returns or throws the error e according to Policy.
+	template <typename Policy>
+	result_t<Policy> fail(const qjson::error &e) {
+		if constexpr (Policy::exceptions)
+			throw decode_error(e);
+		else
+			return e;
+	}
+}
+
+// decode converts the qjson text with the options of Policy.
+template <typename Policy = default_policy>
+result_t<Policy> decode(std::string_view text) {
+	static constexpr qjson_options_t opts = options<Policy>();
+	using out = typename Policy::sink;
+	qjson_result_t res;
+	if (!qjson_decode_ex(text.data(), text.size(), &opts, &res)) {
+		qjson::error e(res.error);
+		qjson_result_free(&res);
+		return detail::fail<Policy>(e);
+	}
+	if constexpr (std::is_same_v<out, sink::validate>) {
+		if constexpr (!Policy::exceptions)
+			return {};
+	} else if constexpr (std::is_same_v<out, sink::digest>) {
+		qjson::digest d;
+		for (size_t i = 0; i < d.size(); i++)
+			d[i] = res.digest[i];
+		return d;
+	} else {
+		// the buffer is moved into the result without copy
+		return qjson::json(res.json, res.len);
+	}
+}
+
+// validating is Policy without output.
+template <typename Policy>
+struct validating : Policy {
+	using sink = qjson::sink::validate;
+};
+
+// validate checks the qjson text with the options of Policy, producing no
+// output.
+template <typename Policy = default_policy>
+result_t<validating<Policy>> validate(std::string_view text) {
+	return decode<validating<Policy>>(text);
+}
+
+namespace pmr {
+
+namespace detail {
+	// header is the size of the block header holding the byte size of a
+	// block, which deallocate requires and realloc doesn’t provide.
+	constexpr size_t header = alignof(std::max_align_t);
+
+	// resource_realloc is the qjson_allocator_t realloc of the memory
+	// resource arg. A failed allocation terminates the program, as the C
+	// engine doesn’t handle them.
+	inline void* resource_realloc(void *arg, void *p, size_t size) noexcept {
+		auto *mr = static_cast<std::pmr::memory_resource*>(arg);
+		char *old = (p == nullptr) ? nullptr : static_cast<char*>(p) - header;
+		size_t oldSize = 0;
+		if (old != nullptr)
+			std::memcpy(&oldSize, old, sizeof(oldSize));
+		char *blk = nullptr;
+		if (size > 0) {
+			blk = static_cast<char*>(mr->allocate(size + header, header));
+			std::memcpy(blk, &size, sizeof(size));
+			if (old != nullptr)
+				std::memcpy(blk + header, p, oldSize < size ? oldSize : size);
+		}
+		if (old != nullptr)
+			mr->deallocate(old, oldSize + header, header);
+		return (blk == nullptr) ? nullptr : blk + header;
+	}
+}
+
+// allocator returns the C allocator of the memory resource mr.
+inline qjson_allocator_t allocator(std::pmr::memory_resource *mr) noexcept {
+	return qjson_allocator_t{detail::resource_realloc, mr};
+}
+
+// text_t is the value type of a conversion with Policy into a memory
+// resource, a view of the json text instead of an owning qjson::json.
+template <typename Policy>
+using text_t = std::conditional_t<std::is_same_v<value_t<Policy>, qjson::json>, std::string_view, value_t<Policy>>;
+
+// result_t is the return type of a conversion with Policy into a memory
+// resource.
+template <typename Policy>
+using result_t = std::conditional_t<Policy::exceptions, text_t<Policy>, expected<text_t<Policy>>>;
+
+// decode converts the qjson text with the options of Policy. The json text
+// and the work buffers are allocated from mr, and the returned view is
+// valid until the memory of mr is released. It is meant for monotonic
+// resources, whose release frees everything at once.
+template <typename Policy = default_policy>
+result_t<Policy> decode(std::string_view text, std::pmr::memory_resource *mr = std::pmr::get_default_resource()) {
+	using out = typename Policy::sink;
+	qjson_allocator_t a = allocator(mr);
+	qjson_options_t opts = options<Policy>();
+	opts.allocator = &a;
+	qjson_result_t res;
+	if (!qjson_decode_ex(text.data(), text.size(), &opts, &res)) {
+		qjson::error e(res.error);
+		qjson_result_free(&res);
+		if constexpr (Policy::exceptions)
+			throw decode_error(e);
+		else
+			return e;
+	}
+	if constexpr (std::is_same_v<out, sink::validate>) {
+		if constexpr (!Policy::exceptions)
+			return {};
+	} else if constexpr (std::is_same_v<out, sink::digest>) {
+		qjson::digest d;
+		for (size_t i = 0; i < d.size(); i++)
+			d[i] = res.digest[i];
+		return d;
+	} else {
+		return std::string_view(res.json, res.len);
+	}
+}
+
+// kind is the type of a json value.
+enum class kind : unsigned char { null, boolean, number, string, array, object };
+
+// node is a json value of a document. The nodes of a document are stored in
+// depth first order, so that the children of a node follow it.
+struct node {
+	std::string_view text; // json text of a number, literal or unescaped string
+	std::string_view key;  // unescaped key of an object member, empty otherwise
+	uint32_t size = 0;     // number of children of an array or object
+	uint32_t span = 1;     // number of nodes of the value, itself included
+	qjson::pmr::kind kind = kind::null;
+};
+
+// value is a reference to a node of a document. A default constructed
+// value, returned for a missing member or index, is false and behaves as
+// an empty null, so that lookups can be chained.
+class value {
+public:
+	value() = default;
+	explicit value(const node *n) noexcept : n(n != nullptr ? n : &none) {}
+
+	explicit operator bool() const noexcept { return n != &none; }
+	qjson::pmr::kind kind() const noexcept { return n->kind; }
+	bool is_null() const noexcept { return n->kind == kind::null; }
+	bool is_bool() const noexcept { return n->kind == kind::boolean; }
+	bool is_number() const noexcept { return n->kind == kind::number; }
+	bool is_string() const noexcept { return n->kind == kind::string; }
+	bool is_array() const noexcept { return n->kind == kind::array; }
+	bool is_object() const noexcept { return n->kind == kind::object; }
+
+	// key returns the key of an object member.
+	std::string_view key() const noexcept { return n->key; }
+	// text returns the json text of a number or literal, or the string.
+	std::string_view text() const noexcept { return n->text; }
+	std::string_view as_string() const noexcept { return n->text; }
+	bool as_bool() const noexcept { return n->kind == kind::boolean && n->text[0] == 't'; }
+	// as_number parses the number, which is followed by a json delimiter,
+	// and returns 0 for another kind.
+	double as_number() const noexcept { return n->kind == kind::number ? std::strtod(n->text.data(), nullptr) : 0; }
+	// size returns the number of children of an array or object.
+	size_t size() const noexcept { return n->size; }
+
+	// iterator iterates the children of an array or object.
+	class iterator {
+	public:
+		explicit iterator(const node *n) noexcept : n(n) {}
+		value operator*() const noexcept { return value(n); }
+		iterator& operator++() noexcept { n += n->span; return *this; }
+		bool operator==(const iterator &o) const noexcept { return n == o.n; }
+		bool operator!=(const iterator &o) const noexcept { return n != o.n; }
+	private:
+		const node *n;
+	};
+	iterator begin() const noexcept { return iterator(n+1); }
+	iterator end() const noexcept { return iterator(n + n->span); }
+
+	// operator[] returns the member key of an object, the last one if it is
+	// duplicated, or a false value.
+	value operator[](std::string_view key) const noexcept {
+		value found;
+		if (n->kind == kind::object)
+			for (value v : *this)
+				if (v.key() == key)
+					found = v;
+		return found;
+	}
+
+	// operator[] returns the element i of an array or a false value.
+	value operator[](size_t i) const noexcept {
+		if (n->kind != kind::array || i >= n->size)
+			return value();
+		iterator it = begin();
+		while (i-- > 0)
+			++it;
+		return *it;
+	}
+
+private:
+	static constexpr node none{};
+	const node *n = &none;
+};
+
+// document is the tree of a json text allocated from a memory resource.
+// The strings without escape sequence are views of the json text, the
+// others are unescaped in the resource.
+class document {
+public:
+	// document builds the tree of the compact json text produced by the C
+	// engine, allocating the nodes from mr.
+	document(std::string_view json, std::pmr::memory_resource *mr) : nodes(mr), text(json) {
+		nodes.reserve(count(json));
+		build(json.data(), std::string_view());
+	}
+
+	// root returns the top level object.
+	value root() const noexcept { return value(nodes.data()); }
+	// json returns the json text of the document.
+	std::string_view json() const noexcept { return text; }
+	// size returns the number of nodes.
+	size_t size() const noexcept { return nodes.size(); }
+
+private:
+	// count returns the number of values of the json text, so that the
+	// nodes are allocated once: the root, and one more than the number of
+	// commas for each non empty array or object.
+	static size_t count(std::string_view json) noexcept {
+		size_t n = 1;
+		for (size_t i = 0; i < json.size(); i++) {
+			switch (json[i]) {
+			case '"':
+				while (json[++i] != '"')
+					if (json[i] == '\\')
+						i++;
+				break;
+			case ',':
+				n++;
+				break;
+			case '[':
+			case '{':
+				if (json[i+1] != ']' && json[i+1] != '}')
+					n++;
+				break;
+			}
+		}
+		return n;
+	}
+
+	// build appends the nodes of the value at p and returns the position
+	// after it.
+	const char* build(const char *p, std::string_view key) {
+		size_t i = nodes.size();
+		nodes.emplace_back();
+		nodes[i].key = key;
+		switch (*p) {
+		case '{':
+		case '[': {
+			bool obj = *p == '{';
+			char close = obj ? '}' : ']';
+			nodes[i].kind = obj ? kind::object : kind::array;
+			p++;
+			uint32_t n = 0;
+			while (*p != close) {
+				std::string_view k;
+				if (obj) {
+					p = string(p, k);
+					p++; // ':'
+				}
+				p = build(p, k);
+				n++;
+				if (*p == ',')
+					p++;
+			}
+			nodes[i].size = n;
+			nodes[i].span = uint32_t(nodes.size() - i);
+			return p+1;
+		}
+		case '"': {
+			std::string_view s;
+			p = string(p, s);
+			nodes[i].kind = kind::string;
+			nodes[i].text = s;
+			return p;
+		}
+		case 't':
+		case 'f':
+		case 'n':
+			nodes[i].kind = (*p == 'n') ? kind::null : kind::boolean;
+			nodes[i].text = std::string_view(p, (*p == 'f') ? 5 : 4);
+			return p + nodes[i].text.size();
+		default: {
+			const char *b = p;
+			while (*p != ',' && *p != ']' && *p != '}' && *p != '\0')
+				p++;
+			nodes[i].kind = kind::number;
+			nodes[i].text = std::string_view(b, size_t(p-b));
+			return p;
+		}
+		}
+	}
+
+	// string sets s to the unescaped json string at p, and returns the
+	// position after it.
+	const char* string(const char *p, std::string_view &s) {
+		const char *b = ++p;
+		bool escaped = false;
+		for (; *p != '"'; p++)
+			if (*p == '\\') {
+				escaped = true;
+				p++;
+			}
+		if (!escaped) {
+			s = std::string_view(b, size_t(p-b));
+			return p+1;
+		}
+		// the unescaped string is never longer than the escaped one
+		auto *mr = nodes.get_allocator().resource();
+		char *o = static_cast<char*>(mr->allocate(size_t(p-b), 1)), *d = o;
+		for (const char *q = b; q < p; q++) {
+			if (*q != '\\') {
+				*d++ = *q;
+				continue;
+			}
+			switch (*++q) {
+			case 'b': *d++ = '\b'; break;
+			case 'f': *d++ = '\f'; break;
+			case 'n': *d++ = '\n'; break;
+			case 'r': *d++ = '\r'; break;
+			case 't': *d++ = '\t'; break;
+			case 'u': {
+				uint32_t c = hex4(q+1);
+				q += 4;
+				if (c >= 0xD800 && c < 0xDC00 && q[1] == '\\' && q[2] == 'u') {
+					c = 0x10000 + ((c - 0xD800) << 10) + (hex4(q+3) - 0xDC00);
+					q += 6;
+				}
+				d = utf8(d, c);
+				break;
+			}
+			default: *d++ = *q; break; // '"', '\\' and '/'
+			}
+		}
+		s = std::string_view(o, size_t(d-o));
+		return p+1;
+	}
+
+	static uint32_t hex4(const char *p) noexcept {
+		uint32_t v = 0;
+		for (int i = 0; i < 4; i++) {
+			char c = p[i];
+			v = v*16 + uint32_t((c <= '9') ? c-'0' : (c|0x20)-'a'+10);
+		}
+		return v;
+	}
+
+	static char* utf8(char *d, uint32_t c) noexcept {
+		if (c < 0x80) {
+			*d++ = char(c);
+		} else if (c < 0x800) {
+			*d++ = char(0xC0 | c>>6);
+			*d++ = char(0x80 | (c & 0x3F));
+		} else if (c < 0x10000) {
+			*d++ = char(0xE0 | c>>12);
+			*d++ = char(0x80 | (c>>6 & 0x3F));
+			*d++ = char(0x80 | (c & 0x3F));
+		} else {
+			*d++ = char(0xF0 | c>>18);
+			*d++ = char(0x80 | (c>>12 & 0x3F));
+			*d++ = char(0x80 | (c>>6 & 0x3F));
+			*d++ = char(0x80 | (c & 0x3F));
+		}
+		return d;
+	}
+
+	std::pmr::vector<node> nodes;
+	std::string_view text;
+};
+
+// parse converts the qjson text with the options of Policy into a document
+// allocated from mr, without heap allocation. Policy must output json.
+template <typename Policy = default_policy>
+auto parse(std::string_view text, std::pmr::memory_resource *mr = std::pmr::get_default_resource()) {
+	static_assert(std::is_same_v<text_t<Policy>, std::string_view>, "parse requires a json or canonical sink");
+	using R = std::conditional_t<Policy::exceptions, document, expected<document>>;
+	auto j = decode<Policy>(text, mr);
+	std::string_view s;
+	if constexpr (Policy::exceptions) {
+		s = j;
+	} else {
+		if (!j)
+			return R(j.error());
+		s = *j;
+	}
+	return R(document(s, mr));
+}
+
+} // namespace pmr
+
+} // namespace qjson
+
+#endif
@@ -0,0 +1,2331 @@
+#ifndef QJSON_CONSTEVAL_HPP
+#define QJSON_CONSTEVAL_HPP
+
+// qjson_consteval.hpp converts qjson text literals at compile time. It
+// requires C++20 and is a constexpr port of the tokenizer, the number
+// expression evaluator and the grammar of qjson.c, producing the same json
+// text:
+//
+//     constexpr auto cfg = qjson::ct::decode<R"(
+//         host: example.com
+//         timeout: 1m30s
+//     )">();
+//     static_assert(cfg.view() == R"({"host":"example.com","timeout":90})");
+//
+// qjson::ct::parse returns a document whose values are read in constant
+// expressions. An invalid text is a compile error instantiating
+// qjson::ct::syntax_error with the error message, line and column as
+// template arguments.
+//
+// The policy of a conversion is a qjson.hpp policy of which disabled,
+// reject_disabled and max_depth apply. The size of a text is bounded by
+// the constexpr evaluation limits of the compiler (e.g. gcc's
+// -fconstexpr-loop-limit and -fconstexpr-ops-limit).
+
+#include "qjson.hpp"
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+#include <type_traits>
+
+namespace qjson {
+namespace ct {
+
+// fixed_string is a string literal given as template argument.
+template <size_t N>
+struct fixed_string {
+	char buf[N] = {};
+
+	constexpr fixed_string(const char (&s)[N]) noexcept {
+		for (size_t i = 0; i < N; i++)
+			buf[i] = s[i];
+	}
+	constexpr std::string_view view() const noexcept { return {buf, N-1}; }
+};
+
+// message is an error message given as template argument.
+struct message {
+	char text[64] = {};
+
+	constexpr message(const char *s) noexcept {
+		for (size_t i = 0; i+1 < sizeof(text) && s[i] != '\0'; i++)
+			text[i] = s[i];
+	}
+};
+
+// syntax_error is instantiated for an invalid text, so that the compiler
+// reports the error message and its position in the text.
+template <message Msg, int Line, int Col>
+struct syntax_error {
+	static_assert(Line == 0, "invalid qjson text, see the message, line and column of qjson::ct::syntax_error");
+	static constexpr bool value = false;
+};
+
+// text is a json text of N bytes computed at compile time.
+template <size_t N>
+struct text {
+	std::array<char, N+1> buf = {};
+
+	constexpr std::string_view view() const noexcept { return {buf.data(), N}; }
+	constexpr const char* c_str() const noexcept { return buf.data(); }
+	static constexpr size_t size() noexcept { return N; }
+	constexpr operator std::string_view() const noexcept { return view(); }
+};
+
+namespace detail {
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Errors, the messages of qjson.c
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+inline constexpr char ErrEndOfInput[] = "end of input";
+inline constexpr char ErrInvalidChar[] = "invalid character";
+inline constexpr char ErrTruncatedChar[] = "last utf8 char is truncated";
+inline constexpr char ErrSyntaxError[] = "syntax error";
+inline constexpr char ErrUnclosedDoubleQuoteString[] = "unclosed double quote string";
+inline constexpr char ErrUnclosedSingleQuoteString[] = "unclosed single quote string";
+inline constexpr char ErrUnclosedSlashStarComment[] = "unclosed /*...*/ comment";
+inline constexpr char ErrNewlineInDoubleQuoteString[] = "newline in double quoted string";
+inline constexpr char ErrNewlineInSingleQuoteString[] = "newline in single quoted string";
+inline constexpr char ErrExpectStringIdentifier[] = "expect string identifier";
+inline constexpr char ErrExpectColon[] = "expect a colon";
+inline constexpr char ErrMaxObjectArrayDepth[] = "too many object or array encapsulations";
+inline constexpr char ErrUnclosedObject[] = "unclosed object";
+inline constexpr char ErrUnclosedArray[] = "unclosed array";
+inline constexpr char ErrUnexpectedEndOfInput[] = "unexpected end of input";
+inline constexpr char ErrExpectIdentifierAfterComma[] = "expect identifier after comma";
+inline constexpr char ErrExpectValueAfterComma[] = "expect value after comma";
+inline constexpr char ErrInvalidEscapeSequence[] = "invalid escape squence";
+inline constexpr char ErrInvalidNumericExpression[] = "invalid numeric expression";
+inline constexpr char ErrInvalidBinaryNumber[] = "invalid binary number";
+inline constexpr char ErrInvalidHexadecimalNumber[] = "invalid hexadecimal number";
+inline constexpr char ErrInvalidOctalNumber[] = "invalid octal number";
+inline constexpr char ErrInvalidIntegerNumber[] = "invalid integer number";
+inline constexpr char ErrInvalidDecimalNumber[] = "invalid decimal number";
+inline constexpr char ErrNumberOverflow[] = "number overflow";
+inline constexpr char ErrUnopenedParenthesis[] = "missing open parenthesis";
+inline constexpr char ErrDivisionByZero[] = "division by zero";
+inline constexpr char ErrUnclosedParenthesis[] = "missing close parenthesis";
+inline constexpr char ErrOperandMustBeInteger[] = "operand must be integer";
+inline constexpr char ErrMarginMustBeWhitespaceOnly[] = "multiline margin must contain only whitespaces";
+inline constexpr char ErrUnclosedMultiline[] = "unclosed multiline";
+inline constexpr char ErrInvalidMarginChar[] = "invalid margin character";
+inline constexpr char ErrMissingNewlineSpecifier[] = "missing \\n or \\r\\n after multiline start";
+inline constexpr char ErrInvalidNewlineSpecifier[] = "expect \\n or \\r\\n after `";
+inline constexpr char ErrInvalidMultilineStart[] = "invalid multiline start line";
+inline constexpr char ErrUnexpectedCloseBrace[] = "unexpected }";
+inline constexpr char ErrUnexpectedCloseSquare[] = "unexpected ]";
+inline constexpr char ErrInvalidISODateTime[] = "invalid ISO date time";
+inline constexpr char ErrDepthLimit[] = "nesting depth limit exceeded";
+inline constexpr char ErrExpressionsDisabled[] = "numeric expressions are disabled";
+inline constexpr char ErrDurationsDisabled[] = "durations are disabled";
+inline constexpr char ErrMultilineDisabled[] = "multiline strings are disabled";
+
+inline constexpr int maxDepth = 200;
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Exact decimal conversions
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// big is an unsigned integer of up to 2560 bits, used to convert decimal
+// numbers from and to doubles exactly like strtod and printf.
+struct big {
+	uint32_t d[80] = {}; // limbs, least significant first
+	int      n = 0;      // number of limbs in use
+
+	constexpr big() = default;
+	constexpr explicit big(uint64_t v) {
+		for (; v != 0; v >>= 32)
+			d[n++] = uint32_t(v);
+	}
+
+	constexpr void mul(uint32_t m) {
+		uint64_t c = 0;
+		for (int i = 0; i < n; i++) {
+			c += uint64_t(d[i])*m;
+			d[i] = uint32_t(c);
+			c >>= 32;
+		}
+		if (c != 0)
+			d[n++] = uint32_t(c);
+	}
+
+	constexpr void mulPow10(int k) {
+		for (; k >= 9; k -= 9)
+			mul(1000000000);
+		for (; k > 0; k--)
+			mul(10);
+	}
+
+	constexpr void add(uint32_t v) {
+		uint64_t c = v;
+		for (int i = 0; c != 0; i++) {
+			if (i == n)
+				d[n++] = 0;
+			c += d[i];
+			d[i] = uint32_t(c);
+			c >>= 32;
+		}
+	}
+
+	constexpr void shl(int k) {
+		if (n == 0)
+			return;
+		int w = k/32, b = k%32;
+		for (int i = n-1; i >= 0; i--)
+			d[i+w] = d[i];
+		for (int i = 0; i < w; i++)
+			d[i] = 0;
+		n += w;
+		if (b != 0) {
+			uint32_t c = 0;
+			for (int i = w; i < n; i++) {
+				uint32_t x = d[i];
+				d[i] = x << b | c;
+				c = x >> (32-b);
+			}
+			if (c != 0)
+				d[n++] = c;
+		}
+	}
+
+	// sub subtracts o, which must not be greater.
+	constexpr void sub(const big &o) {
+		int64_t borrow = 0;
+		for (int i = 0; i < n; i++) {
+			int64_t x = int64_t(d[i]) - ((i < o.n) ? o.d[i] : 0) - borrow;
+			borrow = x < 0;
+			d[i] = uint32_t(x);
+		}
+		while (n > 0 && d[n-1] == 0)
+			n--;
+	}
+
+	constexpr int cmp(const big &o) const {
+		if (n != o.n)
+			return (n < o.n) ? -1 : 1;
+		for (int i = n-1; i >= 0; i--)
+			if (d[i] != o.d[i])
+				return (d[i] < o.d[i]) ? -1 : 1;
+		return 0;
+	}
+
+	constexpr int bits() const {
+		return (n == 0) ? 0 : (n-1)*32 + int(std::bit_width(d[n-1]));
+	}
+};
+
+// formatDouble writes x like printf("%.16g") in buf and returns its length.
+constexpr int formatDouble(double x, char *buf) {
+	int l = 0;
+	uint64_t bits = std::bit_cast<uint64_t>(x);
+	if (bits >> 63)
+		buf[l++] = '-';
+	int be = int(bits >> 52 & 0x7FF);
+	uint64_t m = bits & ((uint64_t(1) << 52) - 1);
+	if (be == 0x7FF) {
+		const char *s = (m != 0) ? "nan" : "inf";
+		for (int i = 0; i < 3; i++)
+			buf[l++] = s[i];
+		return l;
+	}
+	if (be == 0 && m == 0) {
+		buf[l++] = '0';
+		return l;
+	}
+	if (be == 0)
+		be = 1;
+	else
+		m |= uint64_t(1) << 52;
+	int e2 = be - 1075; // x = m*2^e2
+	big num(m), den(1);
+	if (e2 > 0)
+		num.shl(e2);
+	else
+		den.shl(-e2);
+	// k estimates floor(log10(x)), num/den is then scaled to [1, 10)
+	int k = ((e2 + int(std::bit_width(m)) - 1)*78913) >> 18;
+	if (k >= 0)
+		den.mulPow10(k);
+	else
+		num.mulPow10(-k);
+	for (;;) {
+		if (num.cmp(den) < 0) {
+			num.mul(10);
+			k--;
+			continue;
+		}
+		big ten = den;
+		ten.mul(10);
+		if (num.cmp(ten) < 0)
+			break;
+		den = ten;
+		k++;
+	}
+	char digits[16];
+	for (int i = 0; i < 16; i++) {
+		char q = 0;
+		while (num.cmp(den) >= 0) {
+			num.sub(den);
+			q++;
+		}
+		digits[i] = char('0' + q);
+		if (i < 15)
+			num.mul(10);
+	}
+	// round half to even on the remainder
+	num.mul(2);
+	int c = num.cmp(den);
+	if (c > 0 || (c == 0 && (digits[15]-'0')%2 == 1)) {
+		int i = 15;
+		while (i >= 0 && digits[i] == '9')
+			digits[i--] = '0';
+		if (i < 0) {
+			digits[0] = '1';
+			k++;
+		} else
+			digits[i]++;
+	}
+	int last = 15;
+	while (last > 0 && digits[last] == '0')
+		last--;
+	if (k < -4 || k >= 16) {
+		buf[l++] = digits[0];
+		if (last > 0) {
+			buf[l++] = '.';
+			for (int i = 1; i <= last; i++)
+				buf[l++] = digits[i];
+		}
+		buf[l++] = 'e';
+		buf[l++] = (k < 0) ? '-' : '+';
+		int a = (k < 0) ? -k : k;
+		if (a >= 100)
+			buf[l++] = char('0' + a/100);
+		buf[l++] = char('0' + a/10%10);
+		buf[l++] = char('0' + a%10);
+		return l;
+	}
+	if (k < 0) {
+		buf[l++] = '0';
+		buf[l++] = '.';
+		for (int i = -1; i > k; i--)
+			buf[l++] = '0';
+		for (int i = 0; i <= last; i++)
+			buf[l++] = digits[i];
+		return l;
+	}
+	for (int i = 0; i <= k; i++)
+		buf[l++] = digits[i];
+	if (last > k) {
+		buf[l++] = '.';
+		for (int i = k+1; i <= last; i++)
+			buf[l++] = digits[i];
+	}
+	return l;
+}
+
+// binaryExponent scales |x| into [1, 2) and returns its binary exponent.
+constexpr int binaryExponent(double &x) {
+	int e = 0;
+	x = (x < 0) ? -x : x;
+	if (x == 0)
+		return 0;
+	for (; x >= 0x1p32; e += 32)
+		x *= 0x1p-32;
+	for (; x >= 2; e++)
+		x /= 2;
+	for (; x < 0x1p-32; e -= 32)
+		x *= 0x1p32;
+	for (; x < 1; e--)
+		x *= 2;
+	return e;
+}
+
+// overflows returns true if the result of the operation op of a and b,
+// one of '+', '-', '*' and '/', rounds to an infinite value. Since an 
+// overflow is not a constant expression, the operation is done on scaled
+// operands rounding like the unscaled ones.
+constexpr bool overflows(char op, double a, double b) {
+	if (op == '+' || op == '-') {
+		double h = (op == '+') ? a/2 + b/2 : a/2 - b/2;
+		return h >= 0x1p1023 || h <= -0x1p1023;
+	}
+	if (a == 0)
+		return false;
+	int ea = binaryExponent(a), eb = binaryExponent(b);
+	if (op == '*') {
+		double m = a*b;
+		return ea + eb + (m >= 2) + (m >= 4) >= 1024;
+	}
+	double m = a/b;
+	return ea - eb + (m >= 2) - (m < 1) >= 1024;
+}
+
+// parsed is the value of a decimal literal, ok is false when it underflows.
+struct parsed {
+	double v = 0;
+	bool   ok = true;
+};
+
+// parseDouble converts the decimal literal s, with optional '_' separators,
+// to the nearest double like strtod.
+constexpr parsed parseDouble(std::string_view s) {
+	big num;
+	int nd = 0, e10 = 0;
+	size_t i = 0;
+	bool frac = false;
+	for (; i < s.size(); i++) {
+		char c = s[i];
+		if (c == '_')
+			continue;
+		if (c == '.') {
+			frac = true;
+			continue;
+		}
+		if (c < '0' || c > '9')
+			break;
+		if (nd > 0 || c != '0') {
+			num.mul(10);
+			num.add(uint32_t(c-'0'));
+			nd++;
+		}
+		if (frac)
+			e10--;
+	}
+	if (i < s.size()) { // exponent
+		i++;
+		bool neg = false;
+		if (i < s.size() && (s[i] == '+' || s[i] == '-'))
+			neg = s[i++] == '-';
+		int x = 0;
+		for (; i < s.size(); i++)
+			if (s[i] != '_' && x < 100000)
+				x = x*10 + (s[i]-'0');
+		e10 += neg ? -x : x;
+	}
+	if (nd == 0)
+		return {0, true};
+	if (nd + e10 > 310)
+		return {std::bit_cast<double>(uint64_t(0x7FF) << 52), true};
+	if (nd + e10 < -325)
+		return {0, false};
+	big den(1);
+	if (e10 >= 0)
+		num.mulPow10(e10);
+	else
+		den.mulPow10(-e10);
+	// find b so that num/(den*2^b) is in [2^52, 2^53), or b = -1074
+	int b = num.bits() - den.bits() - 53;
+	if (b < -1074)
+		b = -1074;
+	big n, dd;
+	for (;;) {
+		n = num;
+		dd = den;
+		if (b >= 0)
+			dd.shl(b);
+		else
+			n.shl(-b);
+		big lo = dd, hi = dd;
+		lo.shl(52);
+		hi.shl(53);
+		if (n.cmp(hi) >= 0) {
+			b++;
+			continue;
+		}
+		if (n.cmp(lo) < 0 && b > -1074) {
+			b--;
+			continue;
+		}
+		break;
+	}
+	uint64_t q = 0;
+	for (int j = 53; j >= 0; j--) {
+		big t = dd;
+		t.shl(j);
+		if (n.cmp(t) >= 0) {
+			n.sub(t);
+			q |= uint64_t(1) << j;
+		}
+	}
+	n.shl(1);
+	int c = n.cmp(dd);
+	if (c > 0 || (c == 0 && (q & 1) != 0))
+		q++;
+	if (q == uint64_t(1) << 53) {
+		q >>= 1;
+		b++;
+	}
+	if (b > 971)
+		return {std::bit_cast<double>(uint64_t(0x7FF) << 52), true};
+	if (q == 0)
+		return {0, false};
+	return {std::bit_cast<double>((uint64_t(b + 1074) << 52) + q), true};
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Tokenizer
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+enum tokenTag : unsigned char {
+	tagUnknown,
+	tagError,
+	tagIntegerVal,
+	tagDecimalVal,
+	tagPlus,
+	tagMinus,
+	tagMultiplication,
+	tagDivision,
+	tagXor,
+	tagAnd,
+	tagOr,
+	tagInverse,
+	tagModulo,
+	tagOpenParen,
+	tagCloseParen,
+	tagWeeks,
+	tagDays,
+	tagHours,
+	tagMinutes,
+	tagSeconds,
+	tagOpenBrace,
+	tagCloseBrace,
+	tagOpenSquare,
+	tagCloseSquare,
+	tagColon,
+	tagQuotelessString,
+	tagDoubleQuotedString,
+	tagSingleQuotedString,
+	tagMultilineString,
+	tagComma,
+};
+
+// pos is a position in the input.
+struct pos {
+	int b = 0; // index of the byte
+	int s = 0; // index of the first byte of the line
+	int l = 0; // line number starting at 0
+};
+
+// token is a token of the input, or an error message at pos.
+struct token {
+	tokenTag         tag = tagUnknown;
+	detail::pos      pos;
+	std::string_view val;
+	const char      *err = nullptr;
+};
+
+// error is an error message with its position.
+struct error {
+	const char  *err = nullptr;
+	detail::pos  pos;
+};
+
+// utf8Table is the utf8Table of qjson.c.
+inline constexpr std::array<unsigned char, 256> utf8Table = [] {
+	std::array<unsigned char, 256> t = {};
+	t[0x09] = 0x01;
+	for (int i = 0x20; i < 0x80; i++)
+		t[i] = 0x01;
+	for (int i = 0xC2; i < 0xE0; i++)
+		t[i] = 0x12;
+	t[0xE0] = 0x23;
+	for (int i = 0xE1; i < 0xF0; i++)
+		t[i] = 0x13;
+	t[0xED] = 0x33;
+	t[0xF0] = 0x44;
+	for (int i = 0xF1; i < 0xF4; i++)
+		t[i] = 0x14;
+	t[0xF4] = 0x54;
+	return t;
+}();
+
+inline constexpr unsigned char utf8Range[12] = {0, 0, 0x80, 0xBF, 0xA0, 0xBF, 0x80, 0x9F, 0x90, 0xBF, 0x80, 0x8F};
+
+constexpr bool isIntDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool isHexDigit(char c) { return isIntDigit(c) || ((c|0x20) >= 'a' && (c|0x20) <= 'f'); }
+constexpr bool isOctDigit(char c) { return c >= '0' && c <= '7'; }
+constexpr bool isBinDigit(char c) { return c == '0' || c == '1'; }
+
+// whitespace returns the byte length of the white space in front of p.
+constexpr int whitespace(std::string_view p) {
+	if (p.empty())
+		return 0;
+	if (p[0] == ' ' || p[0] == '\t')
+		return 1;
+	if (p.size() > 1 && (unsigned char)p[0] == 0xC2 && (unsigned char)p[1] == 0xA0)
+		return 2;
+	return 0;
+}
+
+// newline returns the byte length of the newline in front of p.
+constexpr int newline(std::string_view p) {
+	if (p.empty())
+		return 0;
+	if (p[0] == '\n')
+		return 1;
+	if (p.size() > 1 && p[0] == '\r' && p[1] == '\n')
+		return 2;
+	return 0;
+}
+
+// column returns the number of utf8 chars in p.
+constexpr int column(std::string_view p) {
+	int cnt = 0;
+	while (!p.empty()) {
+		size_t n = utf8Table[(unsigned char)p[0]] & 0xF;
+		if (n == 0 || n > p.size())
+			break;
+		p.remove_prefix(n);
+		cnt++;
+	}
+	return cnt;
+}
+
+// parseISODateTimeLiteral returns 0 if v doesn’t start with an ISO date
+// time, -1 if it is invalid, or its byte length.
+constexpr int parseISODateTimeLiteral(std::string_view v) {
+	auto digits = [&v](std::initializer_list<int> idx) {
+		for (int i : idx)
+			if (!isIntDigit(v[i]))
+				return false;
+		return true;
+	};
+	if (v.size() < 11 || v[10] != 'T' || v[4] != '-' || v[7] != '-' || !digits({0, 1, 2, 3, 5, 6, 8, 9}))
+		return 0;
+	int n = 11;
+	v.remove_prefix(11);
+	if (v.empty())
+		return n;
+	if (v.size() < 5 || v[2] != ':' || !digits({0, 1, 3, 4}))
+		return -1;
+	n += 5;
+	v.remove_prefix(5);
+	if (v.empty())
+		return n;
+	if (v[0] == 'Z')
+		return n+1;
+	if (v[0] != ':')
+		return n;
+	if (v.size() < 3 || !digits({1, 2}))
+		return -1;
+	n += 3;
+	v.remove_prefix(3);
+	if (v.empty())
+		return n;
+	if (v[0] == 'Z')
+		return n+1;
+	if (v[0] != '.' && v[0] != '+' && v[0] != '-')
+		return n;
+	if (v[0] == '.') {
+		n++;
+		v.remove_prefix(1);
+		size_t p = 0;
+		while (p < v.size() && isIntDigit(v[p]))
+			p++;
+		if (p != 6 && p != 3)
+			return -1;
+		n += int(p);
+		v.remove_prefix(p);
+	}
+	if (v.empty())
+		return n;
+	if (v[0] == 'Z')
+		return n+1;
+	if (v[0] != '+' && v[0] != '-')
+		return n;
+	n++;
+	v.remove_prefix(1);
+	if (v.size() < 5 || v[2] != ':' || !digits({0, 1, 3, 4}))
+		return -1;
+	return n + 5;
+}
+
+// engine is the state of a conversion, like engine_t of qjson.c. The json
+// text is written to out, or only counted when out is null.
+struct engine {
+	std::string_view in;
+	detail::pos      pos;
+	token            tk;
+	int              depth = 0;
+	int              maxDepth = detail::maxDepth;
+	unsigned         disabled = 0;
+	bool             rejectDisabled = false;
+	char            *out = nullptr;
+	size_t           len = 0; // byte length of the output
+
+	constexpr int left() const { return int(in.size()) - pos.b; }
+	constexpr std::string_view p() const { return in.substr(size_t(pos.b)); }
+	constexpr char at(int i) const { return in[size_t(pos.b+i)]; }
+
+	// ------------------------------------------------------------------------------------------------------------------------------------
+	// Output
+
+	constexpr void outputByte(char c) {
+		if (out != nullptr)
+			out[len] = c;
+		len++;
+	}
+
+	constexpr void outputString(std::string_view s) {
+		for (char c : s)
+			outputByte(c);
+	}
+
+	constexpr bool done() const { return tk.tag == tagError; }
+
+	constexpr void setErrorAndPos(const char *err, detail::pos p) {
+		tk = token{tagError, p, {}, err};
+	}
+
+	constexpr void setError(const char *err) { setErrorAndPos(err, pos); }
+
+	// ------------------------------------------------------------------------------------------------------------------------------------
+	// Tokenizer
+
+	constexpr void popBytes(int n) { pos.b += n; }
+
+	constexpr bool popNewline() {
+		int n = newline(p());
+		if (n == 0)
+			return false;
+		popBytes(n);
+		pos.s = pos.b;
+		pos.l++;
+		return true;
+	}
+
+	// qchar sets n to the byte length of the char in front of p, or returns
+	// an error. The continuation bytes are checked like in qjson.c.
+	constexpr error qchar(int &n) {
+		n = 0;
+		if (left() == 0)
+			return {};
+		unsigned char x = utf8Table[(unsigned char)at(0)];
+		if (x == 0x01) {
+			n = 1;
+			return {};
+		}
+		if (x == 0)
+			return {ErrInvalidChar, pos};
+		int l = x & 0xF;
+		if (l > left())
+			return {ErrTruncatedChar, pos};
+		unsigned char b2 = (unsigned char)at(1);
+		int r = (x >> 4) << 1;
+		if (b2 < utf8Range[r] || b2 > utf8Range[r+1])
+			return {ErrInvalidChar, pos};
+		for (int i = 2; i < l; i++)
+			if ((unsigned char)at(i) < 0x80)
+				return {ErrInvalidChar, pos};
+		n = l;
+		return {};
+	}
+
+	constexpr error skipRestOfLine() {
+		for (;;) {
+			if (popNewline() || left() == 0)
+				return {};
+			int n = 0;
+			error err = qchar(n);
+			if (err.err != nullptr)
+				return err;
+			popBytes(n);
+		}
+	}
+
+	constexpr error skipLineComment(bool &ok) {
+		ok = false;
+		if (left() == 0)
+			return {};
+		if (at(0) == '#' || (at(0) == '/' && left() >= 2 && at(1) == '/')) {
+			error err = skipRestOfLine();
+			ok = err.err == nullptr;
+			return err;
+		}
+		return {};
+	}
+
+	constexpr error skipMultilineComment(bool &ok) {
+		ok = false;
+		if (left() < 2 || at(0) != '/' || at(1) != '*')
+			return {};
+		detail::pos startPos = pos;
+		popBytes(2);
+		for (;;) {
+			if (left() == 0)
+				return {ErrUnclosedSlashStarComment, startPos};
+			if (at(0) == '*' && left() >= 2 && at(1) == '/') {
+				popBytes(2);
+				ok = true;
+				return {};
+			}
+			if (popNewline())
+				continue;
+			if ((signed char)at(0) < 0x20) { // control characters are valid
+				popBytes(1);
+				continue;
+			}
+			int n = 0;
+			error err = qchar(n);
+			if (err.err != nullptr)
+				return err;
+			popBytes(n);
+		}
+	}
+
+	constexpr void skipWhitespaces() {
+		for (int n = whitespace(p()); n != 0; n = whitespace(p()))
+			popBytes(n);
+	}
+
+	// quotedString pops the string quoted by q in front of p into s.
+	constexpr error quotedString(char q, std::string_view &s) {
+		s = {};
+		detail::pos startPos = pos;
+		if (left() == 0 || at(0) != q)
+			return {};
+		popBytes(1);
+		for (;;) {
+			if (left() == 0)
+				return {(q == '"') ? ErrUnclosedDoubleQuoteString : ErrUnclosedSingleQuoteString, startPos};
+			if (at(0) == '\\' && left() > 1 && (at(1) == q || at(1) == '\\')) {
+				popBytes(2);
+				continue;
+			}
+			if (at(0) == q) {
+				popBytes(1);
+				s = in.substr(size_t(startPos.b), size_t(pos.b - startPos.b));
+				return {};
+			}
+			if (newline(p()) != 0)
+				return {(q == '"') ? ErrNewlineInDoubleQuoteString : ErrNewlineInSingleQuoteString, startPos};
+			int n = 0;
+			error err = qchar(n);
+			if (err.err != nullptr)
+				return err;
+			popBytes(n);
+		}
+	}
+
+	// lenISODateTime returns the byte length of the rest of an ISO date
+	// time when the ':' in front of p belongs to it, or 0.
+	constexpr int lenISODateTime() {
+		if (at(0) == ':' && pos.b >= 13) {
+			int n = parseISODateTimeLiteral(in.substr(size_t(pos.b-13)));
+			if (n > 13)
+				return n - 13;
+		}
+		return 0;
+	}
+
+	constexpr error quotelessString(std::string_view &s) {
+		s = {};
+		detail::pos startPos = pos;
+		int endIdx = startPos.b;
+		for (;;) {
+			if (left() == 0)
+				break;
+			if (whitespace(p()) != 0) {
+				skipWhitespaces();
+				continue;
+			}
+			char c = at(0);
+			bool stop = c == '\n' || c == '\r' || c == '#' || c == ',' || c == '/' || c == ':' ||
+				c == '[' || c == ']' || c == '{' || c == '}';
+			if (stop && ((c == '/' && left() > 1 && (at(1) == '/' || at(1) == '*')) ||
+				newline(p()) != 0 || (c != '\r' && c != '/'))) {
+				// we met any of , : { } [ ] # \n \r\n // /*
+				int n = (disabled & QJSON_NO_DATES) ? 0 : lenISODateTime();
+				if (n == 0)
+					break;
+				popBytes(n);
+				endIdx = pos.b;
+				continue;
+			}
+			int n = 0;
+			error err = qchar(n);
+			if (err.err != nullptr)
+				return err;
+			popBytes(n);
+			endIdx = pos.b;
+		}
+		if (startPos.b != endIdx)
+			s = in.substr(size_t(startPos.b), size_t(endIdx - startPos.b));
+		return {};
+	}
+
+	constexpr tokenTag delimiter() {
+		tokenTag tag = tagUnknown;
+		switch (at(0)) {
+		case ',': tag = tagComma; break;
+		case ':': tag = tagColon; break;
+		case '[': tag = tagOpenSquare; break;
+		case ']': tag = tagCloseSquare; break;
+		case '{': tag = tagOpenBrace; break;
+		case '}': tag = tagCloseBrace; break;
+		}
+		if (tag != tagUnknown)
+			popBytes(1);
+		return tag;
+	}
+
+	constexpr error skipSpaces() {
+		error err;
+		bool ok = false;
+		while (err.err == nullptr && left() > 0) {
+			skipWhitespaces();
+			err = skipLineComment(ok);
+			if (ok || err.err != nullptr)
+				continue;
+			err = skipMultilineComment(ok);
+			if (ok || err.err != nullptr)
+				continue;
+			if (!popNewline())
+				break;
+		}
+		return err;
+	}
+
+	static constexpr int getMargin(std::string_view p) {
+		int b = 0;
+		for (int n = whitespace(p); n != 0; n = whitespace(p)) {
+			p.remove_prefix(size_t(n));
+			b += n;
+		}
+		return b;
+	}
+
+	static constexpr int matchingMarginLength(std::string_view margin, std::string_view line) {
+		size_t n = (line.size() < margin.size()) ? line.size() : margin.size();
+		for (size_t i = 0; i < n; i++)
+			if (line[i] != margin[i])
+				return int(i);
+		return int(n);
+	}
+
+	static constexpr int newlineSpecifier(std::string_view p) {
+		if (p[0] == '\\') {
+			if (p.size() > 1 && p[1] == 'n')
+				return 2;
+			if (p.size() > 3 && p[1] == 'r' && p[2] == '\\' && p[3] == 'n')
+				return 4;
+		}
+		return 0;
+	}
+
+	// multilineString pops the multiline string in front of p into s,
+	// including its margin and closing `.
+	constexpr error multilineString(std::string_view &s) {
+		s = {};
+		if (left() == 0 || at(0) != '`')
+			return {};
+		int b = getMargin(in.substr(size_t(pos.s), size_t(pos.b-pos.s))) + pos.s;
+		if (b != pos.b)
+			return {ErrMarginMustBeWhitespaceOnly, {b, pos.s, pos.l}};
+		std::string_view margin = in.substr(size_t(pos.s), size_t(pos.b-pos.s));
+		detail::pos startPos = pos;
+		popBytes(1);
+		skipWhitespaces();
+		if (left() == 0)
+			return {ErrMissingNewlineSpecifier, startPos};
+		int n = newlineSpecifier(p());
+		if (n == 0)
+			return {ErrInvalidNewlineSpecifier, startPos};
+		popBytes(n);
+		skipWhitespaces();
+		if (!popNewline()) {
+			bool ok = false;
+			error err = skipLineComment(ok);
+			if (err.err != nullptr)
+				return err;
+			if (!ok)
+				return {ErrInvalidMultilineStart, startPos};
+		}
+		if (left() == 0)
+			return {ErrUnclosedMultiline, startPos};
+		n = matchingMarginLength(margin, p());
+		if (n != int(margin.size()))
+			return {ErrInvalidMarginChar, {pos.b + n, pos.s, pos.l}};
+		popBytes(n);
+		while (left() > 0) {
+			if (popNewline()) {
+				int m = matchingMarginLength(margin, p());
+				if (m != int(margin.size()))
+					return {ErrInvalidMarginChar, {pos.b + m, pos.s, pos.l}};
+				popBytes(m);
+				continue;
+			}
+			if ((signed char)at(0) < 0x20) {
+				popBytes(1);
+				continue;
+			}
+			if (at(0) == '`') {
+				popBytes(1);
+				if (left() == 0 || at(0) != '\\') {
+					s = in.substr(size_t(startPos.s), size_t(pos.b-startPos.s));
+					return {};
+				}
+				continue;
+			}
+			int m = 0;
+			error err = qchar(m);
+			if (err.err != nullptr)
+				return err;
+			popBytes(m);
+		}
+		return {ErrUnclosedMultiline, startPos};
+	}
+
+	constexpr void nextToken() {
+		if (tk.tag == tagError)
+			return;
+		error err = skipSpaces();
+		if (err.err != nullptr) {
+			setErrorAndPos(err.err, err.pos);
+			return;
+		}
+		detail::pos tokenPos = pos;
+		if (left() == 0) {
+			setError(ErrEndOfInput);
+			return;
+		}
+		tokenTag tag = delimiter();
+		if (tag != tagUnknown) {
+			tk = token{tag, tokenPos, {}, nullptr};
+			return;
+		}
+		std::string_view s;
+		for (char q : {'"', '\''}) {
+			err = quotedString(q, s);
+			if (err.err != nullptr) {
+				setErrorAndPos(err.err, err.pos);
+				return;
+			}
+			if (!s.empty()) {
+				tk = token{(q == '"') ? tagDoubleQuotedString : tagSingleQuotedString, tokenPos, s, nullptr};
+				return;
+			}
+		}
+		if (!(disabled & QJSON_NO_MULTILINE)) {
+			err = multilineString(s);
+			if (err.err != nullptr) {
+				setErrorAndPos(err.err, err.pos);
+				return;
+			}
+			if (!s.empty()) {
+				tk = token{tagMultilineString, tokenPos, s, nullptr};
+				return;
+			}
+		} else if (rejectDisabled && at(0) == '`') {
+			setErrorAndPos(ErrMultilineDisabled, tokenPos);
+			return;
+		}
+		err = quotelessString(s);
+		if (err.err != nullptr) {
+			setErrorAndPos(err.err, err.pos);
+			return;
+		}
+		tk = token{tagQuotelessString, tokenPos, s, nullptr};
+	}
+
+	// ------------------------------------------------------------------------------------------------------------------------------------
+	// String output
+
+	// outputQuotedString outputs the double or single quoted string of tk.
+	constexpr void outputQuotedString(char q) {
+		std::string_view str = tk.val;
+		outputByte('"');
+		for (size_t i = 1; i+1 < str.size(); i++) {
+			switch (str[i]) {
+			case '/':
+				if (str[i-1] == '<')
+					outputByte('\\');
+				break;
+			case '\t':
+				outputByte('\\');
+				outputByte('t');
+				continue;
+			case '\\': {
+				char c = str[i+1];
+				if (c != 't' && c != 'n' && c != 'r' && c != 'f' && c != 'b' && c != '/' && c != '\\' && c != q &&
+					!(c == 'u' && str.size() >= i+6 && isHexDigit(str[i+2]) && isHexDigit(str[i+3]) && isHexDigit(str[i+4]) && isHexDigit(str[i+5]))) {
+					setErrorAndPos(ErrInvalidEscapeSequence, {tk.pos.b+int(i), tk.pos.s, tk.pos.l});
+					return;
+				}
+				if (c == '\'' && q == '\'')
+					continue;
+				if (c == '\\' || c == '"') {
+					// the escaped char is output with the backslash
+					outputByte('\\');
+					outputByte(c);
+					i++;
+					continue;
+				}
+				break;
+			}
+			case '"':
+				outputByte('\\');
+				break;
+			}
+			outputByte(str[i]);
+		}
+		outputByte('"');
+	}
+
+	constexpr void outputQuotelessString() {
+		std::string_view str = tk.val;
+		outputByte('"');
+		for (size_t i = 0; i < str.size(); i++) {
+			switch (str[i]) {
+			case '"':
+			case '\\':
+				outputByte('\\');
+				break;
+			case '\t':
+				outputByte('\\');
+				outputByte('t');
+				continue;
+			case '/':
+				if (i > 0 && str[i-1] == '<')
+					outputByte('\\');
+				break;
+			}
+			outputByte(str[i]);
+		}
+		outputByte('"');
+	}
+
+	constexpr void outputMultilineString() {
+		std::string_view str = tk.val;
+		size_t m = str.find('`');
+		std::string_view margin = str.substr(0, m);
+		str.remove_prefix(m+1);
+		for (int n = whitespace(str); n > 0; n = whitespace(str))
+			str.remove_prefix(size_t(n));
+		str.remove_prefix(1);
+		std::string_view nl = "\\n";
+		if (str[0] == 'n')
+			str.remove_prefix(1);
+		else {
+			nl = "\\r\\n";
+			str.remove_prefix(3);
+		}
+		str.remove_prefix(str.find('\n'));
+		// skip \n with margin of first line, and drop closing `
+		str = str.substr(1+margin.size(), str.size()-2-margin.size());
+		outputByte('"');
+		while (!str.empty()) {
+			int n = newline(str);
+			if (n != 0) {
+				outputString(nl);
+				str.remove_prefix(size_t(n)+margin.size());
+				continue;
+			}
+			char c = str[0];
+			size_t pop = 1;
+			if ((unsigned char)c < 0x20) {
+				switch (c) {
+				case '\b': outputString("\\b"); break;
+				case '\t': outputString("\\t"); break;
+				case '\r': outputString("\\r"); break;
+				case '\f': outputString("\\f"); break;
+				default:
+					outputString("\\u00");
+					outputByte("0123456789ABCDEF"[c >> 4]);
+					outputByte("0123456789ABCDEF"[c & 0xF]);
+				}
+			} else if (c == '<') {
+				outputByte('<');
+				if (str.size() > 1 && str[1] == '/')
+					outputByte('\\');
+			} else if (c == '"') {
+				outputString("\\\"");
+			} else if (c == '`' && str.size() > 1 && str[1] == '\\') {
+				outputByte('`');
+				pop = 2;
+			} else if (c == '\\') {
+				outputString("\\\\");
+			} else
+				outputByte(c);
+			str.remove_prefix(pop);
+		}
+		outputByte('"');
+	}
+
+	// ------------------------------------------------------------------------------------------------------------------------------------
+	// Grammar
+
+	constexpr bool value() {
+		switch (tk.tag) {
+		case tagCloseSquare:
+			setError(ErrUnexpectedCloseSquare);
+			return false;
+		case tagCloseBrace:
+			setError(ErrUnexpectedCloseBrace);
+			return false;
+		case tagDoubleQuotedString:
+			outputQuotedString('"');
+			break;
+		case tagSingleQuotedString:
+			outputQuotedString('\'');
+			break;
+		case tagMultilineString:
+			outputMultilineString();
+			break;
+		case tagQuotelessString:
+			if (quotelessValue())
+				return true;
+			break;
+		case tagOpenBrace: {
+			detail::pos startPos = tk.pos;
+			nextToken();
+			if (done()) {
+				if (tk.err == ErrEndOfInput)
+					setErrorAndPos(ErrUnclosedObject, startPos);
+				return true;
+			}
+			if (depth == maxDepth) {
+				setError((maxDepth == detail::maxDepth) ? ErrMaxObjectArrayDepth : ErrDepthLimit);
+				return true;
+			}
+			depth++;
+			if (members()) {
+				if (tk.err == ErrEndOfInput)
+					setErrorAndPos(ErrUnclosedObject, startPos);
+				return true;
+			}
+			depth--;
+			break;
+		}
+		case tagOpenSquare: {
+			nextToken();
+			if (done()) {
+				if (tk.err == ErrEndOfInput)
+					setError(ErrUnclosedArray);
+				return true;
+			}
+			detail::pos startPos = tk.pos;
+			if (depth == maxDepth) {
+				setError((maxDepth == detail::maxDepth) ? ErrMaxObjectArrayDepth : ErrDepthLimit);
+				return true;
+			}
+			depth++;
+			if (values()) {
+				if (tk.err == ErrEndOfInput)
+					setErrorAndPos(ErrUnclosedArray, startPos);
+				return true;
+			}
+			depth--;
+			break;
+		}
+		default:
+			setError(ErrSyntaxError);
+			return false;
+		}
+		nextToken();
+		return done();
+	}
+
+	// quotelessValue outputs the literal, number or string of tk. It returns
+	// true on error.
+	constexpr bool quotelessValue();
+
+	constexpr bool values() {
+		bool notFirst = false;
+		outputByte('[');
+		while (!done() && tk.tag != tagCloseSquare) {
+			if (notFirst) {
+				outputByte(',');
+				if (tk.tag == tagComma) {
+					nextToken();
+					if (done()) {
+						if (tk.err == ErrEndOfInput)
+							setError(ErrExpectValueAfterComma);
+						break;
+					}
+					if (tk.tag == tagCloseBrace || tk.tag == tagCloseSquare) {
+						setError(ErrExpectValueAfterComma);
+						break;
+					}
+				}
+			} else
+				notFirst = true;
+			if (value() || done())
+				break;
+		}
+		outputByte(']');
+		return done();
+	}
+
+	constexpr bool member() {
+		switch (tk.tag) {
+		case tagCloseSquare:
+			setError(ErrUnexpectedCloseSquare);
+			return false;
+		case tagDoubleQuotedString:
+			outputQuotedString('"');
+			break;
+		case tagSingleQuotedString:
+			outputQuotedString('\'');
+			break;
+		case tagQuotelessString:
+			outputQuotelessString();
+			break;
+		default:
+			setError(ErrExpectStringIdentifier);
+			break;
+		}
+		nextToken();
+		if (done()) {
+			if (tk.err == ErrEndOfInput)
+				setError(ErrUnexpectedEndOfInput);
+			return true;
+		}
+		if (tk.tag != tagColon) {
+			setError(ErrExpectColon);
+			return true;
+		}
+		outputByte(':');
+		nextToken();
+		if (done()) {
+			if (tk.err == ErrEndOfInput)
+				setError(ErrUnexpectedEndOfInput);
+			return true;
+		}
+		return value();
+	}
+
+	constexpr bool members() {
+		bool notFirst = false;
+		outputByte('{');
+		while (!done() && tk.tag != tagCloseBrace) {
+			if (notFirst) {
+				outputByte(',');
+				if (tk.tag == tagComma) {
+					nextToken();
+					if (done()) {
+						if (tk.err == ErrEndOfInput)
+							setError(ErrExpectIdentifierAfterComma);
+						break;
+					}
+					if (tk.tag == tagCloseBrace || tk.tag == tagCloseSquare) {
+						setError(ErrExpectIdentifierAfterComma);
+						break;
+					}
+				}
+			} else
+				notFirst = true;
+			if (member() || done())
+				break;
+		}
+		outputByte('}');
+		return done();
+	}
+
+	constexpr void decode() {
+		nextToken();
+		members();
+		if (tk.tag == tagCloseBrace)
+			tk = token{tagError, tk.pos, {}, ErrSyntaxError};
+	}
+};
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Number expressions
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// numToken is an operator, an integer or decimal value, or an error.
+struct numToken {
+	tokenTag    tag = tagUnknown;
+	int         pos = 0;
+	int64_t     i = 0;
+	double      f = 0;
+	const char *e = nullptr;
+};
+
+constexpr numToken numError(int pos, const char *err) { return {tagError, pos, 0, 0, err}; }
+
+constexpr unsigned char precedence(tokenTag t) {
+	switch (t) {
+	case tagPlus: case tagMinus: case tagXor: case tagOr: case tagInverse:
+		return 1;
+	case tagMultiplication: case tagDivision: case tagAnd: case tagModulo:
+		return 2;
+	case tagWeeks: case tagDays: case tagHours: case tagMinutes: case tagSeconds:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+inline constexpr unsigned char highestPrecedence = 4;
+
+// digitsLen returns the byte length of the digits with optional single '_'
+// separators in front of v, 0 if there are none, or -1 if invalid.
+template <typename IsDigit>
+constexpr int digitsLen(std::string_view v, IsDigit isDigit) {
+	if (v.empty() || !isDigit(v[0]))
+		return 0;
+	for (size_t p = 1; p < v.size(); p++) {
+		if (v[p] == '_') {
+			p++;
+			if (p == v.size())
+				return -1;
+		}
+		if (!isDigit(v[p]))
+			return (v[p-1] == '_') ? -1 : int(p);
+	}
+	return int(v.size());
+}
+
+// headerLen skips n bytes of header and an optional '_' in front of v.
+constexpr int headerLen(int n, std::string_view &v) {
+	if (size_t(n) >= v.size())
+		return -1;
+	v.remove_prefix(size_t(n));
+	if (v[0] == '_') {
+		n++;
+		v.remove_prefix(1);
+		if (v.empty())
+			return -1;
+	}
+	return n;
+}
+
+// prefixedLiteral returns the byte length of the 0b, 0o or 0x literal in
+// front of v, 0 if there is none, or -1 if it is invalid.
+template <typename IsDigit>
+constexpr int prefixedLiteral(std::string_view v, char prefix, IsDigit isDigit) {
+	if (v.size() < 2 || v[0] != '0' || (v[1]&0xDF) != prefix)
+		return 0;
+	int n = headerLen(2, v);
+	if (n >= 0) {
+		int p = digitsLen(v, isDigit);
+		if (p > 0)
+			return n + p;
+	}
+	return -1;
+}
+
+constexpr int parseOctLiteral(std::string_view v) {
+	if (v.empty() || v[0] != '0')
+		return 0;
+	if (v.size() >= 2 && (v[1]&0xDF) == 'O')
+		return prefixedLiteral(v, 'O', isOctDigit);
+	// a 0 not followed by _ or an octal digit is not an octal number
+	if (v.size() < 2 || (v[1] != '_' && !isOctDigit(v[1])))
+		return 0;
+	int n = headerLen(1, v);
+	if (n >= 0) {
+		int p = digitsLen(v, isOctDigit);
+		if (p > 0)
+			return n + p;
+	}
+	return -1;
+}
+
+constexpr int parseIntLiteral(std::string_view v) {
+	if (v[0] >= '1' && v[0] <= '9')
+		return digitsLen(v, isIntDigit);
+	if (v[0] != '0')
+		return 0;
+	if (v.size() > 1 && (v[1] == '_' || isIntDigit(v[1])))
+		return -1;
+	return 1;
+}
+
+constexpr int parseExponent(std::string_view v) {
+	if (v.empty() || (v[0]&0xDF) != 'E')
+		return 0;
+	int n = 1;
+	v.remove_prefix(1);
+	if (v.empty())
+		return -1;
+	if (v[0] == '+' || v[0] == '-') {
+		n++;
+		v.remove_prefix(1);
+		if (v.empty())
+			return -1;
+	}
+	int p = digitsLen(v, isIntDigit);
+	return (p > 0) ? n + p : -1;
+}
+
+constexpr int parseDecLiteral(std::string_view v) {
+	int p = digitsLen(v, isIntDigit);
+	if (p < 0)
+		return 0;
+	if (p == 0) {
+		// numbers must be of the form .123[e[+/-]145]
+		if (v[0] != '.' || v.size() < 2)
+			return 0;
+		v.remove_prefix(1);
+		p = digitsLen(v, isIntDigit);
+		if (p < 0)
+			return -1;
+		if (p == 0)
+			return (!v.empty() && (v[0] == '_' || (v[0]&0xDF) == 'E')) ? -1 : 0;
+		v.remove_prefix(size_t(p));
+		int q = parseExponent(v);
+		return (q < 0) ? -1 : 1 + p + q;
+	}
+	int n = p;
+	v.remove_prefix(size_t(p));
+	int q = parseExponent(v);
+	if (q < 0)
+		return -1;
+	if (q > 0)
+		return p + q;
+	if (v.empty() || v[0] != '.')
+		return 0;
+	n++;
+	v.remove_prefix(1);
+	q = digitsLen(v, isIntDigit);
+	if (q < 0)
+		return -1;
+	n += q;
+	v.remove_prefix(size_t(q));
+	p = parseExponent(v);
+	if (p < 0)
+		return -1;
+	n += p;
+	if (int(v.size()) > p && v[size_t(p)] == '_')
+		return -1;
+	return n;
+}
+
+// decodeInt returns the value of the digits of v in base, or -1 on overflow.
+constexpr int64_t decodeInt(std::string_view v, unsigned base) {
+	uint64_t val = 0;
+	for (char c : v) {
+		if (c == '_')
+			continue;
+		uint64_t d = isIntDigit(c) ? uint64_t(c-'0') : uint64_t((c&0xDF)-'A'+10);
+		if (val > (UINT64_MAX - d)/base)
+			return -1;
+		val = val*base + d;
+	}
+	return (val >> 63) ? -1 : int64_t(val);
+}
+
+// daysFromCivil returns the number of days since 1970-01-01 of the date,
+// normalizing the days beyond the end of the month like timegm.
+constexpr int64_t daysFromCivil(int64_t y, int64_t m, int64_t d) {
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y-399) / 400;
+	int64_t yoe = y - era*400;
+	int64_t doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5;
+	int64_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+	return era*146097 + doe - 719468 + d - 1;
+}
+
+// decodeISODateTime returns the UTC time in seconds of the ISO date time
+// literal v, or -1 if it is invalid, like decodeISODateTimeLiteral.
+constexpr double decodeISODateTime(std::string_view v) {
+	auto num = [&v](size_t b, size_t n) {
+		int x = 0;
+		for (size_t i = b; i < b+n; i++)
+			x = x*10 + (v[i]-'0');
+		return x;
+	};
+	int y = num(0, 4), M = num(5, 2), d = num(8, 2), h = 0, m = 0, s = 0, ho = 0, mo = 0;
+	double f = 0;
+	if (v.size() >= 16) {
+		h = num(11, 2);
+		m = num(14, 2);
+	}
+	if (v.size() >= 19 && v[16] == ':') {
+		s = num(17, 2);
+		size_t p = 19;
+		if (p < v.size() && v[p] == '.') {
+			p++;
+			if (p+3 < v.size() && isIntDigit(v[p+3])) {
+				f = double(num(p, 6))/1000000;
+				p += 6;
+			} else {
+				f = double(num(p, 3))/1000;
+				p += 3;
+			}
+		}
+		if (p < v.size() && v[p] != 'Z') {
+			ho = num(p+1, 2);
+			if (v[p] == '-')
+				ho = -ho;
+			mo = num(p+4, 2);
+		}
+	}
+	if (y < 1970 || M < 1 || M > 12 || d < 1 || d > 31 || h < 0 || h > 24 || m < 0 || m > 59 || s < 0 || s > 60 ||
+		ho < -15 || ho > 15 || mo < 0 || mo > 59 || (h == 24 && m != 0 && s != 0 && f != 0))
+		return -1;
+	double t = double(daysFromCivil(y, M, d)*86400 + h*3600 + m*60 + s) + f;
+	if (ho < 0)
+		return t - ho*3600 + mo*60;
+	return t - ho*3600 - mo*60;
+}
+
+// numEngine evaluates a number expression, like numEngine_t of qjson.c.
+struct numEngine {
+	std::string_view in;
+	int              pos = 0;
+	numToken         tk;
+	unsigned         disabled = 0;
+
+	constexpr std::string_view p() const { return in.substr(size_t(pos)); }
+
+	constexpr bool nextOperator() {
+		tokenTag x = tagUnknown;
+		switch (in[size_t(pos)]) {
+		case '%': x = tagModulo; break;
+		case '&': x = tagAnd; break;
+		case '(': x = tagOpenParen; break;
+		case ')': x = tagCloseParen; break;
+		case '*': x = tagMultiplication; break;
+		case '+': x = tagPlus; break;
+		case '-': x = tagMinus; break;
+		case '/': x = tagDivision; break;
+		case '^': x = tagXor; break;
+		case 'd': x = tagDays; break;
+		case 'h': x = tagHours; break;
+		case 'm': x = tagMinutes; break;
+		case 's': x = tagSeconds; break;
+		case 'w': x = tagWeeks; break;
+		case '|': x = tagOr; break;
+		case '~': x = tagInverse; break;
+		}
+		if (x == tagUnknown)
+			return false;
+		tk = numToken{x, pos, 0, 0, nullptr};
+		pos++;
+		return true;
+	}
+
+	// nextValue pops the literal of length n, or sets an error.
+	constexpr bool intValue(int n, const char *invalid, int skip, unsigned base) {
+		if (n == 0)
+			return false;
+		if (n < 0) {
+			tk = numError(pos, invalid);
+			return true;
+		}
+		int64_t v = decodeInt(p().substr(size_t(skip), size_t(n-skip)), base);
+		if (v < 0) {
+			tk = numError(pos, ErrNumberOverflow);
+			return true;
+		}
+		tk = numToken{tagIntegerVal, pos, v, 0, nullptr};
+		pos += n;
+		return true;
+	}
+
+	constexpr bool nextDateValue() {
+		int n = parseISODateTimeLiteral(p());
+		if (n == 0)
+			return false;
+		double v = (n < 0) ? -1 : decodeISODateTime(p().substr(0, size_t(n)));
+		if (v < 0) {
+			tk = numError(pos, ErrInvalidISODateTime);
+			return true;
+		}
+		tk = numToken{tagDecimalVal, pos, 0, v, nullptr};
+		pos += n;
+		return true;
+	}
+
+	constexpr bool nextDecValue() {
+		int n = parseDecLiteral(p());
+		if (n == 0)
+			return false;
+		parsed v;
+		if (n > 0)
+			v = parseDouble(p().substr(0, size_t(n)));
+		if (n < 0 || !v.ok) {
+			tk = numError(pos, ErrInvalidDecimalNumber);
+			return true;
+		}
+		if (v.v > 0x1.fffffffffffffp1023) {
+			tk = numError(pos, ErrNumberOverflow);
+			return true;
+		}
+		tk = numToken{tagDecimalVal, pos, 0, v.v, nullptr};
+		pos += n;
+		return true;
+	}
+
+	constexpr bool nextOctValue() {
+		int n = parseOctLiteral(p());
+		int skip = (n > 1 && (in[size_t(pos+1)]&0xDF) == 'O') ? 2 : 1;
+		return intValue(n, ErrInvalidOctalNumber, skip, 8);
+	}
+
+	constexpr void checkOperator(bool first) {
+		switch (tk.tag) {
+		case tagWeeks: case tagDays: case tagHours: case tagMinutes: case tagSeconds:
+			if (disabled & QJSON_NO_DURATIONS)
+				tk = numError(tk.pos, ErrDurationsDisabled);
+			return;
+		case tagPlus: case tagMinus:
+			if (first)
+				return;
+			[[fallthrough]];
+		default:
+			if (disabled & QJSON_NO_EXPRESSIONS)
+				tk = numError(tk.pos, ErrExpressionsDisabled);
+		}
+	}
+
+	constexpr void nextToken() {
+		if (tk.tag == tagError)
+			return;
+		for (int n = whitespace(p()); n != 0; n = whitespace(p()))
+			pos += n;
+		if (size_t(pos) == in.size()) {
+			tk = numError(pos, ErrEndOfInput);
+			return;
+		}
+		bool first = tk.tag == tagUnknown;
+		if (nextOperator()) {
+			if (disabled != 0)
+				checkOperator(first);
+			return;
+		}
+		if (!(!(disabled & QJSON_NO_DATES) && nextDateValue()) &&
+			!intValue(prefixedLiteral(p(), 'B', isBinDigit), ErrInvalidBinaryNumber, 2, 2) &&
+			!intValue(prefixedLiteral(p(), 'X', isHexDigit), ErrInvalidHexadecimalNumber, 2, 16) &&
+			!nextDecValue() && !nextOctValue() &&
+			!intValue(parseIntLiteral(p()), ErrInvalidIntegerNumber, 0, 10))
+			tk = numError(pos, ErrInvalidNumericExpression);
+	}
+
+	// operand evaluates the right operand of an operator, an end of input
+	// becoming an invalid expression.
+	constexpr numToken operand(unsigned char rbp) {
+		numToken right = expression(rbp);
+		if (right.tag == tagError && right.e == ErrEndOfInput)
+			right.e = ErrInvalidNumericExpression;
+		return right;
+	}
+
+	static constexpr numToken toDouble(numToken t) {
+		if (t.tag == tagIntegerVal)
+			return numToken{tagDecimalVal, t.pos, 0, double(t.i), nullptr};
+		return t;
+	}
+
+	constexpr numToken nud(numToken t) {
+		switch (t.tag) {
+		case tagIntegerVal:
+		case tagDecimalVal:
+			return t;
+		case tagPlus:
+			return operand(highestPrecedence + 1);
+		case tagMinus: {
+			numToken right = operand(highestPrecedence + 1);
+			if (right.tag == tagIntegerVal)
+				right.i = int64_t(0 - uint64_t(right.i));
+			else if (right.tag == tagDecimalVal)
+				right.f = -right.f;
+			return right;
+		}
+		case tagOpenParen: {
+			numToken right = operand(0);
+			if (right.tag == tagError)
+				return right;
+			if (tk.tag != tagCloseParen)
+				return numError(t.pos, ErrUnclosedParenthesis);
+			nextToken();
+			return right;
+		}
+		case tagCloseParen:
+			return numError(t.pos, ErrUnopenedParenthesis);
+		case tagInverse: {
+			numToken right = operand(highestPrecedence + 1);
+			if (right.tag == tagError)
+				return right;
+			if (right.tag == tagDecimalVal)
+				return numError(t.pos, ErrOperandMustBeInteger);
+			right.i = ~right.i;
+			return right;
+		}
+		default:
+			return numError(t.pos, ErrInvalidNumericExpression);
+		}
+	}
+
+	constexpr numToken duration(numToken t, numToken left, double d, unsigned char rbp) {
+		left = toDouble(left);
+		numToken right;
+		if (tk.tag != tagCloseParen) {
+			right = expression(rbp);
+			if (right.tag == tagError && right.e != ErrEndOfInput) // right hand operand is optional
+				return right;
+		}
+		if (overflows('*', left.f, d))
+			return numError(t.pos, ErrNumberOverflow);
+		left.f *= d;
+		if (right.tag == tagIntegerVal || right.tag == tagDecimalVal) {
+			right = toDouble(right);
+			if (overflows('+', left.f, right.f))
+				return numError(t.pos, ErrNumberOverflow);
+			left.f += right.f;
+		}
+		return left;
+	}
+
+	constexpr numToken led(numToken t, numToken left) {
+		switch (t.tag) {
+		case tagWeeks:
+			return duration(t, left, 3600*24*7, precedence(tagWeeks)-1);
+		case tagDays:
+			return duration(t, left, 3600*24, precedence(tagDays)-1);
+		case tagHours:
+			return duration(t, left, 3600, precedence(tagHours)-1);
+		case tagMinutes:
+			return duration(t, left, 60, precedence(tagMinutes)-1);
+		case tagSeconds:
+			return duration(t, left, 1, precedence(tagSeconds)-1);
+		case tagPlus: case tagMinus: case tagMultiplication: case tagDivision:
+		case tagModulo: case tagAnd: case tagOr: case tagXor:
+			break;
+		default:
+			return numError(t.pos, ErrInvalidNumericExpression);
+		}
+		numToken right = operand(precedence(t.tag));
+		if (right.tag == tagError)
+			return right;
+		if (left.tag == tagDecimalVal || right.tag == tagDecimalVal) {
+			left = toDouble(left);
+			right = toDouble(right);
+		}
+		bool integer = left.tag == tagIntegerVal;
+		// integer operations wrap around like the C engine on two’s complement
+		uint64_t a = uint64_t(left.i), b = uint64_t(right.i);
+		// decimal operations overflowing to an infinite value are errors
+		switch (t.tag) {
+		case tagPlus:
+			if (integer)
+				left.i = int64_t(a + b);
+			else if (overflows('+', left.f, right.f))
+				return numError(t.pos, ErrNumberOverflow);
+			else
+				left.f += right.f;
+			return left;
+		case tagMinus:
+			if (integer)
+				left.i = int64_t(a - b);
+			else if (overflows('-', left.f, right.f))
+				return numError(t.pos, ErrNumberOverflow);
+			else
+				left.f -= right.f;
+			return left;
+		case tagMultiplication:
+			if (integer)
+				left.i = int64_t(a * b);
+			else if (overflows('*', left.f, right.f))
+				return numError(t.pos, ErrNumberOverflow);
+			else
+				left.f *= right.f;
+			return left;
+		case tagDivision:
+			if (integer ? right.i == 0 : right.f == 0)
+				return numError(t.pos, ErrDivisionByZero);
+			if (integer)
+				left.i /= right.i;
+			else if (overflows('/', left.f, right.f))
+				return numError(t.pos, ErrNumberOverflow);
+			else
+				left.f /= right.f;
+			return left;
+		default:
+			break;
+		}
+		if (!integer)
+			return numError(t.pos, ErrOperandMustBeInteger);
+		switch (t.tag) {
+		case tagModulo:
+			if (right.i == 0)
+				return numError(t.pos, ErrDivisionByZero);
+			left.i %= right.i;
+			return left;
+		case tagAnd:
+			left.i &= right.i;
+			return left;
+		case tagOr:
+			left.i |= right.i;
+			return left;
+		default:
+			left.i ^= right.i;
+			return left;
+		}
+	}
+
+	constexpr numToken expression(unsigned char rbp) {
+		if (tk.tag == tagError)
+			return tk;
+		numToken t = tk;
+		nextToken();
+		numToken left = nud(t);
+		while (left.tag != tagError && rbp < precedence(tk.tag)) {
+			t = tk;
+			nextToken();
+			left = led(t, left);
+		}
+		return left;
+	}
+};
+
+// evalNumberExpression evaluates the expression in input to a decimal
+// value or an error.
+constexpr numToken evalNumberExpression(std::string_view input, unsigned disabled) {
+	numEngine e{input, 0, {}, disabled};
+	e.nextToken();
+	numToken t = e.expression(0);
+	if (t.tag != tagError && e.tk.tag == tagError && (e.tk.e == ErrExpressionsDisabled || e.tk.e == ErrDurationsDisabled))
+		return e.tk; // the expression stopped at a disabled operator
+	return numEngine::toDouble(t);
+}
+
+constexpr bool isJSONNumber(std::string_view p) {
+	size_t i = 0, l = p.size();
+	if (i < l && p[i] == '-')
+		i++;
+	if (i == l || !isIntDigit(p[i]))
+		return false;
+	if (p[i++] != '0')
+		while (i < l && isIntDigit(p[i]))
+			i++;
+	if (i < l && p[i] == '.') {
+		if (++i == l || !isIntDigit(p[i]))
+			return false;
+		while (i < l && isIntDigit(p[i]))
+			i++;
+	}
+	if (i < l && (p[i] == 'e' || p[i] == 'E')) {
+		if (++i < l && (p[i] == '+' || p[i] == '-'))
+			i++;
+		if (i == l || !isIntDigit(p[i]))
+			return false;
+		while (i < l && isIntDigit(p[i]))
+			i++;
+	}
+	return i == l;
+}
+
+constexpr bool isNumberExpr(std::string_view p) {
+	for (size_t i = 0; i < p.size(); i++) {
+		if (p[i] == '+' || p[i] == '-' || p[i] == ' ' || p[i] == '\t' || p[i] == '(')
+			continue;
+		return isIntDigit(p[i]) || (p[i] == '.' && i+1 < p.size() && isIntDigit(p[i+1]));
+	}
+	return false;
+}
+
+// literalValue returns the json literal of the qjson literal p, or an empty
+// view. Like isLiteralValue, a shorter literal matches the front of p.
+constexpr std::string_view literalValue(std::string_view p) {
+	// is tests the lower case literal, whose first char may be upper case,
+	// and whose other chars are all lower or all upper case
+	auto is = [&p](std::string_view lower) {
+		if ((p[0]|0x20) != lower[0])
+			return false;
+		bool lo = true, up = true;
+		for (size_t i = 1; i < lower.size(); i++) {
+			lo = lo && p[i] == lower[i];
+			up = up && p[i] == char(lower[i] & 0xDF);
+		}
+		return lo || up;
+	};
+	switch (p.size()) {
+	case 5:
+		if (is("false"))
+			return "false";
+		[[fallthrough]];
+	case 4:
+		if (is("null"))
+			return "null";
+		if (is("true"))
+			return "true";
+		[[fallthrough]];
+	case 3:
+		if (is("yes"))
+			return "true";
+		if (is("off"))
+			return "false";
+		[[fallthrough]];
+	case 2:
+		if ((p[0]|0x20) == 'o' && (p[1]|0x20) == 'n')
+			return "true";
+		if ((p[0]|0x20) == 'n' && (p[1]|0x20) == 'o')
+			return "false";
+	}
+	return {};
+}
+
+constexpr bool engine::quotelessValue() {
+	std::string_view val = tk.val;
+	std::string_view lit = literalValue(val);
+	if (!lit.empty()) {
+		outputString(lit);
+		return false;
+	}
+	if (!isNumberExpr(val)) {
+		outputQuotelessString();
+		return false;
+	}
+	if ((disabled & QJSON_NO_EXPRESSIONS) && isJSONNumber(val)) {
+		// without expressions, json numbers are copied as is
+		outputString(val);
+		return false;
+	}
+	numToken t = evalNumberExpression(val, disabled);
+	if (t.tag == tagError) {
+		if (!rejectDisabled && (t.e == ErrExpressionsDisabled || t.e == ErrDurationsDisabled)) {
+			outputQuotelessString();
+			return false;
+		}
+		setErrorAndPos(t.e, {tk.pos.b + t.pos, tk.pos.s, tk.pos.l});
+		return true;
+	}
+	char buf[32] = {};
+	int n = formatDouble(t.f, buf);
+	outputString({buf, size_t(n)});
+	return false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Conversion
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// result is the outcome of a conversion: the byte length of the json
+// text, or the error with its line and column starting at 1.
+struct result {
+	size_t      len = 0;
+	const char *err = nullptr;
+	int         line = 0;
+	int         col = 0;
+};
+
+// convert converts text into out with the options of Policy, or only
+// computes the json length when out is null.
+template <typename Policy>
+constexpr result convert(std::string_view text, char *out) {
+	static_assert(Policy::duplicates == QJSON_DUP_ALLOW, "duplicate key policies are not supported at compile time");
+	static_assert(std::is_same_v<typename Policy::sink, qjson::sink::json>, "only the json sink is supported at compile time");
+	if (text.empty()) {
+		if (out != nullptr) {
+			out[0] = '{';
+			out[1] = '}';
+		}
+		return {2};
+	}
+	engine e;
+	e.in = text;
+	e.out = out;
+	e.disabled = Policy::disabled;
+	e.rejectDisabled = Policy::reject_disabled;
+	if (Policy::max_depth > 0 && Policy::max_depth < maxDepth)
+		e.maxDepth = Policy::max_depth;
+	e.decode();
+	if (e.tk.err == ErrEndOfInput)
+		return {e.len};
+	detail::pos p = e.tk.pos;
+	return {0, e.tk.err, p.l+1, column(text.substr(size_t(p.s), size_t(p.b-p.s)))+1};
+}
+
+} // namespace detail
+
+// decode converts the qjson text S into a json text at compile time, with
+// the options of Policy.
+template <fixed_string S, typename Policy = default_policy>
+consteval auto decode() {
+	constexpr detail::result r = detail::convert<Policy>(S.view(), nullptr);
+	if constexpr (r.err != nullptr) {
+		static_assert(syntax_error<message(r.err), r.line, r.col>::value);
+		return text<0>{};
+	} else {
+		text<r.len> t;
+		detail::convert<Policy>(S.view(), t.buf.data());
+		return t;
+	}
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Document
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+using kind = qjson::pmr::kind;
+
+// node is a json value of a document. Its strings are offsets in the
+// characters of the document, and the nodes are stored in depth first
+// order, so that the children of a node follow it.
+struct node {
+	uint32_t off = 0, len = 0;       // json text of a number or literal, or unescaped string
+	uint32_t keyOff = 0, keyLen = 0; // unescaped key of an object member
+	uint32_t size = 0;               // number of children of an array or object
+	uint32_t span = 1;               // number of nodes of the value, itself included
+	double   number = 0;             // value of a number
+	ct::kind kind = kind::null;
+};
+
+// value is a reference to a node of a document. A default constructed
+// value, returned for a missing member or index, is false.
+class value {
+public:
+	constexpr value() = default;
+	constexpr value(const node *n, const char *chars) noexcept : n(n), chars(chars) {}
+
+	constexpr explicit operator bool() const noexcept { return n != nullptr; }
+	constexpr ct::kind kind() const noexcept { return n->kind; }
+	constexpr bool is_null() const noexcept { return n->kind == kind::null; }
+	constexpr bool is_bool() const noexcept { return n->kind == kind::boolean; }
+	constexpr bool is_number() const noexcept { return n->kind == kind::number; }
+	constexpr bool is_string() const noexcept { return n->kind == kind::string; }
+	constexpr bool is_array() const noexcept { return n->kind == kind::array; }
+	constexpr bool is_object() const noexcept { return n->kind == kind::object; }
+
+	constexpr std::string_view key() const noexcept { return {chars + n->keyOff, n->keyLen}; }
+	constexpr std::string_view text() const noexcept { return {chars + n->off, n->len}; }
+	constexpr std::string_view as_string() const noexcept { return text(); }
+	constexpr bool as_bool() const noexcept { return chars[n->off] == 't'; }
+	constexpr double as_number() const noexcept { return n->number; }
+	constexpr size_t size() const noexcept { return n->size; }
+
+	// iterator iterates the children of an array or object.
+	class iterator {
+	public:
+		constexpr iterator(const node *n, const char *chars) noexcept : n(n), chars(chars) {}
+		constexpr value operator*() const noexcept { return value(n, chars); }
+		constexpr iterator& operator++() noexcept { n += n->span; return *this; }
+		constexpr bool operator==(const iterator &o) const noexcept { return n == o.n; }
+	private:
+		const node *n;
+		const char *chars;
+	};
+	constexpr iterator begin() const noexcept { return iterator(n+1, chars); }
+	constexpr iterator end() const noexcept { return iterator(n + n->span, chars); }
+
+	// operator[] returns the member key of an object, the last one if it is
+	// duplicated, or a false value.
+	constexpr value operator[](std::string_view key) const noexcept {
+		value found;
+		if (n != nullptr && n->kind == kind::object)
+			for (value v : *this)
+				if (v.key() == key)
+					found = v;
+		return found;
+	}
+
+	// operator[] returns the element i of an array or a false value.
+	constexpr value operator[](size_t i) const noexcept {
+		if (n == nullptr || n->kind != kind::array || i >= n->size)
+			return value();
+		iterator it = begin();
+		while (i-- > 0)
+			++it;
+		return *it;
+	}
+
+private:
+	const node *n = nullptr;
+	const char *chars = nullptr;
+};
+
+// document is the tree of NodeCount values of a json text, built at compile
+// time. Its characters are the json text followed by the unescaped strings
+// containing escape sequences.
+template <size_t NodeCount, size_t CharCount>
+struct document {
+	std::array<node, NodeCount> nodes = {};
+	std::array<char, CharCount> chars = {};
+	size_t                      jsonLen = 0;
+
+	// root returns the top level object.
+	constexpr value root() const noexcept { return value(nodes.data(), chars.data()); }
+	// json returns the json text of the document.
+	constexpr std::string_view json() const noexcept { return {chars.data(), jsonLen}; }
+	static constexpr size_t size() noexcept { return NodeCount; }
+};
+
+namespace detail {
+
+// treeBuilder builds the nodes of a compact json text produced by engine,
+// or only counts the nodes and characters when nodes is null.
+struct treeBuilder {
+	std::string_view json;
+	node            *nodes = nullptr;
+	char            *chars = nullptr;
+	size_t           nNodes = 0;
+	size_t           nChars = 0;
+
+	// build appends the nodes of the value at json[i] and returns the index
+	// after it.
+	constexpr size_t build(size_t i, uint32_t keyOff, uint32_t keyLen) {
+		size_t k = nNodes++;
+		node n;
+		n.keyOff = keyOff;
+		n.keyLen = keyLen;
+		char c = json[i];
+		if (c == '{' || c == '[') {
+			bool obj = c == '{';
+			char close = obj ? '}' : ']';
+			n.kind = obj ? kind::object : kind::array;
+			i++;
+			while (json[i] != close) {
+				uint32_t ko = 0, kl = 0;
+				if (obj) {
+					i = string(i, ko, kl);
+					i++; // ':'
+				}
+				i = build(i, ko, kl);
+				n.size++;
+				if (json[i] == ',')
+					i++;
+			}
+			i++;
+			n.span = uint32_t(nNodes - k);
+		} else if (c == '"') {
+			n.kind = kind::string;
+			i = string(i, n.off, n.len);
+		} else {
+			size_t b = i;
+			while (i < json.size() && json[i] != ',' && json[i] != ']' && json[i] != '}')
+				i++;
+			n.off = uint32_t(b);
+			n.len = uint32_t(i-b);
+			if (c == 't' || c == 'f')
+				n.kind = kind::boolean;
+			else if (c == 'n' && json[b+1] == 'u')
+				n.kind = kind::null;
+			else {
+				n.kind = kind::number;
+				std::string_view t = json.substr(b, i-b);
+				bool neg = t[0] == '-';
+				if (neg)
+					t.remove_prefix(1);
+				n.number = (t[0] == 'i' || t[0] == 'n') ? std::bit_cast<double>(uint64_t(0x7FF) << 52) : parseDouble(t).v;
+				if (neg)
+					n.number = -n.number;
+			}
+		}
+		if (nodes != nullptr)
+			nodes[k] = n;
+		return i;
+	}
+
+	// string sets off and len to the unescaped json string at json[i], and
+	// returns the index after it.
+	constexpr size_t string(size_t i, uint32_t &off, uint32_t &len) {
+		size_t b = ++i;
+		bool escaped = false;
+		for (; json[i] != '"'; i++)
+			if (json[i] == '\\') {
+				escaped = true;
+				i++;
+			}
+		if (!escaped) {
+			off = uint32_t(b);
+			len = uint32_t(i-b);
+			return i+1;
+		}
+		off = uint32_t(nChars);
+		for (size_t q = b; q < i; q++) {
+			if (json[q] != '\\') {
+				put(json[q]);
+				continue;
+			}
+			switch (json[++q]) {
+			case 'b': put('\b'); break;
+			case 'f': put('\f'); break;
+			case 'n': put('\n'); break;
+			case 'r': put('\r'); break;
+			case 't': put('\t'); break;
+			case 'u': {
+				uint32_t c = hex4(q+1);
+				q += 4;
+				if (c >= 0xD800 && c < 0xDC00 && json[q+1] == '\\' && json[q+2] == 'u') {
+					c = 0x10000 + ((c - 0xD800) << 10) + (hex4(q+3) - 0xDC00);
+					q += 6;
+				}
+				utf8(c);
+				break;
+			}
+			default: put(json[q]); break; // '"', '\\' and '/'
+			}
+		}
+		len = uint32_t(nChars - off);
+		return i+1;
+	}
+
+	constexpr void put(char c) {
+		if (chars != nullptr)
+			chars[nChars] = c;
+		nChars++;
+	}
+
+	constexpr uint32_t hex4(size_t i) const {
+		uint32_t v = 0;
+		for (size_t j = i; j < i+4; j++) {
+			char c = json[j];
+			v = v*16 + uint32_t((c <= '9') ? c-'0' : (c|0x20)-'a'+10);
+		}
+		return v;
+	}
+
+	constexpr void utf8(uint32_t c) {
+		if (c < 0x80) {
+			put(char(c));
+		} else if (c < 0x800) {
+			put(char(0xC0 | c>>6));
+			put(char(0x80 | (c & 0x3F)));
+		} else if (c < 0x10000) {
+			put(char(0xE0 | c>>12));
+			put(char(0x80 | (c>>6 & 0x3F)));
+			put(char(0x80 | (c & 0x3F)));
+		} else {
+			put(char(0xF0 | c>>18));
+			put(char(0x80 | (c>>12 & 0x3F)));
+			put(char(0x80 | (c>>6 & 0x3F)));
+			put(char(0x80 | (c & 0x3F)));
+		}
+	}
+};
+
+// treeSize is the number of nodes and characters of a document.
+struct treeSize {
+	size_t nodes = 0;
+	size_t chars = 0;
+};
+
+template <size_t N>
+constexpr treeSize countTree(const text<N> &t) {
+	treeBuilder b{t.view()};
+	b.nChars = N;
+	b.build(0, 0, 0);
+	return {b.nNodes, b.nChars};
+}
+
+} // namespace detail
+
+// parse converts the qjson text S at compile time, with the options of
+// Policy, into a document.
+template <fixed_string S, typename Policy = default_policy>
+consteval auto parse() {
+	constexpr auto t = decode<S, Policy>();
+	constexpr detail::treeSize n = detail::countTree(t);
+	document<n.nodes, n.chars> d;
+	for (size_t i = 0; i < t.size(); i++)
+		d.chars[i] = t.buf[i];
+	d.jsonLen = t.size();
+	detail::treeBuilder b{t.view(), d.nodes.data(), d.chars.data()};
+	b.nChars = t.size();
+	b.build(0, 0, 0);
+	return d;
+}
+
+} // namespace ct
+} // namespace qjson
+
+#endif
@@ -0,0 +1,295 @@
+// qjson is a command line converter of qjson text into json text.
+//
+// Usage: qjson [-a] [-c] [-d] [-e max] [-f] [-i indent] [-j threads] [-k] [-o dir] [file ...]
+//
+// Without file arguments, the qjson text is read from stdin and the json
+// text is written to stdout. Otherwise the files are converted in parallel
+// by a pool of threads and the json texts are written to stdout in the
+// order of the arguments, each followed by a newline, or to dir/name.json
+// when -o is given. With -c the inputs are only validated. With -k the
+// json is canonical, with sorted keys and normalized numbers and strings,
+// and with -d only the hexadecimal digest of the canonical json is written,
+// followed by the file name. With -f, the json is flattened into one
+// "path<TAB>value" line per scalar value, path being its json pointer.
+// With -i, the json is indented by the given number of spaces per level,
+// and with -a its non ascii chars are escaped.
+// Errors are reported on stderr in the file:line:col: message format. 
+// With -e, the parser recovers from errors and reports up to max errors 
+// per input. The exit status is 1 if any input is invalid or could not be
+// read or written.
+#define _GNU_SOURCE
+#include "qjson.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// job_t is the conversion of one input file.
+typedef struct {
+	const char     *name;   // input file name, NULL for stdin
+	qjson_result_t  res;    // conversion result
+	char            ioErr[512]; // input or output error message, empty if none
+	bool            done;   // true when the conversion is done
+} job_t;
+
+// pool_t is the shared state of the conversion threads.
+typedef struct {
+	job_t           *jobs;
+	int              nJobs;
+	int              next;    // index of the next job to process
+	const char      *outDir;  // output directory or NULL for stdout
+	qjson_options_t  opts;
+	pthread_mutex_t  mu;
+	pthread_cond_t   cond;    // signaled when a job is done
+} pool_t;
+
+// readAll reads the content of fd in a heap allocated buffer. It is used
+// for inputs that can’t be mapped in memory like pipes.
+char* readAll(int fd, size_t *len) {
+	size_t cap = 64*1024, l = 0;
+	char *buf = malloc(cap);
+	for (;;) {
+		if (l == cap) {
+			cap *= 2;
+			buf = realloc(buf, cap);
+		}
+		ssize_t n = read(fd, buf+l, cap-l);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return NULL;
+		}
+		if (n == 0)
+			break;
+		l += (size_t)n;
+	}
+	*len = l;
+	return buf;
+}
+
+// outputPath returns the heap allocated path of the json output file of name.
+char* outputPath(const char *outDir, const char *name) {
+	const char *base = strrchr(name, '/');
+	base = (base == NULL) ? name : base+1;
+	const char *ext = strrchr(base, '.');
+	int baseLen = (ext == NULL || ext == base) ? (int)strlen(base) : (int)(ext-base);
+	size_t l = strlen(outDir) + baseLen + 7;
+	char *path = malloc(l);
+	snprintf(path, l, "%s/%.*s.json", outDir, baseLen, base);
+	return path;
+}
+
+// writeAll writes the len bytes of buf to path.
+bool writeAll(const char *path, const char *buf, size_t len, char *ioErr, size_t ioErrLen) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL || fwrite(buf, 1, len, f) != len || fputc('\n', f) == EOF) {
+		snprintf(ioErr, ioErrLen, "%s: %s", path, strerror(errno));
+		if (f != NULL)
+			fclose(f);
+		return false;
+	}
+	if (fclose(f) != 0) {
+		snprintf(ioErr, ioErrLen, "%s: %s", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// convert processes job j. The input file is mapped in memory when possible.
+void convert(pool_t *p, job_t *j) {
+	int fd = (j->name == NULL) ? STDIN_FILENO : open(j->name, O_RDONLY);
+	if (fd < 0) {
+		snprintf(j->ioErr, sizeof(j->ioErr), "%s: %s", j->name, strerror(errno));
+		return;
+	}
+	struct stat st;
+	char *in = NULL, *buf = NULL;
+	size_t len = 0;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		len = (size_t)st.st_size;
+		in = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in == MAP_FAILED)
+			in = NULL;
+		else
+			madvise(in, len, MADV_SEQUENTIAL);
+	}
+	if (in == NULL && (buf = readAll(fd, &len)) == NULL) {
+		snprintf(j->ioErr, sizeof(j->ioErr), "%s: %s", j->name ? j->name : "<stdin>", strerror(errno));
+		if (fd != STDIN_FILENO)
+			close(fd);
+		return;
+	}
+	qjson_decode_ex((in != NULL) ? in : buf, len, &p->opts, &j->res);
+	// the newline ending flattened lines is written like the one following json
+	if (p->opts.flatten && j->res.len > 0)
+		j->res.len--;
+	if (in != NULL)
+		munmap(in, len);
+	free(buf);
+	if (fd != STDIN_FILENO)
+		close(fd);
+	if (p->outDir != NULL && j->res.json != NULL) {
+		char *path = outputPath(p->outDir, j->name);
+		writeAll(path, j->res.json, j->res.len, j->ioErr, sizeof(j->ioErr));
+		free(path);
+		qjson_result_free(&j->res);
+	}
+}
+
+// worker processes jobs until there are none left.
+void* worker(void *arg) {
+	pool_t *p = arg;
+	for (;;) {
+		pthread_mutex_lock(&p->mu);
+		int i = p->next++;
+		pthread_mutex_unlock(&p->mu);
+		if (i >= p->nJobs)
+			return NULL;
+		convert(p, &p->jobs[i]);
+		pthread_mutex_lock(&p->mu);
+		p->jobs[i].done = true;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->mu);
+	}
+}
+
+// report prints the result of job j and returns false if it failed.
+bool report(job_t *j, bool digest) {
+	const char *name = (j->name == NULL) ? "<stdin>" : j->name;
+	if (j->ioErr[0] != '\0' || j->res.error.msg != NULL)
+		fflush(stdout);
+	if (j->ioErr[0] != '\0') {
+		fprintf(stderr, "%s\n", j->ioErr);
+		return false;
+	}
+	if (j->res.error.msg != NULL) {
+		size_t n = (j->res.errors != NULL) ? j->res.nErrors : 1;
+		const qjson_error_t *errs = (j->res.errors != NULL) ? j->res.errors : &j->res.error;
+		for (size_t i = 0; i < n; i++)
+			fprintf(stderr, "%s:%d:%d: %s\n", name, errs[i].line, errs[i].col, errs[i].msg);
+		qjson_result_free(&j->res);
+		return false;
+	}
+	if (digest) {
+		for (int i = 0; i < 16; i++)
+			printf("%02x", j->res.digest[i]);
+		printf("  %s\n", (j->name == NULL) ? "-" : j->name);
+		return true;
+	}
+	if (j->res.json != NULL) {
+		fwrite(j->res.json, 1, j->res.len, stdout);
+		fputc('\n', stdout);
+		qjson_result_free(&j->res);
+	}
+	return true;
+}
+
+void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-a] [-c] [-d] [-e max] [-f] [-i indent] [-j threads] [-k] [-o dir] [file ...]\n"
+		"  -a          escape non ascii chars as \\uxxxx\n"
+		"  -c          validate only, don’t output json\n"
+		"  -d          output the digest of the canonical json instead of the json\n"
+		"  -e max      recover from errors and report up to max errors per file\n"
+		"  -f          output a path<TAB>value line per scalar value instead of the json\n"
+		"  -i indent   output json indented by indent spaces per level\n"
+		"  -j threads  number of conversion threads (default: number of cpus)\n"
+		"  -k          output canonical json with sorted keys\n"
+		"  -o dir      write file.qjson as dir/file.json instead of stdout\n"
+		"  -v          print version and exit\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	pool_t p;
+	memset(&p, 0, sizeof(p));
+	qjson_options_init(&p.opts);
+	long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "acde:fi:j:ko:v")) != -1) {
+		switch (opt) {
+		case 'a':
+			p.opts.ensureAscii = true;
+			break;
+		case 'c':
+			p.opts.validateOnly = true;
+			break;
+		case 'd':
+			p.opts.digestOnly = true;
+			break;
+		case 'e':
+			p.opts.maxErrors = (int)strtol(optarg, NULL, 10);
+			if (p.opts.maxErrors < 1)
+				usage(argv[0]);
+			break;
+		case 'f':
+			p.opts.flatten = true;
+			break;
+		case 'i': {
+			static char spaces[17];
+			long n = strtol(optarg, NULL, 10);
+			if (n < 0 || n > 16)
+				usage(argv[0]);
+			p.opts.indent = memset(spaces, ' ', n);
+			break;
+		}
+		case 'j':
+			nThreads = strtol(optarg, NULL, 10);
+			if (nThreads < 1)
+				usage(argv[0]);
+			break;
+		case 'k':
+			p.opts.canonical = true;
+			break;
+		case 'o':
+			p.outDir = optarg;
+			break;
+		case 'v':
+			printf("%s\n", qjson_version());
+			return 0;
+		default:
+			usage(argv[0]);
+		}
+	}
+	p.nJobs = argc - optind;
+	if (p.nJobs == 0) {
+		if (p.outDir != NULL)
+			usage(argv[0]);
+		job_t j;
+		memset(&j, 0, sizeof(j));
+		convert(&p, &j);
+		return report(&j, p.opts.digestOnly) ? 0 : 1;
+	}
+	p.jobs = calloc(p.nJobs, sizeof(job_t));
+	for (int i = 0; i < p.nJobs; i++)
+		p.jobs[i].name = argv[optind+i];
+	if (nThreads > p.nJobs)
+		nThreads = p.nJobs;
+	pthread_mutex_init(&p.mu, NULL);
+	pthread_cond_init(&p.cond, NULL);
+	pthread_t *threads = malloc(nThreads*sizeof(pthread_t));
+	for (long i = 0; i < nThreads; i++)
+		pthread_create(&threads[i], NULL, worker, &p);
+	// report results in argument order as soon as they are available
+	int status = 0;
+	for (int i = 0; i < p.nJobs; i++) {
+		pthread_mutex_lock(&p.mu);
+		while (!p.jobs[i].done)
+			pthread_cond_wait(&p.cond, &p.mu);
+		pthread_mutex_unlock(&p.mu);
+		if (!report(&p.jobs[i], p.opts.digestOnly))
+			status = 1;
+	}
+	for (long i = 0; i < nThreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(p.jobs);
+	if (fflush(stdout) != 0)
+		status = 1;
+	return status;
+}
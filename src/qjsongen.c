@@ -0,0 +1,698 @@
+// qjsongen is a command line generator of C data from a qjson file.
+//
+// Usage: qjsongen [-n name] [-o file] file.qjson
+//
+// The qjson file is converted to canonical json, with members sorted by
+// key and duplicate keys rejected, and written as static const arrays of a
+// C or C++ source file included by the program: a pool of the '\0'
+// terminated strings and keys, the values, the members of the objects, and
+// the integer and decimal numbers. The arrays hold no pointers, so that
+// they are placed in read only data shared by the processes without
+// relocation. They are referenced by a qjsongen_table_t named name, by
+// default the base name of the file, with which the generated functions
+// read the values. Members are found by a perfect hash table of the
+// (object, key) pairs of the file, with a single probe.
+//
+// The output is written to stdout, or to file when -o is given. Errors are
+// reported on stderr in the file:line:col: message format and the exit
+// status is then 1.
+#include "qjson.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The type of a generated value, written as QJSONGEN_XXX.
+enum { genNull, genFalse, genTrue, genInt, genDouble, genString, genArray, genObject };
+
+// value_t is a generated value. off is the offset of a string in the pool,
+// the index of the number in ints or doubles, the index of the first
+// element in values, or of the first member in members.
+typedef struct {
+	uint32_t type;
+	uint32_t len; // byte length of a string, number of elements or members
+	uint32_t off;
+} value_t;
+
+// member_t is a generated member of an object.
+typedef struct {
+	uint32_t key;    // offset of the key in the pool
+	uint32_t keyLen; // byte length of the key
+	uint32_t value;  // index of the value in values
+} member_t;
+
+// gen_t is the state of a generation. The arrays are appended to with
+// grow.
+typedef struct {
+	char     *pool;    // strings and keys, each '\0' terminated
+	int       nPool, capPool;
+	uint32_t *poolSet; // open addressing set of the pool offsets + 1, to store strings once
+	int       capSet, nSet;
+	value_t  *values;
+	int       nValues, capValues;
+	member_t *members;
+	int       nMembers, capMembers;
+	const char **ints;    // canonical json text of the numbers
+	int       nInts, capInts;
+	const char **doubles;
+	int       nDoubles, capDoubles;
+	char     *buf;     // unescaped string
+	int       capBuf;
+} gen_t;
+
+// grow makes room for n more items of size sz in the array *p of *len
+// items and capacity *cap.
+void grow(void *p, int *cap, int len, int n, size_t sz) {
+	if (len + n <= *cap)
+		return;
+	int c = (*cap == 0) ? 64 : *cap;
+	while (len + n > c)
+		c *= 2;
+	*(void**)p = realloc(*(void**)p, (size_t)c*sz);
+	*cap = c;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Hash
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// The members are found by a hash and displace table. A key of an object
+// is hashed with the index of the first member of the object as seed, and
+// the hash selects a bucket of about 4 keys. Each bucket has a
+// displacement chosen so that its keys land in free slots of a power of
+// two table, and the slot holds the index of the member. hashMix and
+// hashKey are written to the generated file as qjsongen_mix and
+// qjsongen_hash.
+
+// hashMix is the finalizer of MurmurHash3.
+uint64_t hashMix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// hashKey returns the FNV-1a hash of the n bytes of s, seeded by seed.
+uint64_t hashKey(const char *s, size_t n, uint32_t seed) {
+	uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+	for (size_t i = 0; i < n; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return hashMix(h);
+}
+
+// table_t is the perfect hash table of the members.
+typedef struct {
+	uint32_t *buckets; // displacement of the buckets
+	uint32_t  nBuckets;
+	uint32_t *slots;   // index of the member, UINT32_MAX for a free slot
+	uint32_t  nSlots;
+} table_t;
+
+// bucket_t is the list of the members of a bucket.
+typedef struct {
+	uint32_t b;     // bucket index
+	int      first; // index of the first member in next
+	int      n;     // number of members
+} bucket_t;
+
+int compareBuckets(const void *a, const void *b) {
+	const bucket_t *x = a, *y = b;
+	if (x->n != y->n)
+		return (x->n > y->n) ? -1 : 1;
+	return (x->b > y->b) - (x->b < y->b);
+}
+
+// memberHash returns the hash of member m of the object whose first member
+// is first.
+uint64_t memberHash(const gen_t *g, uint32_t m, uint32_t first) {
+	return hashKey(g->pool + g->members[m].key, g->members[m].keyLen, first);
+}
+
+// buildTable fills t with the members of g. The buckets are placed from the
+// largest to the smallest, trying displacements until their members land
+// in distinct free slots. It returns false if a bucket can’t be placed,
+// which only happens with colliding 64 bit hashes.
+bool buildTable(const gen_t *g, table_t *t) {
+	uint32_t n = (uint32_t)g->nMembers;
+	t->nBuckets = (n+3)/4;
+	t->nSlots = 1;
+	while (t->nSlots < n)
+		t->nSlots *= 2;
+	if (n == 0) {
+		t->nBuckets = 0;
+		t->nSlots = 0;
+	}
+	t->buckets = calloc(t->nBuckets+1, sizeof(uint32_t));
+	t->slots = malloc((t->nSlots+1)*sizeof(uint32_t));
+	memset(t->slots, 0xFF, (t->nSlots+1)*sizeof(uint32_t));
+	if (n == 0)
+		return true;
+	// hashes of the members, and of the objects’ members grouped by bucket
+	uint64_t *h = malloc(n*sizeof(uint64_t));
+	int *next = malloc(n*sizeof(int));
+	bucket_t *bk = calloc(t->nBuckets, sizeof(bucket_t));
+	for (uint32_t b = 0; b < t->nBuckets; b++)
+		bk[b] = (bucket_t){b, -1, 0};
+	for (int v = 0; v < g->nValues; v++) {
+		if (g->values[v].type != genObject)
+			continue;
+		for (uint32_t m = g->values[v].off; m < g->values[v].off + g->values[v].len; m++) {
+			h[m] = memberHash(g, m, g->values[v].off);
+			bucket_t *b = &bk[(uint32_t)(h[m] >> 32) % t->nBuckets];
+			next[m] = b->first;
+			b->first = (int)m;
+			b->n++;
+		}
+	}
+	qsort(bk, t->nBuckets, sizeof(bucket_t), compareBuckets);
+	uint32_t *slots = malloc(4*sizeof(uint32_t));
+	bool ok = true;
+	for (uint32_t i = 0; i < t->nBuckets && bk[i].n > 0 && ok; i++) {
+		slots = realloc(slots, (size_t)bk[i].n*sizeof(uint32_t));
+		for (uint32_t d = 0; ; d++) {
+			if (d == 1u << 24) {
+				ok = false;
+				break;
+			}
+			int k = 0;
+			for (int m = bk[i].first; m >= 0; m = next[m], k++) {
+				slots[k] = (uint32_t)hashMix(h[m] + d) & (t->nSlots-1);
+				if (t->slots[slots[k]] != UINT32_MAX)
+					break;
+				int j = 0;
+				while (j < k && slots[j] != slots[k])
+					j++;
+				if (j < k)
+					break;
+			}
+			if (k < bk[i].n)
+				continue;
+			k = 0;
+			for (int m = bk[i].first; m >= 0; m = next[m], k++)
+				t->slots[slots[k]] = (uint32_t)m;
+			t->buckets[bk[i].b] = d;
+			break;
+		}
+	}
+	free(slots);
+	free(bk);
+	free(next);
+	free(h);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Values
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// hexDigits returns the value of the 4 hexadecimal digits at p.
+unsigned hexDigits(const char *p) {
+	unsigned v = 0;
+	for (int i = 0; i < 4; i++)
+		v = v*16 + (unsigned)(isdigit((unsigned char)p[i]) ? p[i]-'0' : (p[i]|0x20)-'a'+10);
+	return v;
+}
+
+// unescape sets g->buf to the unescaped json string at p, and returns its
+// byte length and the pointer following the string in *end.
+int unescape(gen_t *g, const char *p, const char **end) {
+	int n = 0;
+	p++;
+	for (;;) {
+		grow(&g->buf, &g->capBuf, n, 4, 1);
+		char c = *p++;
+		if (c == '"')
+			break;
+		if (c != '\\') {
+			g->buf[n++] = c;
+			continue;
+		}
+		switch (c = *p++) {
+		case 'b': g->buf[n++] = '\b'; break;
+		case 'f': g->buf[n++] = '\f'; break;
+		case 'n': g->buf[n++] = '\n'; break;
+		case 'r': g->buf[n++] = '\r'; break;
+		case 't': g->buf[n++] = '\t'; break;
+		case 'u': {
+			unsigned v = hexDigits(p);
+			p += 4;
+			if (v >= 0xD800 && v < 0xDC00 && p[0] == '\\' && p[1] == 'u' && hexDigits(p+2) >= 0xDC00 && hexDigits(p+2) < 0xE000) {
+				v = 0x10000 + ((v-0xD800) << 10) + (hexDigits(p+2)-0xDC00);
+				p += 6;
+			}
+			// lone surrogates are encoded like other code points
+			if (v < 0x80)
+				g->buf[n++] = (char)v;
+			else if (v < 0x800) {
+				g->buf[n++] = (char)(0xC0 | v>>6);
+				g->buf[n++] = (char)(0x80 | (v & 0x3F));
+			} else if (v < 0x10000) {
+				g->buf[n++] = (char)(0xE0 | v>>12);
+				g->buf[n++] = (char)(0x80 | (v>>6 & 0x3F));
+				g->buf[n++] = (char)(0x80 | (v & 0x3F));
+			} else {
+				g->buf[n++] = (char)(0xF0 | v>>18);
+				g->buf[n++] = (char)(0x80 | (v>>12 & 0x3F));
+				g->buf[n++] = (char)(0x80 | (v>>6 & 0x3F));
+				g->buf[n++] = (char)(0x80 | (v & 0x3F));
+			}
+			break;
+		}
+		default: // '"', '\\' and '/'
+			g->buf[n++] = c;
+		}
+	}
+	*end = p;
+	return n;
+}
+
+// addString adds the n bytes of g->buf to the pool, unless they are already
+// in it, and returns their offset.
+uint32_t addString(gen_t *g, int n) {
+	if (2*(g->nSet+1) > g->capSet) {
+		int cap = (g->capSet == 0) ? 1024 : 2*g->capSet;
+		uint32_t *set = calloc((size_t)cap, sizeof(uint32_t));
+		for (int i = 0; i < g->capSet; i++) {
+			if (g->poolSet[i] == 0)
+				continue;
+			const char *s = g->pool + g->poolSet[i] - 1;
+			int j = (int)(hashKey(s, strlen(s), 0) & (uint64_t)(cap-1));
+			while (set[j] != 0)
+				j = (j+1) & (cap-1);
+			set[j] = g->poolSet[i];
+		}
+		free(g->poolSet);
+		g->poolSet = set;
+		g->capSet = cap;
+	}
+	// strings with a '\0' are not shared, strlen would not find them
+	bool shared = memchr(g->buf, '\0', (size_t)n) == NULL;
+	int j = (int)(hashKey(g->buf, (size_t)n, 0) & (uint64_t)(g->capSet-1));
+	while (shared && g->poolSet[j] != 0) {
+		const char *s = g->pool + g->poolSet[j] - 1;
+		if (strncmp(s, g->buf, (size_t)n) == 0 && s[n] == '\0')
+			return g->poolSet[j] - 1;
+		j = (j+1) & (g->capSet-1);
+	}
+	uint32_t off = (uint32_t)g->nPool;
+	grow(&g->pool, &g->capPool, g->nPool, n+1, 1);
+	memcpy(g->pool + g->nPool, g->buf, (size_t)n);
+	g->pool[g->nPool + n] = '\0';
+	g->nPool += n+1;
+	if (shared) {
+		g->poolSet[j] = off+1;
+		g->nSet++;
+	}
+	return off;
+}
+
+// count returns the number of members or elements of the object or array
+// at p.
+int count(const char *p) {
+	int n = 0, depth = 0;
+	bool str = false;
+	if (p[1] == '}' || p[1] == ']')
+		return 0;
+	for (p++; ; p++) {
+		if (str) {
+			if (*p == '\\')
+				p++;
+			else if (*p == '"')
+				str = false;
+			continue;
+		}
+		switch (*p) {
+		case '"':
+			str = true;
+			break;
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			if (depth-- == 0)
+				return n+1;
+			break;
+		case ',':
+			if (depth == 0)
+				n++;
+			break;
+		}
+	}
+}
+
+// genValue sets values[v] to the canonical json value at p and returns the
+// pointer following it. The elements and members of a container are given
+// consecutive values, so that they are indexed.
+const char* genValue(gen_t *g, int v, const char *p) {
+	value_t *val = &g->values[v];
+	switch (*p) {
+	case '{':
+	case '[': {
+		bool obj = *p == '{';
+		int n = count(p), first = g->nValues, m = g->nMembers;
+		grow(&g->values, &g->capValues, g->nValues, n, sizeof(value_t));
+		g->nValues += n;
+		if (obj) {
+			grow(&g->members, &g->capMembers, g->nMembers, n, sizeof(member_t));
+			g->nMembers += n;
+		}
+		g->values[v] = (value_t){obj ? genObject : genArray, (uint32_t)n, (uint32_t)(obj ? m : first)};
+		p++;
+		for (int i = 0; i < n; i++) {
+			if (obj) {
+				int l = unescape(g, p, &p);
+				g->members[m+i] = (member_t){addString(g, l), (uint32_t)l, (uint32_t)(first+i)};
+				p++; // ':'
+			}
+			p = genValue(g, first+i, p);
+			p++; // ',' or closing bracket
+		}
+		return (n == 0) ? p+1 : p;
+	}
+	case '"': {
+		int l = unescape(g, p, &p);
+		*val = (value_t){genString, (uint32_t)l, addString(g, l)};
+		return p;
+	}
+	case 't':
+		*val = (value_t){genTrue, 0, 0};
+		return p+4;
+	case 'f':
+		*val = (value_t){genFalse, 0, 0};
+		return p+5;
+	case 'n':
+		if (p[1] == 'u') {
+			*val = (value_t){genNull, 0, 0};
+			return p+4;
+		}
+	}
+	// canonical numbers are integers below 2^53 or in %g form, and inf or
+	// nan for an overflow
+	const char *e = p;
+	bool integer = true;
+	while (*e != ',' && *e != '}' && *e != ']' && *e != '\0') {
+		if (!isdigit((unsigned char)*e) && *e != '-')
+			integer = false;
+		e++;
+	}
+	if (integer) {
+		grow(&g->ints, &g->capInts, g->nInts, 1, sizeof(char*));
+		g->ints[g->nInts] = p;
+		*val = (value_t){genInt, (uint32_t)(e-p), (uint32_t)g->nInts++};
+	} else {
+		grow(&g->doubles, &g->capDoubles, g->nDoubles, 1, sizeof(char*));
+		g->doubles[g->nDoubles] = p;
+		*val = (value_t){genDouble, (uint32_t)(e-p), (uint32_t)g->nDoubles++};
+	}
+	return e;
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Output
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// header holds the declarations shared by the generated files, written
+// once in a translation unit.
+const char *header =
+	"#ifndef QJSONGEN_TYPES\n"
+	"#define QJSONGEN_TYPES\n"
+	"#include <math.h>\n"
+	"#include <stddef.h>\n"
+	"#include <stdint.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"// qjsongen_type_t is the type of a value.\n"
+	"typedef enum {\n"
+	"\tQJSONGEN_NULL, QJSONGEN_FALSE, QJSONGEN_TRUE, QJSONGEN_INT, QJSONGEN_DOUBLE, QJSONGEN_STRING, QJSONGEN_ARRAY, QJSONGEN_OBJECT\n"
+	"} qjsongen_type_t;\n"
+	"\n"
+	"// qjsongen_value_t is a value. off is the offset of a string in chars,\n"
+	"// the index of a number in ints or doubles, the index of the first\n"
+	"// element of an array in values, or of the first member of an object in\n"
+	"// members. Members are sorted by the utf8 bytes of their key.\n"
+	"typedef struct {\n"
+	"\tuint32_t type; // qjsongen_type_t\n"
+	"\tuint32_t len;  // byte length of a string, number of elements or members\n"
+	"\tuint32_t off;\n"
+	"} qjsongen_value_t;\n"
+	"\n"
+	"// qjsongen_member_t is a member of an object.\n"
+	"typedef struct {\n"
+	"\tuint32_t key;    // offset of the key in chars\n"
+	"\tuint32_t keyLen; // byte length of the key\n"
+	"\tuint32_t value;  // index of the value in values\n"
+	"} qjsongen_member_t;\n"
+	"\n"
+	"// qjsongen_table_t references the arrays generated from a qjson file.\n"
+	"// The root object is values[0].\n"
+	"typedef struct {\n"
+	"\tconst char              *chars;   // '\\0' terminated strings and keys\n"
+	"\tconst qjsongen_value_t  *values;\n"
+	"\tconst qjsongen_member_t *members;\n"
+	"\tconst int64_t           *ints;\n"
+	"\tconst double            *doubles;\n"
+	"\tconst uint32_t          *buckets; // displacement of the hash buckets\n"
+	"\tconst uint32_t          *slots;   // member of the hash slots, UINT32_MAX if free\n"
+	"\tuint32_t                 nBuckets, nSlots;\n"
+	"} qjsongen_table_t;\n"
+	"\n"
+	"static inline uint64_t qjsongen_mix(uint64_t h) {\n"
+	"\th ^= h >> 33;\n"
+	"\th *= 0xff51afd7ed558ccdULL;\n"
+	"\th ^= h >> 33;\n"
+	"\th *= 0xc4ceb9fe1a85ec53ULL;\n"
+	"\th ^= h >> 33;\n"
+	"\treturn h;\n"
+	"}\n"
+	"\n"
+	"static inline uint64_t qjsongen_hash(const char *s, size_t n, uint32_t seed) {\n"
+	"\tuint64_t h = 0xcbf29ce484222325ULL ^ seed;\n"
+	"\tfor (size_t i = 0; i < n; i++) {\n"
+	"\t\th ^= (unsigned char)s[i];\n"
+	"\t\th *= 0x100000001b3ULL;\n"
+	"\t}\n"
+	"\treturn qjsongen_mix(h);\n"
+	"}\n"
+	"\n"
+	"// qjsongen_root returns the top level object of t.\n"
+	"static inline const qjsongen_value_t* qjsongen_root(const qjsongen_table_t *t) {\n"
+	"\treturn &t->values[0];\n"
+	"}\n"
+	"\n"
+	"// qjsongen_get returns the member of the object v with the len bytes key,\n"
+	"// or NULL.\n"
+	"static inline const qjsongen_value_t* qjsongen_get(const qjsongen_table_t *t, const qjsongen_value_t *v, const char *key, size_t len) {\n"
+	"\tif (v == NULL || v->type != QJSONGEN_OBJECT || v->len == 0)\n"
+	"\t\treturn NULL;\n"
+	"\tuint64_t h = qjsongen_hash(key, len, v->off);\n"
+	"\tuint32_t m = t->slots[(uint32_t)qjsongen_mix(h + t->buckets[(uint32_t)(h >> 32) % t->nBuckets]) & (t->nSlots-1)];\n"
+	"\tif (m < v->off || m - v->off >= v->len || t->members[m].keyLen != len || memcmp(t->chars + t->members[m].key, key, len) != 0)\n"
+	"\t\treturn NULL;\n"
+	"\treturn &t->values[t->members[m].value];\n"
+	"}\n"
+	"\n"
+	"// qjsongen_at returns the element i of the array v, or NULL.\n"
+	"static inline const qjsongen_value_t* qjsongen_at(const qjsongen_table_t *t, const qjsongen_value_t *v, size_t i) {\n"
+	"\tif (v == NULL || v->type != QJSONGEN_ARRAY || i >= v->len)\n"
+	"\t\treturn NULL;\n"
+	"\treturn &t->values[v->off + i];\n"
+	"}\n"
+	"\n"
+	"// qjsongen_string returns the '\\0' terminated string v, whose byte length\n"
+	"// is v->len.\n"
+	"static inline const char* qjsongen_string(const qjsongen_table_t *t, const qjsongen_value_t *v) {\n"
+	"\treturn t->chars + v->off;\n"
+	"}\n"
+	"\n"
+	"// qjsongen_number returns the value of the number v.\n"
+	"static inline double qjsongen_number(const qjsongen_table_t *t, const qjsongen_value_t *v) {\n"
+	"\treturn (v->type == QJSONGEN_INT) ? (double)t->ints[v->off] : t->doubles[v->off];\n"
+	"}\n"
+	"#endif\n";
+
+// writeChars writes the pool as a string literal, escaping with octal
+// sequences the bytes that are not printable ascii.
+void writeChars(FILE *f, const char *name, const gen_t *g) {
+	fprintf(f, "static const char %s_chars[] =\n\t\"", name);
+	int col = 0;
+	for (int i = 0; i < g->nPool; i++) {
+		unsigned char c = (unsigned char)g->pool[i];
+		if (col >= 72) {
+			fprintf(f, "\"\n\t\"");
+			col = 0;
+		}
+		if (c < 0x20 || c >= 0x7F || c == '"' || c == '\\' || c == '?') {
+			fprintf(f, "\\%03o", c);
+			col += 4;
+		} else {
+			fputc(c, f);
+			col++;
+		}
+	}
+	fprintf(f, "\";\n\n");
+}
+
+// writeUints writes the n uint32_t items of p, by group of size, as the
+// array of the given type and name.
+void writeUints(FILE *f, const char *type, const char *name, const char *suffix, const uint32_t *p, int n, int size) {
+	fprintf(f, "static const %s %s_%s[] = {", type, name, suffix);
+	int perLine = (size == 1) ? 12 : 4;
+	for (int i = 0; i < n; i++) {
+		fprintf(f, (i % perLine == 0) ? "\n\t" : " ");
+		if (size == 1)
+			fprintf(f, "%uu,", p[i]);
+		else
+			fprintf(f, "{%u, %u, %u},", p[3*i], p[3*i+1], p[3*i+2]);
+	}
+	if (n == 0)
+		fprintf(f, (size == 1) ? "0" : "{0, 0, 0}");
+	fprintf(f, "\n};\n\n");
+}
+
+// writeNumbers writes the n canonical json numbers of p as the array of
+// the given type and name.
+void writeNumbers(FILE *f, const char *type, const char *name, const char *suffix, const char **p, int n) {
+	fprintf(f, "static const %s %s_%s[] = {", type, name, suffix);
+	for (int i = 0; i < n; i++) {
+		fprintf(f, (i % 6 == 0) ? "\n\t" : " ");
+		int l = (int)strcspn(p[i], ",]}");
+		bool neg = p[i][0] == '-';
+		if (strncmp(p[i] + neg, "inf", 3) == 0)
+			fprintf(f, "%sHUGE_VAL,", neg ? "-" : "");
+		else if (strncmp(p[i] + neg, "nan", 3) == 0)
+			fprintf(f, "NAN,");
+		else
+			fprintf(f, "%.*s,", l, p[i]);
+	}
+	if (n == 0)
+		fprintf(f, "0");
+	fprintf(f, "\n};\n\n");
+}
+
+// generate writes the C source of g, whose member hash table is t, to f.
+void generate(FILE *f, const char *name, const char *src, const gen_t *g, const table_t *t) {
+	fprintf(f, "// Code generated by qjsongen from %s. DO NOT EDIT.\n\n%s\n", src, header);
+	writeChars(f, name, g);
+	writeUints(f, "qjsongen_value_t", name, "values", (const uint32_t*)g->values, g->nValues, 3);
+	writeUints(f, "qjsongen_member_t", name, "members", (const uint32_t*)g->members, g->nMembers, 3);
+	writeNumbers(f, "int64_t", name, "ints", g->ints, g->nInts);
+	writeNumbers(f, "double", name, "doubles", g->doubles, g->nDoubles);
+	writeUints(f, "uint32_t", name, "buckets", t->buckets, (int)t->nBuckets, 1);
+	writeUints(f, "uint32_t", name, "slots", t->slots, (int)t->nSlots, 1);
+	fprintf(f, "static const qjsongen_table_t %s = {\n"
+		"\t%s_chars, %s_values, %s_members, %s_ints, %s_doubles, %s_buckets, %s_slots, %uu, %uu\n};\n",
+		name, name, name, name, name, name, name, name, t->nBuckets, t->nSlots);
+}
+
+// ----------------------------------------------------------------------------------------------------------------------------------------
+// Main
+// ----------------------------------------------------------------------------------------------------------------------------------------
+
+// readFile returns the heap allocated content of path, or NULL.
+char* readFile(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+	size_t cap = 64*1024, l = 0;
+	char *buf = malloc(cap);
+	for (;;) {
+		l += fread(buf+l, 1, cap-l, f);
+		if (l < cap)
+			break;
+		cap *= 2;
+		buf = realloc(buf, cap);
+	}
+	bool ok = !ferror(f);
+	fclose(f);
+	if (!ok) {
+		free(buf);
+		return NULL;
+	}
+	*len = l;
+	return buf;
+}
+
+// defaultName returns the heap allocated C identifier made of the base
+// name of path.
+char* defaultName(const char *path) {
+	const char *base = strrchr(path, '/');
+	base = (base == NULL) ? path : base+1;
+	size_t l = strcspn(base, ".");
+	char *name = malloc(l+2), *p = name;
+	if (l == 0 || isdigit((unsigned char)base[0]))
+		*p++ = '_';
+	for (size_t i = 0; i < l; i++)
+		*p++ = isalnum((unsigned char)base[i]) ? base[i] : '_';
+	*p = '\0';
+	return name;
+}
+
+void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-n name] [-o file] file.qjson\n"
+		"  -n name  name of the generated table (default: base name of the file)\n"
+		"  -o file  write the C source to file instead of stdout\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	const char *name = NULL, *out = NULL, *src = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+			name = argv[++i];
+		else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+			out = argv[++i];
+		else if (argv[i][0] == '-' || src != NULL)
+			usage(argv[0]);
+		else
+			src = argv[i];
+	}
+	if (src == NULL)
+		usage(argv[0]);
+	size_t len = 0;
+	char *in = readFile(src, &len);
+	if (in == NULL) {
+		perror(src);
+		return 1;
+	}
+	qjson_options_t opts;
+	qjson_options_init(&opts);
+	opts.canonical = true;
+	opts.duplicateKeys = QJSON_DUP_ERROR;
+	qjson_result_t res;
+	if (!qjson_decode_ex(in, len, &opts, &res)) {
+		fprintf(stderr, "%s:%d:%d: %s\n", src, res.error.line, res.error.col, res.error.msg);
+		return 1;
+	}
+	free(in);
+	gen_t g;
+	memset(&g, 0, sizeof(g));
+	grow(&g.values, &g.capValues, 0, 1, sizeof(value_t));
+	g.nValues = 1;
+	genValue(&g, 0, res.json);
+	table_t t;
+	if (!buildTable(&g, &t)) {
+		fprintf(stderr, "%s: no perfect hash found for the keys\n", src);
+		return 1;
+	}
+	char *defName = (name == NULL) ? defaultName(src) : NULL;
+	FILE *f = (out == NULL) ? stdout : fopen(out, "w");
+	if (f == NULL) {
+		perror(out);
+		return 1;
+	}
+	generate(f, (name != NULL) ? name : defName, src, &g, &t);
+	if ((out != NULL) ? fclose(f) != 0 : fflush(f) != 0) {
+		perror((out != NULL) ? out : "<stdout>");
+		if (out != NULL)
+			remove(out);
+		return 1;
+	}
+	return 0;
+}
@@ -1,41 +1,1797 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <datetime.h>
 #include <stdbool.h>
 #include "qjson.h"
+#ifdef __linux__
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
+// LimitError is the exception raised when a limit is exceeded or a
+// conversion is cancelled.
+static PyObject *LimitError;
+
+// limitReasons are the reason attributes of LimitError by error code.
+static const char *limitReasons[] = {"syntax", "input", "output", "tokens", "depth", "time", "cancelled"};
+
+// setAttr sets the attribute name of o to v and releases v.
+static int setAttr(PyObject *o, const char *name, PyObject *v) {
+    if (v == NULL)
+        return -1;
+    int r = PyObject_SetAttrString(o, name, v);
+    Py_DECREF(v);
+    return r;
+}
+
+// setErrorIn raises a value error exception with the message and position of
+// err, or a LimitError with reason, line, col and offset attributes when a
+// limit is exceeded. The message names file when it is not NULL.
+static PyObject *setErrorIn(const qjson_error_t *err, const char *file) {
+    const char *of = (file != NULL) ? " of " : "";
+    file = (file != NULL) ? file : "";
+    if (err->code == QJSON_ERROR_SYNTAX) {
+        PyErr_Format(PyExc_ValueError, "%s at line %d col %d%s%s", err->msg, err->line, err->col, of, file);
+        return NULL;
+    }
+    PyObject *exc = PyObject_CallFunction(LimitError, "N", 
+        PyUnicode_FromFormat("%s at line %d col %d%s%s", err->msg, err->line, err->col, of, file));
+    if (exc == NULL)
+        return NULL;
+    if (setAttr(exc, "reason", PyUnicode_FromString(limitReasons[err->code])) < 0 ||
+        setAttr(exc, "line", PyLong_FromLong(err->line)) < 0 ||
+        setAttr(exc, "col", PyLong_FromLong(err->col)) < 0 ||
+        setAttr(exc, "offset", PyLong_FromSize_t(err->offset)) < 0) {
+        Py_DECREF(exc);
+        return NULL;
+    }
+    PyErr_SetObject(LimitError, exc);
+    Py_DECREF(exc);
+    return NULL;
+}
+
+// setError raises the exception of err.
+static PyObject *setError(const qjson_error_t *err) {
+    return setErrorIn(err, NULL);
+}
+
+// checkArg_t is the argument of checkSignals.
+typedef struct {
+    PyObject *cancel; // object with an is_set method, or NULL
+} checkArg_t;
+
+// checkSignals is the check callback of decode, called without the GIL.
+// It runs the signal handlers so that Ctrl-C interrupts long conversions,
+// and returns false if one raised an exception or if cancel is set.
+static bool checkSignals(void *arg) {
+    checkArg_t *c = arg;
+    PyGILState_STATE state = PyGILState_Ensure();
+    bool ok = PyErr_CheckSignals() == 0;
+    if (ok && c->cancel != NULL) {
+        PyObject *r = PyObject_CallMethod(c->cancel, "is_set", NULL);
+        ok = r != NULL && PyObject_Not(r) == 1;
+        Py_XDECREF(r);
+    }
+    PyGILState_Release(state);
+    return ok;
+}
+
+// includesObject is a cache of the files included by decode. Its lock 
+// serializes the calls using it, made without the GIL.
+typedef struct {
+    PyObject_HEAD
+    qjson_includes_t   *inc;
+    PyThread_type_lock  lock;
+} includesObject;
+
+static void includes_dealloc(includesObject *self) {
+    qjson_includes_free(self->inc);
+    if (self->lock != NULL)
+        PyThread_free_lock(self->lock);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject *includes_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"base_dir", "max_depth", NULL};
+    PyObject *baseDir = NULL;
+    int maxDepth = 16;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O&$i", kwlist, PyUnicode_FSConverter, &baseDir, &maxDepth))
+        return NULL;
+    if (maxDepth < 1) {
+        Py_XDECREF(baseDir);
+        PyErr_SetString(PyExc_ValueError, "max_depth must be at least 1");
+        return NULL;
+    }
+    includesObject *self = (includesObject*)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        self->inc = qjson_includes_new((baseDir != NULL) ? PyBytes_AS_STRING(baseDir) : ".", maxDepth);
+        self->lock = PyThread_allocate_lock();
+        if (self->lock == NULL) {
+            Py_DECREF(self);
+            self = (includesObject*)PyErr_NoMemory();
+        }
+    }
+    Py_XDECREF(baseDir);
+    return (PyObject*)self;
+}
+
+static PyObject *includes_get_parses(includesObject *self, void *closure) {
+    size_t parses, hits;
+    qjson_includes_stats(self->inc, &parses, &hits);
+    return PyLong_FromSize_t(parses);
+}
+
+static PyObject *includes_get_hits(includesObject *self, void *closure) {
+    size_t parses, hits;
+    qjson_includes_stats(self->inc, &parses, &hits);
+    return PyLong_FromSize_t(hits);
+}
+
+static PyGetSetDef includesGetSet[] = {
+    {"parses", (getter)includes_get_parses, NULL, "number of included files decoded", NULL},
+    {"hits", (getter)includes_get_hits, NULL, "number of includes served from the cache", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject includesType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qjson2json.Includes",
+    .tp_doc = "Includes(base_dir='.', *, max_depth=16)\n"
+        "Cache of the qjson files included by \"@include path\" values in the texts decoded with it.\n"
+        "Paths are relative to the including file, or to base_dir for the decoded text. A file is\n"
+        "decoded again only when its modification time or size changes.",
+    .tp_basicsize = sizeof(includesObject),
+    .tp_dealloc = (destructor)includes_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = includes_new,
+    .tp_getset = includesGetSet,
+};
+
+// dupPolicies are the values of the duplicates argument of decode in the
+// order of qjson_dup_policy_t.
+static const char *dupPolicies[] = {"allow", "error", "first", "last"};
+
+// unescapePath returns the str of the n bytes of the path p of a flattened
+// line, escaped like the content of a json string.
+static PyObject *unescapePath(const char *p, Py_ssize_t n) {
+    if (memchr(p, '\\', n) == NULL)
+        return PyUnicode_DecodeUTF8(p, n, NULL);
+    char *buf = PyMem_Malloc(n), *q = buf;
+    if (buf == NULL)
+        return PyErr_NoMemory();
+    for (const char *end = p+n; p < end; p++) {
+        if (*p != '\\') {
+            *q++ = *p;
+            continue;
+        }
+        switch (*++p) {
+        case 'b': *q++ = '\b'; break;
+        case 'f': *q++ = '\f'; break;
+        case 'n': *q++ = '\n'; break;
+        case 'r': *q++ = '\r'; break;
+        case 't': *q++ = '\t'; break;
+        case 'u': {
+            // control char, lone surrogate, or non ascii char with ensure_ascii
+            unsigned v = (unsigned)strtoul((char[5]){p[1], p[2], p[3], p[4], 0}, NULL, 16);
+            p += 4;
+            if (v >= 0xD800 && v < 0xDC00 && end-p > 6 && p[1] == '\\' && p[2] == 'u') {
+                unsigned lo = (unsigned)strtoul((char[5]){p[3], p[4], p[5], p[6], 0}, NULL, 16);
+                if (lo >= 0xDC00 && lo < 0xE000) {
+                    v = 0x10000 + ((v - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                }
+            }
+            if (v < 0x80)
+                *q++ = (char)v;
+            else if (v < 0x800) {
+                *q++ = (char)(0xC0 | v >> 6);
+                *q++ = (char)(0x80 | (v & 0x3F));
+            } else if (v < 0x10000) {
+                *q++ = (char)(0xE0 | v >> 12);
+                *q++ = (char)(0x80 | (v >> 6 & 0x3F));
+                *q++ = (char)(0x80 | (v & 0x3F));
+            } else {
+                *q++ = (char)(0xF0 | v >> 18);
+                *q++ = (char)(0x80 | (v >> 12 & 0x3F));
+                *q++ = (char)(0x80 | (v >> 6 & 0x3F));
+                *q++ = (char)(0x80 | (v & 0x3F));
+            }
+            break;
+        }
+        default: *q++ = *p;
+        }
+    }
+    PyObject *tmp = PyUnicode_DecodeUTF8(buf, q-buf, "surrogatepass");
+    PyMem_Free(buf);
+    return tmp;
+}
+
+// flatPairs returns the list of the (path, value) str pairs of the n bytes
+// of flattened lines p.
+static PyObject *flatPairs(const char *p, Py_ssize_t n) {
+    PyObject *list = PyList_New(0);
+    for (const char *end = p+n; list != NULL && p < end; ) {
+        const char *tab = memchr(p, '\t', end-p), *nl = memchr(tab, '\n', end-tab);
+        PyObject *path = unescapePath(p, tab-p);
+        PyObject *val = (path != NULL) ? PyUnicode_DecodeUTF8(tab+1, nl-tab-1, NULL) : NULL;
+        PyObject *pair = (val != NULL) ? PyTuple_Pack(2, path, val) : NULL;
+        Py_XDECREF(path);
+        Py_XDECREF(val);
+        if (pair == NULL || PyList_Append(list, pair) < 0)
+            Py_CLEAR(list);
+        Py_XDECREF(pair);
+        p = nl+1;
+    }
+    return list;
+}
+
+// prettyOptions sets the indent and separators of opts from the indent and
+// separators arguments of decode, like those of json.dumps. *spaces holds
+// the indent given as a number of spaces, released by the caller.
+static bool prettyOptions(qjson_options_t *opts, PyObject *indent, PyObject *separators, PyObject **spaces) {
+    if (PyLong_Check(indent)) {
+        Py_ssize_t n = PyLong_AsSsize_t(indent);
+        PyObject *space = PyUnicode_FromString(" ");
+        *spaces = (space != NULL && !PyErr_Occurred()) ? PySequence_Repeat(space, (n > 0) ? n : 0) : NULL;
+        Py_XDECREF(space);
+        if (*spaces == NULL)
+            return false;
+        indent = *spaces;
+    }
+    if (indent != Py_None && (opts->indent = PyUnicode_AsUTF8(indent)) == NULL)
+        return false;
+    if (separators != Py_None) {
+        if (!PyTuple_Check(separators)) {
+            PyErr_SetString(PyExc_TypeError, "separators must be an (item_separator, key_separator) tuple");
+            return false;
+        }
+        if (!PyArg_ParseTuple(separators, "ss", &opts->itemSeparator, &opts->keySeparator))
+            return false;
+    }
+    return true;
+}
+
+// decodeWith converts the text argument of decode, digest or flatten with
+// the options given as keyword arguments. It returns the json text, the 
+// digest of the canonical json when digestOnly is true, or the list of the
+// (path, value) pairs of the json when flatten is true.
+static PyObject *decodeWith(PyObject *args, PyObject *kwargs, bool digestOnly, bool flatten) {
+    static char *kwlist[] = {"text", "max_input", "max_output", "max_tokens", "max_depth", "timeout", "cancel",
+        "expressions", "durations", "dates", "multiline", "reject_disabled", "canonical", "duplicates", "includes",
+        "indent", "separators", "ensure_ascii", NULL};
+    const char *inStr;
+    Py_ssize_t inLen, maxInput = 0, maxOutput = 0, maxTokens = 0;
+    int maxDepth = 0;
+    double timeout = 0;
+    checkArg_t check = {NULL};
+    int expressions = 1, durations = 1, dates = 1, multiline = 1, rejectDisabled = 0, canonical = 0, ensureAscii = 0;
+    const char *duplicates = "allow";
+    PyObject *includes = Py_None, *indent = Py_None, *separators = Py_None, *spaces = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|$nnnidOppppppsOOOp", kwlist, &inStr, &inLen,
+            &maxInput, &maxOutput, &maxTokens, &maxDepth, &timeout, &check.cancel,
+            &expressions, &durations, &dates, &multiline, &rejectDisabled, &canonical, &duplicates, &includes,
+            &indent, &separators, &ensureAscii))
+        return NULL;
+    if (includes != Py_None && !PyObject_TypeCheck(includes, &includesType)) {
+        PyErr_SetString(PyExc_TypeError, "includes must be an Includes object or None");
+        return NULL;
+    }
+    includesObject *inc = (includes != Py_None) ? (includesObject*)includes : NULL;
+    int policy = 0;
+    while (policy < 4 && strcmp(duplicates, dupPolicies[policy]) != 0)
+        policy++;
+    if (policy == 4) {
+        PyErr_SetString(PyExc_ValueError, "duplicates must be 'allow', 'error', 'first' or 'last'");
+        return NULL;
+    }
+    if (check.cancel == Py_None)
+        check.cancel = NULL;
+    if (maxInput < 0 || maxOutput < 0 || maxTokens < 0 || maxDepth < 0 || timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "limits must be positive or zero");
+        return NULL;
+    }
+    qjson_options_t opts;
+    qjson_options_init(&opts);
+    opts.maxInputBytes = (size_t)maxInput;
+    opts.maxOutputBytes = (size_t)maxOutput;
+    opts.maxTokens = (size_t)maxTokens;
+    opts.maxDepth = maxDepth;
+    opts.timeout = timeout;
+    opts.disabled = (expressions ? 0 : QJSON_NO_EXPRESSIONS) | (durations ? 0 : QJSON_NO_DURATIONS) |
+        (dates ? 0 : QJSON_NO_DATES) | (multiline ? 0 : QJSON_NO_MULTILINE);
+    opts.rejectDisabled = rejectDisabled != 0;
+    opts.canonical = canonical != 0;
+    opts.digestOnly = digestOnly;
+    opts.flatten = flatten;
+    opts.ensureAscii = ensureAscii != 0;
+    opts.duplicateKeys = (qjson_dup_policy_t)policy;
+    // the signals are checked every checkInterval tokens, taking the GIL
+    // at most every 10 ms, so that Ctrl-C interrupts any long conversion
+    opts.check = checkSignals;
+    opts.checkArg = &check;
+    opts.includes = (inc != NULL) ? inc->inc : NULL;
+    if (!prettyOptions(&opts, indent, separators, &spaces)) {
+        Py_XDECREF(spaces);
+        return NULL;
+    }
+
+    // The GIL is released during the conversion so that decode calls in 
+    // different threads run in parallel. inStr remains valid since args
+    // holds a reference on it.
+    qjson_result_t res;
+    Py_BEGIN_ALLOW_THREADS
+    if (inc != NULL)
+        PyThread_acquire_lock(inc->lock, WAIT_LOCK);
+    qjson_decode_ex(inStr, (size_t)inLen, &opts, &res);
+    if (inc != NULL)
+        PyThread_release_lock(inc->lock);
+    Py_END_ALLOW_THREADS
+    Py_XDECREF(spaces);
+    if (PyErr_Occurred()) {
+        // raised by a signal handler or the cancel object
+        qjson_result_free(&res);
+        return NULL;
+    }
+    if (res.error.msg != NULL) {
+        setErrorIn(&res.error, res.errorFile);
+        qjson_result_free(&res);
+        return NULL;
+    }
+    if (digestOnly)
+        return PyBytes_FromStringAndSize((const char*)res.digest, sizeof(res.digest));
+    PyObject *tmp = flatten ? flatPairs(res.json, res.len) : PyUnicode_DecodeUTF8(res.json, res.len, NULL);
+    qjson_result_free(&res);
+    return tmp;
+}
+
 // Function decode of qjson2json module.
 // Given a string containing qjson text, it returns the corresponding json text
-// or raise a value error exception if the qjson text is invalid. 
-static PyObject *qjson2json_decode(PyObject *self, PyObject *args) {
+// or raise a value error exception if the qjson text is invalid. The keyword
+// arguments limit the conversion of untrusted input.
+static PyObject *qjson2json_decode(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return decodeWith(args, kwargs, false, false);
+}
+
+// Function digest of qjson2json module.
+// Given a string containing qjson text, it returns the 16 bytes digest of 
+// its canonical json text without building it.
+static PyObject *qjson2json_digest(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return decodeWith(args, kwargs, true, false);
+}
+
+// Function flatten of qjson2json module.
+// Given a string containing qjson text, it returns the list of the (path, 
+// value) pairs of its scalar values and empty containers, path being a
+// json pointer and value a json text.
+static PyObject *qjson2json_flatten(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return decodeWith(args, kwargs, false, true);
+}
+
+// Function merge of qjson2json module.
+// Given a sequence of strings containing qjson text, it returns the json 
+// text of their deep merge in order, or raise a value error exception 
+// naming the invalid layer.
+static PyObject *qjson2json_merge(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"texts", "arrays", NULL};
+    PyObject *texts;
+    const char *arrays = "replace";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$s", kwlist, &texts, &arrays))
+        return NULL;
+    qjson_merge_arrays_t mode;
+    if (strcmp(arrays, "replace") == 0)
+        mode = QJSON_MERGE_REPLACE;
+    else if (strcmp(arrays, "concat") == 0)
+        mode = QJSON_MERGE_CONCAT;
+    else {
+        PyErr_SetString(PyExc_ValueError, "arrays must be 'replace' or 'concat'");
+        return NULL;
+    }
+    PyObject *seq = PySequence_Fast(texts, "texts must be a sequence of strings");
+    if (seq == NULL)
+        return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    const char **strs = PyMem_Malloc((n+1)*sizeof(char*));
+    size_t *lens = PyMem_Malloc((n+1)*sizeof(size_t));
+    if (strs == NULL || lens == NULL) {
+        PyMem_Free(strs);
+        PyMem_Free(lens);
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_ssize_t l;
+        // the utf8 buffers are cached in the strings held by seq
+        strs[i] = PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(seq, i), &l);
+        if (strs[i] == NULL) {
+            PyMem_Free(strs);
+            PyMem_Free(lens);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        lens[i] = (size_t)l;
+    }
+    qjson_result_t res;
+    Py_BEGIN_ALLOW_THREADS
+    qjson_merge(strs, lens, (size_t)n, NULL, mode, &res);
+    Py_END_ALLOW_THREADS
+    PyMem_Free(strs);
+    PyMem_Free(lens);
+    Py_DECREF(seq);
+    PyObject *tmp = NULL;
+    if (res.error.msg != NULL)
+        PyErr_Format(PyExc_ValueError, "%s at line %d col %d of layer %zu", res.error.msg, 
+            res.error.line, res.error.col, res.layer);
+    else
+        tmp = PyUnicode_DecodeUTF8(res.json, res.len, NULL);
+    qjson_result_free(&res);
+    return tmp;
+}
+
+// Function diff of qjson2json module.
+// Given the old and new qjson texts, it returns the json text of the RFC 6902
+// operations changing the old json into the new one, or of the json pointers
+// of the changed values, or raise a value error exception if a text is invalid.
+static PyObject *qjson2json_diff(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"old", "new", "paths", NULL};
+    const char *oldStr, *newStr;
+    Py_ssize_t oldLen, newLen;
+    int paths = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#s#|$p", kwlist, &oldStr, &oldLen, &newStr, &newLen, &paths))
+        return NULL;
+    qjson_result_t res;
+    Py_BEGIN_ALLOW_THREADS
+    qjson_diff(oldStr, (size_t)oldLen, newStr, (size_t)newLen, NULL, paths != 0, &res);
+    Py_END_ALLOW_THREADS
+    PyObject *tmp = NULL;
+    if (res.error.msg != NULL)
+        PyErr_Format(PyExc_ValueError, "%s at line %d col %d of %s text", res.error.msg, 
+            res.error.line, res.error.col, (res.layer == 0) ? "old" : "new");
+    else
+        tmp = PyUnicode_DecodeUTF8(res.json, res.len, NULL);
+    qjson_result_free(&res);
+    return tmp;
+}
+
+// Function from_json of qjson2json module.
+// Given a string containing a json object, it returns the corresponding
+// idiomatic qjson text or raise a value error exception if the json text
+// is invalid.
+static PyObject *qjson2json_from_json(PyObject *self, PyObject *args) {
     const char *inStr;
-    if (!PyArg_ParseTuple(args, "s", &inStr))
-        return NULL;
-	
-    // assert inStr is a utf8 encoded C string
-	
-    // call the wrapped C function returning a heap allocated utf8 c string
-    // or NULL when the heap allocation failed.
-    const char *outStr = qjson_decode(inStr);
+    Py_ssize_t inLen;
+    if (!PyArg_ParseTuple(args, "s#", &inStr, &inLen))
+        return NULL;
+
+    char *outStr;
+    size_t outLen;
+    qjson_error_t err;
+    Py_BEGIN_ALLOW_THREADS
+    outStr = qjson_from_json(inStr, (size_t)inLen, &outLen, &err);
+    Py_END_ALLOW_THREADS
     if (outStr == NULL)
+        return setError(&err);
+    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, outLen, NULL);
+    free(outStr);
+    return tmp;
+}
+
+// Maximal estimated byte length of a list of scalars written on one line.
+#define oneLineListMaxLen 60
+
+// dumpOpts_t are the options of dumps.
+typedef struct {
+    bool durations; // write timedelta as durations instead of seconds
+    bool dates;     // write datetime as ISO date time instead of seconds
+} dumpOpts_t;
+
+static int dumpValue(qjson_writer_t *w, PyObject *o, const dumpOpts_t *opts);
+
+// writeUTF8 writes the str o as a key or a string value.
+static int writeUTF8(qjson_writer_t *w, PyObject *o, bool isKey) {
+    Py_ssize_t len;
+    const char *s = PyUnicode_AsUTF8AndSize(o, &len);
+    if (s == NULL)
+        return -1;
+    if (isKey)
+        qjson_write_key(w, s, (size_t)len);
+    else
+        qjson_write_string(w, s, (size_t)len);
+    return 0;
+}
+
+// writeFloat writes the shortest representation of v.
+static int writeFloat(qjson_writer_t *w, double v) {
+    if (!Py_IS_FINITE(v)) {
+        PyErr_SetString(PyExc_ValueError, "out of range float values are not qjson compliant");
+        return -1;
+    }
+    char *s = PyOS_double_to_string(v, 'r', 0, 0, NULL);
+    if (s == NULL)
+        return -1;
+    qjson_write_raw(w, s, strlen(s));
+    PyMem_Free(s);
+    return 0;
+}
+
+// writeInt writes the int o. Values outside ±(2^63-1) are written as float
+// since the decoder rejects integer literals that overflow an int64, and 
+// -2^63 is the negation of such a literal.
+static int writeInt(qjson_writer_t *w, PyObject *o) {
+    int overflow;
+    long long v = PyLong_AsLongLongAndOverflow(o, &overflow);
+    if (v == -1 && PyErr_Occurred())
+        return -1;
+    if (overflow != 0 || v == LLONG_MIN) {
+        double f = PyLong_AsDouble(o);
+        if (f == -1.0 && PyErr_Occurred())
+            return -1;
+        return writeFloat(w, f);
+    }
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%lld", v);
+    qjson_write_raw(w, buf, n);
+    return 0;
+}
+
+// writeDuration writes the timedelta o as a duration like 1d2h30m15.5s.
+static int writeDuration(qjson_writer_t *w, PyObject *o) {
+    long long days = PyDateTime_DELTA_GET_DAYS(o);
+    long long secs = PyDateTime_DELTA_GET_SECONDS(o);
+    long long us = PyDateTime_DELTA_GET_MICROSECONDS(o);
+    long long total = (days*86400 + secs)*1000000 + us;
+    char buf[96], *p = buf;
+    const char *end = buf + sizeof(buf);
+    bool neg = total < 0;
+    if (neg) {
+        total = -total;
+        p += snprintf(p, end-p, "-(");
+    }
+    secs = total / 1000000;
+    us = total % 1000000;
+    if (secs >= 86400)
+        p += snprintf(p, end-p, "%lldd", secs/86400);
+    if (secs%86400 >= 3600)
+        p += snprintf(p, end-p, "%lldh", secs%86400/3600);
+    if (secs%3600 >= 60)
+        p += snprintf(p, end-p, "%lldm", secs%3600/60);
+    if (secs%60 != 0 || us != 0 || p == buf + (neg ? 2 : 0)) {
+        p += snprintf(p, end-p, "%lld", secs%60);
+        if (us != 0) {
+            p += snprintf(p, end-p, ".%06lld", us);
+            while (p[-1] == '0')
+                p--;
+        }
+        *p++ = 's';
+    }
+    if (neg)
+        *p++ = ')';
+    qjson_write_raw(w, buf, p-buf);
+    return 0;
+}
+
+// writeDateTime writes the datetime o as an ISO date time in UTC. Naive
+// datetime are assumed to be in UTC.
+static int writeDateTime(qjson_writer_t *w, PyObject *o) {
+    PyObject *utc = NULL;
+    PyObject *tz = PyObject_GetAttrString(o, "tzinfo");
+    if (tz == NULL)
+        return -1;
+    if (tz != Py_None) {
+        utc = PyObject_CallMethod(o, "astimezone", "O", PyDateTime_TimeZone_UTC);
+        if (utc == NULL) {
+            Py_DECREF(tz);
+            return -1;
+        }
+        o = utc;
+    }
+    Py_DECREF(tz);
+    int y = PyDateTime_GET_YEAR(o);
+    if (y < 1970) {
+        Py_XDECREF(utc);
+        PyErr_SetString(PyExc_ValueError, "qjson date times must be after 1970");
+        return -1;
+    }
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d", y, 
+        PyDateTime_GET_MONTH(o), PyDateTime_GET_DAY(o), PyDateTime_DATE_GET_HOUR(o),
+        PyDateTime_DATE_GET_MINUTE(o), PyDateTime_DATE_GET_SECOND(o));
+    int us = PyDateTime_DATE_GET_MICROSECOND(o);
+    if (us != 0)
+        n += snprintf(buf+n, sizeof(buf)-n, (us%1000 == 0) ? ".%03d" : ".%06d", (us%1000 == 0) ? us/1000 : us);
+    buf[n++] = 'Z';
+    Py_XDECREF(utc);
+    qjson_write_raw(w, buf, n);
+    return 0;
+}
+
+// writeSeconds writes the float returned by calling the method name of o.
+static int writeSeconds(qjson_writer_t *w, PyObject *o, const char *name) {
+    PyObject *v = PyObject_CallMethod(o, name, NULL);
+    if (v == NULL)
+        return -1;
+    double f = PyFloat_AsDouble(v);
+    Py_DECREF(v);
+    if (f == -1.0 && PyErr_Occurred())
+        return -1;
+    return writeFloat(w, f);
+}
+
+// isOneLineList returns true if the items of the list or tuple o are 
+// scalars that can be written on one line.
+static bool isOneLineList(PyObject *o) {
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(o), len = 0;
+    if (n == 0)
+        return false;
+    PyObject **items = PySequence_Fast_ITEMS(o);
+    for (Py_ssize_t i = 0; i < n && len <= oneLineListMaxLen; i++) {
+        PyObject *v = items[i];
+        if (PyUnicode_Check(v)) {
+            Py_ssize_t l = PyUnicode_GET_LENGTH(v);
+            if (PyUnicode_FindChar(v, '\n', 0, l, 1) != -1)
+                return false;
+            len += l + 2;
+        } else if (v == Py_None || PyBool_Check(v) || PyLong_Check(v) || PyFloat_Check(v)) {
+            len += 6;
+        } else {
+            return false;
+        }
+    }
+    return len <= oneLineListMaxLen;
+}
+
+// dumpDict writes the members of the dict o.
+static int dumpDict(qjson_writer_t *w, PyObject *o, const dumpOpts_t *opts) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    qjson_write_begin_object(w);
+    while (PyDict_Next(o, &pos, &key, &value)) {
+        if (PyUnicode_Check(key)) {
+            if (writeUTF8(w, key, true) < 0)
+                return -1;
+        } else if (PyLong_Check(key)) {
+            PyObject *s = PyObject_Str(key);
+            if (s == NULL)
+                return -1;
+            int r = writeUTF8(w, s, true);
+            Py_DECREF(s);
+            if (r < 0)
+                return -1;
+        } else {
+            PyErr_Format(PyExc_TypeError, "keys must be str or int, not %.100s", Py_TYPE(key)->tp_name);
+            return -1;
+        }
+        if (dumpValue(w, value, opts) < 0)
+            return -1;
+    }
+    qjson_write_end_object(w);
+    return 0;
+}
+
+// dumpList writes the values of the list or tuple o.
+static int dumpList(qjson_writer_t *w, PyObject *o, const dumpOpts_t *opts) {
+    qjson_write_begin_array(w, isOneLineList(o));
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(o);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        // the list may be modified by a value conversion
+        if (i >= PySequence_Fast_GET_SIZE(o))
+            break;
+        if (dumpValue(w, PySequence_Fast_GET_ITEM(o, i), opts) < 0)
+            return -1;
+    }
+    qjson_write_end_array(w);
+    return 0;
+}
+
+// dumpValue writes the value o.
+static int dumpValue(qjson_writer_t *w, PyObject *o, const dumpOpts_t *opts) {
+    if (PyUnicode_Check(o))
+        return writeUTF8(w, o, false);
+    if (o == Py_None) {
+        qjson_write_raw(w, "null", 4);
+        return 0;
+    }
+    if (o == Py_True) {
+        qjson_write_raw(w, "true", 4);
+        return 0;
+    }
+    if (o == Py_False) {
+        qjson_write_raw(w, "false", 5);
+        return 0;
+    }
+    if (PyLong_Check(o))
+        return writeInt(w, o);
+    if (PyFloat_Check(o))
+        return writeFloat(w, PyFloat_AS_DOUBLE(o));
+    if (PyDelta_Check(o))
+        return opts->durations ? writeDuration(w, o) : writeSeconds(w, o, "total_seconds");
+    if (PyDateTime_Check(o)) {
+        if (opts->dates)
+            return writeDateTime(w, o);
+        return writeSeconds(w, o, "timestamp");
+    }
+    if (!PyDict_Check(o) && !PyList_Check(o) && !PyTuple_Check(o)) {
+        PyErr_Format(PyExc_TypeError, "Object of type %.100s is not qjson serializable", Py_TYPE(o)->tp_name);
+        return -1;
+    }
+    if (Py_EnterRecursiveCall(" while encoding a qjson object"))
+        return -1;
+    int r = PyDict_Check(o) ? dumpDict(w, o, opts) : dumpList(w, o, opts);
+    Py_LeaveRecursiveCall();
+    return r;
+}
+
+// Function dumps of qjson2json module.
+// Given a dict, it returns the corresponding idiomatic qjson text.
+static PyObject *qjson2json_dumps(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"obj", "indent", "commas", "durations", "dates", NULL};
+    PyObject *obj;
+    int indent = 2, commas = 0, durations = 1, dates = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$ippp", kwlist, &obj, &indent, &commas, &durations, &dates))
+        return NULL;
+    if (indent < 0) {
+        PyErr_SetString(PyExc_ValueError, "indent must be positive or zero");
+        return NULL;
+    }
+    if (!PyDict_Check(obj)) {
+        PyErr_Format(PyExc_TypeError, "qjson top level value must be a dict, not %.100s", Py_TYPE(obj)->tp_name);
+        return NULL;
+    }
+    dumpOpts_t opts = {durations != 0, dates != 0};
+    qjson_writer_t *w = qjson_writer_new(indent, commas != 0);
+    if (dumpValue(w, obj, &opts) < 0) {
+        qjson_writer_free(w);
+        return NULL;
+    }
+    size_t len;
+    char *outStr = qjson_writer_finish(w, &len);
+    qjson_writer_free(w);
+    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, len, NULL);
+    free(outStr);
+    return tmp;
+}
+
+// Function format of qjson2json module.
+// Given a string containing qjson text, it returns the text in the 
+// canonical layout with its comments preserved, or raise a value error
+// exception if the qjson text is invalid.
+static PyObject *qjson2json_format(PyObject *self, PyObject *args) {
+    const char *inStr;
+    Py_ssize_t inLen;
+    if (!PyArg_ParseTuple(args, "s#", &inStr, &inLen))
+        return NULL;
+
+    char *outStr = NULL;
+    size_t outLen;
+    qjson_error_t err;
+    Py_BEGIN_ALLOW_THREADS
+    qjson_cst_t *c = qjson_cst_parse(inStr, (size_t)inLen, &err);
+    if (c != NULL)
+        outStr = qjson_cst_format(c, &outLen);
+    qjson_cst_free(c);
+    Py_END_ALLOW_THREADS
+    if (outStr == NULL)
+        return setError(&err);
+    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, outLen, NULL);
+    free(outStr);
+    return tmp;
+}
+
+// Function patch of qjson2json module.
+// Given a string containing qjson text, a path as a sequence of keys and
+// indexes, and a string containing a qjson value, it returns the text 
+// where the value at path is replaced and the rest is left unmodified.
+static PyObject *qjson2json_patch(PyObject *self, PyObject *args) {
+    const char *inStr, *valStr;
+    Py_ssize_t inLen, valLen;
+    PyObject *pathObj;
+    if (!PyArg_ParseTuple(args, "s#Os#", &inStr, &inLen, &pathObj, &valStr, &valLen))
+        return NULL;
+    PyObject *seq = PySequence_Fast(pathObj, "path must be a sequence of str and int");
+    if (seq == NULL)
+        return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    qjson_path_t *path = PyMem_Malloc((n+1)*sizeof(qjson_path_t));
+    if (path == NULL) {
+        Py_DECREF(seq);
         return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *o = PySequence_Fast_GET_ITEM(seq, i);
+        Py_ssize_t l = 0;
+        path[i].key = NULL;
+        path[i].index = 0;
+        if (PyUnicode_Check(o)) {
+            path[i].key = PyUnicode_AsUTF8AndSize(o, &l);
+        } else if (PyLong_Check(o)) {
+            long index = PyLong_AsLong(o);
+            if (index < 0 && !PyErr_Occurred())
+                PyErr_SetString(PyExc_IndexError, "negative path index");
+            else if (index > INT_MAX)
+                PyErr_SetString(PyExc_OverflowError, "path index too large");
+            path[i].index = (int)index;
+        } else {
+            PyErr_SetString(PyExc_TypeError, "path must be a sequence of str and int");
+        }
+        if (PyErr_Occurred()) {
+            PyMem_Free(path);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        path[i].keyLen = (size_t)l;
+    }
+
+    char *outStr = NULL;
+    size_t outLen;
+    qjson_error_t err;
+    Py_BEGIN_ALLOW_THREADS
+    qjson_cst_t *c = qjson_cst_parse(inStr, (size_t)inLen, &err);
+    if (c != NULL)
+        outStr = qjson_cst_patch(c, path, (int)n, valStr, (size_t)valLen, &outLen, &err);
+    qjson_cst_free(c);
+    Py_END_ALLOW_THREADS
+    PyMem_Free(path);
+    Py_DECREF(seq);
+    if (outStr == NULL) {
+        if (err.msg != NULL && strcmp(err.msg, "path not found") == 0) {
+            PyErr_SetString(PyExc_KeyError, err.msg);
+            return NULL;
+        }
+        return setError(&err);
+    }
+    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, outLen, NULL);
+    free(outStr);
+    return tmp;
+}
 
-    // set isError to true if the returned string is an error
-    bool isError = strlen(outStr) > 0 && outStr[0] != '{';
+// Names of the token tags, indexed by qjson_token_tag_t.
+static const char *tokenTagNames[] = {
+    "end", "error", "{", "}", "[", "]", ":", ",", "quoteless", "double_quoted",
+    "single_quoted", "multiline", "whitespace", "newline", "comment"
+};
+
+// Interned str objects of tokenTagNames, created at module initialization.
+static PyObject *tokenTags[sizeof(tokenTagNames)/sizeof(tokenTagNames[0])];
 
-    // convert the returned string into a python unicode string
-    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, strlen(outStr), NULL);
-    free((char*)outStr);
+// charCount returns the number of utf8 chars of the n bytes of p.
+static Py_ssize_t charCount(const char *p, size_t n) {
+    Py_ssize_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += (p[i]&0xC0) != 0x80;
+    return count;
+}
 
-    // if didn’t return an error, return the string produced by the decoder
-    if (!isError) 
-        return tmp;
+// byteOffset returns the byte offset of the char index pos of the n bytes
+// of utf8 text p, or -1 if pos is beyond the end of p.
+static Py_ssize_t byteOffset(const char *p, size_t n, Py_ssize_t pos) {
+    size_t i = 0;
+    for (; pos > 0 && i < n; pos--)
+        for (i++; i < n && (p[i]&0xC0) == 0x80; i++)
+            ;
+    return (pos > 0) ? -1 : (Py_ssize_t)i;
+}
 
-    // raise a value error exception 
-    PyErr_SetObject(PyExc_ValueError, tmp);
+// tokensObject is the iterator returned by tokens.
+typedef struct {
+    PyObject_HEAD
+    PyObject      *text;  // reference on the str or bytes input
+    const char    *in;    // utf8 input
+    qjson_lexer_t *lx;    // lexer, NULL when done
+    Py_ssize_t     batch; // maximum number of tokens per list
+    bool           chars; // positions are char indexes of a str input instead of byte offsets
+    size_t         byte;  // byte offset of the end of the last token when chars is true
+    Py_ssize_t     chr;   // its char index
+    bool           failed; // err is raised by the next call
+    qjson_error_t  err;   // error met by the lexer
+} tokensObject;
+
+static void tokens_dealloc(tokensObject *self) {
+    qjson_lexer_free(self->lx);
+    Py_XDECREF(self->text);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// tokens_next returns the list of the next tokens, or raise a value error
+// exception if an invalid token is met. The tokens preceding the invalid
+// token are returned first.
+static PyObject *tokens_next(tokensObject *self) {
+    if (self->failed) {
+        self->failed = false;
+        return setError(&self->err);
+    }
+    if (self->lx == NULL)
+        return NULL;
+    PyObject *list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+    qjson_token_t tk;
+    while (PyList_GET_SIZE(list) < self->batch) {
+        if (!qjson_lexer_next(self->lx, &tk)) {
+            self->failed = qjson_lexer_error(self->lx, &self->err);
+            qjson_lexer_free(self->lx);
+            self->lx = NULL;
+            break;
+        }
+        Py_ssize_t offset = (Py_ssize_t)tk.offset, len = (Py_ssize_t)tk.len;
+        if (self->chars) {
+            // tokens are in input order, so the chars are counted once
+            offset = self->chr + charCount(self->in+self->byte, tk.offset-self->byte);
+            len = charCount(self->in+tk.offset, tk.len);
+            self->byte = tk.offset+tk.len;
+            self->chr = offset+len;
+        }
+        PyObject *t = Py_BuildValue("(Onni)", tokenTags[tk.tag], offset, len, tk.line);
+        if (t == NULL || PyList_Append(list, t) < 0) {
+            Py_XDECREF(t);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(t);
+    }
+    if (PyList_GET_SIZE(list) == 0) {
+        Py_DECREF(list);
+        return tokens_next(self);
+    }
+    return list;
+}
+
+static PyTypeObject tokensType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qjson2json.tokens_iterator",
+    .tp_basicsize = sizeof(tokensObject),
+    .tp_dealloc = (destructor)tokens_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)tokens_next,
+};
+
+// Function tokens of qjson2json module.
+// Given a str or bytes containing qjson text, it returns an iterator of 
+// lists of at most batch tokens. A token is a (tag, offset, length, line)
+// tuple where offset and length are in chars of a str text, or in bytes of
+// a bytes text.
+static PyObject *qjson2json_tokens(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"text", "trivia", "batch", NULL};
+    PyObject *text;
+    int trivia = 0;
+    Py_ssize_t batch = 1024;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$pn", kwlist, &text, &trivia, &batch))
+        return NULL;
+    const char *inStr;
+    Py_ssize_t inLen;
+    if (PyUnicode_Check(text)) {
+        inStr = PyUnicode_AsUTF8AndSize(text, &inLen);
+        if (inStr == NULL)
+            return NULL;
+    } else if (PyBytes_Check(text)) {
+        inStr = PyBytes_AS_STRING(text);
+        inLen = PyBytes_GET_SIZE(text);
+    } else {
+        PyErr_Format(PyExc_TypeError, "text must be str or bytes, not %.100s", Py_TYPE(text)->tp_name);
+        return NULL;
+    }
+    if (batch < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch must be positive");
+        return NULL;
+    }
+    tokensObject *it = PyObject_New(tokensObject, &tokensType);
+    if (it == NULL)
+        return NULL;
+    Py_INCREF(text);
+    it->text = text;
+    it->in = inStr;
+    it->batch = batch;
+    it->chars = PyUnicode_Check(text) && !PyUnicode_IS_ASCII(text);
+    it->byte = 0;
+    it->chr = 0;
+    it->failed = false;
+    it->lx = qjson_lexer_new(inStr, (size_t)inLen, trivia != 0);
+    if (it->lx == NULL) {
+        Py_DECREF(it);
+        PyErr_SetString(PyExc_ValueError, "input too large");
+        return NULL;
+    }
+    return (PyObject*)it;
+}
+
+// documentObject is an editable qjson document.
+typedef struct {
+    PyObject_HEAD
+    qjson_doc_t *doc;
+    bool         ascii; // the text is ascii, so that char indexes are byte offsets
+} documentObject;
+
+static void document_dealloc(documentObject *self) {
+    qjson_doc_free(self->doc);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject *document_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"text", NULL};
+    PyObject *text;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "U", kwlist, &text))
+        return NULL;
+    Py_ssize_t inLen;
+    const char *inStr = PyUnicode_AsUTF8AndSize(text, &inLen);
+    if (inStr == NULL)
+        return NULL;
+    documentObject *self = (documentObject*)type->tp_alloc(type, 0);
+    if (self == NULL)
+        return NULL;
+    self->ascii = PyUnicode_IS_ASCII(text);
+    Py_BEGIN_ALLOW_THREADS
+    self->doc = qjson_doc_new(inStr, (size_t)inLen);
+    Py_END_ALLOW_THREADS
+    if (self->doc == NULL) {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_ValueError, "input too large");
+        return NULL;
+    }
+    return (PyObject*)self;
+}
+
+// document_edit replaces the chars from start to end of the text by text,
+// and returns True if the resulting text is valid.
+static PyObject *document_edit(documentObject *self, PyObject *args) {
+    Py_ssize_t start, end, inLen;
+    PyObject *text;
+    if (!PyArg_ParseTuple(args, "nnU", &start, &end, &text))
+        return NULL;
+    const char *inStr = PyUnicode_AsUTF8AndSize(text, &inLen);
+    if (inStr == NULL)
+        return NULL;
+    size_t b, e;
+    if (!self->ascii && start >= 0 && end >= start) {
+        // convert the char indexes into byte offsets in the utf8 text,
+        // counting the chars from the previous edit
+        bool ok = qjson_doc_byte_offset(self->doc, (size_t)start, &b) && qjson_doc_byte_offset(self->doc, (size_t)end, &e);
+        start = ok ? (Py_ssize_t)b : -1;
+        end = ok ? (Py_ssize_t)e : -1;
+    }
+    if (start < 0 || end < start) {
+        PyErr_SetString(PyExc_IndexError, "invalid edit range");
+        return NULL;
+    }
+    // the edit keeps the GIL, which serializes it with the other methods
+    // reading or modifying the document
+    qjson_error_t err;
+    bool ok = qjson_doc_edit(self->doc, (size_t)start, (size_t)end, inStr, (size_t)inLen, &err);
+    if (!ok && strcmp(err.msg, "invalid edit range") == 0) {
+        PyErr_SetString(PyExc_IndexError, err.msg);
+        return NULL;
+    }
+    self->ascii = self->ascii && PyUnicode_IS_ASCII(text);
+    return PyBool_FromLong(ok);
+}
+
+// document_format returns the document text in the canonical layout.
+static PyObject *document_format(documentObject *self, PyObject *unused) {
+    const qjson_cst_t *c = qjson_doc_cst(self->doc);
+    if (c == NULL) {
+        qjson_error_t err;
+        qjson_doc_error(self->doc, &err);
+        return setError(&err);
+    }
+    size_t outLen;
+    char *outStr = qjson_cst_format(c, &outLen);
+    PyObject *tmp = PyUnicode_DecodeUTF8(outStr, outLen, NULL);
+    free(outStr);
+    return tmp;
+}
+
+static PyObject *document_get_text(documentObject *self, void *closure) {
+    size_t len;
+    const char *text = qjson_doc_text(self->doc, &len);
+    return PyUnicode_DecodeUTF8(text, len, NULL);
+}
+
+static PyObject *document_get_error(documentObject *self, void *closure) {
+    qjson_error_t err;
+    if (!qjson_doc_error(self->doc, &err))
+        Py_RETURN_NONE;
+    return PyUnicode_FromFormat("%s at line %d col %d", err.msg, err.line, err.col);
+}
+
+static PyMethodDef documentMethods[] = {
+    {"edit", (PyCFunction)document_edit, METH_VARARGS, 
+        "edit(start, end, text)\n"
+        "Replaces the chars from start to end of the text by text, and returns True if the\n"
+        "resulting text is valid. Only the smallest enclosing sequence of members or values is reparsed."},
+    {"format", (PyCFunction)document_format, METH_NOARGS, 
+        "Returns the text in the canonical layout, or raise a ValueError exception if the text is invalid."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef documentGetSet[] = {
+    {"text", (getter)document_get_text, NULL, "document text", NULL},
+    {"error", (getter)document_get_error, NULL, "error message of the text, or None if it is valid", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject documentType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qjson2json.Document",
+    .tp_doc = "Document(text)\nEditable qjson document revalidated incrementally after each edit.",
+    .tp_basicsize = sizeof(documentObject),
+    .tp_dealloc = (destructor)document_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = document_new,
+    .tp_methods = documentMethods,
+    .tp_getset = documentGetSet,
+};
+
+// sourceMapObject maps the positions in a json output of decode_with_source_map
+// to positions in its qjson input.
+typedef struct {
+    PyObject_HEAD
+    qjson_result_t  res;  // decoding result holding the source map
+    PyObject       *text; // qjson input
+    PyObject       *json; // json output
+} sourceMapObject;
+
+static void sourceMap_dealloc(sourceMapObject *self) {
+    qjson_result_free(&self->res);
+    Py_XDECREF(self->text);
+    Py_XDECREF(self->json);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// sourceMap_lookup returns the (line, col) position in the qjson input of
+// the last key or value starting at or before the char index pos of the
+// json output, or None if there is none.
+static PyObject *sourceMap_lookup(sourceMapObject *self, PyObject *args) {
+    Py_ssize_t pos;
+    if (!PyArg_ParseTuple(args, "n", &pos))
+        return NULL;
+    if (pos < 0 || pos > PyUnicode_GET_LENGTH(self->json)) {
+        PyErr_SetString(PyExc_IndexError, "position out of range");
+        return NULL;
+    }
+    size_t outOffset = (size_t)pos;
+    if (!PyUnicode_IS_ASCII(self->json)) {
+        // convert the char index into a byte offset in the utf8 output
+        Py_ssize_t len;
+        const char *p = PyUnicode_AsUTF8AndSize(self->json, &len);
+        if (p == NULL)
+            return NULL;
+        outOffset = (size_t)byteOffset(p, (size_t)len, pos);
+    }
+    const char *text = PyUnicode_AsUTF8(self->text);
+    if (text == NULL)
+        return NULL;
+    qjson_mapping_t m;
+    if (!qjson_source_map_lookup(self->res.sourceMap, outOffset, text, &m))
+        Py_RETURN_NONE;
+    return Py_BuildValue("(ii)", m.line, m.col);
+}
+
+static PyMethodDef sourceMapMethods[] = {
+    {"lookup", (PyCFunction)sourceMap_lookup, METH_VARARGS, 
+        "lookup(pos)\n"
+        "Returns the (line, col) position in the qjson input of the last key or value starting at or before\n"
+        "the char index pos of the json output, or None if there is none."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject sourceMapType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qjson2json.SourceMap",
+    .tp_doc = "Source map of the json output of decode_with_source_map.",
+    .tp_basicsize = sizeof(sourceMapObject),
+    .tp_dealloc = (destructor)sourceMap_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_methods = sourceMapMethods,
+};
+
+// Function decode_with_source_map of the qjson2json module.
+// It returns the json text of the qjson text and its source map, or raise
+// a value error exception if the qjson text is invalid.
+static PyObject *qjson2json_decode_with_source_map(PyObject *self, PyObject *args) {
+    PyObject *text;
+    if (!PyArg_ParseTuple(args, "U", &text))
+        return NULL;
+    Py_ssize_t inLen;
+    const char *inStr = PyUnicode_AsUTF8AndSize(text, &inLen);
+    if (inStr == NULL)
+        return NULL;
+    sourceMapObject *sm = PyObject_New(sourceMapObject, &sourceMapType);
+    if (sm == NULL)
+        return NULL;
+    memset(&sm->res, 0, sizeof(sm->res));
+    Py_INCREF(text);
+    sm->text = text;
+    sm->json = NULL;
+    qjson_options_t opts;
+    qjson_options_init(&opts);
+    opts.sourceMap = true;
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = qjson_decode_ex(inStr, (size_t)inLen, &opts, &sm->res);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        setError(&sm->res.error);
+        Py_DECREF(sm);
+        return NULL;
+    }
+    sm->json = PyUnicode_DecodeUTF8(sm->res.json, sm->res.len, NULL);
+    if (sm->json == NULL) {
+        Py_DECREF(sm);
+        return NULL;
+    }
+    // only the source map is needed from now on
+    free(sm->res.json);
+    sm->res.json = NULL;
+    PyObject *tmp = PyTuple_Pack(2, sm->json, (PyObject*)sm);
+    Py_DECREF(sm);
+    return tmp;
+}
+
+// Function validate of the qjson2json module.
+// It returns the list of the (line, col, message) errors of the qjson text,
+// collecting up to max_errors of them in one pass. The list is empty when
+// the text is valid.
+static PyObject *qjson2json_validate(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"text", "max_errors", NULL};
+    const char *inStr;
+    Py_ssize_t inLen;
+    int maxErrors = 100;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|$i", kwlist, &inStr, &inLen, &maxErrors))
+        return NULL;
+    if (maxErrors < 1) {
+        PyErr_SetString(PyExc_ValueError, "max_errors must be at least 1");
+        return NULL;
+    }
+    qjson_options_t opts;
+    qjson_options_init(&opts);
+    opts.validateOnly = true;
+    opts.maxErrors = maxErrors;
+    qjson_result_t res;
+    Py_BEGIN_ALLOW_THREADS
+    qjson_decode_ex(inStr, (size_t)inLen, &opts, &res);
+    Py_END_ALLOW_THREADS
+    PyObject *list = PyList_New(0);
+    size_t n = (res.errors != NULL) ? res.nErrors : (res.error.msg != NULL);
+    const qjson_error_t *errs = (res.errors != NULL) ? res.errors : &res.error;
+    for (size_t i = 0; list != NULL && i < n; i++) {
+        PyObject *tmp = Py_BuildValue("(iis)", errs[i].line, errs[i].col, errs[i].msg);
+        if (tmp == NULL || PyList_Append(list, tmp) < 0)
+            Py_CLEAR(list);
+        Py_XDECREF(tmp);
+    }
+    qjson_result_free(&res);
+    return list;
+}
+
+#ifdef __linux__
+// watchFile_t is a qjson file of a watched directory.
+typedef struct {
+    char     *name;  // file name in the directory
+    uint64_t  hash;  // hash of the file content
+    char     *json;  // json of the last valid content, NULL if none
+    size_t    len;
+    char     *error; // error message of the content, NULL if it is valid
+} watchFile_t;
+
+// watcherObject watches the qjson files of a directory with inotify. The
+// changed files are decoded by a background thread running watcher_run, 
+// which waits for events without the GIL and takes it only to publish a 
+// new snapshot. The files are only modified by that thread once started.
+typedef struct {
+    PyObject_HEAD
+    PyObject    *callback;
+    PyObject    *snapshot; // dict of the json by file name, or merged json str
+    PyObject    *errors;   // dict of the error messages by file name
+    pthread_t    thread;   // thread running watcher_run, holding a reference
+    bool         joinable; // the thread is neither joined nor detached
+    char        *dir;
+    int          ifd, efd; // inotify and stop eventfd descriptors
+    int          delay;    // coalescing delay in milliseconds
+    bool         merge, changes;
+    bool         stale;    // the merged json misses a change of the files
+    watchFile_t *files;    // sorted by name
+    int          nFiles, capFiles;
+    char        *merged;   // json of the merged files when merge is true
+    size_t       mergedLen;
+} watcherObject;
+
+// setItem sets the item key of dict d to v and releases v.
+static int setItem(PyObject *d, PyObject *key, PyObject *v) {
+    if (v == NULL)
+        return -1;
+    int r = PyDict_SetItem(d, key, v);
+    Py_DECREF(v);
+    return r;
+}
+
+// nameList_t is a set of file names.
+typedef struct {
+    char **names;
+    int    n, cap;
+} nameList_t;
+
+static void nameAdd(nameList_t *l, const char *name) {
+    for (int i = 0; i < l->n; i++)
+        if (strcmp(l->names[i], name) == 0)
+            return;
+    if (l->n == l->cap) {
+        l->cap = (l->cap == 0) ? 16 : l->cap*2;
+        l->names = realloc(l->names, l->cap*sizeof(char*));
+    }
+    l->names[l->n++] = strdup(name);
+}
+
+static void nameFree(nameList_t *l) {
+    for (int i = 0; i < l->n; i++)
+        free(l->names[i]);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+// isQjsonName returns true if name is the name of a visible qjson file.
+static bool isQjsonName(const char *name) {
+    size_t l = strlen(name);
+    return name[0] != '.' && l > 6 && strcmp(name+l-6, ".qjson") == 0;
+}
+
+// contentHash returns the FNV-1a hash of the n bytes of p.
+static uint64_t contentHash(const char *p, size_t n) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ull;
+    return h;
+}
+
+// readFile returns the heap allocated content of the regular file at path
+// and its byte length in *len, or NULL.
+static char *readFile(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    size_t cap = (size_t)st.st_size+1, l = 0;
+    char *buf = malloc(cap);
+    for (;;) {
+        if (l == cap)
+            buf = realloc(buf, cap *= 2);
+        ssize_t n = read(fd, buf+l, cap-l);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            close(fd);
+            if (n == 0) {
+                *len = l;
+                return buf;
+            }
+            free(buf);
+            return NULL;
+        }
+        l += (size_t)n;
+    }
+}
+
+// watchFind returns the index of the file name, or the index where it 
+// would be inserted with *found false.
+static int watchFind(watcherObject *w, const char *name, bool *found) {
+    int lo = 0, hi = w->nFiles;
+    while (lo < hi) {
+        int mid = (lo+hi)/2, c = strcmp(w->files[mid].name, name);
+        if (c == 0) {
+            *found = true;
+            return mid;
+        }
+        if (c < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+// watchReload decodes the file name again if its content changed, and 
+// returns true if it was modified, created or removed. It is called 
+// without the GIL.
+static bool watchReload(watcherObject *w, const char *name) {
+    bool found;
+    int i = watchFind(w, name, &found);
+    size_t l = strlen(w->dir)+strlen(name)+2, len;
+    char *path = malloc(l);
+    snprintf(path, l, "%s/%s", w->dir, name);
+    char *text = readFile(path, &len);
+    free(path);
+    if (text == NULL) {
+        if (!found)
+            return false;
+        watchFile_t *f = &w->files[i];
+        w->stale |= f->json != NULL;
+        free(f->name);
+        free(f->json);
+        free(f->error);
+        memmove(f, f+1, (w->nFiles-i-1)*sizeof(watchFile_t));
+        w->nFiles--;
+        return true;
+    }
+    uint64_t h = contentHash(text, len);
+    if (found && w->files[i].hash == h) {
+        free(text);
+        return false;
+    }
+    if (!found) {
+        if (w->nFiles == w->capFiles) {
+            w->capFiles = (w->capFiles == 0) ? 16 : w->capFiles*2;
+            w->files = realloc(w->files, w->capFiles*sizeof(watchFile_t));
+        }
+        memmove(&w->files[i+1], &w->files[i], (w->nFiles-i)*sizeof(watchFile_t));
+        w->nFiles++;
+        w->files[i] = (watchFile_t){strdup(name), 0, NULL, 0, NULL};
+    }
+    watchFile_t *f = &w->files[i];
+    f->hash = h;
+    // the merged layers keep the last of duplicate keys, like qjson_merge
+    qjson_options_t opts;
+    qjson_options_init(&opts);
+    if (w->merge)
+        opts.duplicateKeys = QJSON_DUP_LAST;
+    qjson_result_t res;
+    qjson_decode_ex(text, len, &opts, &res);
+    free(text);
+    free(f->error);
+    f->error = NULL;
+    if (res.error.msg != NULL) {
+        f->error = malloc(256);
+        snprintf(f->error, 256, "%s at line %d col %d", res.error.msg, res.error.line, res.error.col);
+    } else {
+        free(f->json);
+        w->stale = true;
+        f->json = res.json;
+        f->len = res.len;
+        res.json = NULL;
+    }
+    qjson_result_free(&res);
+    return true;
+}
+
+// watchScan adds to l the names of the qjson files of the directory and of
+// the files known to be there.
+static void watchScan(watcherObject *w, nameList_t *l) {
+    DIR *d = opendir(w->dir);
+    struct dirent *ent;
+    while (d != NULL && (ent = readdir(d)) != NULL)
+        if (isQjsonName(ent->d_name))
+            nameAdd(l, ent->d_name);
+    if (d != NULL)
+        closedir(d);
+    for (int i = 0; i < w->nFiles; i++)
+        nameAdd(l, w->files[i].name);
+}
+
+// watchMerge merges the json of the valid files in name order. The json 
+// kept for each file is merged as is, without being decoded again.
+static void watchMerge(watcherObject *w) {
+    const char **jsons = malloc((w->nFiles+1)*sizeof(char*));
+    size_t n = 0;
+    for (int i = 0; i < w->nFiles; i++)
+        if (w->files[i].json != NULL)
+            jsons[n++] = w->files[i].json;
+    qjson_result_t res;
+    qjson_merge_json(jsons, n, QJSON_MERGE_REPLACE, &res);
+    free(jsons);
+    w->stale = false;
+    free(w->merged);
+    w->merged = res.json;
+    w->mergedLen = res.len;
+    res.json = NULL;
+    qjson_result_free(&res);
+}
+
+// watchLoad reloads the files of l, keeps in l the names of the changed 
+// ones, and merges the files again if the json of one of them changed. It
+// is called without the GIL.
+static void watchLoad(watcherObject *w, nameList_t *l) {
+    int n = 0;
+    for (int i = 0; i < l->n; i++) {
+        if (watchReload(w, l->names[i]))
+            l->names[n++] = l->names[i];
+        else
+            free(l->names[i]);
+    }
+    l->n = n;
+    if (w->stale && w->merge)
+        watchMerge(w);
+}
+
+// watchPublish replaces the snapshot and errors with new ones updated with
+// the changed files of l, and returns the list of their names, or NULL 
+// on error.
+static PyObject *watchPublish(watcherObject *w, nameList_t *l) {
+    PyObject *changed = PyList_New(0);
+    PyObject *errors = PyDict_Copy(w->errors);
+    PyObject *snapshot = w->merge ? PyUnicode_DecodeUTF8(w->merged, w->mergedLen, NULL) : PyDict_Copy(w->snapshot);
+    if (changed == NULL || errors == NULL || snapshot == NULL)
+        goto fail;
+    for (int i = 0; i < l->n; i++) {
+        bool found;
+        watchFile_t *f = &w->files[watchFind(w, l->names[i], &found)];
+        PyObject *name = PyUnicode_DecodeFSDefault(l->names[i]);
+        if (name == NULL || PyList_Append(changed, name) < 0) {
+            Py_XDECREF(name);
+            goto fail;
+        }
+        int r = 0;
+        if (found && f->error != NULL)
+            r = setItem(errors, name, PyUnicode_FromString(f->error));
+        else if (PyDict_Contains(errors, name) == 1)
+            r = PyDict_DelItem(errors, name);
+        if (r == 0 && !w->merge) {
+            if (found && f->json != NULL)
+                r = setItem(snapshot, name, PyUnicode_DecodeUTF8(f->json, f->len, NULL));
+            else if (!found && PyDict_Contains(snapshot, name) == 1)
+                r = PyDict_DelItem(snapshot, name);
+        }
+        Py_DECREF(name);
+        if (r < 0)
+            goto fail;
+    }
+    Py_SETREF(w->snapshot, snapshot);
+    Py_SETREF(w->errors, errors);
+    return changed;
+fail:
+    Py_XDECREF(changed);
+    Py_XDECREF(errors);
+    Py_XDECREF(snapshot);
+    return NULL;
+}
+
+// watcher_run is the loop of the background thread, called with the GIL. 
+// It waits for events without the GIL, coalesces the events following the
+// first one until none is received during the delay, reloads the changed 
+// files, and calls the callback if any was really modified.
+static void watcher_run(watcherObject *w) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        nameList_t l = {NULL, 0, 0};
+        bool stop = false, rescan = false;
+        Py_BEGIN_ALLOW_THREADS
+        int timeout = -1;
+        for (;;) {
+            struct pollfd fds[2] = {{w->ifd, POLLIN, 0}, {w->efd, POLLIN, 0}};
+            int r = poll(fds, 2, timeout);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            if (fds[1].revents != 0) {
+                stop = true;
+                break;
+            }
+            ssize_t n = read(w->ifd, buf, sizeof(buf));
+            for (char *p = buf; n > 0 && p < buf+n; ) {
+                struct inotify_event *ev = (struct inotify_event*)p;
+                if (ev->mask & IN_Q_OVERFLOW)
+                    rescan = true;
+                else if (ev->mask & (IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF))
+                    stop = true;
+                else if (ev->len > 0 && isQjsonName(ev->name))
+                    nameAdd(&l, ev->name);
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+            timeout = w->delay;
+        }
+        if (!stop) {
+            if (rescan)
+                watchScan(w, &l);
+            watchLoad(w, &l);
+        }
+        Py_END_ALLOW_THREADS
+        if (l.n > 0) {
+            PyObject *changed = watchPublish(w, &l), *r = NULL;
+            if (changed != NULL) {
+                r = w->changes ? PyObject_CallFunctionObjArgs(w->callback, w->snapshot, changed, NULL)
+                    : PyObject_CallFunctionObjArgs(w->callback, w->snapshot, NULL);
+                Py_DECREF(changed);
+            }
+            if (r == NULL)
+                PyErr_WriteUnraisable(w->callback);
+            Py_XDECREF(r);
+        }
+        nameFree(&l);
+        if (stop)
+            break;
+    }
+}
+
+// watcherThread runs watcher_run in the background thread and releases the
+// reference of the thread to w.
+static void *watcherThread(void *arg) {
+    PyGILState_STATE g = PyGILState_Ensure();
+    watcher_run((watcherObject*)arg);
+    Py_DECREF((PyObject*)arg);
+    PyGILState_Release(g);
     return NULL;
 }
 
+static void watcher_dealloc(watcherObject *self) {
+    if (self->ifd >= 0)
+        close(self->ifd);
+    if (self->efd >= 0)
+        close(self->efd);
+    for (int i = 0; i < self->nFiles; i++) {
+        free(self->files[i].name);
+        free(self->files[i].json);
+        free(self->files[i].error);
+    }
+    free(self->files);
+    free(self->merged);
+    free(self->dir);
+    if (self->joinable)
+        pthread_detach(self->thread);
+    Py_XDECREF(self->callback);
+    Py_XDECREF(self->snapshot);
+    Py_XDECREF(self->errors);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+// watcher_start starts the background thread running watcher_run, which 
+// holds a reference to self until its end.
+static int watcher_start(watcherObject *self) {
+    Py_INCREF(self);
+    int err = pthread_create(&self->thread, NULL, watcherThread, self);
+    if (err != 0) {
+        Py_DECREF(self);
+        errno = err;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    self->joinable = true;
+    return 0;
+}
+
+static PyObject *watcher_new(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"path", "callback", "merge", "changes", "delay", NULL};
+    PyObject *path, *callback;
+    int merge = 0, changes = 0;
+    double delay = 0.05;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&O|$ppd", kwlist, PyUnicode_FSConverter, &path, &callback,
+            &merge, &changes, &delay))
+        return NULL;
+    if (!PyCallable_Check(callback) || delay < 0) {
+        Py_DECREF(path);
+        PyErr_SetString(!PyCallable_Check(callback) ? PyExc_TypeError : PyExc_ValueError,
+            !PyCallable_Check(callback) ? "callback must be callable" : "delay must be positive or zero");
+        return NULL;
+    }
+    watcherObject *self = (watcherObject*)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    self->ifd = self->efd = -1;
+    self->dir = strdup(PyBytes_AS_STRING(path));
+    self->delay = (int)(delay*1000);
+    self->merge = merge != 0;
+    self->changes = changes != 0;
+    Py_INCREF(callback);
+    self->callback = callback;
+    self->ifd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (self->ifd < 0 || inotify_add_watch(self->ifd, self->dir, 
+            IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR) < 0 ||
+            (self->efd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_DECREF(path);
+    // decode the files present before the thread starts, and merge them
+    // even if none is valid
+    nameList_t l = {NULL, 0, 0};
+    self->stale = true;
+    Py_BEGIN_ALLOW_THREADS
+    watchScan(self, &l);
+    watchLoad(self, &l);
+    Py_END_ALLOW_THREADS
+    self->snapshot = PyDict_New();
+    self->errors = PyDict_New();
+    PyObject *changed = (self->snapshot == NULL || self->errors == NULL) ? NULL : watchPublish(self, &l);
+    nameFree(&l);
+    if (changed == NULL) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_DECREF(changed);
+    if (watcher_start(self) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject*)self;
+}
+
+// watcher_close stops the background thread and waits for its end, unless
+// it is called by the callback.
+static PyObject *watcher_close(watcherObject *self, PyObject *unused) {
+    if (!self->joinable)
+        Py_RETURN_NONE;
+    uint64_t one = 1;
+    if (write(self->efd, &one, sizeof(one)) < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    self->joinable = false;
+    if (pthread_equal(self->thread, pthread_self())) {
+        pthread_detach(self->thread);
+        Py_RETURN_NONE;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(self->thread, NULL);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *watcher_enter(watcherObject *self, PyObject *unused) {
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+static PyObject *watcher_exit(watcherObject *self, PyObject *args) {
+    PyObject *r = watcher_close(self, NULL);
+    if (r == NULL)
+        return NULL;
+    Py_DECREF(r);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *watcher_get_snapshot(watcherObject *self, void *closure) {
+    Py_INCREF(self->snapshot);
+    return self->snapshot;
+}
+
+static PyObject *watcher_get_errors(watcherObject *self, void *closure) {
+    Py_INCREF(self->errors);
+    return self->errors;
+}
+
+static PyMethodDef watcherMethods[] = {
+    {"close", (PyCFunction)watcher_close, METH_NOARGS, "Stops watching and waits for the end of the background thread."},
+    {"__enter__", (PyCFunction)watcher_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)watcher_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef watcherGetSet[] = {
+    {"snapshot", (getter)watcher_get_snapshot, NULL, "dict of the json text by file name, or merged json text", NULL},
+    {"errors", (getter)watcher_get_errors, NULL, "dict of the error message by name of the invalid files", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject watcherType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "qjson2json.Watcher",
+    .tp_doc = "Watcher(path, callback, *, merge=False, changes=False, delay=0.05)\n"
+        "Watches the *.qjson files of the directory path with inotify. A background thread coalesces the\n"
+        "events received within delay seconds, decodes the files whose content changed, and calls\n"
+        "callback(snapshot), or callback(snapshot, changed) with the list of the changed file names when\n"
+        "changes is True. The snapshot is a dict of the json text by file name, or the json text of the\n"
+        "merge of the files in name order when merge is True. Invalid files keep their last valid json\n"
+        "and are listed in errors. Call close, or use the watcher as a context manager, to stop it.",
+    .tp_basicsize = sizeof(watcherObject),
+    .tp_dealloc = (destructor)watcher_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = watcher_new,
+    .tp_methods = watcherMethods,
+    .tp_getset = watcherGetSet,
+};
+#endif
+
 // Function version of the qjson2json module.
 // It returns a string specifying the version of the syntax and the converter. 
 static PyObject *qjson2json_version() {
@@ -46,8 +1802,75 @@ static PyObject *qjson2json_version() {
 
 // Module’s method table and initialization function. 
 static PyMethodDef qjson2json_methods[] = {
-    {"decode",  (PyCFunction)qjson2json_decode, METH_VARARGS, 
-        "Converts qjson text into json text, or raise a ValueError exception if the qjson text is invalid."},
+    {"decode",  (PyCFunction)qjson2json_decode, METH_VARARGS | METH_KEYWORDS, 
+        "decode(text, *, max_input=0, max_output=0, max_tokens=0, max_depth=0, timeout=0, cancel=None,\n"
+        "       expressions=True, durations=True, dates=True, multiline=True, reject_disabled=False,\n"
+        "       canonical=False, duplicates='allow', includes=None, indent=None, separators=None,\n"
+        "       ensure_ascii=False)\n"
+        "Converts qjson text into json text, or raise a ValueError exception if the qjson text is invalid.\n"
+        "With includes, an Includes cache, \"@include path\" values are replaced by the json of the file.\n"
+        "With canonical, keys are sorted and numbers and strings are written in a normalized form.\n"
+        "With indent, a number of spaces or a string, members and values are written on their own line\n"
+        "indented once per level. separators is an (item_separator, key_separator) tuple, by default\n"
+        "(',', ':'), or (',', ': ') with an indent. With ensure_ascii, non ascii chars are escaped.\n"
+        "Keys met twice in an object are output with duplicates='allow', rejected with 'error', or\n"
+        "output once with the first or last value with 'first' or 'last'.\n"
+        "The syntax features set to False are disabled and their checks skipped. Disabled expressions,\n"
+        "durations and multiline strings are then quoteless strings, or errors when reject_disabled is True.\n"
+        "The input and output byte lengths, the number of tokens, the nesting depth and the time in\n"
+        "seconds are limited when the corresponding argument is not 0. The conversion is cancelled when\n"
+        "cancel, a threading.Event, is set. Exceeding a limit or cancelling raise a LimitError."},
+    {"digest",  (PyCFunction)qjson2json_digest, METH_VARARGS | METH_KEYWORDS, 
+        "digest(text, **options)\n"
+        "Returns the 16 bytes MurmurHash3 digest of the canonical json text of the qjson text, without\n"
+        "building it. It accepts the same options as decode and raises the same exceptions."},
+    {"flatten",  (PyCFunction)qjson2json_flatten, METH_VARARGS | METH_KEYWORDS, 
+        "flatten(text, **options)\n"
+        "Returns the list of the (path, value) pairs of the scalar values and empty objects and arrays of\n"
+        "the json of the qjson text in order, path being the RFC 6901 json pointer of the value, like\n"
+        "'/servers/0/host', and value its json text. It accepts the same options as decode and raises\n"
+        "the same exceptions."},
+    {"merge",  (PyCFunction)qjson2json_merge, METH_VARARGS | METH_KEYWORDS, 
+        "merge(texts, *, arrays='replace')\n"
+        "Returns the json text of the deep merge of the qjson texts in order. Objects are merged\n"
+        "recursively and other values replaced, arrays are replaced or concatenated with arrays='concat'.\n"
+        "A key repeated in a text replaces its previous value, as with duplicates='last'.\n"
+        "Raise a ValueError exception naming the layer if a qjson text is invalid."},
+    {"diff",  (PyCFunction)qjson2json_diff, METH_VARARGS | METH_KEYWORDS, 
+        "diff(old, new, *, paths=False)\n"
+        "Returns the json text of the RFC 6902 operations changing the json of the old qjson text into\n"
+        "the json of the new one, or of the json pointers of the changed values when paths is True.\n"
+        "Raise a ValueError exception if a qjson text is invalid."},
+    {"from_json",  (PyCFunction)qjson2json_from_json, METH_VARARGS, 
+        "Converts a json object text into idiomatic qjson text, or raise a ValueError exception if the json text is invalid."},
+    {"dumps",  (PyCFunction)qjson2json_dumps, METH_VARARGS | METH_KEYWORDS, 
+        "dumps(obj, *, indent=2, commas=False, durations=True, dates=True)\n"
+        "Converts the dict obj into idiomatic qjson text. timedelta and datetime values are written as\n"
+        "durations and ISO date times, or as seconds when durations or dates is False."},
+    {"format",  (PyCFunction)qjson2json_format, METH_VARARGS, 
+        "Converts qjson text into the canonical layout preserving comments, or raise a ValueError exception if the qjson text is invalid."},
+    {"patch",  (PyCFunction)qjson2json_patch, METH_VARARGS, 
+        "patch(text, path, value)\n"
+        "Replaces the value at path, a sequence of keys and indexes, by the qjson value text, leaving the rest of text unmodified.\n"
+        "Raise a KeyError if path is not found, and a ValueError if text or the result is invalid."},
+    {"tokens",  (PyCFunction)qjson2json_tokens, METH_VARARGS | METH_KEYWORDS, 
+        "tokens(text, *, trivia=False, batch=1024)\n"
+        "Returns an iterator of lists of at most batch (tag, offset, length, line) tokens of the qjson text.\n"
+        "Offsets and lengths are in chars of a str text, or in bytes of a bytes text. White spaces,\n"
+        "newlines and comments are returned when trivia is True. Raise a ValueError when an invalid\n"
+        "token is met."},
+    {"decode_with_source_map",  (PyCFunction)qjson2json_decode_with_source_map, METH_VARARGS, 
+        "decode_with_source_map(text)\n"
+        "Returns the json text of the qjson text and a SourceMap whose lookup(pos) method returns the\n"
+        "(line, col) position in text of the key or value at the char index pos of the json text.\n"
+        "The json text is the compact output of decode with the default options: the source map is not\n"
+        "available for canonical, flattened, indented or ASCII output, nor with duplicates='first' or 'last'.\n"
+        "Raise a ValueError exception if the qjson text is invalid."},
+    {"validate",  (PyCFunction)qjson2json_validate, METH_VARARGS | METH_KEYWORDS, 
+        "validate(text, *, max_errors=100)\n"
+        "Returns the list of the (line, col, message) errors of the qjson text, empty if it is valid.\n"
+        "The parser recovers from errors at the next comma, closing bracket or line, so that up to\n"
+        "max_errors errors are reported in one pass."},
     {"version", (PyCFunction)qjson2json_version, METH_VARARGS, "Return the syntax and converter version."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
@@ -64,5 +1887,58 @@ static struct PyModuleDef qjson2jsonmodule = {
 
 // Module initialization function.
 PyMODINIT_FUNC PyInit_qjson2json(void) {
-    return PyModule_Create(&qjson2jsonmodule);
+    PyDateTime_IMPORT;
+    if (PyDateTimeAPI == NULL)
+        return NULL;
+    if (PyType_Ready(&tokensType) < 0)
+        return NULL;
+    if (PyType_Ready(&documentType) < 0)
+        return NULL;
+    if (PyType_Ready(&sourceMapType) < 0)
+        return NULL;
+    if (PyType_Ready(&includesType) < 0)
+        return NULL;
+#ifdef __linux__
+    if (PyType_Ready(&watcherType) < 0)
+        return NULL;
+#endif
+    for (size_t i = 0; i < sizeof(tokenTags)/sizeof(tokenTags[0]); i++) {
+        tokenTags[i] = PyUnicode_InternFromString(tokenTagNames[i]);
+        if (tokenTags[i] == NULL)
+            return NULL;
+    }
+    PyObject *m = PyModule_Create(&qjson2jsonmodule);
+    if (m == NULL)
+        return NULL;
+    Py_INCREF(&documentType);
+    if (PyModule_AddObject(m, "Document", (PyObject*)&documentType) < 0) {
+        Py_DECREF(&documentType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&includesType);
+    if (PyModule_AddObject(m, "Includes", (PyObject*)&includesType) < 0) {
+        Py_DECREF(&includesType);
+        Py_DECREF(m);
+        return NULL;
+    }
+#ifdef __linux__
+    Py_INCREF(&watcherType);
+    if (PyModule_AddObject(m, "Watcher", (PyObject*)&watcherType) < 0) {
+        Py_DECREF(&watcherType);
+        Py_DECREF(m);
+        return NULL;
+    }
+#endif
+    LimitError = PyErr_NewExceptionWithDoc("qjson2json.LimitError", 
+        "Raised when a limit of decode is exceeded or the conversion is cancelled. The reason\n"
+        "attribute is one of input, output, tokens, depth, time or cancelled, and the line, col\n"
+        "and offset attributes are the position reached.", PyExc_ValueError, NULL);
+    if (LimitError == NULL || PyModule_AddObject(m, "LimitError", LimitError) < 0) {
+        Py_XDECREF(LimitError);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(LimitError);
+    return m;
 }
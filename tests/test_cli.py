@@ -0,0 +1,96 @@
+"""
+testing the qjson command line converter built by make
+"""
+
+import os
+import subprocess
+
+import pytest
+
+QJSON = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'qjson')
+
+pytestmark = pytest.mark.skipif(not os.path.exists(QJSON), reason='qjson is not built')
+
+def run(*args, stdin=''):
+    """
+    run qjson with args and stdin, returning the completed process
+    """
+    return subprocess.run([QJSON, *args], input=stdin, capture_output=True, text=True, timeout=30)
+
+def test_stdin():
+    """
+    test the conversion of stdin to stdout
+    """
+    p = run(stdin='a: 1 + 2\nb: [x, y]\n')
+    assert p.returncode == 0
+    assert p.stdout == '{"a":3,"b":["x","y"]}\n'
+    assert p.stderr == ''
+    p = run(stdin='a: 1\nb: [x\n')
+    assert p.returncode == 1
+    assert p.stdout == ''
+    assert p.stderr.startswith('<stdin>:2:')
+
+def test_files(tmp_path):
+    """
+    test the conversion of files in argument order, and the file:line:col errors
+    """
+    names = []
+    for i in range(20):
+        f = tmp_path / f'f{i}.qjson'
+        f.write_text(f'i: {i}\n')
+        names.append(str(f))
+    p = run('-j', '4', *names)
+    assert p.returncode == 0
+    assert p.stdout == ''.join(f'{{"i":{i}}}\n' for i in range(20))
+    bad = tmp_path / 'bad.qjson'
+    bad.write_text('a: 1\nb: {c: 2\n')
+    p = run(names[0], str(bad))
+    assert p.returncode == 1
+    assert p.stdout == '{"i":0}\n'
+    line, col, msg = p.stderr.split(':', 3)[1:]
+    assert p.stderr.startswith(f'{bad}:')
+    assert (int(line), int(col)) == (2, 4)
+    assert msg.strip() != ''
+    p = run(str(tmp_path / 'missing.qjson'))
+    assert p.returncode == 1
+    assert 'missing.qjson' in p.stderr
+
+def test_validate():
+    """
+    test the validate only mode
+    """
+    p = run('-c', stdin='a: 1\n')
+    assert (p.returncode, p.stdout, p.stderr) == (0, '', '')
+    p = run('-c', stdin='a: [1\n')
+    assert p.returncode == 1
+    assert p.stdout == ''
+    assert p.stderr.startswith('<stdin>:')
+
+def test_output_dir(tmp_path):
+    """
+    test the output of the json files into a directory
+    """
+    src = tmp_path / 'src'
+    out = tmp_path / 'out'
+    src.mkdir()
+    out.mkdir()
+    (src / 'a.qjson').write_text('a: 1\n')
+    (src / 'b.conf.qjson').write_text('b: [true]\n')
+    p = run('-o', str(out), str(src / 'a.qjson'), str(src / 'b.conf.qjson'))
+    assert (p.returncode, p.stdout, p.stderr) == (0, '', '')
+    assert (out / 'a.json').read_text() == '{"a":1}\n'
+    assert (out / 'b.conf.json').read_text() == '{"b":[true]}\n'
+    p = run('-o', str(tmp_path / 'none'), str(src / 'a.qjson'))
+    assert p.returncode == 1
+    assert 'a.json' in p.stderr
+
+def test_usage():
+    """
+    test the exit status of invalid arguments
+    """
+    assert run('-x').returncode == 2
+    assert run('-j', '0').returncode == 2
+    assert run('-o', '/tmp').returncode == 2
+    p = run('-v')
+    assert p.returncode == 0
+    assert p.stdout.strip() != ''
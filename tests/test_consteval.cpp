@@ -0,0 +1,36 @@
+// test_consteval checks that qjson::ct::decode gives the json text of
+// qjson_decode_ex. It is built and run by make test. Compiled with
+// QJSON_TEST_OVERFLOW, it must fail with a number overflow syntax_error.
+
+#include "qjson_consteval.hpp"
+#include <cstdio>
+#include <string_view>
+
+// same returns true if the compile time and run time conversions of S give
+// the same json text.
+template <qjson::ct::fixed_string S>
+bool same() {
+	constexpr auto json = qjson::ct::decode<S>();
+	qjson_result_t r;
+	bool ok = qjson_decode_ex(S.buf, S.view().size(), nullptr, &r) && json.view() == std::string_view(r.json, r.len);
+	if (!ok)
+		fprintf(stderr, "test_consteval: %s\n  ct: %s\n  rt: %s\n", S.buf, json.c_str(), (r.json != nullptr) ? r.json : r.error.msg);
+	qjson_result_free(&r);
+	return ok;
+}
+
+#ifdef QJSON_TEST_OVERFLOW
+constexpr auto overflow = qjson::ct::decode<"a: 1e308*10">();
+#endif
+
+int main() {
+	bool ok = same<"a: b">();
+	ok &= same<"host: example.com\ntimeout: 1m30s\nports: [80, 0x1BB]">();
+	ok &= same<"a: 1_000.5, b: 0.0, c: 1e-310">();
+	ok &= same<"a: 9223372036854775807, b: 1.7976931348623157e308, c: 1e307*10">();
+	ok &= same<"a: 0 / 1e-320 + 1, b: 0 * 1e308">();
+	ok &= same<"a: 'x \"y\"', b: \"caf\\u00e9 <\\/x>\", c: -0, d: 2021-03-01T10:20:30Z">();
+	ok &= same<"t:\n  `\\n\n  a\x01 \x1f é\n  b`">();
+	ok &= same<"a: {b: [1, {c: null}], d: [], e: {}}, f: true /* comment */\n# comment\ng: 1 + 2*3 % 4">();
+	return ok ? 0 : 1;
+}
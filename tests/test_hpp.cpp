@@ -0,0 +1,180 @@
+// test_hpp checks the C++17 API of qjson.hpp: the expected results and the
+// exceptions of the policies, and the documents of qjson::pmr. It is built
+// and run by make test, linked with malloc, calloc and realloc wrapped to
+// count the heap allocations.
+
+#include "qjson.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+
+// allocs is the number of heap allocations.
+static size_t allocs = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void *p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+	allocs++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void *p, size_t size) {
+	allocs++;
+	return __real_realloc(p, size);
+}
+}
+
+// operator new allocates with the wrapped malloc, so that the allocations
+// of the standard library are counted too.
+void* operator new(size_t size) {
+	void *p = std::malloc(size > 0 ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	std::free(p);
+}
+
+namespace {
+
+bool failed = false;
+
+// check reports the test named what as failed if ok is false.
+void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "test_hpp: %s\n", what);
+		failed = true;
+	}
+}
+
+struct strict : qjson::default_policy {
+	static constexpr unsigned disabled = QJSON_NO_EXPRESSIONS | QJSON_NO_DURATIONS;
+	static constexpr qjson_dup_policy_t duplicates = QJSON_DUP_ERROR;
+	static constexpr int max_depth = 2;
+};
+
+struct throwing : strict {
+	static constexpr bool exceptions = true;
+};
+
+struct canonical : qjson::default_policy {
+	using sink = qjson::sink::canonical;
+};
+
+struct digest : qjson::default_policy {
+	using sink = qjson::sink::digest;
+};
+
+void testExpected() {
+	auto j = qjson::decode("a: 1 + 2\nb: [x, 'y']\n");
+	check(j.has_value() && j->view() == R"({"a":3,"b":["x","y"]})", "decode");
+	check(j.value().c_str()[j->size()] == '\0', "decode c_str");
+
+	auto e = qjson::decode("a: [1, 2\n");
+	check(!e && e.error().line == 1 && e.error().col == 5 && e.error().code == QJSON_ERROR_SYNTAX, "decode error");
+	bool thrown = false;
+	try {
+		e.value();
+	} catch (const qjson::decode_error &err) {
+		thrown = err.get().line == 1 && std::string_view(err.what()) == e.error().what();
+	}
+	check(thrown, "value of an error throws");
+
+	auto s = qjson::decode<strict>("a: 1h\nb: 1 + 2\n");
+	check(s && s->view() == R"({"a":"1h","b":"1 + 2"})", "disabled features");
+	check(!qjson::decode<strict>("a: 1, a: 2"), "duplicate key error");
+	auto d = qjson::decode<strict>("a: {b: {c: {d: 1}}}");
+	check(!d && d.error().code == QJSON_ERROR_DEPTH_LIMIT, "depth limit");
+
+	auto c = qjson::decode<canonical>("b: 1.50, a: 'x'");
+	check(c && c->view() == R"({"a":"x","b":1.5})", "canonical");
+	auto h1 = qjson::decode<digest>("b: 1.50, a: 'x'");
+	auto h2 = qjson::decode<digest>("a: x\nb: 15e-1\n");
+	check(h1 && h2 && *h1 == *h2, "digest");
+
+	check(bool(qjson::validate("a: b")), "validate");
+	auto v = qjson::validate<strict>("a: 1, a: 2");
+	check(!v && v.error().line == 1, "validate error");
+}
+
+void testExceptions() {
+	qjson::json j = qjson::decode<throwing>("a: [1, 2]");
+	check(j.view() == R"({"a":[1,2]})", "throwing decode");
+	try {
+		qjson::decode<throwing>("a: 1\na: 2\n");
+		check(false, "throwing duplicate key");
+	} catch (const qjson::decode_error &e) {
+		check(e.get().line == 2 && e.get().code == QJSON_ERROR_SYNTAX, "throwing duplicate key position");
+	}
+	try {
+		qjson::validate<throwing>("a: {b: {c: {d: 1}}}");
+		check(false, "throwing depth limit");
+	} catch (const qjson::decode_error &e) {
+		check(e.get().code == QJSON_ERROR_DEPTH_LIMIT, "throwing depth limit code");
+	}
+}
+
+void testPmr() {
+	const char *text =
+		"server: {host: example.com, ports: [80, 0x1BB], tls: true}\n"
+		"name: 'caf\\u00e9 \"x\"', a: 1, a: 2.5, none: null, empty: {}\n";
+	size_t heap = allocs;
+	check(qjson::decode(text) && allocs > heap, "heap allocations are counted");
+
+	std::byte buf[16*1024];
+	std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf), std::pmr::null_memory_resource());
+	size_t before = allocs;
+	auto doc = qjson::pmr::parse(text, &arena);
+	check(allocs == before, "pmr parse allocates from the heap");
+	check(bool(doc), "pmr parse");
+	if (!doc)
+		return;
+
+	qjson::pmr::value root = doc->root();
+	check(root.is_object() && root.size() == 6, "root");
+	check(root["server"]["host"].as_string() == "example.com", "chained lookup");
+	check(root["server"]["ports"][1].as_number() == 443, "array index");
+	check(root["server"]["tls"].as_bool(), "bool");
+	check(root["name"].as_string() == "caf\u00e9 \"x\"", "unescaped string");
+	check(root["a"].as_number() == 2.5, "last duplicate");
+	check(root["none"].is_null() && bool(root["none"]), "null");
+	check(root["empty"].is_object() && root["empty"].size() == 0, "empty object");
+	size_t n = 0;
+	for (qjson::pmr::value v : root["server"]["ports"])
+		n += v.is_number();
+	check(n == 2, "iteration");
+
+	qjson::pmr::value missing = root["client"]["host"];
+	check(!missing && missing.is_null() && missing.as_string().empty() && missing.size() == 0, "missing member");
+	check(missing.as_number() == 0 && !missing.as_bool() && missing.begin() == missing.end(), "missing member accessors");
+	check(!root["server"]["ports"][2] && !root["a"][0] && !root["server"][size_t(0)], "missing index");
+	check(allocs == before, "pmr lookups allocate from the heap");
+
+	auto err = qjson::pmr::parse("a: [1", &arena);
+	check(!err && err.error().line == 1, "pmr parse error");
+}
+
+} // namespace
+
+int main() {
+	testExpected();
+	testExceptions();
+	testPmr();
+	return failed ? 1 : 0;
+}
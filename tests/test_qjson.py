@@ -2,6 +2,13 @@
 testing qjson2json
 """
 
+import json
+import re
+import signal
+import threading
+
+import pytest
+
 import qjson2json
 
 def test_qjson():
@@ -9,4 +16,363 @@ def test_qjson():
     test qjson2json
     """
     assert qjson2json.decode("a:b") == '{"a":"b"}'
-    
\ No newline at end of file
+    
+def test_from_json():
+    """
+    test qjson2json.from_json
+    """
+    text = '{"a": "b", "n": [1, 2], "o": {"s": "x y", "t": "true"}}'
+    assert qjson2json.from_json(text) == 'a: b\nn: [1, 2]\no: {\n  s: x y\n  t: "true"\n}\n'
+    assert qjson2json.decode(qjson2json.from_json(text)) == qjson2json.decode(text[1:-1])
+    with pytest.raises(ValueError, match='expect string identifier'):
+        qjson2json.from_json('[1]')
+
+def test_dumps():
+    """
+    test qjson2json.dumps
+    """
+    import datetime
+    obj = {"a": "b", "n": [1, 2.5], "d": datetime.timedelta(hours=1, minutes=30),
+           "t": datetime.datetime(2021, 3, 1, 10, 20, 30)}
+    text = qjson2json.dumps(obj)
+    assert text == 'a: b\nn: [1, 2.5]\nd: 1h30m\nt: 2021-03-01T10:20:30Z\n'
+    assert qjson2json.decode(text) == '{"a":"b","n":[1,2.5],"d":5400,"t":1614594030}'
+    assert qjson2json.dumps({"a": {"b": 1}}, indent=4, commas=True) == 'a: {\n    b: 1\n}\n'
+    # integers beyond an int64 literal are written as float and round trip
+    assert qjson2json.dumps({"a": -2**63, "b": 2**63-1}) == 'a: -9.223372036854776e+18\nb: 9223372036854775807\n'
+    assert json.loads(qjson2json.decode(qjson2json.dumps({"a": -2**63}))) == {"a": -2**63}
+    with pytest.raises(ValueError, match='indent must be positive'):
+        qjson2json.dumps({"a": 1}, indent=-1)
+
+def test_format():
+    """
+    test qjson2json.format
+    """
+    text = '# top\na: 1,  b: [1,2] // c\n\n\no: {x: y,\n  z: "s"}\n'
+    assert qjson2json.format(text) == '# top\na: 1\nb: [1, 2] // c\n\no: {\n  x: y\n  z: "s"\n}\n'
+    assert qjson2json.format(qjson2json.format(text)) == qjson2json.format(text)
+
+def test_patch():
+    """
+    test qjson2json.patch
+    """
+    text = 'a: 1, b: [1,2] // c\n"o": {x: y}\n'
+    assert qjson2json.patch(text, ['b', 1], '3') == 'a: 1, b: [1,3] // c\n"o": {x: y}\n'
+    assert qjson2json.patch(text, ['o', 'x'], "'z'") == 'a: 1, b: [1,2] // c\n"o": {x: \'z\'}\n'
+    assert qjson2json.patch('a: {x: 1}, a: {x: 2}', ['a', 'x'], '3') == 'a: {x: 1}, a: {x: 3}'
+    with pytest.raises(KeyError, match='path not found'):
+        qjson2json.patch(text, ['b', 5], '3')
+
+def test_tokens():
+    """
+    test qjson2json.tokens
+    """
+    text = 'a: [1, "b"] # c\n'
+    tokens = [t for batch in qjson2json.tokens(text, batch=2) for t in batch]
+    assert tokens == [('quoteless', 0, 1, 1), (':', 1, 1, 1), ('[', 3, 1, 1), ('quoteless', 4, 1, 1),
+                      (',', 5, 1, 1), ('double_quoted', 7, 3, 1), (']', 10, 1, 1)]
+    tokens = [t for batch in qjson2json.tokens(text, trivia=True) for t in batch]
+    assert ''.join(text[t[1]:t[1]+t[2]] for t in tokens) == text
+    assert tokens[-2:] == [('comment', 12, 3, 1), ('newline', 15, 1, 1)]
+    text = 'é: ["ü€", x] # 😀\n'
+    tokens = [t for batch in qjson2json.tokens(text, trivia=True) for t in batch]
+    assert ''.join(text[t[1]:t[1]+t[2]] for t in tokens) == text
+    assert tokens[4] == ('double_quoted', 4, 4, 1)
+    assert [t[1:3] for batch in qjson2json.tokens(text.encode()) for t in batch][3] == (5, 7)
+    with pytest.raises(ValueError, match='unclosed double quote string at line 1 col 4'):
+        list(qjson2json.tokens('a: "b'))
+
+def test_document():
+    """
+    test qjson2json.Document
+    """
+    text = 'a: 1\nb: [1, 2] # c\nd: {e: f}\n'
+    doc = qjson2json.Document(text)
+    assert doc.error is None
+    i = text.index('2')
+    assert not doc.edit(i, i+1, '"')
+    assert doc.error == 'newline in double quoted string at line 2 col 8'
+    assert doc.edit(i, i+1, '"x"')
+    i = doc.text.index('f')
+    assert doc.edit(i, i+1, '[g, h]')
+    assert doc.text == 'a: 1\nb: [1, "x"] # c\nd: {e: [g, h]}\n'
+    assert doc.format() == 'a: 1\nb: [1, "x"] # c\nd: {e: [g, h]}\n'
+    assert doc.edit(0, len(doc.text), 'x: [1]')
+    assert doc.format() == 'x: [1]\n'
+    # offsets are char indexes, like those of the source map
+    doc = qjson2json.Document('é: "ü"\nb: 1\n')
+    i = doc.text.index('1')
+    assert doc.edit(i, i+1, '"€"')
+    assert doc.text == 'é: "ü"\nb: "€"\n'
+    assert doc.edit(4, 5, '😀') and doc.text == 'é: "😀"\nb: "€"\n'
+    # edits far from each other in a text larger than the gap of its buffer
+    text = ''.join('k%d: "é%d"\n' % (i, i) for i in range(2000))
+    doc = qjson2json.Document(text)
+    i, j = text.rindex('é'), text.index('é')
+    assert doc.edit(i+1, i+1, 'x') and doc.edit(j, j+1, 'ü')
+    text = text[:j] + 'ü' + text[j+1:i+1] + 'x' + text[i+1:]
+    assert doc.text == text and doc.format() == qjson2json.format(text)
+    with pytest.raises(IndexError, match='invalid edit range'):
+        doc.edit(0, len(doc.text)+1, 'x')
+
+
+def test_decode_with_source_map():
+    """
+    test qjson2json.decode_with_source_map
+    """
+    text = 'a: 1\nb: [x, {c: "é"}]\n' + ''.join('k%d: %d\n' % (i, i) for i in range(100))
+    out, smap = qjson2json.decode_with_source_map(text)
+    assert out == qjson2json.decode(text)
+    assert smap.lookup(0) == (1, 1)
+    assert smap.lookup(out.index('1')) == (1, 4)
+    assert smap.lookup(out.index('{"c"')) == (2, 8)
+    assert smap.lookup(out.index('"é"')) == (2, 12)
+    for i in range(100):
+        assert smap.lookup(out.index('"k%d"' % i)) == (i + 3, 1)
+        key = '"k%d":' % i
+        assert smap.lookup(out.index(key) + len(key)) == (i + 3, len(key))
+    with pytest.raises(ValueError, match='unclosed array at line 1 col 5'):
+        qjson2json.decode_with_source_map('a: [')
+
+
+def test_validate():
+    """
+    test qjson2json.validate
+    """
+    assert qjson2json.validate('a: 1\nb: [1, 2]\n') == []
+    text = 'a: [1,]\nb 2\nc: 1\nd: {e: [1, 2}, f: 3}\ng: "h\ni: 1'
+    assert qjson2json.validate(text) == [
+        (1, 8, 'expect value after comma'), (3, 2, 'expect a colon'),
+        (4, 14, 'unexpected }'), (4, 20, 'syntax error'), (5, 4, 'newline in double quoted string')]
+    assert qjson2json.validate(text, max_errors=2) == qjson2json.validate(text)[:2]
+    assert qjson2json.validate('a: {b: {c: 1') == [(1, 8, 'unclosed object'), (1, 4, 'unclosed object')]
+    # recovery stops at the end of input in a truncated utf8 char
+    assert qjson2json.validate(b'a: 1, b\xc3') == [(1, 8, 'last utf8\xa0char is truncated')]
+    assert qjson2json.validate(b'a: [1, x\xe2\x82')[0] == (1, 9, 'last utf8\xa0char is truncated')
+
+
+def test_limits():
+    """
+    test the limits and cancellation of qjson2json.decode
+    """
+    text = 'a: 1\nb: [2, 3]\n'
+    assert qjson2json.decode(text, max_input=100, max_output=100, max_tokens=10, max_depth=1, timeout=10) == \
+        '{"a":1,"b":[2,3]}'
+    for kwargs, reason, line, col in [({'max_input': 10}, 'input', 1, 1), ({'max_output': 10}, 'output', 3, 1),
+                                      ({'max_tokens': 5}, 'tokens', 2, 4)]:
+        with pytest.raises(qjson2json.LimitError, match='limit') as e:
+            qjson2json.decode(text, **kwargs)
+        assert (e.value.reason, e.value.line, e.value.col) == (reason, line, col)
+    with pytest.raises(qjson2json.LimitError, match='depth') as e:
+        qjson2json.decode('a: [[1]]', max_depth=1)
+    assert e.value.reason == 'depth'
+    event = threading.Event()
+    event.set()
+    with pytest.raises(qjson2json.LimitError, match='cancel') as e:
+        qjson2json.decode('a: [%s]' % ', '.join(['1'] * 1000000), cancel=event)
+    assert e.value.reason == 'cancelled' and isinstance(e.value, ValueError)
+    # a signal handler interrupts a conversion without limits
+    def interrupt(signum, frame):
+        raise KeyboardInterrupt
+    previous = signal.signal(signal.SIGALRM, interrupt)
+    try:
+        signal.setitimer(signal.ITIMER_REAL, 0.01)
+        with pytest.raises(KeyboardInterrupt):
+            qjson2json.decode('a: [%s]' % ', '.join(['1'] * 500000))
+    finally:
+        signal.setitimer(signal.ITIMER_REAL, 0)
+        signal.signal(signal.SIGALRM, previous)
+
+
+def test_dialect():
+    """
+    test the syntax features of qjson2json.decode
+    """
+    text = 'a: 1.50\nb: 1 + 2\nc: 1h30m\nd: a`b\n'
+    assert qjson2json.decode(text) == '{"a":1.5,"b":3,"c":5400,"d":"a`b"}'
+    assert qjson2json.decode(text, expressions=False) == '{"a":1.50,"b":"1 + 2","c":5400,"d":"a`b"}'
+    assert qjson2json.decode(text, durations=False) == '{"a":1.5,"b":3,"c":"1h30m","d":"a`b"}'
+    assert qjson2json.decode('a: `x', multiline=False) == '{"a":"`x"}'
+    for kwargs in [{'expressions': False}, {'durations': False}]:
+        with pytest.raises(ValueError, match='are disabled'):
+            qjson2json.decode(text, reject_disabled=True, **kwargs)
+    with pytest.raises(ValueError, match='expect string identifier at line 1 col 18'):
+        qjson2json.decode('a: 2021-03-01T10:20:30Z', dates=False)
+
+
+def test_numbers():
+    """
+    test the conversion of number literals and expressions
+    """
+    assert qjson2json.decode('a: 1_000.5, b: 1_000') == '{"a":1000.5,"b":1000}'
+    # a subnormal sets errno to ERANGE before 0.0 is converted
+    assert qjson2json.decode('a: 1e-310, b: 0.0') == '{"a":9.999999999999969e-311,"b":0}'
+    assert qjson2json.decode('a: 9223372036854775807') == '{"a":9.223372036854776e+18}'
+    for text, msg in [('a: 18446744073709551616', 'number overflow at line 1 col 4'),
+                      ('a: 99999999999999999999', 'number overflow at line 1 col 4'),
+                      ('a: 1e400', 'number overflow at line 1 col 4'),
+                      ('a: 1e308*10', 'number overflow at line 1 col 9')]:
+        with pytest.raises(ValueError, match='^' + re.escape(msg) + '$'):
+            qjson2json.decode(text)
+
+
+def test_multiline():
+    """
+    test the control and non ascii chars of multiline strings
+    """
+    text = 't:\n  `\\n\n  a\x01 \x1f é\n  b`'
+    assert qjson2json.decode(text) == '{"t":"a\\u0001 \\u001F é\\nb"}'
+    assert qjson2json.decode(text, ensure_ascii=True) == '{"t":"a\\u0001 \\u001F \\u00e9\\nb"}'
+
+
+def test_json_fast_path():
+    """
+    test that json members input is decoded like by the qjson parser
+    """
+    text = '"a": 1,\r\n"b": [-0, 1.50, 1e2, "</x>\t\\u00e9", true, null],\n"c": {}'
+    assert qjson2json.decode(text) == '{"a":1,"b":[0,1.5,100,"<\\/x>\\t\\u00e9",true,null],"c":{}}'
+    assert qjson2json.decode(text + ',\nd: 2') == '{"a":1,"b":[0,1.5,100,"<\\/x>\\t\\u00e9",true,null],"c":{},"d":2}'
+    for text, msg in [('"a": [1,]', 'expect value after comma at line 1 col 10'),
+                      ('"a": "\\x"', 'invalid escape squence at line 1 col 7'),
+                      ('"a": 1,', 'expect identifier after comma at line 1 col 8')]:
+        with pytest.raises(ValueError, match=msg):
+            qjson2json.decode(text)
+
+
+def test_canonical():
+    """
+    test the canonical output and digest of qjson2json
+    """
+    text = 'b: [1.50, 1e2, -0, "\\u00e9\\/\\u0001"]\na: {z: 1, y: 2, z: 0}'
+    canonical = '{"a":{"y":2,"z":1,"z":0},"b":[1.5,100,0,"\u00e9/\\u0001"]}'
+    assert qjson2json.decode(text, canonical=True) == canonical
+    digest = qjson2json.digest(text)
+    assert len(digest) == 16
+    assert qjson2json.digest('a: {y: 2, z: 1, z: 0}\nb: [1.5, 100, 0, "é/\\u0001"]') == digest
+    assert qjson2json.digest('a: 1') != qjson2json.digest('a: 2')
+
+
+def test_pretty():
+    """
+    test the indent and separators of qjson2json.decode
+    """
+    text = 'a: {b: [1, {}], c: "x,:"}\nd: []'
+    assert qjson2json.decode(text, indent=2) == json.dumps(json.loads(qjson2json.decode(text)), indent=2)
+    assert qjson2json.decode(text, indent='\t') == '{\n\t"a": {\n\t\t"b": [\n\t\t\t1,\n\t\t\t{}\n\t\t],\n\t\t"c": "x,:"\n\t},\n\t"d": []\n}'
+    assert qjson2json.decode(text, separators=(', ', ': ')) == '{"a": {"b": [1, {}], "c": "x,:"}, "d": []}'
+
+
+def test_ensure_ascii():
+    """
+    test the ascii output of qjson2json.decode
+    """
+    text = '"k\u00e9": [\u00fcber, "\U0001f3d4", "\\u00e9"]'
+    out = qjson2json.decode(text, ensure_ascii=True)
+    assert out == '{"k\\u00e9":["\\u00fcber","\\ud83c\\udfd4","\\u00e9"]}'
+    assert json.loads(out) == json.loads(qjson2json.decode(text))
+    assert qjson2json.flatten(text, ensure_ascii=True)[0] == ('/k\u00e9/0', '"\\u00fcber"')
+
+
+def test_flatten():
+    """
+    test the flattened output of qjson2json
+    """
+    text = 'a: {b: [1, {}], "c/~": x}\n"t\\tab": []'
+    assert qjson2json.flatten(text) == [('/a/b/0', '1'), ('/a/b/1', '{}'), ('/a/c~1~0', '"x"'), ('/t\tab', '[]')]
+    assert qjson2json.flatten('z: 1.50\na: 2', canonical=True) == [('/a', '2'), ('/z', '1.5')]
+    assert qjson2json.flatten('') == []
+
+
+def test_duplicates():
+    """
+    test the duplicate keys policies of qjson2json.decode
+    """
+    text = 'a: 1\nb: {x: 1, "x": [2], y: 3}\n"\\u0061": 4'
+    assert qjson2json.decode(text) == '{"a":1,"b":{"x":1,"x":[2],"y":3},"\\u0061":4}'
+    assert qjson2json.decode(text, duplicates='first') == '{"a":1,"b":{"x":1,"y":3}}'
+    assert qjson2json.decode(text, duplicates='last') == '{"a":4,"b":{"x":[2],"y":3}}'
+    with pytest.raises(ValueError, match='^duplicate key at line 2 col 11$'):
+        qjson2json.decode(text, duplicates='error')
+    assert qjson2json.decode('"a": 1, "b": 2, "a": 3', duplicates='last') == '{"a":3,"b":2}'
+    text = 'a: {x: 1, y: 2, x: {x: [1], x: [2, 3]}, x: 4, z: 5, x: "long"}\nb: 1\na: 2'
+    assert qjson2json.decode(text, duplicates='last') == '{"a":2,"b":1}'
+    assert qjson2json.decode(text[:-5], duplicates='last') == '{"a":{"x":"long","y":2,"z":5},"b":1}'
+    with pytest.raises(ValueError, match='^unexpected end of input at line 1 col 18$'):
+        qjson2json.decode('b: {c: 1, c: 2, d', duplicates='last')
+    text = ','.join('k%d: %d' % (i % 10, i) for i in range(100000))
+    assert qjson2json.decode(text, duplicates='last') == json.dumps(
+        {'k%d' % i: 99990 + i for i in range(10)}, separators=(',', ':'))
+
+
+def test_merge():
+    """
+    test the merge of qjson layers
+    """
+    layers = ['a: 1\nb: {x: 1, y: [1]}\nc: [1]', 'b: {y: [2], "\\u007a": 3}\nc: {d: 1}', 'b: {x: 2}\nd: 4']
+    assert qjson2json.merge(layers) == '{"a":1,"b":{"x":2,"y":[2],"\\u007a":3},"c":{"d":1},"d":4}'
+    assert qjson2json.merge(layers[:2], arrays='concat') == '{"a":1,"b":{"x":1,"y":[1,2],"\\u007a":3},"c":{"d":1}}'
+    assert qjson2json.merge([]) == '{}'
+    # a key repeated in a layer replaces its value, as with duplicates='last'
+    assert qjson2json.merge(['a: {x: 1}, a: {y: 2}']) == qjson2json.decode('a: {x: 1}, a: {y: 2}', duplicates='last')
+    assert qjson2json.merge(['a: {x: 1}, b: 1', 'a: {y: 2}, a: {z: 3}']) == '{"a":{"x":1,"z":3},"b":1}'
+    with pytest.raises(ValueError, match='of layer 1$'):
+        qjson2json.merge(['a: 1', 'b: ['])
+
+
+def test_diff():
+    """
+    test the structural diff of qjson documents
+    """
+    old, new = 'a: 1\nb: [1, 2]\nc: {d: x}', 'b: [1]\nc: {d: "y/~"}\ne: 3'
+    assert qjson2json.diff(old, new) == ('[{"op":"remove","path":"/a"},{"op":"remove","path":"/b/1"},'
+        '{"op":"replace","path":"/c/d","value":"y/~"},{"op":"add","path":"/e","value":3}]')
+    assert qjson2json.diff(old, new, paths=True) == '["/a","/b/1","/c/d","/e"]'
+    assert qjson2json.diff('a: 1, b: {c: 2}', 'b: {"c": 2}, a: 1') == '[]'
+    assert qjson2json.diff('a: "\\u0041", b: ["x"]', 'a: A, b: ["\\u0078"]') == '[]'
+    assert qjson2json.diff('a: "\\u0041"', 'a: B') == '[{"op":"replace","path":"/a","value":"B"}]'
+    with pytest.raises(ValueError, match='of new text$'):
+        qjson2json.diff('a: 1', 'a:')
+
+
+def test_includes(tmp_path):
+    """
+    test the include directives and their cache
+    """
+    (tmp_path / "common").mkdir()
+    (tmp_path / "common" / "db.qjson").write_text("host: localhost\nport: 5432")
+    (tmp_path / "common" / "base.qjson").write_text("db: @include db.qjson\nlevel: 2")
+    (tmp_path / "loop.qjson").write_text("x: @include loop.qjson")
+    inc = qjson2json.Includes(str(tmp_path))
+    assert qjson2json.decode("a: @include common/base.qjson", includes=inc) == \
+        '{"a":{"db":{"host":"localhost","port":5432},"level":2}}'
+    assert qjson2json.decode("b: [@include common/db.qjson]", includes=inc) == \
+        '{"b":[{"host":"localhost","port":5432}]}'
+    assert (inc.parses, inc.hits) == (2, 1)
+    assert qjson2json.decode("a: @include common/db.qjson") == '{"a":"@include common/db.qjson"}'
+    with pytest.raises(ValueError, match='^include cycle at line 1 col 4 of '):
+        qjson2json.decode("a: @include loop.qjson", includes=inc)
+
+
+def test_watcher(tmp_path):
+    """
+    test the watcher of a directory of qjson files
+    """
+    if not hasattr(qjson2json, "Watcher"):
+        return
+    import queue
+    (tmp_path / "a.qjson").write_text("a: 1")
+    (tmp_path / "b.qjson").write_text("b: [1]")
+    events = queue.Queue()
+    with qjson2json.Watcher(str(tmp_path), lambda s, c: events.put((s, c)), changes=True, delay=0.01) as w:
+        assert w.snapshot == {"a.qjson": '{"a":1}', "b.qjson": '{"b":[1]}'}
+        (tmp_path / "a.qjson").write_text("a: 1")
+        (tmp_path / "b.qjson").write_text("b: [")
+        snapshot, changed = events.get(timeout=5)
+        assert changed == ["b.qjson"] and snapshot["b.qjson"] == '{"b":[1]}'
+        assert w.errors == {"b.qjson": "unclosed array at line 1 col 5"}
+        (tmp_path / "b.qjson").unlink()
+        snapshot, changed = events.get(timeout=5)
+        assert snapshot == {"a.qjson": '{"a":1}'} and w.errors == {}
+    with qjson2json.Watcher(str(tmp_path), events.put, merge=True, delay=0.01) as w:
+        (tmp_path / "c.qjson").write_text("a: 2\nc: 3")
+        assert events.get(timeout=5) == '{"a":2,"c":3}'
@@ -0,0 +1,70 @@
+// test_qjsongen looks up every key of the table that qjsongen generates
+// from test_qjsongen.qjson, and checks some values. It is built and run by
+// make test.
+
+#include "test_qjsongen.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static const qjsongen_table_t *t = &test_qjsongen;
+static bool failed = false;
+
+// check reports the test named what as failed if ok is false.
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		fprintf(stderr, "test_qjsongen: %s\n", what);
+		failed = true;
+	}
+}
+
+// get returns the member key of the object v.
+static const qjsongen_value_t* get(const qjsongen_value_t *v, const char *key) {
+	return qjsongen_get(t, v, key, strlen(key));
+}
+
+// lookupAll looks up every key of the objects in v and returns their
+// number.
+static int lookupAll(const qjsongen_value_t *v) {
+	int n = 0;
+	if (v->type == QJSONGEN_OBJECT) {
+		for (uint32_t i = 0; i < v->len; i++) {
+			const qjsongen_member_t *m = &t->members[v->off + i];
+			const qjsongen_value_t *found = qjsongen_get(t, v, t->chars + m->key, m->keyLen);
+			if (found != &t->values[m->value]) {
+				fprintf(stderr, "test_qjsongen: key %s not found\n", t->chars + m->key);
+				failed = true;
+			}
+			n += 1 + lookupAll(&t->values[m->value]);
+		}
+	} else if (v->type == QJSONGEN_ARRAY) {
+		for (uint32_t i = 0; i < v->len; i++)
+			n += lookupAll(qjsongen_at(t, v, i));
+	}
+	return n;
+}
+
+int main(void) {
+	const qjsongen_value_t *root = qjsongen_root(t);
+	check(lookupAll(root) == 51, "number of keys");
+
+	check(strcmp(qjsongen_string(t, get(root, "name")), "qjsongen test") == 0, "string");
+	check(get(root, "version")->type == QJSONGEN_INT && qjsongen_number(t, get(root, "version")) == 3, "int");
+	check(get(root, "ratio")->type == QJSONGEN_DOUBLE && qjsongen_number(t, get(root, "ratio")) == 0.25, "double");
+	check(get(root, "enabled")->type == QJSONGEN_TRUE && get(root, "disabled")->type == QJSONGEN_FALSE, "bools");
+	check(get(root, "nothing")->type == QJSONGEN_NULL, "null");
+	check(qjsongen_number(t, get(root, "timeout")) == 90, "duration");
+	check(strcmp(qjsongen_string(t, get(root, "")), "empty key") == 0, "empty key");
+	check(get(root, "café") != NULL && get(root, "tab\tkey") != NULL, "escaped keys");
+
+	const qjsongen_value_t *s = qjsongen_at(t, get(root, "servers"), 1);
+	check(qjsongen_number(t, get(s, "port")) == 443, "array element member");
+	check(qjsongen_at(t, get(root, "servers"), 2) == NULL, "array index out of range");
+	const qjsongen_value_t *r = get(get(root, "routes"), "/api/users");
+	check(strcmp(qjsongen_string(t, get(r, "backend")), "users") == 0, "nested object");
+
+	check(get(root, "missing") == NULL && get(root, "nam") == NULL && get(root, "names") == NULL, "missing keys");
+	check(get(root, "host") == NULL && get(r, "name") == NULL, "key of another object");
+	check(get(get(root, "empty"), "a") == NULL && get(get(root, "name"), "a") == NULL, "lookup in an empty object or string");
+	return failed ? 1 : 0;
+}